@@ -36,10 +36,26 @@
 #define MAX_SUBSCRIPTIONS 30
 #endif
 
+#ifndef MAX_SUBSCRIPTION_NODES
+#define MAX_SUBSCRIPTION_NODES (MAX_SUBSCRIPTIONS * 4)
+#endif
+
+#ifndef MAX_SHARE_GROUPS
+#define MAX_SHARE_GROUPS (MAX_SUBSCRIPTIONS / 2) /*"$share/{ShareName}/{filter}" groups, see mqtt_subscription_index.h*/
+#endif
+
 #ifndef MAX_RETAINED_TOPICS
 #define MAX_RETAINED_TOPICS 30
 #endif
 
+#ifndef MAX_RETAINED_NODES
+#define MAX_RETAINED_NODES (MAX_RETAINED_TOPICS * 4)
+#endif
+
+#ifndef MAX_RETAINED_BYTES
+#define MAX_RETAINED_BYTES (MQTT_BUF_SIZE * MAX_RETAINED_TOPICS) /*topic and payload bytes held by retained messages*/
+#endif
+
 #ifndef MAX_TOPIC_LIST_ENTRIES
 #define MAX_TOPIC_LIST_ENTRIES 30
 #endif
@@ -48,10 +64,50 @@
 #define MAX_TOPIC_LENGTH 50
 #endif
 
+#ifndef MAX_TOPIC_TOKENS
+#define MAX_TOPIC_TOKENS ((MAX_SUBSCRIPTION_NODES + MAX_SHARE_GROUPS + 16) * MQTT_MAX_SHARDS) /*distinct topic levels interned at once, shared by every shard's index, see mqtt_topic_table.h*/
+#endif
+
 #ifndef MAX_TOPICS_IN_SUBSCRIBE
 #define MAX_TOPICS_IN_SUBSCRIBE 5
 #endif
 
+#ifndef MAX_MQTT_PROPERTIES
+#define MAX_MQTT_PROPERTIES 16
+#endif
+
+#ifndef MAX_MQTT_USER_PROPERTIES
+#define MAX_MQTT_USER_PROPERTIES 16 /*User Properties kept per packet, any further ones are skipped*/
+#endif
+
+#ifndef MQTT_TOPIC_ALIAS_MAXIMUM
+#define MQTT_TOPIC_ALIAS_MAXIMUM 8 /*topic aliases per connection each way, their topics come from the memory pool*/
+#endif
+
+#ifndef MAX_OUTBOUND_DELIVERIES
+#define MAX_OUTBOUND_DELIVERIES 8 /*PUBLISH frames queued per session*/
+#endif
+
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 16 /*QoS 1 and 2 PUBLISH frames awaiting acknowledgement per session*/
+#endif
+
+#ifndef MQTT_CONNECT_TIMEOUT_MS
+#define MQTT_CONNECT_TIMEOUT_MS 10000 /*a new connection is dropped if its CONNECT hasn't arrived by then*/
+#endif
+
+#ifndef MQTT_MAX_SESSION_EXPIRY_INTERVAL
+#define MQTT_MAX_SESSION_EXPIRY_INTERVAL 60 /*seconds a session and its slot are kept after the connection closes, whatever the client asks for*/
+#endif
+
+#ifndef MQTT_RETRANSMIT_MS
+#define MQTT_RETRANSMIT_MS 20000 /*unacknowledged QoS 1 and 2 frames are sent again after this*/
+#endif
+
+#ifndef MAX_OUTBOUND_BYTES
+#define MAX_OUTBOUND_BYTES (MQTT_BUF_SIZE * 4) /*PUBLISH bytes queued per session*/
+#endif
+
 #ifndef MAX_MSG_LENGTH // YES
 #define MAX_MSG_LENGTH 200
 #endif
@@ -64,6 +120,114 @@
 #define QUEUE_BUFFER_SIZE 2048
 #endif
 
+// Memory pools, see mqtt_memory_pool.h. The large block size is the bigger of
+// MQTT_BUF_SIZE and QUEUE_BUFFER_SIZE.
+
+#ifndef MQTT_POOL_SMALL_BLOCK_SIZE
+#define MQTT_POOL_SMALL_BLOCK_SIZE 64
+#endif
+
+#ifndef MQTT_POOL_SMALL_BLOCKS
+#define MQTT_POOL_SMALL_BLOCKS (MAX_MQTT_SESSIONS * MAX_OUTBOUND_DELIVERIES)
+#endif
+
+#ifndef MQTT_POOL_MEDIUM_BLOCK_SIZE
+#define MQTT_POOL_MEDIUM_BLOCK_SIZE 256
+#endif
+
+#ifndef MQTT_POOL_MEDIUM_BLOCKS
+#define MQTT_POOL_MEDIUM_BLOCKS (MAX_MQTT_SESSIONS * 2)
+#endif
+
+#ifndef MQTT_POOL_LARGE_BLOCKS
+#define MQTT_POOL_LARGE_BLOCKS (MAX_MQTT_SESSIONS / 2 + 1)
+#endif
+
+// Timer wheel, see mqtt_timer_wheel.h. With 100ms ticks and 4 levels of 64 slots
+// a timer can be up to 19 days away before it has to be re-queued.
+
+#ifndef MAX_MQTT_TIMERS
+#define MAX_MQTT_TIMERS (MAX_MQTT_SESSIONS * 4)
+#endif
+
+#ifndef MQTT_TIMER_TICK_MS
+#define MQTT_TIMER_TICK_MS 100
+#endif
+
+#ifndef MQTT_TIMER_LEVELS
+#define MQTT_TIMER_LEVELS 4
+#endif
+
+#ifndef MQTT_SEND_MAX_SEGMENTS
+#define MQTT_SEND_MAX_SEGMENTS 64 /*iovecs per sendmsg in TcpSession::sendMessageVector*/
+#endif
+
+// TcpSession::sendMessageVector takes the queued frames as they are, in segments. The
+// ESP8266 transport only has sendMessage, so the frames are copied into one buffer.
+#if defined(MQTT_EPOLL_TRANSPORT) || defined(NATIVE_BUILD)
+#define MQTT_VECTORED_SEND
+#endif
+
+#ifndef MQTT_EPOLL_MAX_EVENTS
+#define MQTT_EPOLL_MAX_EVENTS 256 /*events taken per epoll_wait with MQTT_EPOLL_TRANSPORT*/
+#endif
+
+// Sharded broker, see mqtt_sharded_broker.h. Only the epoll transport has threads,
+// so only there does per-thread scratch space need to be thread_local.
+
+#ifndef MQTT_MAX_SHARDS
+#ifdef MQTT_EPOLL_TRANSPORT
+#define MQTT_MAX_SHARDS 8 /*worker threads a MqttShardedBroker may have*/
+#else
+#define MQTT_MAX_SHARDS 1
+#endif
+#endif
+
+#ifndef MQTT_SHARD_INBOX_SIZE
+#define MQTT_SHARD_INBOX_SIZE 1024 /*messages waiting for each shard, a power of two*/
+#endif
+
+#ifndef MQTT_SHARD_POLL_MS
+#define MQTT_SHARD_POLL_MS 100
+#endif
+
+#ifdef MQTT_EPOLL_TRANSPORT
+#define MQTT_THREAD_LOCAL thread_local
+#else
+#define MQTT_THREAD_LOCAL
+#endif
+
+// Persistence, see mqtt_persistent_store.h. The store is a log of memory-mapped
+// files, so it is only built where there is a filesystem with mmap.
+
+#if defined(MQTT_EPOLL_TRANSPORT) || defined(NATIVE_BUILD)
+#define MQTT_PERSISTENCE
+#endif
+
+#ifndef MQTT_STORE_SEGMENT_SIZE
+#define MQTT_STORE_SEGMENT_SIZE (1024 * 1024) /*bytes in each log segment file*/
+#endif
+
+#ifndef MQTT_STORE_COMPACT_RATIO
+#define MQTT_STORE_COMPACT_RATIO 4 /*compact once the log is this many times its size after the last compaction*/
+#endif
+
+#ifndef MQTT_STORE_MAX_SEGMENTS
+#define MQTT_STORE_MAX_SEGMENTS 64 /*segments allowed before compaction is forced*/
+#endif
+
+#ifndef MQTT_STORE_PATH_LENGTH
+#define MQTT_STORE_PATH_LENGTH 256
+#endif
+
+#ifndef MQTT_SNAPSHOT_CHUNK_SIZE
+#define MQTT_SNAPSHOT_CHUNK_SIZE (256 * 1024) /*bytes covered by each CRC in a snapshot*/
+#endif
+
+#ifndef MQTT_SNAPSHOT_THREADS
+#define MQTT_SNAPSHOT_THREADS 4 /*threads checking a snapshot's CRCs while it loads*/
+#endif
+
 #ifndef MAX_MQTT_CLIENTS
 #define MAX_MQTT_CLIENTs 10
 #endif
@@ -86,20 +250,30 @@
 #define MQTT_ID "ESPBroker"
 #endif
 
-#define MQTT_DEBUG 1
+// Logging. MQTT_ERROR, MQTT_WARNING and MQTT_INFO lines below MQTT_LOG_LEVEL are
+// compiled out completely. The rest are formatted into an in-memory ring of
+// MQTT_LOG_RING_SIZE records (a power of two) which the application drains when it
+// has time, see mqtt_log.h. Each call site may log at most MQTT_LOG_RATE_LIMIT lines
+// a second, anything over that is counted and reported with the next line.
+
 #ifdef MQTT_DEBUG
-#define MQTT_INFO(format, ...)     \
-    printf(format, ##__VA_ARGS__); \
-    printf("\n"); fflush(stdout);
-#define MQTT_WARNING(format, ...)  \
-    printf(format, ##__VA_ARGS__); \
-    printf("\n"); fflush(stdout);
-#define MQTT_ERROR(format, ...)    \
-    printf(format, ##__VA_ARGS__); \
-    printf("\n"); fflush(stdout);
-#else
-#define MQTT_INFO(format, ...)
-#define MQTT_WARNING(format, ...)
-#define MQTT_ERROR(format, ...)
+#define MQTT_LOG_LEVEL MQTT_LOG_LEVEL_INFO
+#endif
+
+#ifndef MQTT_LOG_LEVEL
+#define MQTT_LOG_LEVEL MQTT_LOG_LEVEL_WARNING
+#endif
+
+#ifndef MQTT_LOG_RING_SIZE
+#define MQTT_LOG_RING_SIZE 32
+#endif
+
+#ifndef MQTT_LOG_LINE_LENGTH
+#define MQTT_LOG_LINE_LENGTH 96
+#endif
+
+#ifndef MQTT_LOG_RATE_LIMIT
+#define MQTT_LOG_RATE_LIMIT 10 /*lines per second per call site*/
 #endif
 
+#include "mqtt_log.h"
@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef TCP_SESSION_H
+#define TCP_SESSION_H
+
+#include <memory>    // For std::shared_ptr, std::unique_ptr
+#include <span>
+#include <vector>
+
+#include "../../test/mocks/ip_addr.h"
+#include "../../test/mocks/ip4_addr.h"
+#include "../../test/mocks/ip.h"
+
+#include "defaults.h"
+#include "mqtt_memory_pool.h"
+
+class TcpServer;
+
+// One TCP connection served by the epoll TcpServer. It offers the same interface
+// as the ESP8266 TcpSession so MqttSession runs on it unchanged.
+//
+// sendMessage() follows espconn_send(): the data is accepted (SEND_OK) if it could be
+// written, or the part the kernel wouldn't take is held until the socket drains.
+// While anything is held back, further sends return RETRY, and the message sent
+// callback fires once it has all gone. sendMessageVector() does the same for a list
+// of segments, handing them to the kernel in one sendmsg() rather than one send()
+// each.
+class TcpSession : public std::enable_shared_from_this<TcpSession>
+{
+public:
+    using TcpSessionPtr = std::shared_ptr<TcpSession>;
+    using SessionId = std::size_t;
+
+    enum sendResult
+    {
+        SEND_OK,
+        RETRY,
+        FAILED_ABORTED
+    };
+
+    bool isSessionValid();
+    SessionId getSessionId();
+    void disconnectSession();
+    sendResult sendMessage(unsigned char *pData, unsigned short len);
+    sendResult sendMessageVector(std::span<const std::span<const unsigned char>> segments);
+
+    bool registerSessionDisconnectedCb(void (*cb)(void *obj, TcpSessionPtr session), void *obj);
+    bool registerSessionReconnectCb(void (*cb)(void *obj, signed char err, TcpSessionPtr session), void *obj);
+    bool registerIncomingMessageCb(void (*cb)(void *obj, char *pData, unsigned short len, TcpSessionPtr session), void *obj);
+    bool registerMessageSentCb(void (*cb)(void *obj, TcpSessionPtr session), void *obj);
+
+    static ip_addr_t convertIpAddress(unsigned char *);
+    static SessionId createUniqueIdentifier(const ip_addr_t &ipAddress, int port);
+
+    ~TcpSession();
+
+    TcpSession(const TcpSession &) = delete;
+    TcpSession &operator=(const TcpSession &) = delete;
+    TcpSession(TcpSession &&) = delete;
+    TcpSession &operator=(TcpSession &&) = delete;
+
+private:
+    friend class TcpServer;
+
+    TcpSession(TcpServer *server, int fd, const ip_addr_t &ipAddress, unsigned short port, bool connecting);
+    void handleReadable(unsigned char *buffer, std::size_t size);
+    void handleWritable();
+    void handleConnectFailed(signed char err);
+    bool flushPending();
+
+private:
+    TcpServer *server_;
+    int fd_;
+    SessionId sessionId_;
+    ip_addr_t ipAddress_;
+    bool connecting_;
+
+    std::vector<unsigned char, MqttPoolAllocator<unsigned char>> pending_;
+    std::size_t pendingOffset_;
+
+    void (*disconnectedCb_)(void *obj, TcpSessionPtr session);
+    void *disconnectedObj_;
+    void (*reconnectCb_)(void *obj, signed char err, TcpSessionPtr session);
+    void *reconnectObj_;
+    void (*incomingMessageCb_)(void *obj, char *pData, unsigned short len, TcpSessionPtr session);
+    void *incomingMessageObj_;
+    void (*messageSentCb_)(void *obj, TcpSessionPtr session);
+    void *messageSentObj_;
+};
+
+#endif // TCP_SESSION_H
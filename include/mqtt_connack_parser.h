@@ -21,8 +21,13 @@
  * THE SOFTWARE.
  *******************************************************************************/
 
-#include <vector>
+#ifndef __MQTT_CONNACK_PARSER_H__
+#define __MQTT_CONNACK_PARSER_H__
+
+#include <span>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
+#include "mqtt_property_bag.h"
 #include "mqtt_utilties.h"
 
 class MqttConnackParser : public MqttMessageParser
@@ -57,23 +62,25 @@ public:
     };
 
     MqttConnackParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &connackMessage);
+    ParseResult parseMessage(std::span<const unsigned char> connackMessage);
     MqttConnackReturnCode getConnackReturnCode() const;
+    const MqttPropertyBag &getProperties() const;
 
 private:
     bool parseFixedHeader();
     ParseResult parseVariableHeader();
-    int parseRemainingLength();
     bool parseConnectAcknowledgeFlags();
     bool parseConnackReturnCode();
     bool parseProperties();
 
 private:
-    std::vector<unsigned char> connackMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
     unsigned char acknowledgeFlags_;
-    int remainingLength_;
+    unsigned long remainingLength_;
     bool sessionPresent_;
     MqttConnackReturnCode connackReturnCode_;
+    MqttPropertyBag properties_;
 };
+
+#endif // __MQTT_CONNACK_PARSER_H__
@@ -21,31 +21,29 @@
  * THE SOFTWARE.
  *******************************************************************************/
 
-#include <string>
-#include <vector>
+#include <span>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttConnectParser : public MqttMessageParser
 {
 public:
     MqttConnectParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
 
 private:
     void parseFixedHeader();
     void parseVariableHeader();
     void parsePayload();
-    int parseRemainingLength();
     void parseProtocolName();
     void parseProtocolLevel();
     void parseConnectFlags();
     void parseKeepAlive();
 
 private:
-    std::vector<unsigned char> connectMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
-    int remainingLength_;
+    unsigned long remainingLength_;
     unsigned char protocolLevel_;
     unsigned char connectFlags_;
     int keepAlive_;
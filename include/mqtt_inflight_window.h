@@ -0,0 +1,100 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_INFLIGHT_WINDOW_H
+#define MQTT_INFLIGHT_WINDOW_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "defaults.h"
+#include "mqtt_shared_publish.h"
+
+// The QoS 1 and 2 PUBLISH frames a session has sent and not yet seen through to
+// the end of their acknowledgement flow. Each occupies a slot, and the packet
+// identifier is the slot number plus one, so PUBACK, PUBREC and PUBCOMP find their
+// entry by indexing rather than searching. Free slots are tracked in a bitmap and
+// allocated round robin, from below the client's Receive Maximum.
+//
+// An entry is flagged for sending again when it has waited too long for its
+// acknowledgement or the client has reconnected. A PUBLISH goes again with the DUP
+// flag set; once PUBREC has arrived only the PUBREL is sent again.
+class MqttInflightWindow
+{
+public:
+  enum class State : unsigned char
+  {
+    Free,
+    AwaitPuback,  // QoS 1 PUBLISH sent
+    AwaitPubrec,  // QoS 2 PUBLISH sent
+    AwaitPubcomp  // QoS 2 PUBREL sent
+  };
+
+  MqttInflightWindow();
+  void clear();
+  void setReceiveMaximum(unsigned short receiveMaximum);
+  void setProtocolLevel(unsigned char protocolLevel);
+  unsigned short getReceiveMaximum() const;
+  std::size_t getCount() const;
+  bool isFull() const;
+  State getState(unsigned short packetIdentifier) const;
+
+  unsigned short add(const MqttPublishDelivery &delivery, std::uint64_t now);
+  void remove(unsigned short packetIdentifier);
+  void unwind(unsigned short packetIdentifier);
+  bool acknowledge(unsigned short packetIdentifier);
+  bool received(unsigned short packetIdentifier);
+  bool complete(unsigned short packetIdentifier);
+
+  std::size_t markForResend(std::uint64_t sentBefore);
+  std::size_t getPendingResends(std::span<unsigned short> packetIdentifiers) const;
+  std::size_t getSegments(unsigned short packetIdentifier, std::span<const unsigned char> (&segments)[MqttPublishDelivery::MAX_SEGMENTS]) const;
+  void markSent(unsigned short packetIdentifier, std::uint64_t now);
+
+private:
+  static constexpr std::size_t WORD_BITS = 64;
+  static constexpr std::size_t WORDS = (MQTT_MAX_INFLIGHT + WORD_BITS - 1) / WORD_BITS;
+
+  struct Entry
+  {
+    MqttPublishDelivery delivery;
+    std::uint64_t sentAt;
+    State state;
+    bool resend;
+    unsigned char pubrel[6];
+    unsigned char pubrelLength;
+  };
+
+  Entry *find(unsigned short packetIdentifier, State state);
+  int allocate();
+
+private:
+  Entry entries_[MQTT_MAX_INFLIGHT];
+  std::uint64_t used_[WORDS];
+  std::size_t count_;
+  std::size_t next_;
+  unsigned short receiveMaximum_;
+  unsigned char protocolLevel_;
+};
+
+#endif /* MQTT_INFLIGHT_WINDOW_H */
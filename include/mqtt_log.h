@@ -0,0 +1,125 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_LOG_H
+#define MQTT_LOG_H
+
+#define MQTT_LOG_LEVEL_NONE 0
+#define MQTT_LOG_LEVEL_ERROR 1
+#define MQTT_LOG_LEVEL_WARNING 2
+#define MQTT_LOG_LEVEL_INFO 3
+
+#include <atomic>
+#include <cstddef>
+#include "defaults.h"
+
+// Logging is kept off the hot path. A log line is formatted straight into a slot of
+// a fixed ring of records, claimed with a compare-and-swap so any thread or callback
+// can log without taking a lock or making a system call. Whoever owns the console
+// (or flash, or network) calls drain() from its idle loop to empty the ring. If the
+// ring is full the line is dropped and counted rather than blocking the caller.
+//
+// Every call site carries its own rate limiter, so a topic that fails validation a
+// thousand times a second produces MQTT_LOG_RATE_LIMIT lines and a count of what
+// was suppressed, not a thousand lines.
+class MqttLog
+{
+public:
+  enum class Level : unsigned char
+  {
+    Error = MQTT_LOG_LEVEL_ERROR,
+    Warning = MQTT_LOG_LEVEL_WARNING,
+    Info = MQTT_LOG_LEVEL_INFO
+  };
+
+  struct Record
+  {
+    Level level;
+    const char *file;
+    unsigned int line;
+    unsigned long timestampMs;
+    unsigned int suppressed; // lines dropped by this call site's rate limiter since the last one
+    char text[MQTT_LOG_LINE_LENGTH];
+  };
+
+  class RateLimiter
+  {
+  public:
+    bool allow(unsigned long nowMs, unsigned int &suppressed);
+
+  private:
+    std::atomic<unsigned long> windowStartMs_{0};
+    std::atomic<unsigned int> count_{0};
+    std::atomic<unsigned int> suppressed_{0};
+  };
+
+  using SinkCb = void (*)(void *obj, const Record &record);
+
+  static void write(Level level, const char *file, unsigned int line, RateLimiter &limiter, const char *format, ...)
+      __attribute__((format(printf, 5, 6)));
+  static std::size_t drain(SinkCb cb, void *obj, std::size_t maxRecords = MQTT_LOG_RING_SIZE);
+  static unsigned long getDroppedCount();
+  static void printSink(void *obj, const Record &record);
+  static unsigned long nowMs();
+
+private:
+  static_assert((MQTT_LOG_RING_SIZE & (MQTT_LOG_RING_SIZE - 1)) == 0, "MQTT_LOG_RING_SIZE must be a power of two");
+
+  struct Slot
+  {
+    std::atomic<std::size_t> sequence;
+    Record record;
+  };
+
+  static Slot ring_[MQTT_LOG_RING_SIZE];
+  static std::atomic<std::size_t> writePosition_;
+  static std::atomic<std::size_t> readPosition_;
+  static std::atomic<unsigned long> dropped_;
+};
+
+#define MQTT_LOG_AT(level, format, ...)                                                        \
+  do                                                                                           \
+  {                                                                                            \
+    static MqttLog::RateLimiter mqttLogLimiter;                                                \
+    MqttLog::write(level, __FILE__, __LINE__, mqttLogLimiter, format, ##__VA_ARGS__);          \
+  } while (0)
+
+#if MQTT_LOG_LEVEL >= MQTT_LOG_LEVEL_ERROR
+#define MQTT_ERROR(format, ...) MQTT_LOG_AT(MqttLog::Level::Error, format, ##__VA_ARGS__)
+#else
+#define MQTT_ERROR(format, ...) do { } while (0)
+#endif
+
+#if MQTT_LOG_LEVEL >= MQTT_LOG_LEVEL_WARNING
+#define MQTT_WARNING(format, ...) MQTT_LOG_AT(MqttLog::Level::Warning, format, ##__VA_ARGS__)
+#else
+#define MQTT_WARNING(format, ...) do { } while (0)
+#endif
+
+#if MQTT_LOG_LEVEL >= MQTT_LOG_LEVEL_INFO
+#define MQTT_INFO(format, ...) MQTT_LOG_AT(MqttLog::Level::Info, format, ##__VA_ARGS__)
+#else
+#define MQTT_INFO(format, ...) do { } while (0)
+#endif
+
+#endif /* MQTT_LOG_H */
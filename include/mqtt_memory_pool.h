@@ -0,0 +1,209 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_MEMORY_POOL_H
+#define MQTT_MEMORY_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include "defaults.h"
+
+// Fixed-block allocation for everything the broker creates and destroys while it
+// runs. Each pool is an array of equal sized blocks reserved up front, with the free
+// blocks linked through their own first bytes, so allocate and deallocate are a
+// couple of pointer moves whatever has happened before and the memory can never
+// fragment. When a pool is empty the allocation fails rather than falling back to
+// the heap; the statistics record the high-water mark of every pool so the sizes in
+// defaults.h can be tuned from a long running system.
+
+struct MqttPoolStats
+{
+  std::size_t blockSize;
+  std::size_t blockCount;
+  std::size_t inUse;
+  std::size_t highWater;
+  std::size_t failures;
+};
+
+template <std::size_t BlockSize, std::size_t BlockCount>
+class MqttBlockPool
+{
+public:
+  MqttBlockPool()
+  {
+    for (std::size_t i = 0; i < BlockCount; i++)
+    {
+      blocks_[i].next = (i + 1 < BlockCount) ? &blocks_[i + 1] : nullptr;
+    }
+    freeList_ = (BlockCount > 0) ? &blocks_[0] : nullptr;
+    inUse_ = 0;
+    highWater_ = 0;
+    failures_ = 0;
+  }
+
+  MqttBlockPool(const MqttBlockPool &) = delete;
+  MqttBlockPool &operator=(const MqttBlockPool &) = delete;
+
+  void *allocate()
+  {
+    if (freeList_ == nullptr)
+    {
+      failures_++;
+      return nullptr;
+    }
+
+    Block *block = freeList_;
+    freeList_ = block->next;
+
+    if (++inUse_ > highWater_)
+    {
+      highWater_ = inUse_;
+    }
+    return block->bytes;
+  }
+
+  void deallocate(void *ptr)
+  {
+    Block *block = static_cast<Block *>(ptr);
+    block->next = freeList_;
+    freeList_ = block;
+    inUse_--;
+  }
+
+  bool owns(const void *ptr) const
+  {
+    const unsigned char *p = static_cast<const unsigned char *>(ptr);
+    const unsigned char *first = reinterpret_cast<const unsigned char *>(&blocks_[0]);
+    return (p >= first) && (p < first + sizeof(blocks_));
+  }
+
+  MqttPoolStats getStats() const
+  {
+    return {BlockSize, BlockCount, inUse_, highWater_, failures_};
+  }
+
+private:
+  union Block
+  {
+    Block *next;
+    alignas(std::max_align_t) unsigned char bytes[BlockSize];
+  };
+
+  Block blocks_[BlockCount];
+  Block *freeList_;
+  std::size_t inUse_;
+  std::size_t highWater_;
+  std::size_t failures_;
+};
+
+// The general purpose pool: a small, medium and large size class, each allocation
+// served by the smallest class it fits. Frames, reassembly buffers and outbound
+// queue entries come from here. Large blocks hold a whole MQTT_BUF_SIZE frame or a
+// QUEUE_BUFFER_SIZE queue buffer, whichever is bigger.
+class MqttMemoryPool
+{
+public:
+  static constexpr std::size_t SIZE_CLASSES = 3;
+  static constexpr std::size_t LARGE_BLOCK_SIZE = (MQTT_BUF_SIZE > QUEUE_BUFFER_SIZE) ? MQTT_BUF_SIZE : QUEUE_BUFFER_SIZE;
+
+  static MqttMemoryPool &getInstance();
+
+  MqttMemoryPool() = default;
+  MqttMemoryPool(const MqttMemoryPool &) = delete;
+  MqttMemoryPool &operator=(const MqttMemoryPool &) = delete;
+
+  void *allocate(std::size_t size);
+  void deallocate(void *ptr);
+  bool owns(const void *ptr) const;
+  MqttPoolStats getStats(std::size_t sizeClass) const;
+  std::size_t getHeapFallbackCount() const;
+  void countHeapFallback();
+
+private:
+  void lock() const;
+  void unlock() const;
+
+private:
+  MqttBlockPool<MQTT_POOL_SMALL_BLOCK_SIZE, MQTT_POOL_SMALL_BLOCKS> small_;
+  MqttBlockPool<MQTT_POOL_MEDIUM_BLOCK_SIZE, MQTT_POOL_MEDIUM_BLOCKS> medium_;
+  MqttBlockPool<LARGE_BLOCK_SIZE, MQTT_POOL_LARGE_BLOCKS> large_;
+  std::size_t heapFallbacks_ = 0;
+  mutable std::atomic_flag busy_ = ATOMIC_FLAG_INIT;
+};
+
+// Lets standard containers and std::allocate_shared draw from MqttMemoryPool. A
+// container can't be told an allocation failed without exceptions, so when the
+// pool is exhausted this allocator takes the memory from the heap instead and the
+// pool counts it; a non-zero getHeapFallbackCount() means the pools are too small.
+template <typename T>
+class MqttPoolAllocator
+{
+public:
+  using value_type = T;
+
+  MqttPoolAllocator() noexcept : pool_(&MqttMemoryPool::getInstance()) {}
+  explicit MqttPoolAllocator(MqttMemoryPool &pool) noexcept : pool_(&pool) {}
+
+  template <typename U>
+  MqttPoolAllocator(const MqttPoolAllocator<U> &other) noexcept : pool_(other.getPool()) {}
+
+  T *allocate(std::size_t n)
+  {
+    void *ptr = pool_->allocate(n * sizeof(T));
+    if (ptr == nullptr)
+    {
+      pool_->countHeapFallback();
+      ptr = ::operator new(n * sizeof(T));
+    }
+    return static_cast<T *>(ptr);
+  }
+
+  void deallocate(T *ptr, [[maybe_unused]] std::size_t n) noexcept
+  {
+    if (pool_->owns(ptr))
+    {
+      pool_->deallocate(ptr);
+    }
+    else
+    {
+      ::operator delete(ptr);
+    }
+  }
+
+  MqttMemoryPool *getPool() const noexcept
+  {
+    return pool_;
+  }
+
+  template <typename U>
+  bool operator==(const MqttPoolAllocator<U> &other) const noexcept
+  {
+    return pool_ == other.getPool();
+  }
+
+private:
+  MqttMemoryPool *pool_;
+};
+
+#endif /* MQTT_MEMORY_POOL_H */
@@ -26,7 +26,10 @@
 
 #include <vector>
 #include "defaults.h"
+#include "mqtt_memory_pool.h"
+#include <span>
 #include <string>
+#include <string_view>
 
 #define MQTT_MAX_FIXED_HEADER_SIZE 3
 
@@ -46,39 +49,25 @@ public:
   MqttMessage();
   void createConnect(const std::string &clientId);
   void createMqttConnackMessage(bool sessionPresent, MqttConnectReturnCode returnCode);
-  void createMqttPublishMessage(const std::string &topic, const std::string &payload, bool retain, unsigned char qos);
+  void createMqttPublishMessage(const std::string &topic, const std::string &payload, bool retain, unsigned char qos, unsigned short packetIdentifier);
   void createMqttPubackMessage(unsigned short packetIdentifier);
   void createMqttPubrecMessage(unsigned short packetIdentifier);
   void createMqttPubrelMessage(unsigned short packetIdentifier);
   void createMqttPubcompMessage(unsigned short packetIdentifier);
   void createMqttSubscribeMessage(const std::vector<std::string>& topics);
-  void reateMqttSubackMessage(unsigned short packetIdentifier, const std::vector<unsigned char>& grantedQoS);
+  void createMqttSubackMessage(unsigned short packetIdentifier, const std::vector<unsigned char>& grantedQoS);
   void createMqttUnsubscribeMessage(const std::vector<std::string>& topics);
   void createMqttUnsubackMessage(unsigned short packetIdentifier);
   void createMqttPingreqMessage();
   void createMqttPingrespMessage();
   void createMqttDisconnectMessage();
+  std::span<const unsigned char> getMessage() const;
 
 private:
-  enum MqttMessageType
-  {
-    MQTT_MSG_TYPE_CONNECT = 0x10,
-    MQTT_MSG_TYPE_CONNACK = 0x20,
-    MQTT_MSG_TYPE_PUBLISH = 0x30,
-    MQTT_MSG_TYPE_PUBACK = 0x40,
-    MQTT_MSG_TYPE_PUBREC = 0x50,
-    MQTT_MSG_TYPE_PUBREL = 0x60,
-    MQTT_MSG_TYPE_PUBCOMP = 0x70,
-    MQTT_MSG_TYPE_SUBSCRIBE = 0x80,
-    MQTT_MSG_TYPE_SUBACK = 0x90,
-    MQTT_MSG_TYPE_UNSUBSCRIBE = 0xA0,
-    MQTT_MSG_TYPE_UNSUBACK = 0xB0,
-    MQTT_MSG_TYPE_PINGREQ = 0xC0,
-    MQTT_MSG_TYPE_PINGRESP = 0xD0,
-    MQTT_MSG_TYPE_DISCONNECT = 0xE0
-  };
+  void finish(std::size_t length);
+  static std::span<const std::string_view> toViews(const std::vector<std::string> &topics, std::string_view (&views)[MAX_TOPICS_IN_SUBSCRIBE]);
 
-  std::vector<unsigned char> message_;
+  std::vector<unsigned char, MqttPoolAllocator<unsigned char>> message_;
   unsigned char qos_;
   bool retain_;
 };
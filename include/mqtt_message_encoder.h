@@ -0,0 +1,87 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_MESSAGE_ENCODER_H
+#define MQTT_MESSAGE_ENCODER_H
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+#include "defaults.h"
+
+// Builds MQTT control packets straight into a buffer the caller owns. Every packet
+// type has a Size() function giving the exact number of bytes it will encode to, so
+// the caller can reserve (or take from a pool) exactly that much once, and an
+// encode() function that writes it with memcpy for the topic and payload. The
+// encode functions return the number of bytes written, or 0 if the buffer is too
+// small, in which case nothing useful has been written.
+class MqttMessageEncoder
+{
+public:
+  static constexpr std::size_t MAX_REMAINING_LENGTH = 268435455; // largest 4 byte variable byte integer
+
+  static std::size_t remainingLengthSize(std::size_t remainingLength);
+  static std::size_t encodeRemainingLength(unsigned char *buffer, std::size_t remainingLength);
+
+  static std::size_t connectSize(std::string_view clientId);
+  static std::size_t encodeConnect(std::span<unsigned char> buffer, std::string_view clientId, unsigned short keepAlive);
+
+  static std::size_t connackSize();
+  static std::size_t encodeConnack(std::span<unsigned char> buffer, bool sessionPresent, unsigned char returnCode);
+
+  static std::size_t publishSize(std::string_view topic, std::size_t payloadLength, unsigned char qos);
+  static std::size_t encodePublish(std::span<unsigned char> buffer, std::string_view topic, std::span<const unsigned char> payload,
+                                   bool retain, unsigned char qos, unsigned short packetIdentifier);
+
+  static std::size_t packetIdentifierOnlySize();
+  static std::size_t encodePuback(std::span<unsigned char> buffer, unsigned short packetIdentifier);
+  static std::size_t encodePubrec(std::span<unsigned char> buffer, unsigned short packetIdentifier);
+  static std::size_t encodePubcomp(std::span<unsigned char> buffer, unsigned short packetIdentifier);
+  static std::size_t encodeUnsuback(std::span<unsigned char> buffer, unsigned short packetIdentifier);
+
+  static std::size_t pubrelSize(unsigned char protocolLevel = 5);
+  static std::size_t encodePubrel(std::span<unsigned char> buffer, unsigned short packetIdentifier, unsigned char protocolLevel = 5);
+
+  static std::size_t subscribeSize(std::span<const std::string_view> topics);
+  static std::size_t encodeSubscribe(std::span<unsigned char> buffer, std::span<const std::string_view> topics, unsigned short packetIdentifier);
+
+  static std::size_t subackSize(std::size_t grantedCount);
+  static std::size_t encodeSuback(std::span<unsigned char> buffer, unsigned short packetIdentifier, std::span<const unsigned char> grantedQoS);
+
+  static std::size_t unsubscribeSize(std::span<const std::string_view> topics);
+  static std::size_t encodeUnsubscribe(std::span<unsigned char> buffer, std::span<const std::string_view> topics, unsigned short packetIdentifier);
+
+  static std::size_t emptyPacketSize();
+  static std::size_t encodePingreq(std::span<unsigned char> buffer);
+  static std::size_t encodePingresp(std::span<unsigned char> buffer);
+  static std::size_t encodeDisconnect(std::span<unsigned char> buffer);
+
+private:
+  static std::size_t encodePacketIdentifierOnly(std::span<unsigned char> buffer, unsigned char fixedHeader, unsigned short packetIdentifier);
+  static std::size_t encodeEmptyPacket(std::span<unsigned char> buffer, unsigned char fixedHeader);
+  static std::size_t subscriptionTopicCount(std::span<const std::string_view> topics);
+  static std::size_t topicListRemainingLength(std::span<const std::string_view> topics, std::size_t bytesPerTopic);
+  static unsigned char *putString(unsigned char *out, std::string_view str);
+};
+
+#endif /* MQTT_MESSAGE_ENCODER_H */
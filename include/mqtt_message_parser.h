@@ -24,10 +24,13 @@
 #ifndef __MQTT_MESSAGE_PARSER_H__
 #define __MQTT_MESSAGE_PARSER_H__
 
-#include <vector>
+#include <array>
+#include <span>
 #include <type_traits>
 #include "defaults.h"
 
+class MqttPropertyBag;
+
 class MqttMessageParser
 {
 public:
@@ -73,16 +76,133 @@ public:
         SharedSubscriptionAvailable = 0x2A      // Byte CONNACK
     };
 
-    virtual ParseResult parseMessage(const std::vector<unsigned char> &message) = 0;
-    static bool parseProperties(const std::vector<unsigned char> &message, size_t &index);
+    // The wire encoding of each property value, see section 2.2.2.2 of the MQTT v5 spec
+    enum class MqttPropertyWireType : unsigned char
+    {
+        Invalid,
+        Byte,
+        TwoByteInteger,
+        FourByteInteger,
+        VariableByteInteger,
+        Utf8String,
+        Utf8StringPair,
+        BinaryData
+    };
+
+    // Control packet types as carried in the top nibble of the fixed header. Type 0 is
+    // reserved on the wire, so it is borrowed to stand for the Will Properties in CONNECT.
+    enum class MqttPacketType : unsigned char
+    {
+        WillProperties = 0,
+        Connect = 1,
+        Connack = 2,
+        Publish = 3,
+        Puback = 4,
+        Pubrec = 5,
+        Pubrel = 6,
+        Pubcomp = 7,
+        Subscribe = 8,
+        Suback = 9,
+        Unsubscribe = 10,
+        Unsuback = 11,
+        Pingreq = 12,
+        Pingresp = 13,
+        Disconnect = 14,
+        Auth = 15
+    };
 
-private:
-    static bool parseByteProperty(const std::vector<unsigned char> &message, unsigned char &value, size_t &index);
-    static bool parseFourByteIntegerProperty(const std::vector<unsigned char> &message, unsigned long &value, size_t &index);
-    static bool parseTwoByteIntegerProperty(const std::vector<unsigned char> &message, unsigned short &value, size_t &index);
-    static bool parseUtf8StringProperty(const std::vector<unsigned char> &message, char *value, size_t &index, size_t maxLength);
-    static bool parseBinaryDataProperty(const std::vector<unsigned char> &message, std::vector<unsigned char> &value, size_t &index);
-    static bool parseVariableByteIntegerProperty(const std::vector<unsigned char> &message, unsigned long &value, size_t &index);
+    struct MqttPropertyInfo
+    {
+        MqttPropertyWireType wireType;
+        unsigned short allowedPackets; // bit n set if the property may appear in MqttPacketType n
+    };
+
+    static constexpr unsigned char MAX_PROPERTY_ID = 0x2A;
+    static constexpr MqttPropertyInfo getPropertyInfo(unsigned char propertyId);
+    static constexpr unsigned short packetBit(MqttPacketType packetType);
+
+    // The parsers work directly on the bytes handed up by the TCP receive callback. The
+    // span is only borrowed for the duration of parseMessage() and any views the parser
+    // hands back (topic names, strings) point into it, so nothing is copied per packet.
+    virtual ParseResult parseMessage(std::span<const unsigned char> message) = 0;
+    static bool parseProperties(std::span<const unsigned char> message, size_t &index,
+                                MqttPacketType packetType, MqttPropertyBag &properties);
 };
 
+constexpr unsigned short MqttMessageParser::packetBit(MqttPacketType packetType)
+{
+    return static_cast<unsigned short>(1u << static_cast<unsigned char>(packetType));
+}
+
+// One entry per property identifier, giving its wire type and the packets it may
+// appear in. Unassigned identifiers are left Invalid so they are rejected on receipt.
+inline constexpr auto mqttPropertyTable = []
+{
+    using Parser = MqttMessageParser;
+    using Id = Parser::MqttPropertyTypes;
+    using Wire = Parser::MqttPropertyWireType;
+    using Packet = Parser::MqttPacketType;
+
+    constexpr unsigned short will = Parser::packetBit(Packet::WillProperties);
+    constexpr unsigned short connect = Parser::packetBit(Packet::Connect);
+    constexpr unsigned short connack = Parser::packetBit(Packet::Connack);
+    constexpr unsigned short publish = Parser::packetBit(Packet::Publish);
+    constexpr unsigned short puback = Parser::packetBit(Packet::Puback);
+    constexpr unsigned short pubrec = Parser::packetBit(Packet::Pubrec);
+    constexpr unsigned short pubrel = Parser::packetBit(Packet::Pubrel);
+    constexpr unsigned short pubcomp = Parser::packetBit(Packet::Pubcomp);
+    constexpr unsigned short subscribe = Parser::packetBit(Packet::Subscribe);
+    constexpr unsigned short suback = Parser::packetBit(Packet::Suback);
+    constexpr unsigned short unsubscribe = Parser::packetBit(Packet::Unsubscribe);
+    constexpr unsigned short unsuback = Parser::packetBit(Packet::Unsuback);
+    constexpr unsigned short disconnect = Parser::packetBit(Packet::Disconnect);
+    constexpr unsigned short auth = Parser::packetBit(Packet::Auth);
+
+    std::array<Parser::MqttPropertyInfo, Parser::MAX_PROPERTY_ID + 1> table{};
+    auto set = [&table](Id id, Wire wireType, unsigned short allowedPackets)
+    {
+        table[static_cast<unsigned char>(id)] = {wireType, allowedPackets};
+    };
+
+    set(Id::PayloadFormatIndicator, Wire::Byte, publish | will);
+    set(Id::MessageExpiryInterval, Wire::FourByteInteger, publish | will);
+    set(Id::ContentType, Wire::Utf8String, publish | will);
+    set(Id::ResponseTopic, Wire::Utf8String, publish | will);
+    set(Id::CorrelationData, Wire::BinaryData, publish | will);
+    set(Id::SubscriptionIdentifier, Wire::VariableByteInteger, publish | subscribe);
+    set(Id::SessionExpiryInterval, Wire::FourByteInteger, connect | connack | disconnect);
+    set(Id::AssignedClientIdentifier, Wire::Utf8String, connack);
+    set(Id::ServerKeepAlive, Wire::TwoByteInteger, connack);
+    set(Id::AuthenticationMethod, Wire::Utf8String, connect | connack | auth);
+    set(Id::AuthenticationData, Wire::BinaryData, connect | connack | auth);
+    set(Id::RequestProblemInformation, Wire::Byte, connect);
+    set(Id::WillDelayInterval, Wire::FourByteInteger, will);
+    set(Id::RequestResponseInformation, Wire::Byte, connect);
+    set(Id::ResponseInformation, Wire::Utf8String, connack);
+    set(Id::ServerReference, Wire::Utf8String, connack | disconnect);
+    set(Id::ReasonString, Wire::Utf8String, connack | puback | pubrec | pubrel | pubcomp | suback | unsuback | disconnect | auth);
+    set(Id::ReceiveMaximum, Wire::TwoByteInteger, connect | connack);
+    set(Id::TopicAliasMaximum, Wire::TwoByteInteger, connect | connack);
+    set(Id::TopicAlias, Wire::TwoByteInteger, publish);
+    set(Id::MaximumQoS, Wire::Byte, connack);
+    set(Id::RetainAvailable, Wire::Byte, connack);
+    set(Id::UserProperty, Wire::Utf8StringPair,
+        connect | connack | publish | will | puback | pubrec | pubrel | pubcomp |
+            subscribe | suback | unsubscribe | unsuback | disconnect | auth);
+    set(Id::MaximumPacketSize, Wire::FourByteInteger, connect | connack);
+    set(Id::WildcardSubscriptionAvailable, Wire::Byte, connack);
+    set(Id::SubscriptionIdentifierAvailable, Wire::Byte, connack);
+    set(Id::SharedSubscriptionAvailable, Wire::Byte, connack);
+    return table;
+}();
+
+constexpr MqttMessageParser::MqttPropertyInfo MqttMessageParser::getPropertyInfo(unsigned char propertyId)
+{
+    if (propertyId > MAX_PROPERTY_ID)
+    {
+        return {MqttPropertyWireType::Invalid, 0};
+    }
+    return mqttPropertyTable[propertyId];
+}
+
 #endif // __MQTT_MESSAGE_PARSER_H__
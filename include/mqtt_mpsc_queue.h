@@ -0,0 +1,119 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef __MQTT_MPSC_QUEUE_H__
+#define __MQTT_MPSC_QUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// A bounded queue that any number of threads can push to and one thread pops
+// from, without locks. Each slot carries a sequence number saying whether it is
+// free for the producer on this lap or holds an item for the consumer, so a push is
+// one compare-and-swap to claim a position plus a store to publish it. A full
+// queue refuses the push rather than blocking, leaving the producer to decide what
+// to drop. Capacity must be a power of two.
+template <typename T, std::size_t Capacity>
+class MqttMpscQueue
+{
+public:
+    static_assert((Capacity >= 2) && ((Capacity & (Capacity - 1)) == 0), "Capacity must be a power of two");
+
+    MqttMpscQueue()
+    {
+        for (std::size_t i = 0; i < Capacity; i++)
+        {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        pushPosition_.store(0, std::memory_order_relaxed);
+        popPosition_ = 0;
+    }
+
+    MqttMpscQueue(const MqttMpscQueue &) = delete;
+    MqttMpscQueue &operator=(const MqttMpscQueue &) = delete;
+
+    // safe from any thread
+    bool push(T item)
+    {
+        std::size_t position = pushPosition_.load(std::memory_order_relaxed);
+        Slot *slot;
+
+        for (;;)
+        {
+            slot = &slots_[position & (Capacity - 1)];
+            std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+            if (difference == 0)
+            {
+                if (pushPosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false; // full, the consumer hasn't freed this slot yet
+            }
+            else
+            {
+                position = pushPosition_.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->item = std::move(item);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // only from the consuming thread
+    bool pop(T &item)
+    {
+        Slot *slot = &slots_[popPosition_ & (Capacity - 1)];
+
+        if (slot->sequence.load(std::memory_order_acquire) != popPosition_ + 1)
+        {
+            return false; // empty, or the next push hasn't finished yet
+        }
+
+        item = std::move(slot->item);
+        slot->item = T();
+        slot->sequence.store(popPosition_ + Capacity, std::memory_order_release);
+        popPosition_++;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<std::size_t> sequence;
+        T item;
+    };
+
+    Slot slots_[Capacity];
+    alignas(64) std::atomic<std::size_t> pushPosition_;
+    alignas(64) std::size_t popPosition_;
+};
+
+#endif /* __MQTT_MPSC_QUEUE_H__ */
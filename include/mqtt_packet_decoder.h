@@ -0,0 +1,294 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_PACKET_DECODER_H
+#define MQTT_PACKET_DECODER_H
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string_view>
+#include "defaults.h"
+#include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
+
+// What the decoder makes of a packet from a client. Each view is a handful of
+// fields and spans pointing into the received frame, filled in on the stack and
+// valid only while the frame is. Properties are left as the raw block, Property
+// Length included, for MqttMessageParser::parseProperties to read into a bag if
+// anybody wants them; before MQTT v5 the block is empty.
+
+struct MqttFixedHeader
+{
+  MqttMessageParser::MqttPacketType type;
+  unsigned char flags;
+  std::size_t headerLength; // the type byte and the remaining length
+  std::size_t remainingLength;
+};
+
+struct MqttConnectView
+{
+  unsigned char protocolLevel; // 3 for v3.1, 4 for v3.1.1, 5 for v5
+  bool cleanStart;
+  bool will;
+  unsigned char willQos;
+  bool willRetain;
+  unsigned short keepAlive;
+  std::span<const unsigned char> properties;
+  std::string_view clientId;
+  std::span<const unsigned char> willProperties;
+  std::string_view willTopic;
+  std::span<const unsigned char> willPayload;
+  bool hasUserName;
+  std::string_view userName;
+  bool hasPassword;
+  std::span<const unsigned char> password;
+};
+
+struct MqttPublishView
+{
+  unsigned char qos;
+  bool retain;
+  bool duplicate;
+  std::string_view topic;
+  unsigned short packetIdentifier; // 0 for QoS 0
+  std::span<const unsigned char> properties;
+  std::span<const unsigned char> payload;
+};
+
+// PUBACK, PUBREC, PUBREL and PUBCOMP
+struct MqttAckView
+{
+  unsigned short packetIdentifier;
+  unsigned char reasonCode; // 0 when the packet leaves it out
+  std::span<const unsigned char> properties;
+};
+
+// SUBSCRIBE and UNSUBSCRIBE. The filters have all been checked, and are read one
+// at a time with MqttPacketDecoder::nextFilter.
+struct MqttSubscribeView
+{
+  unsigned short packetIdentifier;
+  std::span<const unsigned char> properties;
+  std::span<const unsigned char> filters;
+  std::size_t filterCount;
+};
+
+// DISCONNECT and AUTH
+struct MqttReasonView
+{
+  unsigned char reasonCode;
+  std::span<const unsigned char> properties;
+};
+
+// Decodes packets sent by a client in one pass: the fixed header once, its flags
+// checked against packetRules, then the rest of the packet by its type into one of
+// the views above, which dispatch() hands to the matching method of a handler:
+//
+//   handleConnect(const MqttConnectView &)
+//   handlePublish(const MqttPublishView &)
+//   handleAck(MqttMessageParser::MqttPacketType, const MqttAckView &)
+//   handleSubscribe(const MqttSubscribeView &)
+//   handleUnsubscribe(const MqttSubscribeView &)
+//   handlePingreq()
+//   handleDisconnect(const MqttReasonView &)
+//   handleAuth(const MqttReasonView &)
+//
+// The handler is a template parameter, so there is no object to build and no
+// virtual call per packet. Nothing is copied or allocated.
+class MqttPacketDecoder
+{
+public:
+  using MqttPacketType = MqttMessageParser::MqttPacketType;
+
+  enum class Result
+  {
+    Success,
+    MalformedPacket,     // a length or field does not fit, the connection must close
+    InvalidFlags,        // fixed header flags not allowed for the packet type
+    ProtocolError,       // well formed, but breaks a rule of the protocol
+    UnsupportedProtocol, // a CONNECT for a protocol level we don't speak
+    UnexpectedPacket     // a packet only a server sends
+  };
+
+  // The fixed header flags each packet type must have: (flags & mask) == value.
+  // PUBLISH carries DUP, QoS and RETAIN there instead, checked in decodePublish.
+  struct PacketRule
+  {
+    unsigned char mask;
+    unsigned char value;
+  };
+
+  static constexpr std::array<PacketRule, 16> packetRules = {{
+      {0x0F, 0x00}, // reserved, never valid
+      {0x0F, 0x00}, // CONNECT
+      {0x0F, 0x00}, // CONNACK
+      {0x00, 0x00}, // PUBLISH
+      {0x0F, 0x00}, // PUBACK
+      {0x0F, 0x00}, // PUBREC
+      {0x0F, 0x02}, // PUBREL
+      {0x0F, 0x00}, // PUBCOMP
+      {0x0F, 0x02}, // SUBSCRIBE
+      {0x0F, 0x00}, // SUBACK
+      {0x0F, 0x02}, // UNSUBSCRIBE
+      {0x0F, 0x00}, // UNSUBACK
+      {0x0F, 0x00}, // PINGREQ
+      {0x0F, 0x00}, // PINGRESP
+      {0x0F, 0x00}, // DISCONNECT
+      {0x0F, 0x00}  // AUTH
+  }};
+
+  template <typename Handler>
+  static Result dispatch(std::span<const unsigned char> frame, unsigned char protocolLevel, Handler &handler);
+
+  static Result decodeFixedHeader(std::span<const unsigned char> frame, MqttFixedHeader &header);
+  static Result decodeConnect(std::span<const unsigned char> body, MqttConnectView &view);
+  static Result decodePublish(const MqttFixedHeader &header, std::span<const unsigned char> body,
+                              unsigned char protocolLevel, MqttPublishView &view);
+  static Result decodeAck(std::span<const unsigned char> body, unsigned char protocolLevel, MqttAckView &view);
+  static Result decodeSubscribe(std::span<const unsigned char> body, unsigned char protocolLevel, MqttSubscribeView &view);
+  static Result decodeUnsubscribe(std::span<const unsigned char> body, unsigned char protocolLevel, MqttSubscribeView &view);
+  static Result decodeReason(std::span<const unsigned char> body, unsigned char protocolLevel, MqttReasonView &view);
+
+  static bool nextFilter(std::span<const unsigned char> &filters, std::string_view &filter, unsigned char &options);
+  static bool nextFilter(std::span<const unsigned char> &filters, std::string_view &filter);
+
+private:
+  static std::span<const unsigned char> readProperties(MqttReader &reader, unsigned char protocolLevel);
+};
+
+/**
+ * Decodes one complete frame and hands it to the handler method for its type.
+ * protocolLevel is the one from the client's CONNECT, which decides whether the
+ * packets carry properties.
+ *
+ * @return Success if the handler was called, otherwise why the frame was refused
+ */
+
+template <typename Handler>
+MqttPacketDecoder::Result MqttPacketDecoder::dispatch(std::span<const unsigned char> frame, unsigned char protocolLevel,
+                                                      Handler &handler)
+{
+  MqttFixedHeader header;
+  Result result = decodeFixedHeader(frame, header);
+
+  if (result != Result::Success)
+  {
+    return result;
+  }
+
+  const std::span<const unsigned char> body = frame.subspan(header.headerLength);
+
+  switch (header.type)
+  {
+  case MqttPacketType::Connect:
+  {
+    MqttConnectView view;
+    if ((result = decodeConnect(body, view)) == Result::Success)
+    {
+      handler.handleConnect(view);
+    }
+    break;
+  }
+
+  case MqttPacketType::Publish:
+  {
+    MqttPublishView view;
+    if ((result = decodePublish(header, body, protocolLevel, view)) == Result::Success)
+    {
+      handler.handlePublish(view);
+    }
+    break;
+  }
+
+  case MqttPacketType::Puback:
+  case MqttPacketType::Pubrec:
+  case MqttPacketType::Pubrel:
+  case MqttPacketType::Pubcomp:
+  {
+    MqttAckView view;
+    if ((result = decodeAck(body, protocolLevel, view)) == Result::Success)
+    {
+      handler.handleAck(header.type, view);
+    }
+    break;
+  }
+
+  case MqttPacketType::Subscribe:
+  {
+    MqttSubscribeView view;
+    if ((result = decodeSubscribe(body, protocolLevel, view)) == Result::Success)
+    {
+      handler.handleSubscribe(view);
+    }
+    break;
+  }
+
+  case MqttPacketType::Unsubscribe:
+  {
+    MqttSubscribeView view;
+    if ((result = decodeUnsubscribe(body, protocolLevel, view)) == Result::Success)
+    {
+      handler.handleUnsubscribe(view);
+    }
+    break;
+  }
+
+  case MqttPacketType::Pingreq:
+    result = body.empty() ? Result::Success : Result::MalformedPacket;
+    if (result == Result::Success)
+    {
+      handler.handlePingreq();
+    }
+    break;
+
+  case MqttPacketType::Disconnect:
+  {
+    MqttReasonView view;
+    if ((result = decodeReason(body, protocolLevel, view)) == Result::Success)
+    {
+      handler.handleDisconnect(view);
+    }
+    break;
+  }
+
+  case MqttPacketType::Auth:
+  {
+    MqttReasonView view;
+    result = (protocolLevel < 5) ? Result::ProtocolError : decodeReason(body, protocolLevel, view);
+    if (result == Result::Success)
+    {
+      handler.handleAuth(view);
+    }
+    break;
+  }
+
+  default:
+    result = Result::UnexpectedPacket;
+    break;
+  }
+
+  return result;
+}
+
+#endif /* MQTT_PACKET_DECODER_H */
@@ -0,0 +1,88 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef __MQTT_PACKET_REASSEMBLER_H__
+#define __MQTT_PACKET_REASSEMBLER_H__
+
+#include <span>
+#include <cstddef>
+#include "defaults.h"
+
+// TCP delivers a byte stream, not MQTT packets. A segment can hold part of a
+// packet, exactly one packet or many packets, and a packet can be split at any
+// byte including the middle of its Remaining Length. The reassembler turns the
+// stream back into complete frames (fixed header included) and hands each one to
+// a callback as a span.
+//
+// Frames that arrive whole within a segment are handed up as views into that
+// segment, so the common case copies nothing. Only a frame that straddles a
+// segment boundary is gathered into a buffer, and as there is only ever one such
+// frame at a time it always starts at offset zero: each byte is copied at most
+// once and the buffer never needs to be compacted. The buffer is a large block
+// from MqttMemoryPool, held only while a frame is incomplete, so idle sessions
+// don't each carry MQTT_BUF_SIZE bytes.
+class MqttPacketReassembler
+{
+public:
+    enum class Result
+    {
+        Success,
+        MalformedRemainingLength,
+        PacketTooLarge,
+        OutOfMemory
+    };
+
+    using FrameCb = void (*)(void *obj, std::span<const unsigned char> frame);
+
+    MqttPacketReassembler();
+    ~MqttPacketReassembler();
+
+    MqttPacketReassembler(const MqttPacketReassembler &) = delete;
+    MqttPacketReassembler &operator=(const MqttPacketReassembler &) = delete;
+
+    Result addSegment(const unsigned char *data, std::size_t len, FrameCb cb, void *obj);
+    void reset();
+    std::size_t getBufferedLength() const;
+
+private:
+    enum class HeaderResult
+    {
+        Complete,
+        Incomplete,
+        Malformed
+    };
+
+    static HeaderResult decodeFrameLength(const unsigned char *data, std::size_t len, std::size_t &frameLength);
+    Result gatherPartialFrame(const unsigned char *data, std::size_t len, std::size_t &consumed, FrameCb cb, void *obj);
+    void resetFrame();
+    void releaseBuffer();
+
+private:
+    unsigned char *buffer_;
+    std::size_t bufferedLength_;
+    std::size_t frameLength_;
+    std::size_t remainingLength_;
+    unsigned char lengthBytes_;
+};
+
+#endif // __MQTT_PACKET_REASSEMBLER_H__
@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_PERSISTENT_STORE_H
+#define MQTT_PERSISTENT_STORE_H
+
+#include "defaults.h"
+
+#ifdef MQTT_PERSISTENCE
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Keeps the retained messages and persistent session state across a restart, as an
+// append-only log of records in memory-mapped segment files of
+// MQTT_STORE_SEGMENT_SIZE bytes. A change is one record copied onto the end of the
+// mapped segment, with no system call, and the kernel writes the pages back. Each
+// record carries a CRC-32 so a record torn by a crash, and everything after it, is
+// ignored when the log is replayed.
+//
+// Records that have been overwritten or cleared stay in the log until compaction,
+// which starts a new segment, has the owner append the state that is still live,
+// then deletes the older segments. A crash part way through leaves the old segments
+// in place, and replaying them followed by the partial new ones gives the same
+// state, so the log is never without a complete copy.
+//
+// Instead of compacting, the owner can save its state somewhere else and take a
+// checkpoint: beginCheckpoint() starts a new segment and returns where it begins,
+// and once the saved state is safe endCheckpoint() deletes the segments before it.
+// A later open() from that position replays only what changed since.
+//
+// The store knows nothing of what the records mean; open() hands each one back to
+// the owner, oldest first, to be applied in order.
+class MqttPersistentStore
+{
+public:
+  enum class RecordType : unsigned char
+  {
+    Retain = 1,
+    ClearRetained,
+    Subscribe,
+    Unsubscribe,
+    EndSession
+  };
+
+  struct Record
+  {
+    RecordType type;
+    unsigned char qos;
+    std::string_view clientId;
+    std::string_view topic;
+    std::span<const unsigned char> payload;
+  };
+
+  // A place in the log, from which a replay can start
+  struct Position
+  {
+    std::uint32_t sequence;
+    std::uint32_t offset;
+  };
+
+  using ReplayCb = void (*)(void *obj, const Record &record);
+  using SnapshotCb = bool (*)(void *obj, MqttPersistentStore &store);
+
+  MqttPersistentStore();
+  ~MqttPersistentStore();
+
+  MqttPersistentStore(const MqttPersistentStore &) = delete;
+  MqttPersistentStore &operator=(const MqttPersistentStore &) = delete;
+
+  bool open(const char *directory, ReplayCb cb, void *obj, const Position &from = {0, 0});
+  void close();
+  bool isOpen() const;
+  bool append(const Record &record);
+  bool sync();
+  bool needsCompaction() const;
+  bool compact(SnapshotCb cb, void *obj);
+  Position beginCheckpoint();
+  void endCheckpoint(const Position &position, std::size_t snapshotBytes);
+  std::size_t getSegmentCount() const;
+  std::size_t getLogBytes() const;
+  std::size_t getReplayedCount() const;
+  const char *getDirectory() const;
+
+  static std::uint32_t checksum(const unsigned char *data, std::size_t length);
+
+private:
+  static constexpr std::size_t HEADER_SIZE = 8;  // length and CRC-32 of the body
+  static constexpr std::size_t FIXED_BODY = 10;  // type, QoS and the three lengths
+  static constexpr std::size_t SEGMENT_NAME = 13; // "/%08x.seg" after the directory
+
+  bool formatPath(std::uint32_t sequence, char *path, std::size_t size) const;
+  bool openSegment(std::uint32_t sequence, bool create);
+  void closeSegment();
+  std::size_t replaySegment(const unsigned char *base, std::size_t size, std::size_t from, ReplayCb cb, void *obj);
+  void removeSegments(std::uint32_t first, std::uint32_t last);
+
+private:
+  char directory_[MQTT_STORE_PATH_LENGTH - SEGMENT_NAME];
+  int fd_;
+  unsigned char *base_;
+  std::size_t used_;
+  std::uint32_t firstSequence_;
+  std::uint32_t activeSequence_;
+  std::size_t logBytes_;
+  std::size_t compactedBytes_;
+  std::size_t checkpointBytes_;
+  std::size_t replayed_;
+};
+
+#endif /* MQTT_PERSISTENCE */
+
+#endif /* MQTT_PERSISTENT_STORE_H */
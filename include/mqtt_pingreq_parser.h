@@ -21,14 +21,15 @@
  * THE SOFTWARE.
  *******************************************************************************/
 
-#include <vector>
+#include <span>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttPingreqParser : public MqttMessageParser
 {
 public:
     MqttPingreqParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
 
 private:
     void parseFixedHeader();
@@ -37,7 +38,6 @@ public:
     // Accessors to retrieve parsed information
 
 private:
-    std::vector<unsigned char> pingreqMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
 };
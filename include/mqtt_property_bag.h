@@ -0,0 +1,84 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef __MQTT_PROPERTY_BAG_H__
+#define __MQTT_PROPERTY_BAG_H__
+
+#include <span>
+#include <string_view>
+#include <cstddef>
+#include "defaults.h"
+#include "mqtt_message_parser.h"
+
+// Holds the properties found in one received packet. Nothing is copied or decoded
+// while parsing: each entry is just the property id and where its value sits in the
+// packet, and the getters decode on demand. A broker that forwards a PUBLISH with a
+// handful of user properties therefore never pays for the ones it doesn't look at.
+//
+// The bag is fixed size and refers to the packet buffer, so it is only valid while
+// that buffer is. User Properties are kept apart from the rest (MAX_MQTT_USER_PROPERTIES
+// of them, any further ones are skipped) so a client sending many of them can't crowd
+// out the properties the broker acts on.
+class MqttPropertyBag
+{
+public:
+    using MqttPropertyTypes = MqttMessageParser::MqttPropertyTypes;
+    using MqttPacketType = MqttMessageParser::MqttPacketType;
+
+    MqttPropertyBag();
+    void reset(std::span<const unsigned char> message);
+    bool add(MqttPropertyTypes propertyId, std::size_t offset, std::size_t length, MqttPacketType packetType);
+
+    std::size_t getCount() const;
+    bool contains(MqttPropertyTypes propertyId) const;
+
+    bool getByte(MqttPropertyTypes propertyId, unsigned char &value) const;
+    bool getTwoByteInteger(MqttPropertyTypes propertyId, unsigned short &value) const;
+    bool getFourByteInteger(MqttPropertyTypes propertyId, unsigned long &value) const;
+    bool getVariableByteInteger(MqttPropertyTypes propertyId, unsigned long &value) const;
+    bool getString(MqttPropertyTypes propertyId, std::string_view &value) const;
+    bool getBinaryData(MqttPropertyTypes propertyId, std::span<const unsigned char> &value) const;
+
+    std::size_t getUserPropertyCount() const;
+    bool getUserProperty(std::size_t n, std::string_view &name, std::string_view &value) const;
+
+private:
+    struct Property
+    {
+        MqttPropertyTypes propertyId;
+        unsigned int offset;
+        unsigned int length;
+    };
+
+    const Property *find(MqttPropertyTypes propertyId) const;
+    bool isWireType(MqttPropertyTypes propertyId, MqttMessageParser::MqttPropertyWireType wireType) const;
+
+private:
+    std::span<const unsigned char> message_;
+    Property properties_[MAX_MQTT_PROPERTIES];
+    unsigned char count_;
+    Property userProperties_[MAX_MQTT_USER_PROPERTIES];
+    unsigned char userCount_;
+};
+
+#endif // __MQTT_PROPERTY_BAG_H__
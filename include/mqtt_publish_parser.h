@@ -35,29 +35,28 @@
 //     return 0;
 // }
 
-#include <vector>
-#include <string>
+#include <span>
+#include <string_view>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttPublishParser : public MqttMessageParser
 {
 public:
     MqttPublishParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
 
 private:
     void parseFixedHeader();
     void parseVariableHeader();
     void parsePayload();
-    int parseRemainingLength();
     void parseTopicName();
     void parsePacketIdentifier();
 
 private:
-    std::vector<unsigned char> publishMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
-    int remainingLength_;
-    std::string topicName_;
+    unsigned long remainingLength_;
+    std::string_view topicName_;
     int packetIdentifier_;
 };
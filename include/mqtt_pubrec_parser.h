@@ -35,19 +35,19 @@
 // }
 
 #include <iostream>
-#include <vector>
+#include <span>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttPubrecParser : public MqttMessageParser
 {
 public:
     MqttPubrecParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
 
 private:
     void parseFixedHeader();
     void parseVariableHeader();
-    int parseRemainingLength();
     void parsePacketIdentifier();
 
 public:
@@ -55,9 +55,8 @@ public:
     int getPacketIdentifier() const;
 
 private:
-    std::vector<unsigned char> pubrecMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
-    int remainingLength_;
+    unsigned long remainingLength_;
     int packetIdentifier_;
 };
@@ -34,20 +34,20 @@
 //     return 0;
 // }
 
-#include <vector>
+#include <span>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttPubrelParser : public MqttMessageParser
 {
 public:
     MqttPubrelParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
 
 private:
     // Parse the fixed header
     void parseFixedHeader();
     void parseVariableHeader();
-    int parseRemainingLength();
     void parsePacketIdentifier();
 
 public:
@@ -55,9 +55,8 @@ public:
     int getPacketIdentifier() const;
 
 private:
-    std::vector<unsigned char> pubrelMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
-    int remainingLength_;
+    unsigned long remainingLength_;
     int packetIdentifier_;
 };
@@ -0,0 +1,235 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_READER_H
+#define MQTT_READER_H
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+// A cursor over the bytes of a received packet, shared by every parser. Each read
+// makes one length check for the whole field, never one per byte. A read that runs
+// short marks the reader as failed and moves it to the end, so every read after it
+// fails at once and returns 0 or an empty view: a parser can read a whole group of
+// fields and ask isValid() once at the end, and a malformed packet costs no more
+// than a well formed one.
+//
+// For a group of fixed size fields, ensure() makes the one check and the take
+// methods then read without any.
+class MqttReader
+{
+public:
+  explicit MqttReader(std::span<const unsigned char> bytes = {});
+
+  bool isValid() const;
+  bool atEnd() const;
+  std::size_t getPosition() const;
+  std::size_t getRemaining() const;
+  std::span<const unsigned char> getBytes() const;
+  std::span<const unsigned char> getRest() const;
+  void fail();
+
+  bool ensure(std::size_t count);
+  unsigned char takeByte();
+  unsigned short takeTwoByteInteger();
+  unsigned long takeFourByteInteger();
+
+  unsigned char readByte();
+  unsigned short readTwoByteInteger();
+  unsigned long readFourByteInteger();
+  unsigned long readVariableByteInteger();
+  std::span<const unsigned char> readBytes(std::size_t count);
+  std::span<const unsigned char> readBinary();
+  std::string_view readString();
+
+private:
+  const unsigned char *data_;
+  std::size_t size_;
+  std::size_t position_;
+  bool valid_;
+};
+
+inline MqttReader::MqttReader(std::span<const unsigned char> bytes)
+    : data_(bytes.data()), size_(bytes.size()), position_(0), valid_(true)
+{
+}
+
+/**
+ * @return false once any read has run past the end
+ */
+
+inline bool MqttReader::isValid() const
+{
+  return valid_;
+}
+
+inline bool MqttReader::atEnd() const
+{
+  return position_ == size_;
+}
+
+inline std::size_t MqttReader::getPosition() const
+{
+  return position_;
+}
+
+inline std::size_t MqttReader::getRemaining() const
+{
+  return size_ - position_;
+}
+
+/**
+ * @return the whole packet, for anything that keeps offsets into it
+ */
+
+inline std::span<const unsigned char> MqttReader::getBytes() const
+{
+  return std::span<const unsigned char>(data_, size_);
+}
+
+/**
+ * @return the bytes not read yet, such as a PUBLISH payload
+ */
+
+inline std::span<const unsigned char> MqttReader::getRest() const
+{
+  return std::span<const unsigned char>(data_ + position_, size_ - position_);
+}
+
+/**
+ * Marks the packet as malformed, for a field that fits but holds a value that
+ * can't be right
+ */
+
+inline void MqttReader::fail()
+{
+  valid_ = false;
+  position_ = size_;
+}
+
+/**
+ * Checks that count more bytes are there, for the take methods to read
+ * @return false, and the reader failed, if they aren't
+ */
+
+inline bool MqttReader::ensure(std::size_t count)
+{
+  if (count > size_ - position_)
+  {
+    fail();
+  }
+  return valid_;
+}
+
+inline unsigned char MqttReader::takeByte()
+{
+  return data_[position_++];
+}
+
+inline unsigned short MqttReader::takeTwoByteInteger()
+{
+  const unsigned char *p = data_ + position_;
+  position_ += 2;
+  return static_cast<unsigned short>((p[0] << 8) | p[1]);
+}
+
+inline unsigned long MqttReader::takeFourByteInteger()
+{
+  const unsigned char *p = data_ + position_;
+  position_ += 4;
+  return (static_cast<unsigned long>(p[0]) << 24) | (static_cast<unsigned long>(p[1]) << 16) |
+         (static_cast<unsigned long>(p[2]) << 8) | static_cast<unsigned long>(p[3]);
+}
+
+inline unsigned char MqttReader::readByte()
+{
+  return ensure(1) ? takeByte() : 0;
+}
+
+inline unsigned short MqttReader::readTwoByteInteger()
+{
+  return ensure(2) ? takeTwoByteInteger() : 0;
+}
+
+inline unsigned long MqttReader::readFourByteInteger()
+{
+  return ensure(4) ? takeFourByteInteger() : 0;
+}
+
+/**
+ * A Variable Byte Integer, as used for the remaining length and the property
+ * length. More than four bytes is malformed, so at most four are looked at.
+ */
+
+inline unsigned long MqttReader::readVariableByteInteger()
+{
+  unsigned long value = 0;
+
+  for (unsigned int shift = 0; (shift < 28) && (position_ < size_); shift += 7)
+  {
+    const unsigned char encodedByte = data_[position_++];
+    value |= static_cast<unsigned long>(encodedByte & 0x7F) << shift;
+
+    if ((encodedByte & 0x80) == 0)
+    {
+      return value;
+    }
+  }
+
+  fail();
+  return 0;
+}
+
+inline std::span<const unsigned char> MqttReader::readBytes(std::size_t count)
+{
+  if (!ensure(count))
+  {
+    return {};
+  }
+  std::span<const unsigned char> bytes(data_ + position_, count);
+  position_ += count;
+  return bytes;
+}
+
+/**
+ * Binary Data: a two byte length and that many bytes
+ */
+
+inline std::span<const unsigned char> MqttReader::readBinary()
+{
+  return readBytes(readTwoByteInteger());
+}
+
+/**
+ * A UTF-8 Encoded String, as a view into the packet. The text is not checked
+ * here, that is up to MqttUtf8::isValid.
+ */
+
+inline std::string_view MqttReader::readString()
+{
+  std::span<const unsigned char> bytes = readBinary();
+  return std::string_view(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+}
+
+#endif /* MQTT_READER_H */
@@ -0,0 +1,135 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_RETAINED_STORE_H
+#define MQTT_RETAINED_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include "defaults.h"
+#include "mqtt_shared_publish.h"
+
+// The last retained PUBLISH of every topic, kept in a tree of topic levels the same
+// shape as MqttSubscriptionIndex but the other way round: the tree holds topic names
+// and is searched with a filter. A SUBSCRIBE to "site/+/sensors/#" follows the
+// literal levels through the child hash, fans out over the children of a node only
+// where the filter has a '+', and hands over whole subtrees at a '#', so it never
+// looks at retained messages outside the part of the tree the filter covers.
+//
+// The messages themselves are MqttSharedPublish blocks from MqttMemoryPool, so a
+// retained message sent to a new subscriber is the same encoded topic and payload
+// that every other delivery shares. The number of messages is fixed by
+// MAX_RETAINED_TOPICS and the bytes they may hold by setMemoryLimit().
+class MqttRetainedStore
+{
+public:
+  struct Retained
+  {
+    const MqttSharedPublish::MqttSharedPublishPtr &publish;
+    unsigned char qos;
+  };
+
+  using MatchCb = void (*)(void *obj, const Retained &retained);
+
+  MqttRetainedStore();
+  void clear();
+  bool store(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos);
+  bool store(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos);
+  bool remove(std::string_view topic);
+  std::size_t match(std::string_view filter, MatchCb cb, void *obj) const;
+  std::size_t forEach(MatchCb cb, void *obj) const;
+  void setMemoryLimit(std::size_t maxBytes);
+  std::size_t getMemoryLimit() const;
+  std::size_t getMemoryUsed() const;
+  std::size_t getMessageCount() const;
+  std::size_t getNodeCount() const;
+
+  // The tree of topic levels is plain data that can be saved and loaded as one
+  // block, with the messages attached to their nodes afterwards (see MqttSnapshot).
+  // A saved tree only fits a store built with the same layout.
+  using NodeCb = void (*)(void *obj, std::uint32_t node, const Retained &retained);
+
+  static std::uint32_t getTreeLayout();
+  static std::size_t getTreeSize();
+  void saveTree(unsigned char *out) const;
+  bool loadTree(const unsigned char *in);
+  std::size_t forEachNode(NodeCb cb, void *obj) const;
+  bool attach(std::uint32_t node, const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos);
+
+private:
+  static constexpr int NO_ENTRY = -1;
+  static constexpr int ROOT_NODE = 0;
+  static constexpr std::size_t CHILD_BUCKETS = [] {
+    std::size_t buckets = 1;
+    while (buckets < MAX_RETAINED_NODES)
+    {
+      buckets <<= 1;
+    }
+    return buckets;
+  }();
+
+  struct Node
+  {
+    int parent;
+    int nextInBucket;
+    int firstChild;
+    int nextSibling;
+    unsigned short childCount;
+    unsigned char levelLength;
+    char level[MAX_TOPIC_LENGTH];
+  };
+
+  // kept apart from the nodes so the tree itself is plain data that can be saved
+  // and loaded as it is
+  struct Message
+  {
+    MqttSharedPublish::MqttSharedPublishPtr publish;
+    unsigned char qos;
+  };
+
+  static std::size_t sizeOf(const MqttSharedPublish::MqttSharedPublishPtr &publish);
+
+  int findChild(int parent, std::string_view level) const;
+  int findOrAddChild(int parent, std::string_view level);
+  int findNode(std::string_view topic) const;
+  void releaseNodeIfUnused(int node);
+  std::size_t emit(int node, MatchCb cb, void *obj) const;
+  std::size_t emitSubtree(int node, bool skipSystem, MatchCb cb, void *obj) const;
+  std::size_t matchLevel(int node, const std::string_view *levels, std::size_t levelCount,
+                         std::size_t depth, MatchCb cb, void *obj) const;
+  std::size_t bucketFor(int parent, std::string_view level) const;
+
+private:
+  Node nodes_[MAX_RETAINED_NODES];
+  Message messages_[MAX_RETAINED_NODES];
+  int buckets_[CHILD_BUCKETS];
+  int freeNodes_;
+  std::size_t nodeCount_;
+  std::size_t messageCount_;
+  std::size_t bytesUsed_;
+  std::size_t maxBytes_;
+};
+
+#endif /* MQTT_RETAINED_STORE_H */
@@ -26,7 +26,9 @@
 
 #include <memory>
 
-#ifdef NATIVE_BUILD
+#if defined(MQTT_EPOLL_TRANSPORT)
+#include "epoll/tcp_session.h"
+#elif defined(NATIVE_BUILD)
 #include "../test/mocks/ip_addr.h"
 #include "../test/mocks/ip4_addr.h"
 #include "../test/mocks/ip.h"
@@ -36,7 +38,16 @@
 #include "tcp_session.h"
 #endif
 
+#include "mqtt_memory_pool.h"
+#include "mqtt_persistent_store.h"
+#include "mqtt_retained_store.h"
 #include "mqtt_session.h"
+#include "mqtt_shared_publish.h"
+#include "mqtt_snapshot.h"
+#include "mqtt_subscription_index.h"
+#include "mqtt_timer_wheel.h"
+
+class TcpServer;
 
 // Message Queuing Telemetry Transport (MQTT) is a lightweight and open messaging protocol
 // designed for small sensors and mobile devices with high-latency or unreliable networks.
@@ -54,6 +65,7 @@ public:
 
   bool startMqttClient(ip_addr_t ipAddress, unsigned short port);
   bool startMqttServer(unsigned short portno);
+  bool startMqttServer(TcpServer &tcpServer, unsigned short portno);
   bool stopMqttServer();
   bool stopMqttClient();
   void sessionConnected();
@@ -61,6 +73,43 @@ public:
   void sessionDisconnected(MqttSession::SessionId sessionId);
   std::size_t getSessionCount();
   MqttSession::MqttSessionPtr getSession(MqttSession::SessionId sessionId);
+  MqttSubscriptionIndex &getSubscriptionIndex();
+  void setShareStrategy(MqttSubscriptionIndex::ShareStrategy strategy);
+  std::size_t getSubscriberLoad(MqttSession::SessionId sessionId) const;
+  MqttPoolStats getSessionPoolStats() const;
+  std::size_t publish(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos);
+  std::size_t publish(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos);
+  void setOutboundPolicy(const MqttSession::OutboundPolicy &policy);
+
+  // Retained messages are kept in one store per server; a new subscription is sent
+  // the ones its filter matches with sendRetained()
+  MqttRetainedStore &getRetainedStore();
+  bool retain(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos);
+  bool retain(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos);
+  std::size_t sendRetained(MqttSession::SessionId sessionId, std::string_view filter, unsigned char qos);
+
+  // Keepalives, session expiry and the other timeouts of every session are on one
+  // timer wheel, moved on by whoever runs the event loop (see MqttTimerWheel)
+  std::size_t processTimers(std::uint64_t elapsedMs);
+  MqttTimerWheel &getTimerWheel();
+
+#ifdef MQTT_PERSISTENCE
+  // Retained messages changed through retain() are also written to a log in
+  // directory, and restored after a restart from the last snapshot plus the log
+  // written since (see MqttPersistentStore and MqttSnapshot). processTimers()
+  // starts a checkpoint in the background when the log has grown enough, and
+  // trims the log once it has been written.
+  bool enablePersistence(const char *directory);
+  bool checkpoint(bool wait = false);
+  MqttPersistentStore &getPersistentStore();
+  void handlePersistedRecord(const MqttPersistentStore::Record &record);
+#endif
+
+  // Hands every publish() of a topic and payload to cb instead of delivering it
+  // here, for brokers made of several MqttServers (see MqttShardedBroker)
+  using PublishRouterCb = std::size_t (*)(void *obj, MqttServer &server, std::string_view topic,
+                                          std::span<const unsigned char> payload, unsigned char qos);
+  void setPublishRouter(PublishRouterCb cb, void *obj);
 
   // A drawback of using the RAII (Resource Acquisition Is Initialization) principle is that
   // shared_ptr and unique_ptr both need to have access to the constructor and destructor for
@@ -72,6 +121,42 @@ public:
 
   void handleTcpSessionConnect(TcpSession::TcpSessionPtr tcpSession);
 
+  // Each session's transport callbacks are given its slot, and run between
+  // enterSession() and leaveSession() so an ended session outlives the callback
+  struct SessionSlot
+  {
+    MqttServer *server;
+    MqttSession::SessionId sessionId;
+  };
+
+  MqttSession *enterSession(MqttSession::SessionId sessionId);
+  void leaveSession();
+
+  // One PUBLISH on its way to the matching subscribers. The frame is only encoded
+  // when the first match is found, and then shared by every delivery.
+  struct PublishFanOut
+  {
+    MqttServer *server;
+    std::string_view topic;
+    std::span<const unsigned char> payload;
+    unsigned char qos;
+    MqttSharedPublish::MqttSharedPublishPtr encoded;
+    std::size_t delivered;
+  };
+
+  void handleSubscriptionMatch(PublishFanOut &fanOut, const MqttSubscriptionIndex::Subscription &subscription);
+
+  // The retained messages matching one new subscription, on their way to its session
+  struct RetainedFanOut
+  {
+    MqttServer *server;
+    MqttSession *session;
+    unsigned char qos;
+    std::size_t delivered;
+  };
+
+  void handleRetainedMatch(RetainedFanOut &fanOut, const MqttRetainedStore::Retained &retained);
+
 private:
   MqttServer(const MqttServer &) = delete;
   MqttServer &operator=(const MqttServer &) = delete;
@@ -82,17 +167,44 @@ private:
   bool addSession(MqttSession::SessionId sessionId, const MqttSession::MqttSessionPtr session);
   void removeSession(MqttSession::SessionId sessionId);
   void removeAllSessions();
+  void releaseEndedSessions();
   MqttSession::MqttSessionPtr getSession(MqttSession::SessionId sessionId) const;
+#ifdef MQTT_PERSISTENCE
+  void finishCheckpoint(MqttSnapshot::CheckpointState state);
+#endif
 
 private:
+  // Sessions are built in place in sessionPool_ and handed back to it when the
+  // unique_ptr lets go, so connecting and disconnecting never touches the heap
+  struct SessionDeleter
+  {
+    MqttServer *server;
+    void operator()(MqttSession *session) const;
+  };
+
   struct MapSessions
   {
     bool mappingValid;
+    bool ended; // to be removed once nothing is using it, see sessionDisconnected()
+    SessionSlot slot;
     TcpSession::TcpSessionPtr tcpSession;
-    std::unique_ptr<MqttSession> mqttSession;
+    std::unique_ptr<MqttSession, SessionDeleter> mqttSession;
   };
 
+  MqttBlockPool<sizeof(MqttSession), MAX_MQTT_SESSIONS> sessionPool_;
   MapSessions sessionMapping_[MAX_MQTT_SESSIONS];
+  MqttSubscriptionIndex subscriptions_;
+  MqttRetainedStore retained_;
+#ifdef MQTT_PERSISTENCE
+  MqttPersistentStore persistentStore_;
+  MqttSnapshot snapshot_;
+#endif
+  MqttTimerWheel timerWheel_;
+  PublishRouterCb publishRouterCb_;
+  std::size_t busyDepth_; // fan-outs, timers and transport callbacks under way
+  std::size_t endedCount_;
+  void *publishRouterObj_;
+  MqttSession::OutboundPolicy outboundPolicy_;
   ip_addr_t ipAddress_;
   unsigned short port_;
 };
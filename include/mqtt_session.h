@@ -25,9 +25,12 @@
 #define MQTT_SESSION_H
 
 #include <memory>    // For std::shared_ptr, std::unique_ptr
+#include <span>
 #include <stdexcept> // For std::runtime_error
 
-#ifdef NATIVE_BUILD
+#if defined(MQTT_EPOLL_TRANSPORT)
+#include "epoll/tcp_session.h"
+#elif defined(NATIVE_BUILD)
 #include "../test/mocks/ip_addr.h"
 #include "../test/mocks/ip4_addr.h"
 #include "../test/mocks/ip.h"
@@ -40,6 +43,14 @@
 #include "defaults.h"
 #include "mqtt_topic.h"
 #include "mqtt_message.h"
+#include "mqtt_packet_decoder.h"
+#include "mqtt_packet_reassembler.h"
+#include "mqtt_inflight_window.h"
+#include "mqtt_shared_publish.h"
+#include "mqtt_timer_wheel.h"
+#include "mqtt_topic_alias.h"
+
+class MqttServer;
 
 // In the context of MQTT (Message Queuing Telemetry Transport), a "TCP session"
 // usually encompasses the entire lifespan of a MQTT connection, from its
@@ -57,7 +68,7 @@ public:
 
   MqttSession() = default;
   MqttSession(TcpSession::TcpSessionPtr tcpSession);
-  ~MqttSession() = default;
+  ~MqttSession();
 
   // In modern C++, it's generally recommended to follow the Rule of Three (or Rule of Five).
   // Since you have a custom destructor in MqttSession, it's good practice to also define or
@@ -77,6 +88,78 @@ public:
   void handleTcpReconnect(signed char err, TcpSession::TcpSessionPtr tcpSession);
   void handleTcpMessageSent(TcpSession::TcpSessionPtr tcpSession);
   void handleTcpIncomingMessage(TcpSession::TcpSessionPtr tcpSession, char *pdata, unsigned short len);
+  void handleIncomingFrame(std::span<const unsigned char> frame);
+
+  // Packets from the client, as decoded by MqttPacketDecoder::dispatch
+  void handleConnect(const MqttConnectView &view);
+  void handlePublish(const MqttPublishView &view);
+  void handleAck(MqttMessageParser::MqttPacketType type, const MqttAckView &view);
+  void handleSubscribe(const MqttSubscribeView &view);
+  void handleUnsubscribe(const MqttSubscribeView &view);
+  void handlePingreq();
+  void handleDisconnect(const MqttReasonView &view);
+  void handleAuth(const MqttReasonView &view);
+
+  // Keepalive and session expiry run on the timer wheel of the server that owns
+  // the session. Until the CONNECT arrives the keepalive timer holds the connect
+  // timeout instead. The keepalive is restarted by every packet received, and the
+  // session expiry interval counts from the moment the connection is lost.
+  void setTimerWheel(MqttTimerWheel *timerWheel);
+  bool startKeepAlive(unsigned short keepAliveSeconds);
+  void setSessionExpiryInterval(unsigned long seconds);
+  void handleKeepAliveExpired();
+  void handleSessionExpired();
+
+  // The server that owns the session, and the session's slot there. PUBLISHes from
+  // the client go out through the server and SUBSCRIBEs go into its subscription
+  // index, and the server is told when the session has ended: when the connection
+  // closes with no session expiry interval, or when the interval runs out.
+  void setServer(MqttServer *server, SessionId sessionId);
+
+  // QoS 1 and 2 delivery. Frames waiting for an acknowledgement are sent again
+  // after MQTT_RETRANSMIT_MS, or all at once by retransmitInflight(). v5 forbids
+  // resending on a live connection, so there only retransmitInflight() does it;
+  // nothing calls it yet, as a CONNECT can't resume a session, and a v5 client
+  // that doesn't acknowledge keeps its Receive Maximum window full until it
+  // disconnects.
+  void setReceiveMaximum(unsigned short receiveMaximum);
+  void retransmitInflight();
+  void handleRetransmit();
+  std::size_t getInflightCount() const;
+
+  // What happens to a PUBLISH for a subscriber whose outbound queue is full. A
+  // subscriber that stops reading must not hold on to broker memory, or hold up the
+  // delivery to everyone else, so the queue is bounded in messages and in bytes.
+  enum class SlowConsumerPolicy : unsigned char
+  {
+    DropNewest,     // refuse the new PUBLISH
+    DropOldestQoS0, // make room by dropping the oldest queued QoS 0 PUBLISH
+    Disconnect,     // drop the queue and close the connection
+    Spill           // hand the PUBLISH to spillCb until the queue drains
+  };
+
+  // spillCb takes the PUBLISH (returning false if it can't), and once the queue has
+  // drained drainedCb is called so the spilled messages can be delivered again
+  using SpillCb = bool (*)(void *obj, MqttSession &session, const MqttPublishDelivery &delivery);
+  using SpillDrainedCb = void (*)(void *obj, MqttSession &session);
+
+  struct OutboundPolicy
+  {
+    std::size_t maxMessages = MAX_OUTBOUND_DELIVERIES;
+    std::size_t maxBytes = MAX_OUTBOUND_BYTES;
+    SlowConsumerPolicy slowConsumer = SlowConsumerPolicy::DropNewest;
+    SpillCb spillCb = nullptr;
+    SpillDrainedCb drainedCb = nullptr;
+    void *spillObj = nullptr;
+  };
+
+  void setOutboundPolicy(const OutboundPolicy &policy);
+  bool deliverPublish(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos, bool retain);
+  std::size_t getOutboundCount() const;
+  std::size_t getOutboundBytes() const;
+  std::size_t getOutboundDropCount() const;
+  std::size_t getOutboundSpillCount() const;
+  bool isOutboundFull() const;
 
 private: // state machine for the MQTT session
   void WaitForConnect_HandleMsg(MqttMessage msg);
@@ -87,16 +170,82 @@ private: // state machine for the MQTT session
 private: // utility methods
   void print_topic(MqttTopic *topic) const;
   bool publish_topic(MqttTopic *topic, unsigned char *data, unsigned short data_len) const;
+  void sendOutbound();
+  void gatherOutbound();
+  void addOutboundFrame(std::span<const unsigned char> (&segments)[MqttPublishDelivery::MAX_SEGMENTS],
+                        std::size_t count, unsigned short packetIdentifier, unsigned short topicAlias);
+  unsigned short applyTopicAlias(MqttPublishDelivery &delivery);
+  bool resolveTopicAlias(const MqttPublishView &view, std::string_view &topic);
+  void commitOutbound(std::size_t sent);
+  TcpSession::sendResult sendOutboundBatch(std::size_t &sent);
+  std::uint64_t getTick() const;
+  bool hasOutboundRoom(std::size_t frameLength) const;
+  bool makeOutboundRoom();
+  bool spillPublish(const MqttPublishDelivery &delivery);
+  void removeOutbound(std::size_t position);
+  void popOutbound();
+  void clearOutbound();
 
 private:
   bool sessionValid_;
   TcpSession::TcpSessionPtr tcpSession_;
+  MqttPacketReassembler reassembler_;
+  unsigned char protocolLevel_ = 4; // until the CONNECT says otherwise
+  bool connectReceived_ = false;
+  bool closing_ = false; // drop the connection once the current segment is done
   unsigned char will_qos_;
   int will_retain_;
   int clean_session_;
   unsigned char clientId_[23];
   unsigned char IPAddress_[4];
-  unsigned long sessionExpiryIntervalTimeout_;
+  unsigned long sessionExpiryIntervalTimeout_ = 0;
+  MqttTimerWheel *timerWheel_ = nullptr;
+  MqttTimerWheel::TimerId keepAliveTimer_ = MqttTimerWheel::INVALID_TIMER;
+  MqttTimerWheel::TimerId sessionExpiryTimer_ = MqttTimerWheel::INVALID_TIMER;
+  std::uint64_t keepAliveMs_ = 0;
+  MqttServer *server_ = nullptr;
+  SessionId sessionId_ = 0;
+
+  // PUBLISH frames waiting for the TCP session, oldest first
+  MqttPublishDelivery outbound_[MAX_OUTBOUND_DELIVERIES];
+  std::size_t outboundHead_ = 0;
+  std::size_t outboundCount_ = 0;
+  std::size_t outboundBytes_ = 0;
+  std::size_t outboundDrops_ = 0;
+  std::size_t outboundSpills_ = 0;
+  OutboundPolicy outboundPolicy_;
+  bool spilling_ = false;
+  bool outboundClosed_ = false;
+  MqttInflightWindow inflight_;
+  MqttTimerWheel::TimerId retransmitTimer_ = MqttTimerWheel::INVALID_TIMER;
+
+  // Topic aliases, from v5 (see MqttInboundTopicAliases). Only QoS 0 PUBLISHes go
+  // out by alias, as a QoS 1 or 2 one may be sent again after its alias has moved
+  // on to another topic.
+  MqttInboundTopicAliases inboundAliases_;
+  MqttOutboundTopicAliases outboundAliases_;
+
+  // The frames of one send, inflight ones going again and then the head of the
+  // queue. Only used while sendOutbound runs, so one serves every session on a
+  // thread.
+  static constexpr std::size_t OUTBOUND_BATCH_FRAMES = MAX_OUTBOUND_DELIVERIES * 2;
+  struct OutboundBatch
+  {
+    std::span<const unsigned char> segments[OUTBOUND_BATCH_FRAMES * MqttPublishDelivery::MAX_SEGMENTS];
+    std::size_t frameEnd[OUTBOUND_BATCH_FRAMES]; // one past the last segment of each frame
+    unsigned short packetIdentifiers[OUTBOUND_BATCH_FRAMES];
+    unsigned short topicAliases[OUTBOUND_BATCH_FRAMES]; // an alias the frame sets, or 0
+    std::size_t frameCount;
+    std::size_t resendCount;
+    std::size_t segmentCount;
+  };
+  static MQTT_THREAD_LOCAL OutboundBatch outboundBatch_;
+
+#ifndef MQTT_VECTORED_SEND
+  // the transport wants contiguous bytes and copies them before sendMessage
+  // returns, so one buffer serves every session on a thread
+  static MQTT_THREAD_LOCAL unsigned char sendBuffer_[MQTT_BUF_SIZE];
+#endif
 };
 
 #endif /* MQTT_SESSION_H */
\ No newline at end of file
@@ -0,0 +1,107 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_SHARDED_BROKER_H
+#define MQTT_SHARDED_BROKER_H
+
+#ifdef MQTT_EPOLL_TRANSPORT
+
+#include <atomic>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "epoll/tcp_server.h"
+#include "mqtt_mpsc_queue.h"
+#include "mqtt_server.h"
+#include "mqtt_shared_publish.h"
+
+// Runs the broker on several threads. Each shard is a worker thread with its own
+// TcpServer, MqttServer and epoll loop, and owns the sessions it accepted outright:
+// nothing a session touches is shared, so the data path takes no locks. All the
+// shards listen on the same port with SO_REUSEPORT and the kernel spreads new
+// connections between them.
+//
+// The one thing that crosses shards is a PUBLISH. It is encoded once where it
+// arrives, delivered to that shard's subscribers straight away, and a reference to
+// the shared frame is pushed onto every other shard's lock-free inbox. Each shard
+// matches it against its own subscriptions when it next wakes, so the payload is
+// never copied between threads.
+class MqttShardedBroker
+{
+public:
+  using ShardTaskCb = void (*)(void *obj, MqttServer &server);
+
+  // one worker thread's share of the broker
+  struct Shard
+  {
+    struct Message
+    {
+      MqttSharedPublish::MqttSharedPublishPtr publish;
+      unsigned char qos;
+      ShardTaskCb task;
+      void *obj;
+    };
+
+    MqttShardedBroker *broker;
+    std::size_t index;
+    MqttServer mqttServer;
+    TcpServer tcpServer;
+    MqttMpscQueue<Message, MQTT_SHARD_INBOX_SIZE> inbox;
+    std::thread thread;
+  };
+
+  explicit MqttShardedBroker(std::size_t shardCount);
+  ~MqttShardedBroker();
+
+  bool start(unsigned short port);
+  void stop();
+  std::size_t getShardCount() const;
+  unsigned short getListenPort() const;
+  unsigned long getDroppedCount() const;
+
+  std::size_t publish(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos);
+  bool post(std::size_t shard, ShardTaskCb cb, void *obj);
+
+  std::size_t handleShardPublish(Shard &shard, std::string_view topic, std::span<const unsigned char> payload, unsigned char qos);
+
+private:
+  MqttShardedBroker(const MqttShardedBroker &) = delete;
+  MqttShardedBroker &operator=(const MqttShardedBroker &) = delete;
+
+  void runShard(Shard &shard);
+  void drainInbox(Shard &shard);
+  bool sendToShard(Shard &shard, Shard::Message message);
+
+private:
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<bool> running_;
+  std::atomic<unsigned long> dropped_;
+  unsigned short port_;
+};
+
+#endif /* MQTT_EPOLL_TRANSPORT */
+
+#endif /* MQTT_SHARDED_BROKER_H */
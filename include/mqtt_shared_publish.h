@@ -0,0 +1,104 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_SHARED_PUBLISH_H
+#define MQTT_SHARED_PUBLISH_H
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "defaults.h"
+#include "mqtt_memory_pool.h"
+
+// A PUBLISH received once is usually sent on to many subscribers, and apart from a
+// few header bits the bytes are the same every time. MqttSharedPublish holds the parts
+// that never change - the length prefixed topic and the payload - encoded once in a
+// single buffer that is never modified after create(), so any number of outbound
+// queues can hold a reference to it at once. The object, its reference count and
+// the encoded bytes are all taken from MqttMemoryPool.
+class MqttSharedPublish
+{
+public:
+  using MqttSharedPublishPtr = std::shared_ptr<const MqttSharedPublish>;
+
+  static MqttSharedPublishPtr create(std::string_view topic, std::span<const unsigned char> payload);
+
+  std::string_view getTopic() const;
+  std::span<const unsigned char> getPayload() const;
+  std::span<const unsigned char> getTopicBlock() const;
+
+  // use create(), the constructor is only public for allocate_shared
+  MqttSharedPublish(std::string_view topic, std::span<const unsigned char> payload);
+
+private:
+  MqttSharedPublish(const MqttSharedPublish &) = delete;
+  MqttSharedPublish &operator=(const MqttSharedPublish &) = delete;
+
+private:
+  std::vector<unsigned char, MqttPoolAllocator<unsigned char>> body_;
+  std::size_t topicLength_;
+};
+
+// One delivery of a shared PUBLISH to one subscriber. Only the bits that differ per
+// recipient live here: the fixed header with its QoS and retain flags, the Remaining
+// Length, the packet identifier and, from v5, the properties. The frame on the wire
+// is made of up to five segments, the header, the shared topic block (or an empty
+// topic when a Topic Alias stands in for it), the packet identifier (QoS > 0 only),
+// the properties (v5 only) and the shared payload.
+class MqttPublishDelivery
+{
+public:
+  static constexpr std::size_t MAX_SEGMENTS = 5;
+
+  MqttPublishDelivery();
+  MqttPublishDelivery(MqttSharedPublish::MqttSharedPublishPtr publish, unsigned char qos, bool retain, unsigned short packetIdentifier);
+
+  bool isValid() const;
+  void reset();
+  unsigned char getQoS() const;
+  unsigned short getPacketIdentifier() const;
+  void setPacketIdentifier(unsigned short packetIdentifier);
+  void setDuplicate();
+  bool setProperties(unsigned short topicAlias, bool sendTopic);
+  const MqttSharedPublish::MqttSharedPublishPtr &getPublish() const;
+  std::size_t getFrameLength() const;
+  std::size_t getSegments(std::span<const unsigned char> (&segments)[MAX_SEGMENTS]) const;
+  std::size_t copyTo(std::span<unsigned char> buffer) const;
+
+private:
+  std::size_t getRemainingLength(const MqttSharedPublish &publish, std::size_t propertiesLength, bool topicOmitted) const;
+
+private:
+  MqttSharedPublish::MqttSharedPublishPtr publish_;
+  unsigned char header_[5]; // fixed header and up to 4 bytes of Remaining Length
+  unsigned char headerLength_;
+  unsigned char packetIdentifier_[2];
+  unsigned char properties_[4]; // Property Length, then a Topic Alias if there is one
+  unsigned char propertiesLength_;
+  bool topicOmitted_;
+  unsigned char qos_;
+};
+
+#endif /* MQTT_SHARED_PUBLISH_H */
@@ -0,0 +1,123 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_SNAPSHOT_H
+#define MQTT_SNAPSHOT_H
+
+#include "defaults.h"
+
+#ifdef MQTT_PERSISTENCE
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "mqtt_persistent_store.h"
+#include "mqtt_retained_store.h"
+
+// A checkpoint of the retained messages, so a restart loads one file and replays
+// only the log records written since, rather than the whole log.
+//
+// The file is a header and a table of sections, each section located by its offset
+// from the start of the file so the file can be mapped anywhere. The retained
+// store's tree of topic levels links its nodes by index, so its section is the
+// tree exactly as it sits in memory and is copied straight back in; the messages
+// section then hangs each message back on its node. If the broker was rebuilt with
+// different table sizes the tree is skipped and the messages are stored by topic
+// instead. Every MQTT_SNAPSHOT_CHUNK_SIZE bytes of each section has its own CRC-32,
+// and load() checks the chunks on MQTT_SNAPSHOT_THREADS threads at once.
+//
+// startCheckpoint() copies the store into a buffer, which is quick, on the calling
+// thread; computing the CRCs and writing the file, under a temporary name renamed
+// into place once it is on disk, happen on a background thread.
+class MqttSnapshot
+{
+public:
+  enum class CheckpointState
+  {
+    Idle,
+    Writing,
+    Written,
+    Failed
+  };
+
+  MqttSnapshot();
+  ~MqttSnapshot();
+
+  MqttSnapshot(const MqttSnapshot &) = delete;
+  MqttSnapshot &operator=(const MqttSnapshot &) = delete;
+
+  static bool load(const char *directory, MqttRetainedStore &retained, MqttPersistentStore::Position &position);
+
+  bool startCheckpoint(const char *directory, const MqttRetainedStore &retained,
+                       const MqttPersistentStore::Position &position);
+  bool isCheckpointing() const;
+  CheckpointState pollCheckpoint();
+  CheckpointState waitForCheckpoint();
+  const MqttPersistentStore::Position &getCheckpointPosition() const;
+  std::size_t getCheckpointBytes() const;
+
+  void handleRetainedNode(std::uint32_t node, const MqttRetainedStore::Retained &retained);
+
+private:
+  enum class SectionType : std::uint32_t
+  {
+    RetainedTree = 1,
+    RetainedMessages = 2
+  };
+
+  static constexpr std::uint32_t MAGIC = 0x4E53514D; // "MQSN"
+  static constexpr std::uint32_t VERSION = 1;
+  static constexpr std::size_t SECTIONS = 2;
+  static constexpr std::size_t HEADER_SIZE = 32;
+  static constexpr std::size_t SECTION_ENTRY_SIZE = 24;
+  static constexpr std::size_t MESSAGE_ENTRY_SIZE = 13;
+
+  struct Section
+  {
+    std::uint64_t offset;
+    std::uint64_t length;
+  };
+
+  static bool formatPath(const char *directory, const char *suffix, char *path, std::size_t size);
+  static std::size_t chunksIn(std::uint64_t length);
+  static bool verifyChunks(const unsigned char *base, const Section (&sections)[SECTIONS], const unsigned char *crcs);
+  static bool loadMessages(const unsigned char *messages, std::size_t length, bool attach, MqttRetainedStore &retained);
+  static void writeCheckpoint(MqttSnapshot *snapshot);
+  void finishImage();
+  bool writeFile();
+
+private:
+  std::vector<unsigned char> image_;
+  Section sections_[SECTIONS];
+  std::uint32_t messageCount_;
+  char directory_[MQTT_STORE_PATH_LENGTH];
+  MqttPersistentStore::Position position_;
+  std::thread writer_;
+  std::atomic<CheckpointState> state_;
+};
+
+#endif /* MQTT_PERSISTENCE */
+
+#endif /* MQTT_SNAPSHOT_H */
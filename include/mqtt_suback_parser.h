@@ -21,19 +21,19 @@
  * THE SOFTWARE.
  *******************************************************************************/
 
-#include <vector>
+#include <span>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttSubackParser : public MqttMessageParser
 {
 public:
     MqttSubackParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
     
 private:
     void parseFixedHeader();
     void parseVariableHeader();
-    int parseRemainingLength();
     void parsePacketIdentifier();
     void parsePayload();
 
@@ -42,9 +42,8 @@ public:
     int getPacketIdentifier() const;
 
 private:
-    std::vector<unsigned char> subackMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
-    int remainingLength_;
+    unsigned long remainingLength_;
     int packetIdentifier_;
 };
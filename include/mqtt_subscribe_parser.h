@@ -35,31 +35,30 @@
 //     return 0;
 // }
 
-#include <iostream>
-#include <vector>
+#include <span>
+#include <string_view>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttSubscribeParser : public MqttMessageParser
 {
 public:
     MqttSubscribeParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
 
 private:
     void parseFixedHeader();
     void parseVariableHeader();
-    int parseRemainingLength();
     void parsePacketIdentifier();
     void parsePayload();
-    std::string parseString();
+    std::string_view parseString();
 
 public:
     int getPacketIdentifier() const;
 
 private:
-    std::vector<unsigned char> subscribeMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
-    int remainingLength_;
+    unsigned long remainingLength_;
     int packetIdentifier_;
 };
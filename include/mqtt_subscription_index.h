@@ -0,0 +1,179 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_SUBSCRIPTION_INDEX_H
+#define MQTT_SUBSCRIPTION_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "defaults.h"
+#include "mqtt_topic_table.h"
+
+// The subscription index holds every topic filter the broker has been asked for,
+// arranged as a tree of topic levels. Each node has its exact-match children (found
+// through a hash of parent and level), plus one slot each for a '+' and a '#' child.
+// Matching a published topic walks the tree level by level, so the cost depends on
+// the depth of the topic and the wildcards on the way rather than on how many
+// subscriptions exist.
+//
+// Levels are held as MqttTopicTable tokens, so a publish resolves its topic to
+// tokens once and the walk compares integers from there on.
+//
+// A filter of the form "$share/{ShareName}/{filter}" is a shared subscription: its
+// subscribers form a group on the node of {filter}, and each matching message goes
+// to one member of the group rather than to all of them, picked by the index's
+// ShareStrategy. Groups belong to one index, so with MqttShardedBroker a group is
+// made of the members connected to the same shard.
+//
+// All storage is fixed at compile time by MAX_SUBSCRIPTIONS, MAX_SUBSCRIPTION_NODES
+// and MAX_SHARE_GROUPS.
+class MqttSubscriptionIndex
+{
+public:
+  using SubscriberId = std::size_t;
+
+  struct Subscription
+  {
+    SubscriberId subscriber;
+    unsigned char qos;
+  };
+
+  using MatchCb = void (*)(void *obj, const Subscription &subscription);
+
+  // How a shared subscription group picks the member that gets a message
+  enum class ShareStrategy : unsigned char
+  {
+    RoundRobin,    // each member in turn
+    LeastInflight, // the member with the least work outstanding, as told by LoadCb
+    StickyHash     // always the same member for a topic, while the group is unchanged
+  };
+
+  // the messages a subscriber has been sent but not yet finished with
+  using LoadCb = std::size_t (*)(void *obj, SubscriberId subscriber);
+
+  MqttSubscriptionIndex();
+  ~MqttSubscriptionIndex();
+  MqttSubscriptionIndex(const MqttSubscriptionIndex &) = delete;
+  MqttSubscriptionIndex &operator=(const MqttSubscriptionIndex &) = delete;
+  void clear();
+  bool subscribe(std::string_view filter, SubscriberId subscriber, unsigned char qos);
+  bool unsubscribe(std::string_view filter, SubscriberId subscriber);
+  void unsubscribeAll(SubscriberId subscriber);
+  std::size_t match(std::string_view topic, MatchCb cb, void *obj) const;
+  void setShareStrategy(ShareStrategy strategy);
+  void setLoadCb(LoadCb cb, void *obj);
+  std::size_t getSubscriptionCount() const;
+  std::size_t getNodeCount() const;
+  std::size_t getShareGroupCount() const;
+
+private:
+  static constexpr int NO_ENTRY = -1;
+  static constexpr int ROOT_NODE = 0;
+  static constexpr std::size_t CHILD_BUCKETS = [] {
+    std::size_t buckets = 1;
+    while (buckets < MAX_SUBSCRIPTION_NODES)
+    {
+      buckets <<= 1;
+    }
+    return buckets;
+  }();
+
+  using Token = MqttTopicTable::Token;
+
+  struct Node
+  {
+    int parent;
+    int nextInBucket;
+    int plusChild;
+    int hashChild;
+    int firstSubscription;
+    int firstGroup;
+    unsigned short childCount;
+    Token token; // NO_TOKEN for '+' and '#' nodes
+  };
+
+  struct Entry
+  {
+    Subscription subscription;
+    int node;
+    int group; // NO_ENTRY unless the entry is a member of a shared subscription
+    int next;
+  };
+
+  // The members of one "$share/{ShareName}/" on a node. Picking a member moves the
+  // round robin on, which is the only thing match() changes.
+  struct Group
+  {
+    Token shareName;
+    int node;
+    int next;
+    int firstMember;
+    unsigned short memberCount;
+    mutable unsigned int turn;
+  };
+
+  // One match() in progress. The topic is only hashed if a sticky group needs it.
+  struct Walk
+  {
+    std::string_view topic;
+    const Token *tokens;
+    std::size_t levelCount;
+    bool systemTopic;
+    MatchCb cb;
+    void *obj;
+    std::uint32_t topicHash;
+    bool topicHashed;
+  };
+
+  void reset();
+  int findChild(int parent, Token token) const;
+  int findOrAddChild(int parent, std::string_view level);
+  int findNode(std::string_view filter) const;
+  int findGroup(int node, Token shareName) const;
+  int findOrAddGroup(int node, std::string_view shareName);
+  void releaseGroupIfUnused(int group);
+  void releaseNodeIfUnused(int node);
+  void removeEntry(int node, int entry);
+  std::size_t emit(int node, Walk &walk) const;
+  std::size_t matchLevel(int node, std::size_t depth, Walk &walk) const;
+  int pickMember(const Group &group, Walk &walk) const;
+  std::size_t bucketFor(int parent, Token token) const;
+
+private:
+  Node nodes_[MAX_SUBSCRIPTION_NODES];
+  Entry entries_[MAX_SUBSCRIPTIONS];
+  Group groups_[MAX_SHARE_GROUPS];
+  int buckets_[CHILD_BUCKETS];
+  int freeNodes_;
+  int freeEntries_;
+  int freeGroups_;
+  std::size_t nodeCount_;
+  std::size_t subscriptionCount_;
+  std::size_t groupCount_;
+  ShareStrategy shareStrategy_;
+  LoadCb loadCb_;
+  void *loadObj_;
+};
+
+#endif /* MQTT_SUBSCRIPTION_INDEX_H */
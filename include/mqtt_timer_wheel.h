@@ -0,0 +1,104 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_TIMER_WHEEL_H
+#define MQTT_TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include "defaults.h"
+
+// One-shot timers for everything the broker has to do later: keepalive, session
+// expiry, will delay, QoS retransmission and message expiry. Rather than a periodic
+// timer per session, every timer lives in a hierarchical wheel of MQTT_TIMER_LEVELS
+// levels of 64 slots. Level 0 holds the timers due in the next 64 ticks, and each
+// level above covers 64 times the span of the one below; when a level 0 revolution
+// completes, the next slot up is spread out over the level below. Starting,
+// restarting and cancelling a timer are O(1) whatever the number of timers, and a
+// tick only touches the timers that are due (plus, now and then, one slot to
+// cascade).
+//
+// Timers come from a fixed table of MAX_MQTT_TIMERS entries. A TimerId carries a
+// generation count as well as the table index, so the id of a timer that has fired
+// or been cancelled is never mistaken for whatever uses the entry next.
+//
+// The wheel has no clock of its own and isn't thread safe: the event loop that owns
+// it calls advance() with the milliseconds that have passed.
+class MqttTimerWheel
+{
+public:
+  using TimerId = std::uint64_t;
+  using TimerCb = void (*)(void *obj);
+
+  static constexpr TimerId INVALID_TIMER = 0;
+
+  MqttTimerWheel();
+
+  MqttTimerWheel(const MqttTimerWheel &) = delete;
+  MqttTimerWheel &operator=(const MqttTimerWheel &) = delete;
+
+  TimerId start(std::uint64_t delayMs, TimerCb cb, void *obj);
+  bool restart(TimerId timer, std::uint64_t delayMs);
+  bool cancel(TimerId timer);
+  bool isActive(TimerId timer) const;
+  std::size_t advance(std::uint64_t elapsedMs);
+  std::size_t getActiveCount() const;
+  std::uint64_t getTick() const;
+
+private:
+  static constexpr std::size_t SLOT_BITS = 6;
+  static constexpr std::size_t SLOTS = 1 << SLOT_BITS;
+  static constexpr std::size_t LEVELS = MQTT_TIMER_LEVELS;
+  static constexpr std::uint64_t MAX_TICKS = std::uint64_t(1) << (SLOT_BITS * LEVELS);
+  static constexpr int NO_TIMER = -1;
+  static constexpr int NO_SLOT = -1;
+
+  struct Timer
+  {
+    std::uint64_t expiry; // in ticks
+    TimerCb cb;
+    void *obj;
+    int prev;
+    int next;
+    int slot;
+    std::uint32_t generation;
+  };
+
+  int indexOf(TimerId timer) const;
+  std::uint64_t ticksFor(std::uint64_t delayMs) const;
+  void link(int index);
+  void unlink(int index);
+  void release(int index);
+  void cascade(std::size_t level);
+  std::size_t tick();
+
+private:
+  Timer timers_[MAX_MQTT_TIMERS];
+  int slots_[LEVELS * SLOTS];
+  int freeTimers_;
+  std::size_t activeCount_;
+  std::uint64_t now_;
+  std::uint64_t remainderMs_;
+};
+
+#endif /* MQTT_TIMER_WHEEL_H */
@@ -24,8 +24,40 @@
 #ifndef MQTT_TOPIC_H
 #define MQTT_TOPIC_H
 
+#include <cstddef>
+#include <string_view>
 #include "defaults.h"
 
+// What MqttTopic::scan finds in one pass over a topic or filter: where each level
+// starts, where the '+', '#', space and NUL characters are, and whether the text
+// is well formed UTF-8. Validation reads
+// its answers from here, and the same level offsets are used for matching, so the
+// text is not searched again.
+struct MqttTopicScan
+{
+    static constexpr std::size_t MAX_LEVELS = MAX_TOPIC_LENGTH;
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    std::size_t length;
+    std::size_t levelCount; // can be more than MAX_LEVELS, but only that many starts are kept
+    std::size_t longestLevel;
+    std::size_t plusCount;
+    std::size_t hashCount;
+    std::size_t firstPlus; // NONE if there is no '+'
+    std::size_t firstHash; // NONE if there is no '#'
+    bool wildcardsAlone;   // every '+' and '#' is a whole level
+    bool doubleSlash;
+    bool hasSpace;
+    bool hasNul;
+    bool validUtf8;        // only decoded if there is a byte past ASCII
+    unsigned short levelStart[MAX_LEVELS + 1];
+
+    bool levelsFit() const;
+    bool isValidTopicName() const;
+    bool isValidFilter() const;
+    std::string_view getLevel(std::string_view topic, std::size_t level) const;
+};
+
 class MqttTopic
 {
 public:
@@ -38,8 +70,13 @@ public:
     bool hasWildcards() const;
     bool operator==(MqttTopic &other);
 
+    static void scan(std::string_view topic, MqttTopicScan &scan);
+    static bool isValidTopicName(std::string_view topic);
+    static bool splitLevels(std::string_view topic, std::string_view *levels, std::size_t maxLevels, std::size_t &levelCount);
+    static bool splitSharedFilter(std::string_view filter, std::string_view &shareName, std::string_view &topicFilter);
+
 private:
-    unsigned char numberOfOccurences(const char *str, const char chr) const;
+    static bool nextLevel(std::string_view topic, const MqttTopicScan &scan, std::size_t &level, std::string_view &token);
 
 private:
     char topic_[MAX_TOPIC_LENGTH];
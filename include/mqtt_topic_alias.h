@@ -0,0 +1,89 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_TOPIC_ALIAS_H
+#define MQTT_TOPIC_ALIAS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "defaults.h"
+#include "mqtt_memory_pool.h"
+
+static_assert(MQTT_TOPIC_ALIAS_MAXIMUM > 0, "MQTT_TOPIC_ALIAS_MAXIMUM must be at least 1");
+
+// From v5 a connection can send a topic once with a Topic Alias, a number from 1
+// up to what the other end said it would take, and after that send the alias and
+// an empty topic in its place. Each direction has its own aliases, at most
+// MQTT_TOPIC_ALIAS_MAXIMUM of them, and they only last as long as the connection.
+// The topics are held in MqttMemoryPool.
+//
+// Inbound the client chooses the aliases, up to the Topic Alias Maximum the broker
+// sent in its CONNACK, and none until it has sent one. A PUBLISH with a topic and
+// an alias sets the alias, and one with only the alias is for that topic. The
+// topic was checked when the alias was set, so it isn't checked again each time it
+// is used. Each alias keeps a pooled copy of the topic's text rather than its
+// interned levels, as the text is what MqttServer::publish matches.
+class MqttInboundTopicAliases
+{
+public:
+  MqttInboundTopicAliases() = default;
+  void clear();
+  void setMaximum(unsigned short maximum);
+  unsigned short getMaximum() const;
+  bool set(unsigned short topicAlias, std::string_view topic);
+  std::string_view find(unsigned short topicAlias) const;
+
+private:
+  std::vector<char, MqttPoolAllocator<char>> topics_[MQTT_TOPIC_ALIAS_MAXIMUM];
+  unsigned short maximum_ = 0;
+};
+
+// Outbound the broker chooses them, up to the Topic Alias Maximum in the client's
+// CONNECT. A topic that has an alias goes out as the alias alone. A new topic
+// takes a free alias, or the one used least recently, and goes out in full with it
+// that once.
+class MqttOutboundTopicAliases
+{
+public:
+  MqttOutboundTopicAliases();
+  void clear();
+  void setMaximum(unsigned short maximum);
+  unsigned short getMaximum() const;
+  unsigned short assign(std::string_view topic, bool &established);
+  void forget(unsigned short topicAlias);
+
+private:
+  struct Slot
+  {
+    std::vector<char, MqttPoolAllocator<char>> topic; // empty while the alias is free
+    std::uint64_t lastUsed;
+  };
+
+  Slot slots_[MQTT_TOPIC_ALIAS_MAXIMUM];
+  unsigned short maximum_;
+  std::uint64_t clock_;
+};
+
+#endif /* MQTT_TOPIC_ALIAS_H */
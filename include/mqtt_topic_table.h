@@ -0,0 +1,115 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef MQTT_TOPIC_TABLE_H
+#define MQTT_TOPIC_TABLE_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include "defaults.h"
+
+// Every distinct topic level the broker knows about - "house", "kitchen",
+// "temperature" - is stored once here and named by a 32-bit token. The
+// subscription index keys its tree on tokens, so matching a PUBLISH looks each of
+// its levels up once, in one pass through this table, and from then on follows
+// the tree comparing integers rather than hashing and comparing level text at
+// every node it visits. A level no filter has ever used has no token, and can only
+// be matched by a wildcard.
+//
+// Tokens are reference counted and a level's entry is freed when the last filter
+// using it goes. A token carries a generation count as well as the table index, so
+// a token kept past its release never names whatever level takes the entry next.
+//
+// There is one table for the whole process, shared by every shard. Lookups are on
+// the publish path and take no lock: they read under a version count that every
+// change bumps, and look again if it moved. Changes come with subscribe and
+// unsubscribe, and take a spinlock (as in MqttMemoryPool). Storage is fixed by
+// MAX_TOPIC_TOKENS, which allows for the levels of MQTT_MAX_SHARDS indexes.
+class MqttTopicTable
+{
+public:
+  using Token = std::uint32_t;
+
+  static constexpr Token NO_TOKEN = 0;
+
+  static MqttTopicTable &getInstance();
+
+  MqttTopicTable();
+  MqttTopicTable(const MqttTopicTable &) = delete;
+  MqttTopicTable &operator=(const MqttTopicTable &) = delete;
+
+  Token intern(std::string_view level);
+  void release(Token token);
+  Token find(std::string_view level) const;
+  std::size_t resolve(std::string_view topic, Token *tokens, std::size_t maxLevels) const;
+  std::size_t getReferenceCount(Token token);
+  std::size_t getCount() const;
+
+private:
+  static constexpr int NO_ENTRY = -1;
+  // at least 16 bits of index, and whatever is left of the token for the generation
+  static constexpr std::size_t INDEX_BITS = (std::bit_width(std::size_t(MAX_TOPIC_TOKENS)) > 16) ? std::bit_width(std::size_t(MAX_TOPIC_TOKENS)) : 16;
+  static constexpr std::size_t BUCKETS = [] {
+    std::size_t buckets = 1;
+    while (buckets < MAX_TOPIC_TOKENS)
+    {
+      buckets <<= 1;
+    }
+    return buckets;
+  }();
+
+  static_assert(INDEX_BITS <= 24, "token index must leave 8 bits of generation");
+
+  static constexpr std::size_t TEXT_WORDS = (MAX_TOPIC_LENGTH + 3) / 4;
+
+  // everything a lookup reads is atomic, since it reads without the lock
+  struct Entry
+  {
+    std::atomic<std::uint32_t> hash;
+    std::atomic<int> nextInBucket;
+    std::atomic<Token> token;
+    std::atomic<unsigned char> length;
+    std::atomic<std::uint32_t> text[TEXT_WORDS]; // zero past length
+    std::uint32_t references;
+  };
+
+  static std::uint32_t hashOf(std::string_view level);
+  static std::uint32_t textWord(std::string_view level, std::size_t word);
+  int findEntry(std::string_view level, std::uint32_t hash) const;
+  int entryOf(Token token) const;
+  void lock();
+  void unlock();
+
+private:
+  Entry entries_[MAX_TOPIC_TOKENS];
+  std::atomic<int> buckets_[BUCKETS];
+  int freeEntries_;
+  std::atomic<std::size_t> count_;
+  std::atomic<std::uint32_t> version_;
+  std::atomic_flag busy_ = ATOMIC_FLAG_INIT;
+};
+
+#endif /* MQTT_TOPIC_TABLE_H */
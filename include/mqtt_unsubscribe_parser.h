@@ -21,31 +21,30 @@
  * THE SOFTWARE.
  *******************************************************************************/
 
-#include <vector>
-#include <string>
+#include <span>
+#include <string_view>
 #include "mqtt_message_parser.h"
+#include "mqtt_reader.h"
 
 class MqttUnsubscribeParser : public MqttMessageParser
 {
 public:
     MqttUnsubscribeParser();
-    ParseResult parseMessage(const std::vector<unsigned char> &message);
+    ParseResult parseMessage(std::span<const unsigned char> message);
 
 private:
     void parseFixedHeader();
     void parseVariableHeader();
-    int parseRemainingLength();
     void parsePacketIdentifier();
     void parsePayload();
-    std::string parseString();
+    std::string_view parseString();
 
 public:
     int getPacketIdentifier() const;
 
 private:
-    std::vector<unsigned char> unsubscribeMessage_;
-    int currentIndex_;
+    MqttReader reader_;
     unsigned char fixedHeader_;
-    int remainingLength_;
+    unsigned long remainingLength_;
     int packetIdentifier_;
 };
@@ -0,0 +1,105 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifndef __MQTT_UTF8_H__
+#define __MQTT_UTF8_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string.h>
+#include <string_view>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Checks the UTF-8 Encoded Strings of a packet where they lie in the receive
+// buffer, nothing is copied or decoded into another form. The MQTT spec requires
+// well formed UTF-8 with no U+0000 and no surrogate halves (U+D800 to U+DFFF); an
+// overlong encoding or a code point past U+10FFFF is just as malformed.
+//
+// Topics, client ids and property strings are nearly always ASCII, and most are
+// short, so the ASCII check is inline and nothing past it is called unless a byte
+// with its top bit set, or a NUL, turns up.
+class MqttUtf8
+{
+public:
+    static bool isValid(std::string_view text);
+    static std::size_t skipAscii(const unsigned char *bytes, std::size_t i, std::size_t length);
+
+private:
+    static bool isValidFrom(const unsigned char *bytes, std::size_t i, std::size_t length);
+};
+
+inline bool MqttUtf8::isValid(std::string_view text)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(text.data());
+    const std::size_t i = skipAscii(bytes, 0, text.size());
+    return (i == text.size()) || isValidFrom(bytes, i, text.size());
+}
+
+/**
+ * @return the position of the first byte from i on that is not ASCII, or is a
+ * NUL, or length if there is none. 16 bytes at a time with SSE2, then 8 at a
+ * time in a 64 bit word, then the last few one by one.
+ */
+
+inline std::size_t MqttUtf8::skipAscii(const unsigned char *bytes, std::size_t i, std::size_t length)
+{
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+        int special = _mm_movemask_epi8(_mm_or_si128(block, _mm_cmpeq_epi8(block, zero)));
+
+        if (special != 0)
+        {
+            return i + __builtin_ctz(special);
+        }
+    }
+#endif
+
+    constexpr std::uint64_t ones = 0x0101010101010101ULL;
+    constexpr std::uint64_t highBits = 0x8080808080808080ULL;
+
+    for (; i + 8 <= length; i += 8)
+    {
+        std::uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+
+        // a top bit set, or a zero byte, which borrows when one is taken off it
+        if (((word | ((word - ones) & ~word)) & highBits) != 0)
+        {
+            break;
+        }
+    }
+
+    while ((i < length) && (static_cast<unsigned char>(bytes[i] - 1) < 0x7F))
+    {
+        i++;
+    }
+    return i;
+}
+
+#endif /* __MQTT_UTF8_H__ */
@@ -0,0 +1,488 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifdef MQTT_EPOLL_TRANSPORT
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "epoll/tcp_server.h"
+
+/*******************************************************************************
+ * Class Implemenation - private
+ *******************************************************************************/
+
+TcpServer::TcpServer()
+{
+    epollFd_ = -1;
+    wakeupFd_ = -1;
+    listenFd_ = -1;
+    reusePort_ = false;
+    listenPort_ = 0;
+    serverConnectCb_ = nullptr;
+    serverConnectObj_ = nullptr;
+    clientConnectCb_ = nullptr;
+    clientConnectObj_ = nullptr;
+    sessionCount_ = 0;
+}
+
+TcpServer::~TcpServer()
+{
+    cleanup();
+}
+
+/*******************************************************************************
+ * Class Implemenation - public
+ *******************************************************************************/
+
+std::unique_ptr<TcpServer> TcpServer::instance_ = nullptr;
+
+TcpServer &TcpServer::getInstance()
+{
+    if (!instance_)
+    {
+        instance_ = std::make_unique<TcpServer>();
+    }
+    return *instance_;
+}
+
+/**
+ * Close every session and the listening socket
+ */
+
+void TcpServer::cleanup()
+{
+    for (std::size_t fd = 0; fd < sessionsByFd_.size(); fd++)
+    {
+        if (sessionsByFd_[fd] != nullptr)
+        {
+            TcpSession::TcpSessionPtr session = sessionsByFd_[fd];
+            session->disconnectSession();
+        }
+    }
+
+    stopTcpServer();
+
+    if (wakeupFd_ >= 0)
+    {
+        ::close(wakeupFd_);
+        wakeupFd_ = -1;
+    }
+
+    if (epollFd_ >= 0)
+    {
+        ::close(epollFd_);
+        epollFd_ = -1;
+    }
+}
+
+/**
+ * Listen on every local address. A port of 0 picks a free port, which
+ * getListenPort() then reports.
+ */
+
+bool TcpServer::startTcpServer(unsigned short port,
+                               void (*cb)(void *, TcpSession::TcpSessionPtr),
+                               void *ownerObj)
+{
+    if ((listenFd_ >= 0) || !ensureEpoll())
+    {
+        return false;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        MQTT_ERROR("unable to create the listening socket: %s", strerror(errno));
+        return false;
+    }
+
+    int on = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (reusePort_)
+    {
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    socklen_t length = sizeof(address);
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = fd;
+
+    if ((::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) ||
+        (::listen(fd, SOMAXCONN) < 0) ||
+        (::getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) < 0) ||
+        (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0))
+    {
+        MQTT_ERROR("unable to listen on port %u: %s", static_cast<unsigned int>(port), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    listenFd_ = fd;
+    listenPort_ = ntohs(address.sin_port);
+    serverConnectCb_ = cb;
+    serverConnectObj_ = ownerObj;
+    return true;
+}
+
+/**
+ * Start connecting to a server. The connect completes in poll(), which then
+ * calls cb with the new session, or the session's reconnect callback if it failed.
+ */
+
+bool TcpServer::startTcpClient(ip_addr_t ipAddress,
+                               unsigned short port,
+                               void (*cb)(void *, TcpSession::TcpSessionPtr),
+                               void *ownerObj)
+{
+    if (!ensureEpoll())
+    {
+        return false;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        MQTT_ERROR("unable to create the client socket: %s", strerror(errno));
+        return false;
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = static_cast<in_addr_t>(ipAddress.addr); // already in network order
+    address.sin_port = htons(port);
+
+    if ((::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) && (errno != EINPROGRESS))
+    {
+        MQTT_WARNING("unable to connect to port %u: %s", static_cast<unsigned int>(port), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    clientConnectCb_ = cb;
+    clientConnectObj_ = ownerObj;
+
+    TcpSession::TcpSessionPtr session(new TcpSession(this, fd, ipAddress, port, true));
+    return addSession(session);
+}
+
+bool TcpServer::stopTcpServer()
+{
+    if (listenFd_ >= 0)
+    {
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, listenFd_, nullptr);
+        ::close(listenFd_);
+        listenFd_ = -1;
+        listenPort_ = 0;
+    }
+    return true;
+}
+
+bool TcpServer::stopTcpClient(ip_addr_t ipAddress)
+{
+    for (std::size_t fd = 0; fd < sessionsByFd_.size(); fd++)
+    {
+        TcpSession::TcpSessionPtr session = sessionsByFd_[fd];
+
+        if ((session != nullptr) && (session->ipAddress_.addr == ipAddress.addr))
+        {
+            session->disconnectSession();
+        }
+    }
+    return true;
+}
+
+void TcpServer::sessionConnected([[maybe_unused]] void *arg)
+{
+    // connections are accepted by poll(), nothing to do here
+}
+
+void TcpServer::sessionDisconnected(TcpSession::SessionId sessionId)
+{
+    TcpSession::TcpSessionPtr session = getSession(sessionId);
+
+    if (session != nullptr)
+    {
+        session->disconnectSession();
+    }
+}
+
+std::size_t TcpServer::getSessionCount()
+{
+    return sessionCount_;
+}
+
+/**
+ * Look a session up by its identifier. This walks the session table, so it is
+ * for management rather than the data path.
+ */
+
+TcpSession::TcpSessionPtr TcpServer::getSession(TcpSession::SessionId sessionId)
+{
+    for (const TcpSession::TcpSessionPtr &session : sessionsByFd_)
+    {
+        if ((session != nullptr) && (session->getSessionId() == sessionId))
+        {
+            return session;
+        }
+    }
+    return nullptr;
+}
+
+void TcpServer::sessionDead(TcpSession::TcpSessionPtr session)
+{
+    if (session != nullptr)
+    {
+        session->disconnectSession();
+    }
+}
+
+/**
+ * Wait up to timeoutMs (-1 for ever, 0 not at all) for socket events and handle
+ * them, calling the session callbacks as data arrives or drains.
+ *
+ * @return the number of events handled, or -1 if the wait failed
+ */
+
+int TcpServer::poll(int timeoutMs)
+{
+    if (!ensureEpoll())
+    {
+        return -1;
+    }
+
+    epoll_event events[MQTT_EPOLL_MAX_EVENTS];
+    int count = ::epoll_wait(epollFd_, events, MQTT_EPOLL_MAX_EVENTS, timeoutMs);
+
+    if (count < 0)
+    {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        handleEvent(events[i].data.fd, events[i].events);
+    }
+    return count;
+}
+
+/**
+ * Make poll() return now. Safe to call from any thread.
+ */
+
+void TcpServer::wakeup()
+{
+    if (wakeupFd_ >= 0)
+    {
+        eventfd_write(wakeupFd_, 1);
+    }
+}
+
+/**
+ * Share the listening port with other TcpServers that ask for the same, must be
+ * called before startTcpServer()
+ */
+
+void TcpServer::setReusePort(bool reusePort)
+{
+    reusePort_ = reusePort;
+}
+
+unsigned short TcpServer::getListenPort() const
+{
+    return listenPort_;
+}
+
+/*******************************************************************************
+ * Class Implemenation - private
+ *******************************************************************************/
+
+bool TcpServer::ensureEpoll()
+{
+    if (epollFd_ < 0)
+    {
+        epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd_ < 0)
+        {
+            MQTT_ERROR("unable to create the epoll set: %s", strerror(errno));
+            return false;
+        }
+
+        wakeupFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLET;
+        event.data.fd = wakeupFd_;
+
+        if ((wakeupFd_ < 0) || (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeupFd_, &event) < 0))
+        {
+            MQTT_ERROR("unable to create the wakeup event: %s", strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TcpServer::addSession(const TcpSession::TcpSessionPtr &session)
+{
+    int fd = session->fd_;
+
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+
+    if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        MQTT_ERROR("unable to watch socket: %s", strerror(errno));
+        return false; // the session closes the socket as it goes
+    }
+
+    if (static_cast<std::size_t>(fd) >= sessionsByFd_.size())
+    {
+        sessionsByFd_.resize(fd + 1);
+    }
+    sessionsByFd_[fd] = session;
+    sessionCount_++;
+    return true;
+}
+
+void TcpServer::removeSession(int fd)
+{
+    ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+
+    if ((static_cast<std::size_t>(fd) < sessionsByFd_.size()) && (sessionsByFd_[fd] != nullptr))
+    {
+        sessionsByFd_[fd] = nullptr;
+        sessionCount_--;
+    }
+}
+
+void TcpServer::acceptConnections()
+{
+    // edge triggered, so take every connection that is waiting
+
+    while (listenFd_ >= 0)
+    {
+        sockaddr_in address = {};
+        socklen_t length = sizeof(address);
+        int fd = ::accept4(listenFd_, reinterpret_cast<sockaddr *>(&address), &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (fd < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) && (errno != ECONNABORTED))
+            {
+                MQTT_WARNING("accept failed: %s", strerror(errno));
+            }
+            if ((errno == EINTR) || (errno == ECONNABORTED))
+            {
+                continue;
+            }
+            return;
+        }
+
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // MQTT packets are small and latency matters
+
+        ip_addr_t ipAddress;
+        ipAddress.addr = address.sin_addr.s_addr;
+
+        TcpSession::TcpSessionPtr session(new TcpSession(this, fd, ipAddress, ntohs(address.sin_port), false));
+        if (addSession(session) && (serverConnectCb_ != nullptr))
+        {
+            serverConnectCb_(serverConnectObj_, session);
+        }
+    }
+}
+
+void TcpServer::handleEvent(int fd, std::uint32_t events)
+{
+    if (fd == listenFd_)
+    {
+        acceptConnections();
+        return;
+    }
+
+    if (fd == wakeupFd_)
+    {
+        eventfd_t value;
+        eventfd_read(wakeupFd_, &value);
+        return;
+    }
+
+    if ((fd < 0) || (static_cast<std::size_t>(fd) >= sessionsByFd_.size()) || (sessionsByFd_[fd] == nullptr))
+    {
+        return; // closed by an earlier event in the same batch
+    }
+
+    TcpSession::TcpSessionPtr session = sessionsByFd_[fd];
+
+    if (session->connecting_ && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+    {
+        int err = 0;
+        socklen_t length = sizeof(err);
+        ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &length);
+
+        if (err != 0)
+        {
+            MQTT_WARNING("connect failed: %s", strerror(err));
+            session->handleConnectFailed(static_cast<signed char>(-err));
+            return;
+        }
+
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        session->connecting_ = false;
+        if (clientConnectCb_ != nullptr)
+        {
+            clientConnectCb_(clientConnectObj_, session);
+        }
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+    {
+        // read first, the peer may have sent data before closing
+        session->handleReadable(readBuffer_, sizeof(readBuffer_));
+    }
+
+    if (events & EPOLLOUT)
+    {
+        session->handleWritable();
+    }
+}
+
+#endif /* MQTT_EPOLL_TRANSPORT */
@@ -0,0 +1,345 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifdef MQTT_EPOLL_TRANSPORT
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "epoll/tcp_server.h"
+#include "epoll/tcp_session.h"
+
+/*******************************************************************************
+ * Class Implemenation - public
+ *******************************************************************************/
+
+TcpSession::~TcpSession()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+}
+
+TcpSession::SessionId TcpSession::getSessionId()
+{
+    return sessionId_;
+}
+
+bool TcpSession::isSessionValid()
+{
+    return (fd_ >= 0) && !connecting_;
+}
+
+/**
+ * Close the connection. The disconnected callback is called before this returns
+ * and the session is invalid from then on, although the object lives on for as
+ * long as anyone holds a pointer to it.
+ */
+
+void TcpSession::disconnectSession()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+
+    TcpSessionPtr self = shared_from_this();
+    int fd = fd_;
+    fd_ = -1;
+    pending_.clear();
+    pendingOffset_ = 0;
+    server_->removeSession(fd);
+
+    if (disconnectedCb_ != nullptr)
+    {
+        disconnectedCb_(disconnectedObj_, self);
+    }
+}
+
+TcpSession::sendResult TcpSession::sendMessage(unsigned char *pData, unsigned short len)
+{
+    std::span<const unsigned char> segment(pData, len);
+    return sendMessageVector(std::span<const std::span<const unsigned char>>(&segment, 1));
+}
+
+/**
+ * Send the segments as one stream of bytes, MQTT_SEND_MAX_SEGMENTS of them per
+ * sendmsg(). Whatever the kernel doesn't take is copied and held back, so the
+ * segments only need to live until this returns.
+ */
+
+TcpSession::sendResult TcpSession::sendMessageVector(std::span<const std::span<const unsigned char>> segments)
+{
+    if (fd_ < 0)
+    {
+        return FAILED_ABORTED;
+    }
+
+    if (connecting_ || (pendingOffset_ < pending_.size()))
+    {
+        return RETRY;
+    }
+
+    std::size_t segment = 0; // the first segment not yet written in full
+    std::size_t offset = 0;  // and how much of it has been
+
+    while (segment < segments.size())
+    {
+        struct iovec iov[MQTT_SEND_MAX_SEGMENTS];
+        std::size_t iovCount = 0;
+        std::size_t iovBytes = 0;
+
+        for (std::size_t i = segment; (i < segments.size()) && (iovCount < MQTT_SEND_MAX_SEGMENTS); i++)
+        {
+            std::size_t skip = (i == segment) ? offset : 0;
+            if (segments[i].size() > skip)
+            {
+                iov[iovCount].iov_base = const_cast<unsigned char *>(segments[i].data() + skip);
+                iov[iovCount].iov_len = segments[i].size() - skip;
+                iovBytes += iov[iovCount].iov_len;
+                iovCount++;
+            }
+        }
+
+        if (iovCount == 0)
+        {
+            break; // only empty segments left
+        }
+
+        struct msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iovCount;
+        ssize_t written = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                MQTT_WARNING("send on session %zu failed: %s", sessionId_, strerror(errno));
+                return FAILED_ABORTED;
+            }
+            written = 0;
+        }
+
+        for (std::size_t remaining = static_cast<std::size_t>(written); segment < segments.size();)
+        {
+            std::size_t left = segments[segment].size() - offset;
+            if (remaining < left)
+            {
+                offset += remaining;
+                break;
+            }
+            remaining -= left;
+            segment++;
+            offset = 0;
+        }
+
+        if (static_cast<std::size_t>(written) < iovBytes)
+        {
+            break; // the socket buffer is full
+        }
+    }
+
+    if (segment < segments.size())
+    {
+        // hold on to what the kernel didn't take, handleWritable sends it
+        pending_.clear();
+        pendingOffset_ = 0;
+        for (std::size_t i = segment; i < segments.size(); i++)
+        {
+            std::size_t skip = (i == segment) ? offset : 0;
+            pending_.insert(pending_.end(), segments[i].begin() + skip, segments[i].end());
+        }
+    }
+
+    return SEND_OK;
+}
+
+// Register the callback listener and the callbacks
+
+bool TcpSession::registerSessionDisconnectedCb(void (*cb)(void *, TcpSessionPtr session), void *obj)
+{
+    disconnectedCb_ = cb;
+    disconnectedObj_ = obj;
+    return true;
+}
+
+bool TcpSession::registerSessionReconnectCb(void (*cb)(void *, signed char err, TcpSessionPtr session), void *obj)
+{
+    reconnectCb_ = cb;
+    reconnectObj_ = obj;
+    return true;
+}
+
+bool TcpSession::registerIncomingMessageCb(void (*cb)(void *, char *pdata, unsigned short len, TcpSessionPtr session), void *obj)
+{
+    incomingMessageCb_ = cb;
+    incomingMessageObj_ = obj;
+    return true;
+}
+
+bool TcpSession::registerMessageSentCb(void (*cb)(void *, TcpSessionPtr session), void *obj)
+{
+    messageSentCb_ = cb;
+    messageSentObj_ = obj;
+    return true;
+}
+
+ip_addr_t TcpSession::convertIpAddress(unsigned char *ipAddress)
+{
+    ip_addr_t address;
+    IP4_ADDR(&address, ipAddress[0], ipAddress[1], ipAddress[2], ipAddress[3]);
+    return address;
+}
+
+TcpSession::SessionId TcpSession::createUniqueIdentifier(const ip_addr_t &ipAddress, int port)
+{
+    return (static_cast<SessionId>(ipAddress.addr & 0xFFFFFFFF) << 16) | static_cast<SessionId>(port & 0xFFFF);
+}
+
+/*******************************************************************************
+ * Class Implemenation - private
+ *******************************************************************************/
+
+TcpSession::TcpSession(TcpServer *server, int fd, const ip_addr_t &ipAddress, unsigned short port, bool connecting)
+{
+    server_ = server;
+    fd_ = fd;
+    ipAddress_ = ipAddress;
+    sessionId_ = createUniqueIdentifier(ipAddress, port);
+    connecting_ = connecting;
+    pendingOffset_ = 0;
+    disconnectedCb_ = nullptr;
+    disconnectedObj_ = nullptr;
+    reconnectCb_ = nullptr;
+    reconnectObj_ = nullptr;
+    incomingMessageCb_ = nullptr;
+    incomingMessageObj_ = nullptr;
+    messageSentCb_ = nullptr;
+    messageSentObj_ = nullptr;
+}
+
+void TcpSession::handleReadable(unsigned char *buffer, std::size_t size)
+{
+    // edge triggered, so keep reading until the socket is empty
+
+    while (fd_ >= 0)
+    {
+        ssize_t count = ::recv(fd_, buffer, size, 0);
+
+        if (count > 0)
+        {
+            if (incomingMessageCb_ != nullptr)
+            {
+                incomingMessageCb_(incomingMessageObj_, reinterpret_cast<char *>(buffer), static_cast<unsigned short>(count), shared_from_this());
+            }
+            continue;
+        }
+
+        if (count < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+        }
+
+        disconnectSession(); // closed by the peer or failed
+        return;
+    }
+}
+
+void TcpSession::handleWritable()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+
+    if (pending_.empty())
+    {
+        return;
+    }
+
+    if (flushPending() && (messageSentCb_ != nullptr))
+    {
+        messageSentCb_(messageSentObj_, shared_from_this());
+    }
+}
+
+void TcpSession::handleConnectFailed(signed char err)
+{
+    TcpSessionPtr self = shared_from_this();
+
+    if (reconnectCb_ != nullptr)
+    {
+        reconnectCb_(reconnectObj_, err, self);
+    }
+    disconnectSession();
+}
+
+/**
+ * @return true once everything held back has been written
+ */
+
+bool TcpSession::flushPending()
+{
+    while (pendingOffset_ < pending_.size())
+    {
+        ssize_t written = ::send(fd_, pending_.data() + pendingOffset_, pending_.size() - pendingOffset_, MSG_NOSIGNAL);
+
+        if (written < 0)
+        {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                return false;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            disconnectSession();
+            return false;
+        }
+        pendingOffset_ += written;
+    }
+
+    // give the buffer back rather than keep it for an idle connection
+    std::vector<unsigned char, MqttPoolAllocator<unsigned char>>().swap(pending_);
+    pendingOffset_ = 0;
+    return true;
+}
+
+#endif /* MQTT_EPOLL_TRANSPORT */
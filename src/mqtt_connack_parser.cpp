@@ -58,10 +58,9 @@
 
 MqttConnackParser::MqttConnackParser() {}
 
-MqttMessageParser::ParseResult MqttConnackParser::parseMessage(const std::vector<unsigned char> &connackMessage)
+MqttMessageParser::ParseResult MqttConnackParser::parseMessage(std::span<const unsigned char> connackMessage)
 {
-    connackMessage_ = connackMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(connackMessage);
     connackReturnCode_ = MqttConnackReturnCode::InvalidReturnCode;
 
     if (parseFixedHeader() == false)
@@ -71,7 +70,7 @@ MqttMessageParser::ParseResult MqttConnackParser::parseMessage(const std::vector
     }
 
     // Check if there is enough data to match the remaining length
-    if ((remainingLength_) != connackMessage_.size() - currentIndex_)
+    if (!reader_.isValid() || (remainingLength_ != reader_.getRemaining()))
     {
         MQTT_WARNING("Not enough data in the message to match remaining length");
         return ParseResult::InvalidRemainingLength;
@@ -85,10 +84,15 @@ MqttConnackParser::MqttConnackReturnCode MqttConnackParser::getConnackReturnCode
     return connackReturnCode_;
 }
 
+const MqttPropertyBag &MqttConnackParser::getProperties() const
+{
+    return properties_;
+}
+
 bool MqttConnackParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = connackMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 
     if (fixedHeader_ != 0x20)
     {
@@ -96,13 +100,20 @@ bool MqttConnackParser::parseFixedHeader()
         return false;
     }
 
-    remainingLength_ = parseRemainingLength();
+    remainingLength_ = reader_.readVariableByteInteger();
     return true;
 }
 
 MqttMessageParser::ParseResult MqttConnackParser::parseVariableHeader()
 {
-    // The next bytes are part of the variable header
+    // The next bytes are part of the variable header, the acknowledge flags and
+    // return code first
+    if (!reader_.ensure(2))
+    {
+        MQTT_WARNING("CONNACK too short for its variable header");
+        return ParseResult::InvalidMessageStructure;
+    }
+
     if (!parseConnectAcknowledgeFlags())
     {
         MQTT_WARNING("Failed to parse connect acknowledge flags");
@@ -124,25 +135,9 @@ MqttMessageParser::ParseResult MqttConnackParser::parseVariableHeader()
     return ParseResult::Success;
 }
 
-int MqttConnackParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = connackMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 bool MqttConnackParser::parseConnectAcknowledgeFlags()
 {
-    acknowledgeFlags_ = connackMessage_[currentIndex_++];
+    acknowledgeFlags_ = reader_.takeByte();
 
     if ((acknowledgeFlags_ & 0xFE) != 0x00)
     {
@@ -156,7 +151,7 @@ bool MqttConnackParser::parseConnectAcknowledgeFlags()
 
 bool MqttConnackParser::parseConnackReturnCode()
 {
-    connackReturnCode_ = static_cast<MqttConnackReturnCode>(connackMessage_[currentIndex_++]);
+    connackReturnCode_ = static_cast<MqttConnackReturnCode>(reader_.takeByte());
 
     switch (connackReturnCode_)
     {
@@ -185,7 +180,7 @@ bool MqttConnackParser::parseConnackReturnCode()
         return true;
 
     default:
-        MQTT_WARNING("Invalid connack return code: 0x%x", connackReturnCode_);
+        MQTT_WARNING("Invalid connack return code: 0x%x", static_cast<unsigned int>(connackReturnCode_));
         connackReturnCode_ = MqttConnackReturnCode::InvalidReturnCode;
         return false;
     }
@@ -193,6 +188,6 @@ bool MqttConnackParser::parseConnackReturnCode()
 
 bool MqttConnackParser::parseProperties()
 {
-    size_t index = currentIndex_;
-    return MqttMessageParser::parseProperties(connackMessage_, index);
+    size_t index = reader_.getPosition();
+    return MqttMessageParser::parseProperties(reader_.getBytes(), index, MqttPacketType::Connack, properties_);
 }
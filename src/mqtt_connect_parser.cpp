@@ -39,38 +39,46 @@
 //     return 0;
 // }
 
-#include <string>
+#include <string_view>
 #include "mqtt_connect_parser.h"
 
 MqttConnectParser::MqttConnectParser() {}
 
 // Parse the CONNECT message
-MqttMessageParser::ParseResult MqttConnectParser::parseMessage(const std::vector<unsigned char> &connectMessage)
+MqttMessageParser::ParseResult MqttConnectParser::parseMessage(std::span<const unsigned char> connectMessage)
 {
-    connectMessage_ = connectMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(connectMessage);
     parseFixedHeader();
     parseVariableHeader();
     parsePayload();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttConnectParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = connectMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttConnectParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parseProtocolName();
-    parseProtocolLevel();
-    parseConnectFlags();
-    parseKeepAlive();
+
+    // then the protocol level, connect flags and keep alive, read as one group
+    if (reader_.ensure(4))
+    {
+        parseProtocolLevel();
+        parseConnectFlags();
+        parseKeepAlive();
+    }
 }
 
 void MqttConnectParser::parsePayload()
@@ -80,32 +88,12 @@ void MqttConnectParser::parsePayload()
     // Note: This is a simplified example, and you might need to handle various cases
 }
 
-int MqttConnectParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = connectMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttConnectParser::parseProtocolName()
 {
-    // Assuming a fixed-length protocol name of "MQTT"
-    const std::string expectedProtocolName = "MQTT";
-    std::string receivedProtocolName(connectMessage_.begin() + currentIndex_,
-                                     connectMessage_.begin() + currentIndex_ + expectedProtocolName.length());
-
-    currentIndex_ += expectedProtocolName.length();
+    // "MQTT", or "MQIsdp" from a v3.1 client
+    std::string_view receivedProtocolName = reader_.readString();
 
-    if (receivedProtocolName != expectedProtocolName)
+    if (reader_.isValid() && (receivedProtocolName != "MQTT") && (receivedProtocolName != "MQIsdp"))
     {
         MQTT_ERROR("Error: Unexpected protocol name");
     }
@@ -113,16 +101,15 @@ void MqttConnectParser::parseProtocolName()
 
 void MqttConnectParser::parseProtocolLevel()
 {
-    protocolLevel_ = connectMessage_[currentIndex_++];
+    protocolLevel_ = reader_.takeByte();
 }
 
 void MqttConnectParser::parseConnectFlags()
 {
-    connectFlags_ = connectMessage_[currentIndex_++];
+    connectFlags_ = reader_.takeByte();
 }
 
 void MqttConnectParser::parseKeepAlive()
 {
-    // Assuming a fixed-length 2-byte keep-alive field
-    keepAlive_ = (connectMessage_[currentIndex_++] << 8) + connectMessage_[currentIndex_++];
+    keepAlive_ = reader_.takeTwoByteInteger();
 }
@@ -37,16 +37,21 @@
 
 MqttDisconnectParser::MqttDisconnectParser() {}
 
-MqttMessageParser::ParseResult MqttDisconnectParser::parseMessage(const std::vector<unsigned char> &disconnectMessage)
+MqttMessageParser::ParseResult MqttDisconnectParser::parseMessage(std::span<const unsigned char> disconnectMessage)
 {
-    disconnectMessage_ = disconnectMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(disconnectMessage);
     parseFixedHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttDisconnectParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = disconnectMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
+
+    // The remaining length, which must account for the rest of the packet
+    if (reader_.readVariableByteInteger() != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 }
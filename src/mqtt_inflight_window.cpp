@@ -0,0 +1,352 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include <bit>
+#include "mqtt_inflight_window.h"
+#include "mqtt_message_encoder.h"
+
+MqttInflightWindow::MqttInflightWindow()
+{
+    receiveMaximum_ = MQTT_MAX_INFLIGHT;
+    protocolLevel_ = 4;
+    clear();
+}
+
+/**
+ * Forget every entry, as when a clean session starts
+ */
+
+void MqttInflightWindow::clear()
+{
+    for (Entry &entry : entries_)
+    {
+        entry.delivery.reset();
+        entry.sentAt = 0;
+        entry.state = State::Free;
+        entry.resend = false;
+        entry.pubrelLength = 0;
+    }
+    for (std::uint64_t &word : used_)
+    {
+        word = 0;
+    }
+    count_ = 0;
+    next_ = 0;
+}
+
+/**
+ * Limit the window to the Receive Maximum the client sent in its CONNECT. Entries
+ * already inflight above the new limit are left to complete.
+ */
+
+void MqttInflightWindow::setReceiveMaximum(unsigned short receiveMaximum)
+{
+    receiveMaximum_ = ((receiveMaximum == 0) || (receiveMaximum > MQTT_MAX_INFLIGHT)) ? MQTT_MAX_INFLIGHT : receiveMaximum;
+}
+
+/**
+ * The protocol level of the connection, which decides the form of the PUBREL frames
+ */
+
+void MqttInflightWindow::setProtocolLevel(unsigned char protocolLevel)
+{
+    protocolLevel_ = protocolLevel;
+}
+
+unsigned short MqttInflightWindow::getReceiveMaximum() const
+{
+    return receiveMaximum_;
+}
+
+std::size_t MqttInflightWindow::getCount() const
+{
+    return count_;
+}
+
+bool MqttInflightWindow::isFull() const
+{
+    return count_ >= receiveMaximum_;
+}
+
+MqttInflightWindow::State MqttInflightWindow::getState(unsigned short packetIdentifier) const
+{
+    if ((packetIdentifier == 0) || (packetIdentifier > MQTT_MAX_INFLIGHT))
+    {
+        return State::Free;
+    }
+    return entries_[packetIdentifier - 1].state;
+}
+
+/**
+ * Take a slot for a QoS 1 or 2 PUBLISH that is being sent now. The window keeps
+ * its own copy of the delivery, which shares the topic and payload.
+ *
+ * @return the packet identifier for the PUBLISH, or 0 if the window is full
+ */
+
+unsigned short MqttInflightWindow::add(const MqttPublishDelivery &delivery, std::uint64_t now)
+{
+    if (!delivery.isValid() || (delivery.getQoS() == 0) || isFull())
+    {
+        return 0;
+    }
+
+    int slot = allocate();
+    if (slot < 0)
+    {
+        return 0;
+    }
+
+    unsigned short packetIdentifier = static_cast<unsigned short>(slot + 1);
+    Entry &entry = entries_[slot];
+    entry.delivery = delivery;
+    entry.delivery.setPacketIdentifier(packetIdentifier);
+    entry.sentAt = now;
+    entry.state = (delivery.getQoS() == 1) ? State::AwaitPuback : State::AwaitPubrec;
+    entry.resend = false;
+    entry.pubrelLength = 0;
+    return packetIdentifier;
+}
+
+/**
+ * Give the slot back whatever state it is in
+ */
+
+void MqttInflightWindow::remove(unsigned short packetIdentifier)
+{
+    if ((packetIdentifier == 0) || (packetIdentifier > MQTT_MAX_INFLIGHT) ||
+        (entries_[packetIdentifier - 1].state == State::Free))
+    {
+        return;
+    }
+
+    std::size_t slot = packetIdentifier - 1;
+    entries_[slot].delivery.reset();
+    entries_[slot].state = State::Free;
+    entries_[slot].resend = false;
+    used_[slot / WORD_BITS] &= ~(std::uint64_t(1) << (slot % WORD_BITS));
+    count_--;
+}
+
+/**
+ * Give back a slot taken by add() for a frame that was never sent, so the next
+ * add() hands out the same identifier. Unwind the latest add() first.
+ */
+
+void MqttInflightWindow::unwind(unsigned short packetIdentifier)
+{
+    if (getState(packetIdentifier) != State::Free)
+    {
+        remove(packetIdentifier);
+        next_ = packetIdentifier - 1;
+    }
+}
+
+/**
+ * PUBACK, the end of a QoS 1 flow
+ *
+ * @return false if no QoS 1 PUBLISH is waiting for it
+ */
+
+bool MqttInflightWindow::acknowledge(unsigned short packetIdentifier)
+{
+    if (find(packetIdentifier, State::AwaitPuback) == nullptr)
+    {
+        return false;
+    }
+    remove(packetIdentifier);
+    return true;
+}
+
+/**
+ * PUBREC, the client has the QoS 2 PUBLISH. The payload can go now, all that is
+ * left is to send PUBREL and wait for PUBCOMP.
+ *
+ * @return false if no QoS 2 PUBLISH is waiting for it
+ */
+
+bool MqttInflightWindow::received(unsigned short packetIdentifier)
+{
+    Entry *entry = find(packetIdentifier, State::AwaitPubrec);
+    if (entry == nullptr)
+    {
+        // a PUBREC sent again after our PUBREL is answered with PUBREL again
+        entry = find(packetIdentifier, State::AwaitPubcomp);
+        if (entry == nullptr)
+        {
+            return false;
+        }
+        entry->resend = true;
+        return true;
+    }
+
+    entry->delivery.reset();
+    entry->pubrelLength = static_cast<unsigned char>(MqttMessageEncoder::encodePubrel(entry->pubrel, packetIdentifier, protocolLevel_));
+    entry->state = State::AwaitPubcomp;
+    entry->resend = true;
+    return true;
+}
+
+/**
+ * PUBCOMP, the end of a QoS 2 flow
+ *
+ * @return false if no PUBREL is waiting for it
+ */
+
+bool MqttInflightWindow::complete(unsigned short packetIdentifier)
+{
+    if (find(packetIdentifier, State::AwaitPubcomp) == nullptr)
+    {
+        return false;
+    }
+    remove(packetIdentifier);
+    return true;
+}
+
+/**
+ * Flag for sending again every entry last sent at or before sentBefore. Pass the
+ * largest value to resend everything, as on a reconnect.
+ *
+ * @return the number of entries flagged
+ */
+
+std::size_t MqttInflightWindow::markForResend(std::uint64_t sentBefore)
+{
+    std::size_t marked = 0;
+
+    for (Entry &entry : entries_)
+    {
+        if ((entry.state != State::Free) && !entry.resend && (entry.sentAt <= sentBefore))
+        {
+            entry.delivery.setDuplicate();
+            entry.resend = true;
+            marked++;
+        }
+    }
+    return marked;
+}
+
+/**
+ * @return how many of the entries waiting to be sent again were put in
+ *         packetIdentifiers, lowest slot first
+ */
+
+std::size_t MqttInflightWindow::getPendingResends(std::span<unsigned short> packetIdentifiers) const
+{
+    std::size_t count = 0;
+
+    for (std::size_t slot = 0; (slot < MQTT_MAX_INFLIGHT) && (count < packetIdentifiers.size()); slot++)
+    {
+        if ((entries_[slot].state != State::Free) && entries_[slot].resend)
+        {
+            packetIdentifiers[count++] = static_cast<unsigned short>(slot + 1);
+        }
+    }
+    return count;
+}
+
+/**
+ * The frame to send for the entry: the PUBLISH, or once PUBREC is in, the PUBREL
+ *
+ * @return the number of segments, 0 if the entry is free
+ */
+
+std::size_t MqttInflightWindow::getSegments(unsigned short packetIdentifier,
+                                            std::span<const unsigned char> (&segments)[MqttPublishDelivery::MAX_SEGMENTS]) const
+{
+    if (getState(packetIdentifier) == State::Free)
+    {
+        return 0;
+    }
+
+    const Entry &entry = entries_[packetIdentifier - 1];
+    if (entry.state == State::AwaitPubcomp)
+    {
+        segments[0] = std::span<const unsigned char>(entry.pubrel, entry.pubrelLength);
+        return 1;
+    }
+    return entry.delivery.getSegments(segments);
+}
+
+void MqttInflightWindow::markSent(unsigned short packetIdentifier, std::uint64_t now)
+{
+    if (getState(packetIdentifier) != State::Free)
+    {
+        entries_[packetIdentifier - 1].sentAt = now;
+        entries_[packetIdentifier - 1].resend = false;
+    }
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+MqttInflightWindow::Entry *MqttInflightWindow::find(unsigned short packetIdentifier, State state)
+{
+    if ((packetIdentifier == 0) || (packetIdentifier > MQTT_MAX_INFLIGHT) ||
+        (entries_[packetIdentifier - 1].state != state))
+    {
+        return nullptr;
+    }
+    return &entries_[packetIdentifier - 1];
+}
+
+/**
+ * Find the first free slot at or after next_, wrapping round once, so identifiers
+ * are not reused straight away
+ *
+ * @return the slot, or -1 if there is none below the Receive Maximum
+ */
+
+int MqttInflightWindow::allocate()
+{
+    for (std::size_t pass = 0; pass < 2; pass++)
+    {
+        std::size_t start = (pass == 0) ? next_ : 0;
+
+        for (std::size_t word = start / WORD_BITS; word < WORDS; word++)
+        {
+            std::uint64_t freeBits = ~used_[word];
+            if (word == start / WORD_BITS)
+            {
+                freeBits &= ~std::uint64_t(0) << (start % WORD_BITS);
+            }
+            if (freeBits == 0)
+            {
+                continue;
+            }
+
+            std::size_t slot = (word * WORD_BITS) + std::countr_zero(freeBits);
+            if (slot >= receiveMaximum_)
+            {
+                break;
+            }
+
+            used_[word] |= std::uint64_t(1) << (slot % WORD_BITS);
+            next_ = (slot + 1 < receiveMaximum_) ? slot + 1 : 0;
+            count_++;
+            return static_cast<int>(slot);
+        }
+    }
+    return -1;
+}
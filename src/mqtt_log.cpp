@@ -0,0 +1,189 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include "mqtt_log.h"
+
+MqttLog::Slot MqttLog::ring_[MQTT_LOG_RING_SIZE];
+std::atomic<std::size_t> MqttLog::writePosition_{0};
+std::atomic<std::size_t> MqttLog::readPosition_{0};
+std::atomic<unsigned long> MqttLog::dropped_{0};
+
+// Each slot's sequence says whose turn it is. For the write position p that maps onto
+// a slot, the sequence is lap(p) while the slot is free, lap(p) + 1 once the record
+// is complete, and moves on to the next lap when the reader releases it. lap(p) is p
+// with the slot index masked off, so a zero initialised ring starts with every slot
+// free for the first lap.
+
+static inline std::size_t lap(std::size_t position)
+{
+    return position & ~static_cast<std::size_t>(MQTT_LOG_RING_SIZE - 1);
+}
+
+/**
+ * Token bucket of MQTT_LOG_RATE_LIMIT lines per one second window.
+ * @param suppressed set to the number of lines refused since the last one allowed
+ */
+
+bool MqttLog::RateLimiter::allow(unsigned long nowMs, unsigned int &suppressed)
+{
+    unsigned long windowStart = windowStartMs_.load(std::memory_order_relaxed);
+
+    if (nowMs - windowStart >= 1000)
+    {
+        // a racing caller may also reset the window, which only lets one extra line through
+        windowStartMs_.store(nowMs, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+    }
+
+    if (count_.fetch_add(1, std::memory_order_relaxed) >= MQTT_LOG_RATE_LIMIT)
+    {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * Formats a line into the ring. Called through the MQTT_ERROR, MQTT_WARNING and
+ * MQTT_INFO macros rather than directly.
+ */
+
+void MqttLog::write(Level level, const char *file, unsigned int line, RateLimiter &limiter, const char *format, ...)
+{
+    unsigned long timestampMs = nowMs();
+    unsigned int suppressed = 0;
+
+    if (!limiter.allow(timestampMs, suppressed))
+    {
+        return;
+    }
+
+    std::size_t position = writePosition_.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    for (;;)
+    {
+        slot = &ring_[position & (MQTT_LOG_RING_SIZE - 1)];
+        std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(lap(position));
+
+        if (difference == 0)
+        {
+            if (writePosition_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed); // ring full, don't wait for the reader
+            return;
+        }
+        else
+        {
+            position = writePosition_.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->record.level = level;
+    slot->record.file = file;
+    slot->record.line = line;
+    slot->record.timestampMs = timestampMs;
+    slot->record.suppressed = suppressed;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(slot->record.text, sizeof(slot->record.text), format, args);
+    va_end(args);
+
+    slot->sequence.store(lap(position) + 1, std::memory_order_release);
+}
+
+/**
+ * Passes up to maxRecords completed records to cb, oldest first, and frees their
+ * slots. Only one thread should drain at a time.
+ * @return the number of records drained
+ */
+
+std::size_t MqttLog::drain(SinkCb cb, void *obj, std::size_t maxRecords)
+{
+    std::size_t drained = 0;
+
+    while (drained < maxRecords)
+    {
+        std::size_t position = readPosition_.load(std::memory_order_relaxed);
+        Slot *slot = &ring_[position & (MQTT_LOG_RING_SIZE - 1)];
+
+        if (slot->sequence.load(std::memory_order_acquire) != lap(position) + 1)
+        {
+            break; // empty, or the next record is still being written
+        }
+
+        cb(obj, slot->record);
+        readPosition_.store(position + 1, std::memory_order_relaxed);
+        slot->sequence.store(lap(position) + MQTT_LOG_RING_SIZE, std::memory_order_release);
+        drained++;
+    }
+    return drained;
+}
+
+/**
+ * @return the number of lines lost because the ring was full
+ */
+
+unsigned long MqttLog::getDroppedCount()
+{
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+/**
+ * A sink that prints each record on stdout, for use with drain()
+ */
+
+void MqttLog::printSink([[maybe_unused]] void *obj, const Record &record)
+{
+    static const char levels[] = {'?', 'E', 'W', 'I'};
+
+    if (record.suppressed != 0)
+    {
+        printf("%lu %c %s:%u %s (%u similar suppressed)\n", record.timestampMs, levels[static_cast<int>(record.level)],
+               record.file, record.line, record.text, record.suppressed);
+    }
+    else
+    {
+        printf("%lu %c %s:%u %s\n", record.timestampMs, levels[static_cast<int>(record.level)],
+               record.file, record.line, record.text);
+    }
+}
+
+unsigned long MqttLog::nowMs()
+{
+    return static_cast<unsigned long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                          std::chrono::steady_clock::now().time_since_epoch())
+                                          .count());
+}
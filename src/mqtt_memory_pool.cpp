@@ -0,0 +1,152 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_memory_pool.h"
+
+MqttMemoryPool &MqttMemoryPool::getInstance()
+{
+    static MqttMemoryPool instance;
+    return instance;
+}
+
+/**
+ * Take a block from the smallest size class that fits
+ *
+ * @return the block, or nullptr if the size is larger than the largest class
+ *         or that class has no free blocks left
+ */
+
+void *MqttMemoryPool::allocate(std::size_t size)
+{
+    void *ptr = nullptr;
+
+    lock();
+    if (size <= MQTT_POOL_SMALL_BLOCK_SIZE)
+    {
+        ptr = small_.allocate();
+    }
+    else if (size <= MQTT_POOL_MEDIUM_BLOCK_SIZE)
+    {
+        ptr = medium_.allocate();
+    }
+    else if (size <= LARGE_BLOCK_SIZE)
+    {
+        ptr = large_.allocate();
+    }
+    unlock();
+
+    return ptr;
+}
+
+/**
+ * Return a block to the class it came from. The class is found from the address
+ * so callers don't need to remember the size they asked for.
+ */
+
+void MqttMemoryPool::deallocate(void *ptr)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    lock();
+    if (small_.owns(ptr))
+    {
+        small_.deallocate(ptr);
+    }
+    else if (medium_.owns(ptr))
+    {
+        medium_.deallocate(ptr);
+    }
+    else if (large_.owns(ptr))
+    {
+        large_.deallocate(ptr);
+    }
+    else
+    {
+        MQTT_ERROR("block returned to the wrong pool");
+    }
+    unlock();
+}
+
+bool MqttMemoryPool::owns(const void *ptr) const
+{
+    return small_.owns(ptr) || medium_.owns(ptr) || large_.owns(ptr);
+}
+
+/**
+ * @param sizeClass 0 for small, 1 for medium and 2 for large blocks
+ */
+
+MqttPoolStats MqttMemoryPool::getStats(std::size_t sizeClass) const
+{
+    MqttPoolStats stats = {};
+
+    lock();
+    if (sizeClass == 0)
+    {
+        stats = small_.getStats();
+    }
+    else if (sizeClass == 1)
+    {
+        stats = medium_.getStats();
+    }
+    else if (sizeClass == 2)
+    {
+        stats = large_.getStats();
+    }
+    unlock();
+
+    return stats;
+}
+
+std::size_t MqttMemoryPool::getHeapFallbackCount() const
+{
+    return heapFallbacks_;
+}
+
+void MqttMemoryPool::countHeapFallback()
+{
+    lock();
+    heapFallbacks_++;
+    unlock();
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+void MqttMemoryPool::lock() const
+{
+    // the critical sections are a few pointer moves, so spinning is cheaper than
+    // a mutex and keeps the time to allocate bounded
+    while (busy_.test_and_set(std::memory_order_acquire))
+    {
+    }
+}
+
+void MqttMemoryPool::unlock() const
+{
+    busy_.clear(std::memory_order_release);
+}
@@ -22,279 +22,135 @@
  *
  *******************************************************************************/
 
+#include <algorithm>
 #include <string.h>
 #include "mqtt_message.h"
+#include "mqtt_message_encoder.h"
 
 MqttMessage::MqttMessage() {}
 
-void MqttMessage::createConnect(const std::string &clientId)
-{
-    // CONNECT Message Type
-    message_.push_back(MQTT_MSG_TYPE_CONNECT);
-
-    // Remaining Length (variable header + payload)
-    message_.push_back(12); // Remaining Length
-
-    // Variable Header
-    message_.push_back(0);   // Protocol Name Length MSB
-    message_.push_back(4);   // Protocol Name Length LSB
-    message_.push_back('M'); // Protocol Name: M
-    message_.push_back('Q'); // Protocol Name: Q
-    message_.push_back('T'); // Protocol Name: T
-    message_.push_back('T'); // Protocol Name: T
+/**
+ * @return the encoded frame built by the last create call
+ */
 
-    message_.push_back(4); // Protocol Level (MQTT v3.1.1)
-
-    // Connect Flags
-    message_.push_back(0b00000000); // Connect Flags: Clean Session, No Will, No Password, No User Name
-
-    // Keep Alive (two-byte value in seconds)
-    message_.push_back(0);  // Keep Alive MSB
-    message_.push_back(30); // Keep Alive LSB (30 seconds)
-
-    // Payload
-    message_.push_back(0);                 // Client ID Length MSB
-    message_.push_back(clientId.length()); // Client ID Length LSB
+std::span<const unsigned char> MqttMessage::getMessage() const
+{
+    return std::span<const unsigned char>(message_.data(), message_.size());
+}
 
-    for (char c : clientId)
-    {
-        message_.push_back(static_cast<unsigned char>(c)); // Client ID
-    }
+void MqttMessage::createConnect(const std::string &clientId)
+{
+    message_.resize(MqttMessageEncoder::connectSize(clientId));
+    finish(MqttMessageEncoder::encodeConnect(message_, clientId, 30)); // Keep Alive 30 seconds
 }
 
 void MqttMessage::createMqttConnackMessage(bool sessionPresent, MqttConnectReturnCode returnCode)
 {
-    message_.push_back(MQTT_MSG_TYPE_CONNACK);
-    message_.push_back(2); // Remaining Length
-    message_.push_back(sessionPresent ? 1 : 0); // Session Present
-    message_.push_back(returnCode);             // Connect Return Code
+    message_.resize(MqttMessageEncoder::connackSize());
+    finish(MqttMessageEncoder::encodeConnack(message_, sessionPresent, returnCode));
 }
 
-void MqttMessage::createMqttPublishMessage(const std::string &topic, const std::string &payload, bool retain, unsigned char qos)
+void MqttMessage::createMqttPublishMessage(const std::string &topic, const std::string &payload, bool retain, unsigned char qos,
+                                           unsigned short packetIdentifier)
 {
     qos_ = qos;
     retain_ = retain;
-    message_.push_back(MQTT_MSG_TYPE_PUBLISH | (retain ? 0x01 : 0x00) | ((qos & 0x03) << 1)); // PUBLISH | Retain | QoS
 
-    // Remaining Length (variable header + payload)
-    int remainingLength = topic.length() + payload.length() + (qos > 0 ? 2 : 0);
-    do
-    {
-        unsigned char digit = remainingLength % 128;
-        remainingLength /= 128;
-        if (remainingLength > 0)
-        {
-            digit |= 0x80;
-        }
-        message_.push_back(digit);
-    } while (remainingLength > 0);
+    std::span<const unsigned char> payloadBytes(reinterpret_cast<const unsigned char *>(payload.data()), payload.size());
 
-    // Variable Header
-    for (char c : topic)
-    {
-        message_.push_back(static_cast<unsigned char>(c)); // Topic
-    }
-    if (qos > 0)
-    {
-        // Packet Identifier (only for QoS > 0)
-        message_.push_back(0x00); // MSB (Not used in this example)
-        message_.push_back(0x01); // LSB (Not used in this example)
-    }
-
-    // Payload
-    for (char c : payload)
-    {
-        message_.push_back(static_cast<unsigned char>(c)); // Payload
-    }
+    message_.resize(MqttMessageEncoder::publishSize(topic, payload.size(), qos));
+    finish(MqttMessageEncoder::encodePublish(message_, topic, payloadBytes, retain, qos, packetIdentifier));
 }
 
 void MqttMessage::createMqttPubackMessage(unsigned short packetIdentifier)
 {
-    message_.push_back(MQTT_MSG_TYPE_PUBACK);
-
-    // Remaining Length (variable header)
-    message_.push_back(2); // Remaining Length
-    message_.push_back((packetIdentifier >> 8) & 0xFF); // Packet Identifier MSB
-    message_.push_back(packetIdentifier & 0xFF);        // Packet Identifier LSB
+    message_.resize(MqttMessageEncoder::packetIdentifierOnlySize());
+    finish(MqttMessageEncoder::encodePuback(message_, packetIdentifier));
 }
 
 void MqttMessage::createMqttPubrecMessage(unsigned short packetIdentifier)
 {
-    message_.push_back(MQTT_MSG_TYPE_PUBREC);
-
-    // Remaining Length (variable header)
-    message_.push_back(2); // Remaining Length
-    message_.push_back((packetIdentifier >> 8) & 0xFF); // Packet Identifier MSB
-    message_.push_back(packetIdentifier & 0xFF);        // Packet Identifier LSB
+    message_.resize(MqttMessageEncoder::packetIdentifierOnlySize());
+    finish(MqttMessageEncoder::encodePubrec(message_, packetIdentifier));
 }
 
 void MqttMessage::createMqttPubrelMessage(unsigned short packetIdentifier)
 {
-    message_.push_back(MQTT_MSG_TYPE_PUBREL | 0x02); // lower nibble must be 0x2
-    message_.push_back(4); // Remaining Length
-    message_.push_back((packetIdentifier >> 8) & 0xFF); // Packet Identifier MSB
-    message_.push_back(packetIdentifier & 0xFF);        // Packet Identifier LSB
-    message_.push_back(0x00);                           // reason code
-    message_.push_back(0x00);                           // property length
+    message_.resize(MqttMessageEncoder::pubrelSize());
+    finish(MqttMessageEncoder::encodePubrel(message_, packetIdentifier));
 }
 
 void MqttMessage::createMqttPubcompMessage(unsigned short packetIdentifier)
 {
-    message_.push_back(MQTT_MSG_TYPE_PUBCOMP); // PUBCOMP
-    message_.push_back(2); // Remaining Length
-    message_.push_back((packetIdentifier >> 8) & 0xFF); // Packet Identifier MSB
-    message_.push_back(packetIdentifier & 0xFF);        // Packet Identifier LSB
+    message_.resize(MqttMessageEncoder::packetIdentifierOnlySize());
+    finish(MqttMessageEncoder::encodePubcomp(message_, packetIdentifier));
 }
 
 void MqttMessage::createMqttSubscribeMessage(const std::vector<std::string> &topics)
 {
-    message_.push_back(MQTT_MSG_TYPE_SUBSCRIBE | 0x02); // SUBSCRIBE | 0b10000010
-
-    // Remaining Length (variable header + payload)
-    int remainingLength = 2; // Packet Identifier MSB + Packet Identifier LSB
-    int topicsToAdd = std::min(static_cast<int>(topics.size()), MAX_TOPICS_IN_SUBSCRIBE);
-
-    for (int i = 0; i < topicsToAdd; ++i)
-    {
-        const std::string &topic = topics[i];
-
-        if (topic.length() > MAX_TOPIC_LENGTH)
-        {
-            // Skip topics that exceed the maximum length
-            continue;
-        }
-
-        remainingLength += 2 + topic.length() + 1; // Topic Length MSB + Topic Length LSB + Topic + Requested QoS
-    }
+    std::string_view views[MAX_TOPICS_IN_SUBSCRIBE];
+    std::span<const std::string_view> topicViews = toViews(topics, views);
 
-    do
-    {
-        unsigned char digit = remainingLength % 128;
-        remainingLength /= 128;
-        if (remainingLength > 0)
-        {
-            digit |= 0x80;
-        }
-        message_.push_back(digit);
-    } while (remainingLength > 0);
-
-    // Variable Header
-    message_.push_back(0x00); // Packet Identifier MSB (Not used in this example)
-    message_.push_back(0x01); // Packet Identifier LSB (Not used in this example)
-
-    // Payload
-    for (int i = 0; i < topicsToAdd; ++i)
-    {
-        const std::string &topic = topics[i];
-
-        if (topic.length() > MAX_TOPIC_LENGTH)
-        {
-            // Skip topics that exceed the maximum length
-            continue;
-        }
-
-        message_.push_back(0);                                          // Topic Length MSB
-        message_.push_back(static_cast<unsigned char>(topic.length())); // Topic Length LSB
-        for (char c : topic)
-        {
-            message_.push_back(static_cast<unsigned char>(c)); // Topic
-        }
-        message_.push_back(0x00); // Requested QoS (0)
-    }
+    message_.resize(MqttMessageEncoder::subscribeSize(topicViews));
+    finish(MqttMessageEncoder::encodeSubscribe(message_, topicViews, 0x0001)); // Packet Identifier (Not used in this example)
 }
 
-void MqttMessage::reateMqttSubackMessage(unsigned short packetIdentifier, const std::vector<unsigned char> &grantedQoS)
+void MqttMessage::createMqttSubackMessage(unsigned short packetIdentifier, const std::vector<unsigned char> &grantedQoS)
 {
-    message_.push_back(MQTT_MSG_TYPE_SUBACK);
-    message_.push_back(2 + grantedQoS.size()); // Remaining Length
-    message_.push_back((packetIdentifier >> 8) & 0xFF); // Packet Identifier MSB
-    message_.push_back(packetIdentifier & 0xFF);        // Packet Identifier LSB
-
-    // Payload
-    for (unsigned char qos : grantedQoS)
-    {
-        message_.push_back(qos); // Granted QoS
-    }
+    message_.resize(MqttMessageEncoder::subackSize(grantedQoS.size()));
+    finish(MqttMessageEncoder::encodeSuback(message_, packetIdentifier, grantedQoS));
 }
 
 void MqttMessage::createMqttUnsubscribeMessage(const std::vector<std::string> &topics)
 {
-    message_.push_back(MQTT_MSG_TYPE_UNSUBSCRIBE | 0x02); // UNSUBSCRIBE | 0b10100010
+    std::string_view views[MAX_TOPICS_IN_SUBSCRIBE];
+    std::span<const std::string_view> topicViews = toViews(topics, views);
 
-    // Remaining Length (variable header + payload)
-    int remainingLength = 2; // Packet Identifier MSB + Packet Identifier LSB
-    int topicsToRemove = std::min(static_cast<int>(topics.size()), MAX_TOPICS_IN_SUBSCRIBE);
-
-    for (int i = 0; i < topicsToRemove; ++i)
-    {
-        const std::string &topic = topics[i];
-
-        if (topic.length() > MAX_TOPIC_LENGTH)
-        {
-            // Skip topics that exceed the maximum length
-            continue;
-        }
-
-        remainingLength += 2 + topic.length(); // Topic Length MSB + Topic Length LSB + Topic
-    }
-
-    do
-    {
-        unsigned char digit = remainingLength % 128;
-        remainingLength /= 128;
-        if (remainingLength > 0)
-        {
-            digit |= 0x80;
-        }
-        message_.push_back(digit);
-    } while (remainingLength > 0);
-
-    // Variable Header
-    message_.push_back(0x00); // Packet Identifier MSB (Not used in this example)
-    message_.push_back(0x01); // Packet Identifier LSB (Not used in this example)
-
-    // Payload
-    for (int i = 0; i < topicsToRemove; ++i)
-    {
-        const std::string &topic = topics[i];
+    message_.resize(MqttMessageEncoder::unsubscribeSize(topicViews));
+    finish(MqttMessageEncoder::encodeUnsubscribe(message_, topicViews, 0x0001)); // Packet Identifier (Not used in this example)
+}
 
-        if (topic.length() > MAX_TOPIC_LENGTH)
-        {
-            // Skip topics that exceed the maximum length
-            continue;
-        }
+void MqttMessage::createMqttUnsubackMessage(unsigned short packetIdentifier)
+{
+    message_.resize(MqttMessageEncoder::packetIdentifierOnlySize());
+    finish(MqttMessageEncoder::encodeUnsuback(message_, packetIdentifier));
+}
 
-        message_.push_back(0);                                          // Topic Length MSB
-        message_.push_back(static_cast<unsigned char>(topic.length())); // Topic Length LSB
-        for (char c : topic)
-        {
-            message_.push_back(static_cast<unsigned char>(c)); // Topic
-        }
-    }
+void MqttMessage::createMqttPingreqMessage()
+{
+    message_.resize(MqttMessageEncoder::emptyPacketSize());
+    finish(MqttMessageEncoder::encodePingreq(message_));
 }
 
-void MqttMessage::createMqttUnsubackMessage(unsigned short packetIdentifier) 
+void MqttMessage::createMqttPingrespMessage()
 {
-    message_.push_back(MQTT_MSG_TYPE_UNSUBACK);  // UNSUBACK
-    message_.push_back(2);     // Remaining Length
-    message_.push_back((packetIdentifier >> 8) & 0xFF);  // Packet Identifier MSB
-    message_.push_back(packetIdentifier & 0xFF);         // Packet Identifier LSB
+    message_.resize(MqttMessageEncoder::emptyPacketSize());
+    finish(MqttMessageEncoder::encodePingresp(message_));
 }
 
-void MqttMessage::createMqttPingreqMessage() 
+void MqttMessage::createMqttDisconnectMessage()
 {
-    message_.push_back(MQTT_MSG_TYPE_PINGREQ); 
-    message_.push_back(0);     // Remaining Length
+    message_.resize(MqttMessageEncoder::emptyPacketSize());
+    finish(MqttMessageEncoder::encodeDisconnect(message_));
 }
 
-void MqttMessage::createMqttPingrespMessage() 
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+void MqttMessage::finish(std::size_t length)
 {
-    message_.push_back(MQTT_MSG_TYPE_PINGRESP);  
-    message_.push_back(0);     // Remaining Length
+    // the encoder writes nothing useful when it fails, so don't leave half a frame behind
+    message_.resize(length);
 }
 
-void MqttMessage::createMqttDisconnectMessage() 
+std::span<const std::string_view> MqttMessage::toViews(const std::vector<std::string> &topics, std::string_view (&views)[MAX_TOPICS_IN_SUBSCRIBE])
 {
-    message_.push_back(MQTT_MSG_TYPE_DISCONNECT); 
-    message_.push_back(0);     // Remaining Length
+    std::size_t count = std::min(topics.size(), static_cast<std::size_t>(MAX_TOPICS_IN_SUBSCRIBE));
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        views[i] = topics[i];
+    }
+    return std::span<const std::string_view>(views, count);
 }
@@ -0,0 +1,383 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include <string.h>
+#include "mqtt_message_parser.h"
+#include "mqtt_message_encoder.h"
+
+using MqttPacketType = MqttMessageParser::MqttPacketType;
+
+static constexpr unsigned char fixedHeader(MqttPacketType packetType, unsigned char flags = 0)
+{
+    return static_cast<unsigned char>((static_cast<unsigned char>(packetType) << 4) | flags);
+}
+
+/**
+ * @return the number of bytes the Remaining Length takes on the wire
+ */
+
+std::size_t MqttMessageEncoder::remainingLengthSize(std::size_t remainingLength)
+{
+    return (remainingLength < 128) ? 1 : (remainingLength < 16384) ? 2 : (remainingLength < 2097152) ? 3 : 4;
+}
+
+std::size_t MqttMessageEncoder::encodeRemainingLength(unsigned char *buffer, std::size_t remainingLength)
+{
+    std::size_t count = 0;
+
+    do
+    {
+        unsigned char digit = remainingLength % 128;
+        remainingLength /= 128;
+        if (remainingLength > 0)
+        {
+            digit |= 0x80;
+        }
+        buffer[count++] = digit;
+    } while (remainingLength > 0);
+
+    return count;
+}
+
+std::size_t MqttMessageEncoder::connectSize(std::string_view clientId)
+{
+    // protocol name, level, flags and keep alive, then the client id
+    std::size_t remainingLength = 10 + 2 + clientId.size();
+    return 1 + remainingLengthSize(remainingLength) + remainingLength;
+}
+
+std::size_t MqttMessageEncoder::encodeConnect(std::span<unsigned char> buffer, std::string_view clientId, unsigned short keepAlive)
+{
+    std::size_t size = connectSize(clientId);
+
+    if ((buffer.size() < size) || (clientId.size() > 0xFFFF))
+    {
+        return 0;
+    }
+
+    unsigned char *out = buffer.data();
+    *out++ = fixedHeader(MqttPacketType::Connect);
+    out += encodeRemainingLength(out, 10 + 2 + clientId.size());
+
+    out = putString(out, "MQTT");
+    *out++ = 4;          // Protocol Level (MQTT v3.1.1)
+    *out++ = 0b00000000; // Connect Flags: No Will, No Password, No User Name
+    *out++ = (keepAlive >> 8) & 0xFF;
+    *out++ = keepAlive & 0xFF;
+    putString(out, clientId);
+
+    return size;
+}
+
+std::size_t MqttMessageEncoder::connackSize()
+{
+    return 4;
+}
+
+std::size_t MqttMessageEncoder::encodeConnack(std::span<unsigned char> buffer, bool sessionPresent, unsigned char returnCode)
+{
+    if (buffer.size() < connackSize())
+    {
+        return 0;
+    }
+
+    buffer[0] = fixedHeader(MqttPacketType::Connack);
+    buffer[1] = 2;                       // Remaining Length
+    buffer[2] = sessionPresent ? 1 : 0;  // Session Present
+    buffer[3] = returnCode;              // Connect Return Code
+    return connackSize();
+}
+
+std::size_t MqttMessageEncoder::publishSize(std::string_view topic, std::size_t payloadLength, unsigned char qos)
+{
+    std::size_t remainingLength = 2 + topic.size() + (qos > 0 ? 2 : 0) + payloadLength;
+    return 1 + remainingLengthSize(remainingLength) + remainingLength;
+}
+
+std::size_t MqttMessageEncoder::encodePublish(std::span<unsigned char> buffer, std::string_view topic, std::span<const unsigned char> payload,
+                                              bool retain, unsigned char qos, unsigned short packetIdentifier)
+{
+    std::size_t remainingLength = 2 + topic.size() + (qos > 0 ? 2 : 0) + payload.size();
+    std::size_t size = publishSize(topic, payload.size(), qos);
+
+    if ((buffer.size() < size) || (topic.size() > 0xFFFF) || (remainingLength > MAX_REMAINING_LENGTH))
+    {
+        return 0;
+    }
+
+    unsigned char *out = buffer.data();
+    *out++ = fixedHeader(MqttPacketType::Publish, (retain ? 0x01 : 0x00) | ((qos & 0x03) << 1));
+    out += encodeRemainingLength(out, remainingLength);
+    out = putString(out, topic);
+
+    if (qos > 0)
+    {
+        // Packet Identifier (only for QoS > 0)
+        *out++ = (packetIdentifier >> 8) & 0xFF;
+        *out++ = packetIdentifier & 0xFF;
+    }
+
+    if (!payload.empty())
+    {
+        memcpy(out, payload.data(), payload.size());
+    }
+    return size;
+}
+
+std::size_t MqttMessageEncoder::packetIdentifierOnlySize()
+{
+    return 4;
+}
+
+std::size_t MqttMessageEncoder::encodePuback(std::span<unsigned char> buffer, unsigned short packetIdentifier)
+{
+    return encodePacketIdentifierOnly(buffer, fixedHeader(MqttPacketType::Puback), packetIdentifier);
+}
+
+std::size_t MqttMessageEncoder::encodePubrec(std::span<unsigned char> buffer, unsigned short packetIdentifier)
+{
+    return encodePacketIdentifierOnly(buffer, fixedHeader(MqttPacketType::Pubrec), packetIdentifier);
+}
+
+std::size_t MqttMessageEncoder::encodePubcomp(std::span<unsigned char> buffer, unsigned short packetIdentifier)
+{
+    return encodePacketIdentifierOnly(buffer, fixedHeader(MqttPacketType::Pubcomp), packetIdentifier);
+}
+
+std::size_t MqttMessageEncoder::encodeUnsuback(std::span<unsigned char> buffer, unsigned short packetIdentifier)
+{
+    return encodePacketIdentifierOnly(buffer, fixedHeader(MqttPacketType::Unsuback), packetIdentifier);
+}
+
+std::size_t MqttMessageEncoder::pubrelSize(unsigned char protocolLevel)
+{
+    return (protocolLevel >= 5) ? 6 : 4;
+}
+
+/**
+ * From v5 PUBREL carries a reason code and property length, before that it is
+ * just the packet identifier
+ */
+
+std::size_t MqttMessageEncoder::encodePubrel(std::span<unsigned char> buffer, unsigned short packetIdentifier, unsigned char protocolLevel)
+{
+    const std::size_t size = pubrelSize(protocolLevel);
+
+    if (buffer.size() < size)
+    {
+        return 0;
+    }
+
+    buffer[0] = fixedHeader(MqttPacketType::Pubrel, 0x02);    // lower nibble must be 0x2
+    buffer[1] = static_cast<unsigned char>(size - 2);          // Remaining Length
+    buffer[2] = (packetIdentifier >> 8) & 0xFF;                // Packet Identifier MSB
+    buffer[3] = packetIdentifier & 0xFF;                       // Packet Identifier LSB
+    if (protocolLevel >= 5)
+    {
+        buffer[4] = 0x00;                                      // reason code
+        buffer[5] = 0x00;                                      // property length
+    }
+    return size;
+}
+
+/**
+ * At most MAX_TOPICS_IN_SUBSCRIBE topics are sent and any longer than
+ * MAX_TOPIC_LENGTH are skipped
+ */
+
+std::size_t MqttMessageEncoder::subscribeSize(std::span<const std::string_view> topics)
+{
+    std::size_t remainingLength = topicListRemainingLength(topics, 1); // each topic carries a Requested QoS byte
+    return 1 + remainingLengthSize(remainingLength) + remainingLength;
+}
+
+std::size_t MqttMessageEncoder::encodeSubscribe(std::span<unsigned char> buffer, std::span<const std::string_view> topics, unsigned short packetIdentifier)
+{
+    std::size_t size = subscribeSize(topics);
+
+    if (buffer.size() < size)
+    {
+        return 0;
+    }
+
+    unsigned char *out = buffer.data();
+    *out++ = fixedHeader(MqttPacketType::Subscribe, 0x02);
+    out += encodeRemainingLength(out, topicListRemainingLength(topics, 1));
+    *out++ = (packetIdentifier >> 8) & 0xFF;
+    *out++ = packetIdentifier & 0xFF;
+
+    std::size_t topicCount = subscriptionTopicCount(topics);
+
+    for (std::size_t i = 0; i < topicCount; i++)
+    {
+        if (topics[i].size() <= MAX_TOPIC_LENGTH)
+        {
+            out = putString(out, topics[i]);
+            *out++ = 0x00; // Requested QoS (0)
+        }
+    }
+    return size;
+}
+
+std::size_t MqttMessageEncoder::subackSize(std::size_t grantedCount)
+{
+    std::size_t remainingLength = 2 + grantedCount;
+    return 1 + remainingLengthSize(remainingLength) + remainingLength;
+}
+
+std::size_t MqttMessageEncoder::encodeSuback(std::span<unsigned char> buffer, unsigned short packetIdentifier, std::span<const unsigned char> grantedQoS)
+{
+    std::size_t size = subackSize(grantedQoS.size());
+
+    if (buffer.size() < size)
+    {
+        return 0;
+    }
+
+    unsigned char *out = buffer.data();
+    *out++ = fixedHeader(MqttPacketType::Suback);
+    out += encodeRemainingLength(out, 2 + grantedQoS.size());
+    *out++ = (packetIdentifier >> 8) & 0xFF;
+    *out++ = packetIdentifier & 0xFF;
+
+    if (!grantedQoS.empty())
+    {
+        memcpy(out, grantedQoS.data(), grantedQoS.size());
+    }
+    return size;
+}
+
+std::size_t MqttMessageEncoder::unsubscribeSize(std::span<const std::string_view> topics)
+{
+    std::size_t remainingLength = topicListRemainingLength(topics, 0);
+    return 1 + remainingLengthSize(remainingLength) + remainingLength;
+}
+
+std::size_t MqttMessageEncoder::encodeUnsubscribe(std::span<unsigned char> buffer, std::span<const std::string_view> topics, unsigned short packetIdentifier)
+{
+    std::size_t size = unsubscribeSize(topics);
+
+    if (buffer.size() < size)
+    {
+        return 0;
+    }
+
+    unsigned char *out = buffer.data();
+    *out++ = fixedHeader(MqttPacketType::Unsubscribe, 0x02);
+    out += encodeRemainingLength(out, topicListRemainingLength(topics, 0));
+    *out++ = (packetIdentifier >> 8) & 0xFF;
+    *out++ = packetIdentifier & 0xFF;
+
+    std::size_t topicCount = subscriptionTopicCount(topics);
+
+    for (std::size_t i = 0; i < topicCount; i++)
+    {
+        if (topics[i].size() <= MAX_TOPIC_LENGTH)
+        {
+            out = putString(out, topics[i]);
+        }
+    }
+    return size;
+}
+
+std::size_t MqttMessageEncoder::emptyPacketSize()
+{
+    return 2;
+}
+
+std::size_t MqttMessageEncoder::encodePingreq(std::span<unsigned char> buffer)
+{
+    return encodeEmptyPacket(buffer, fixedHeader(MqttPacketType::Pingreq));
+}
+
+std::size_t MqttMessageEncoder::encodePingresp(std::span<unsigned char> buffer)
+{
+    return encodeEmptyPacket(buffer, fixedHeader(MqttPacketType::Pingresp));
+}
+
+std::size_t MqttMessageEncoder::encodeDisconnect(std::span<unsigned char> buffer)
+{
+    return encodeEmptyPacket(buffer, fixedHeader(MqttPacketType::Disconnect));
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+std::size_t MqttMessageEncoder::encodePacketIdentifierOnly(std::span<unsigned char> buffer, unsigned char header, unsigned short packetIdentifier)
+{
+    if (buffer.size() < packetIdentifierOnlySize())
+    {
+        return 0;
+    }
+
+    buffer[0] = header;
+    buffer[1] = 2;                              // Remaining Length
+    buffer[2] = (packetIdentifier >> 8) & 0xFF; // Packet Identifier MSB
+    buffer[3] = packetIdentifier & 0xFF;        // Packet Identifier LSB
+    return packetIdentifierOnlySize();
+}
+
+std::size_t MqttMessageEncoder::encodeEmptyPacket(std::span<unsigned char> buffer, unsigned char header)
+{
+    if (buffer.size() < emptyPacketSize())
+    {
+        return 0;
+    }
+
+    buffer[0] = header;
+    buffer[1] = 0; // Remaining Length
+    return emptyPacketSize();
+}
+
+std::size_t MqttMessageEncoder::subscriptionTopicCount(std::span<const std::string_view> topics)
+{
+    return (topics.size() < MAX_TOPICS_IN_SUBSCRIBE) ? topics.size() : MAX_TOPICS_IN_SUBSCRIBE;
+}
+
+std::size_t MqttMessageEncoder::topicListRemainingLength(std::span<const std::string_view> topics, std::size_t bytesPerTopic)
+{
+    std::size_t remainingLength = 2; // Packet Identifier
+    std::size_t topicCount = subscriptionTopicCount(topics);
+
+    for (std::size_t i = 0; i < topicCount; i++)
+    {
+        if (topics[i].size() <= MAX_TOPIC_LENGTH)
+        {
+            remainingLength += 2 + topics[i].size() + bytesPerTopic; // Topic Length + Topic
+        }
+    }
+    return remainingLength;
+}
+
+unsigned char *MqttMessageEncoder::putString(unsigned char *out, std::string_view str)
+{
+    *out++ = (str.size() >> 8) & 0xFF;
+    *out++ = str.size() & 0xFF;
+
+    if (!str.empty())
+    {
+        memcpy(out, str.data(), str.size());
+    }
+    return out + str.size();
+}
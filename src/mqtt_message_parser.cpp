@@ -21,224 +21,132 @@
  * THE SOFTWARE.
  *******************************************************************************/
 
-#include <vector>
+#include <span>
 #include <cstdint>
 #include "string.h"
 #include "defaults.h"
 #include "mqtt_message_parser.h"
+#include "mqtt_property_bag.h"
+#include "mqtt_reader.h"
+#include "mqtt_utf8.h"
+
+/**
+ * Walks the properties of a packet, starting at the Property Length. Each
+ * property is checked against the property table for its wire type and for
+ * whether it may appear in this packet type, and strings for being UTF-8, then
+ * recorded in the bag as an offset into the message. Values are only decoded
+ * if somebody asks for them.
+ *
+ * A v3.1.1 packet has no properties at all, so if the message ends where the
+ * Property Length would be this is treated as an empty property list.
+ *
+ * @return false if the properties are malformed or not allowed in the packet
+ */
 
-bool MqttMessageParser::parseProperties(const std::vector<unsigned char> &message, size_t &index)
+bool MqttMessageParser::parseProperties(std::span<const unsigned char> message, size_t &index,
+                                        MqttPacketType packetType, MqttPropertyBag &properties)
 {
-    size_t currentIndex = index; // Use a local variable instead of reusing the parameter
-
-    while (currentIndex < message.size()) 
-    {
-        MqttPropertyTypes propertyType;
-        if (!parseVariableByteIntegerProperty(message, reinterpret_cast<unsigned long &>(propertyType), currentIndex))
-        {
-            return false; // Error: Unable to parse property type
-        }
+    properties.reset(message);
 
-        switch (propertyType)
-        {
-        case MqttPropertyTypes::PayloadFormatIndicator:
-        case MqttPropertyTypes::RequestProblemInformation:
-        case MqttPropertyTypes::RequestResponseInformation:
-        case MqttPropertyTypes::RetainAvailable:
-        case MqttPropertyTypes::WildcardSubscriptionAvailable:
-        case MqttPropertyTypes::SubscriptionIdentifierAvailable:
-        case MqttPropertyTypes::SharedSubscriptionAvailable:
-            // These properties are of type 'Byte'
-            {
-                unsigned char byteValue;
-                if (!parseByteProperty(message, byteValue, currentIndex))
-                {
-                    return false; // Error: Unable to parse Byte property
-                }
-                // Process 'byteValue' as needed... TODO
-                break;
-            }
-        case MqttPropertyTypes::MessageExpiryInterval:
-        case MqttPropertyTypes::WillDelayInterval:
-        case MqttPropertyTypes::MaximumPacketSize:
-        case MqttPropertyTypes::SessionExpiryInterval:
-            // These properties are of type 'Four Byte Integer'
-            {
-                unsigned long integerValue;
-                if (!parseFourByteIntegerProperty(message, integerValue, index))
-                {
-                    return false; // Error: Unable to parse Four Byte Integer property
-                }
-                // Process 'integerValue' as needed... TODO
-                break;
-            }
-        case MqttPropertyTypes::TopicAlias:
-        case MqttPropertyTypes::TopicAliasMaximum:
-        case MqttPropertyTypes::MaximumQoS:
-        case MqttPropertyTypes::ReceiveMaximum:
-        case MqttPropertyTypes::ServerKeepAlive:
-            // These properties are of type 'Two Byte Integer'
-            {
-                unsigned short integerValue;
-                if (!parseTwoByteIntegerProperty(message, integerValue, index))
-                {
-                    return false; // Error: Unable to parse Two Byte Integer property
-                }
-                // Process 'integerValue' as needed... TODO
-                break;
-            }
-        case MqttPropertyTypes::ContentType:
-        case MqttPropertyTypes::ResponseTopic:
-        case MqttPropertyTypes::AuthenticationMethod:
-        case MqttPropertyTypes::ResponseInformation:
-        case MqttPropertyTypes::ServerReference:
-        case MqttPropertyTypes::ReasonString:
-        case MqttPropertyTypes::AssignedClientIdentifier:
-        case MqttPropertyTypes::UserProperty:
-            // These properties are of type 'UTF-8 Encoded String'
-            {
-                char *stringValue;
-                size_t stringLength;
-                if (!parseUtf8StringProperty(message, stringValue, stringLength, index))
-                {
-                    return false; // Error: Unable to parse UTF-8 Encoded String property
-                }
-                // Process 'stringValue' and 'stringLength' as needed... TODO
-                break;
-            }
-        case MqttPropertyTypes::CorrelationData:
-        case MqttPropertyTypes::AuthenticationData:
-            // These properties are of type 'Binary Data'
-            {
-                std::vector<unsigned char> binaryValue;
-                if (!parseBinaryDataProperty(message, binaryValue, index))
-                {
-                    return false; // Error: Unable to parse Binary Data property
-                }
-                // Process 'binaryValue' as needed... TODO
-                break;
-            }
-        case MqttPropertyTypes::SubscriptionIdentifier:
-            // This property is of type 'Variable Byte Integer'
-            {
-                unsigned long integerValue;
-                if (!parseVariableByteIntegerProperty(message, integerValue, index))
-                {
-                    return false; // Error: Unable to parse Variable Byte Integer property
-                }
-                // Process 'integerValue' as needed... TODO
-                break;
-            }
-        default:
-            // Unknown property type
-            return false;
-        }
-    }
-
-    index = currentIndex; // Update the index parameter with the new value
-    return true;          // Successfully parsed all properties
-}
-
-bool MqttMessageParser::parseByteProperty(const std::vector<unsigned char> &data, unsigned char &result, size_t &index)
-{
-    if (index < data.size())
+    if (index >= message.size())
     {
-        result = data[index++];
         return true;
     }
-    return false;
-}
 
-bool MqttMessageParser::parseFourByteIntegerProperty(const std::vector<unsigned char> &data, unsigned long &result, size_t &index)
-{
-    if (index + 3 < data.size())
-    {
-        result = (static_cast<unsigned long>(data[index]) << 24) |
-                 (static_cast<unsigned long>(data[index + 1]) << 16) |
-                 (static_cast<unsigned long>(data[index + 2]) << 8) |
-                 static_cast<unsigned long>(data[index + 3]);
-        index += 4;
-        return true;
-    }
-    return false;
-}
+    MqttReader reader(message);
+    reader.readBytes(index);
 
-bool MqttMessageParser::parseUtf8StringProperty(const std::vector<unsigned char> &message, char *value, size_t &index, size_t maxLength)
-{
-    // Ensure that the index is within bounds
-    if (index >= message.size())
+    const unsigned long propertyLength = reader.readVariableByteInteger();
+
+    if (!reader.isValid() || (propertyLength > reader.getRemaining()))
     {
+        MQTT_WARNING("property length runs past the end of the packet");
         return false;
     }
 
-    // Get the length of the UTF-8 string
-    size_t length = message[index++];
+    // read only as far as the end of the properties, so no value can run past it
+    const size_t end = reader.getPosition() + propertyLength;
+    MqttReader block(message.first(end));
+    block.readBytes(reader.getPosition());
 
-    // Check if the length exceeds the maximum allowed
-    if (length > maxLength)
+    while (!block.atEnd())
     {
-        return false;
-    }
+        // Property identifiers are encoded as a variable byte integer, but all the
+        // assigned ones fit in a single byte
 
-    // Ensure that there is enough data in the message
-    if (index + length > message.size())
-    {
-        return false;
-    }
+        unsigned char propertyId = block.takeByte();
+        MqttPropertyInfo info = getPropertyInfo(propertyId);
 
-    // Copy the UTF-8 string to the provided buffer
-    memcpy(value, &message[index], length);
+        if (info.wireType == MqttPropertyWireType::Invalid)
+        {
+            MQTT_WARNING("unknown property 0x%x", propertyId);
+            return false;
+        }
 
-    // Null-terminate the C string
-    value[length] = '\0';
+        if ((info.allowedPackets & packetBit(packetType)) == 0)
+        {
+            MQTT_WARNING("property 0x%x not allowed in packet type %d", propertyId, static_cast<int>(packetType));
+            return false;
+        }
 
-    // Update the index
-    index += length;
+        size_t valueOffset = block.getPosition();
 
-    return true;
-}
+        switch (info.wireType)
+        {
+        case MqttPropertyWireType::Byte:
+            block.readBytes(1);
+            break;
+
+        case MqttPropertyWireType::TwoByteInteger:
+            block.readBytes(2);
+            break;
+
+        case MqttPropertyWireType::FourByteInteger:
+            block.readBytes(4);
+            break;
+
+        case MqttPropertyWireType::VariableByteInteger:
+            block.readVariableByteInteger();
+            break;
+
+        case MqttPropertyWireType::Utf8String:
+            // record the text without its two byte length prefix
+            valueOffset += 2;
+            if (!MqttUtf8::isValid(block.readString()))
+            {
+                block.fail();
+            }
+            break;
 
-bool MqttMessageParser::parseBinaryDataProperty(const std::vector<unsigned char> &data, std::vector<unsigned char> &result, size_t &index)
-{
-    if (index + 1 < data.size())
-    {
-        unsigned short binLen = (static_cast<unsigned short>(data[index]) << 8) | static_cast<unsigned short>(data[index + 1]);
-        index += 2;
+        case MqttPropertyWireType::BinaryData:
+            valueOffset += 2;
+            block.readBinary();
+            break;
 
-        if (index + binLen <= data.size())
+        case MqttPropertyWireType::Utf8StringPair:
+            // record the whole pair, both strings are split out when read
+            if (!MqttUtf8::isValid(block.readString()) || !MqttUtf8::isValid(block.readString()))
+            {
+                block.fail();
+            }
+            break;
+
+        default:
+            return false;
+        }
+
+        if (!block.isValid())
         {
-            result.assign(data.begin() + index, data.begin() + index + binLen);
-            index += binLen;
-            return true;
+            MQTT_WARNING("property 0x%x runs past the end of the properties, or is not valid UTF-8", propertyId);
+            return false;
         }
-    }
-    return false;
-}
 
-bool MqttMessageParser::parseVariableByteIntegerProperty(const std::vector<unsigned char> &data, unsigned long &result, size_t &index)
-{
-    result = 0;
-    unsigned char shift = 0;
-    while (index < data.size())
-    {
-        unsigned char encodedByte = data[index++];
-        result |= static_cast<unsigned long>(encodedByte & 0x7F) << shift;
-        if ((encodedByte & 0x80) == 0)
+        if (!properties.add(static_cast<MqttPropertyTypes>(propertyId), valueOffset, block.getPosition() - valueOffset, packetType))
         {
-            return true;
+            return false;
         }
-        shift += 7;
     }
-    return false;
-}
 
-bool MqttMessageParser::parseTwoByteIntegerProperty(const std::vector<unsigned char> &data, unsigned short &result, size_t &index)
-{
-    if (index + 1 < data.size())
-    {
-        result = (static_cast<unsigned short>(data[index]) << 8) | static_cast<unsigned short>(data[index + 1]);
-        index += 2;
-        return true;
-    }
-    return false;
+    index = end;
+    return true;
 }
@@ -0,0 +1,340 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_packet_decoder.h"
+#include "mqtt_reader.h"
+#include "mqtt_topic.h"
+#include "mqtt_utf8.h"
+
+/**
+ * Reads the type, flags and remaining length, and checks the flags against the
+ * rule for the type. The frame must be exactly one packet, as the reassembler
+ * hands them over.
+ */
+
+MqttPacketDecoder::Result MqttPacketDecoder::decodeFixedHeader(std::span<const unsigned char> frame, MqttFixedHeader &header)
+{
+    MqttReader reader(frame);
+    const unsigned char firstByte = reader.readByte();
+    const unsigned char type = firstByte >> 4;
+    const PacketRule &rule = packetRules[type];
+
+    header.type = static_cast<MqttPacketType>(type);
+    header.flags = firstByte & 0x0F;
+    header.remainingLength = reader.readVariableByteInteger();
+    header.headerLength = reader.getPosition();
+
+    if (!reader.isValid() || (type == 0) || (header.remainingLength != reader.getRemaining()))
+    {
+        return Result::MalformedPacket;
+    }
+
+    return ((header.flags & rule.mask) == rule.value) ? Result::Success : Result::InvalidFlags;
+}
+
+/**
+ * CONNECT. The protocol level comes from here, so unlike the other packets this
+ * one says for itself whether it has properties. The client id and user name
+ * must be UTF-8, and a will topic a valid topic name.
+ */
+
+MqttPacketDecoder::Result MqttPacketDecoder::decodeConnect(std::span<const unsigned char> body, MqttConnectView &view)
+{
+    MqttReader reader(body);
+    const std::string_view protocolName = reader.readString();
+
+    if (!reader.ensure(4))
+    {
+        return Result::MalformedPacket;
+    }
+
+    view.protocolLevel = reader.takeByte();
+    const unsigned char connectFlags = reader.takeByte();
+    view.keepAlive = reader.takeTwoByteInteger();
+
+    if (!((protocolName == "MQTT") && ((view.protocolLevel == 4) || (view.protocolLevel == 5))) &&
+        !((protocolName == "MQIsdp") && (view.protocolLevel == 3)))
+    {
+        return Result::UnsupportedProtocol;
+    }
+
+    view.cleanStart = (connectFlags & 0x02) != 0;
+    view.will = (connectFlags & 0x04) != 0;
+    view.willQos = (connectFlags >> 3) & 0x03;
+    view.willRetain = (connectFlags & 0x20) != 0;
+    view.hasPassword = (connectFlags & 0x40) != 0;
+    view.hasUserName = (connectFlags & 0x80) != 0;
+
+    // the reserved bit must be clear, and the will QoS and retain only go with a will
+
+    if (((connectFlags & 0x01) != 0) || (view.willQos > 2) || (!view.will && ((view.willQos != 0) || view.willRetain)))
+    {
+        return Result::MalformedPacket;
+    }
+
+    view.willProperties = {};
+    view.willTopic = {};
+    view.willPayload = {};
+    view.userName = {};
+    view.password = {};
+
+    view.properties = readProperties(reader, view.protocolLevel);
+    view.clientId = reader.readString();
+
+    if (view.will)
+    {
+        view.willProperties = readProperties(reader, view.protocolLevel);
+        view.willTopic = reader.readString();
+        view.willPayload = reader.readBinary();
+    }
+
+    if (view.hasUserName)
+    {
+        view.userName = reader.readString();
+    }
+    if (view.hasPassword)
+    {
+        view.password = reader.readBinary();
+    }
+
+    if (!reader.isValid() || !reader.atEnd() ||
+        !MqttUtf8::isValid(view.clientId) || !MqttUtf8::isValid(view.userName))
+    {
+        return Result::MalformedPacket;
+    }
+
+    if (view.will && !MqttTopic::isValidTopicName(view.willTopic))
+    {
+        return Result::ProtocolError;
+    }
+
+    // before v5 a password needs a user name
+    return ((view.protocolLevel < 5) && view.hasPassword && !view.hasUserName) ? Result::ProtocolError : Result::Success;
+}
+
+/**
+ * PUBLISH. The topic name is checked here, so no PUBLISH with a wildcard, a NUL
+ * or malformed UTF-8 in its topic gets any further. An empty topic is only allowed from v5, where a
+ * topic alias can stand in for it.
+ */
+
+MqttPacketDecoder::Result MqttPacketDecoder::decodePublish(const MqttFixedHeader &header, std::span<const unsigned char> body,
+                                                           unsigned char protocolLevel, MqttPublishView &view)
+{
+    view.qos = (header.flags >> 1) & 0x03;
+    view.retain = (header.flags & 0x01) != 0;
+    view.duplicate = (header.flags & 0x08) != 0;
+
+    if ((view.qos > 2) || (view.duplicate && (view.qos == 0)))
+    {
+        return Result::InvalidFlags;
+    }
+
+    MqttReader reader(body);
+    view.topic = reader.readString();
+    view.packetIdentifier = (view.qos > 0) ? reader.readTwoByteInteger() : 0;
+    view.properties = readProperties(reader, protocolLevel);
+
+    if (!reader.isValid() || ((view.qos > 0) && (view.packetIdentifier == 0)))
+    {
+        return Result::MalformedPacket;
+    }
+
+    if (view.topic.empty() ? (protocolLevel < 5) : !MqttTopic::isValidTopicName(view.topic))
+    {
+        return Result::ProtocolError;
+    }
+
+    view.payload = reader.getRest();
+    return Result::Success;
+}
+
+/**
+ * PUBACK, PUBREC, PUBREL or PUBCOMP. From v5 the reason code and properties may
+ * follow the packet identifier, each left out when there is nothing to say.
+ */
+
+MqttPacketDecoder::Result MqttPacketDecoder::decodeAck(std::span<const unsigned char> body, unsigned char protocolLevel, MqttAckView &view)
+{
+    MqttReader reader(body);
+    view.packetIdentifier = reader.readTwoByteInteger();
+    view.reasonCode = 0;
+    view.properties = {};
+
+    if ((protocolLevel >= 5) && !reader.atEnd())
+    {
+        view.reasonCode = reader.takeByte();
+        if (!reader.atEnd())
+        {
+            view.properties = readProperties(reader, protocolLevel);
+        }
+    }
+
+    return (reader.isValid() && reader.atEnd() && (view.packetIdentifier != 0)) ? Result::Success : Result::MalformedPacket;
+}
+
+/**
+ * SUBSCRIBE. Each filter must be UTF-8 and its options byte well formed, but
+ * beyond that a filter the broker won't take is answered in the SUBACK, not by
+ * closing the connection.
+ */
+
+MqttPacketDecoder::Result MqttPacketDecoder::decodeSubscribe(std::span<const unsigned char> body, unsigned char protocolLevel,
+                                                             MqttSubscribeView &view)
+{
+    MqttReader reader(body);
+    view.packetIdentifier = reader.readTwoByteInteger();
+    view.properties = readProperties(reader, protocolLevel);
+    view.filters = reader.getRest();
+    view.filterCount = 0;
+
+    // before v5 only the QoS bits of the options are used, v5 adds No Local,
+    // Retain As Published and Retain Handling
+
+    const unsigned char reserved = (protocolLevel >= 5) ? 0xC0 : 0xFC;
+
+    while (!reader.atEnd())
+    {
+        const std::string_view filter = reader.readString();
+        const unsigned char options = reader.readByte();
+
+        if (!MqttUtf8::isValid(filter) || ((options & reserved) != 0) || ((options & 0x03) == 3) || (((options >> 4) & 0x03) == 3))
+        {
+            reader.fail();
+        }
+        view.filterCount++;
+    }
+
+    if (!reader.isValid() || (view.packetIdentifier == 0))
+    {
+        return Result::MalformedPacket;
+    }
+    return (view.filterCount > 0) ? Result::Success : Result::ProtocolError;
+}
+
+MqttPacketDecoder::Result MqttPacketDecoder::decodeUnsubscribe(std::span<const unsigned char> body, unsigned char protocolLevel,
+                                                               MqttSubscribeView &view)
+{
+    MqttReader reader(body);
+    view.packetIdentifier = reader.readTwoByteInteger();
+    view.properties = readProperties(reader, protocolLevel);
+    view.filters = reader.getRest();
+    view.filterCount = 0;
+
+    while (!reader.atEnd())
+    {
+        if (!MqttUtf8::isValid(reader.readString()))
+        {
+            reader.fail();
+        }
+        view.filterCount++;
+    }
+
+    if (!reader.isValid() || (view.packetIdentifier == 0))
+    {
+        return Result::MalformedPacket;
+    }
+    return (view.filterCount > 0) ? Result::Success : Result::ProtocolError;
+}
+
+/**
+ * DISCONNECT or AUTH. Before v5 a DISCONNECT has no body at all; from v5 the
+ * reason code and properties are each left out when there is nothing to say.
+ */
+
+MqttPacketDecoder::Result MqttPacketDecoder::decodeReason(std::span<const unsigned char> body, unsigned char protocolLevel,
+                                                          MqttReasonView &view)
+{
+    MqttReader reader(body);
+    view.reasonCode = 0;
+    view.properties = {};
+
+    if ((protocolLevel >= 5) && !reader.atEnd())
+    {
+        view.reasonCode = reader.takeByte();
+        if (!reader.atEnd())
+        {
+            view.properties = readProperties(reader, protocolLevel);
+        }
+    }
+
+    return (reader.isValid() && reader.atEnd()) ? Result::Success : Result::MalformedPacket;
+}
+
+/**
+ * Takes the next filter and its options from a decoded SUBSCRIBE
+ * @return false once there are none left
+ */
+
+bool MqttPacketDecoder::nextFilter(std::span<const unsigned char> &filters, std::string_view &filter, unsigned char &options)
+{
+    MqttReader reader(filters);
+    filter = reader.readString();
+    options = reader.readByte();
+
+    if (!reader.isValid())
+    {
+        return false;
+    }
+    filters = reader.getRest();
+    return true;
+}
+
+/**
+ * Takes the next filter from a decoded UNSUBSCRIBE
+ * @return false once there are none left
+ */
+
+bool MqttPacketDecoder::nextFilter(std::span<const unsigned char> &filters, std::string_view &filter)
+{
+    MqttReader reader(filters);
+    filter = reader.readString();
+
+    if (!reader.isValid())
+    {
+        return false;
+    }
+    filters = reader.getRest();
+    return true;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+/**
+ * The properties of a v5 packet as the raw block, Property Length included.
+ * Before v5 there are none, and nothing is read.
+ */
+
+std::span<const unsigned char> MqttPacketDecoder::readProperties(MqttReader &reader, unsigned char protocolLevel)
+{
+    if (protocolLevel < 5)
+    {
+        return {};
+    }
+
+    const std::size_t start = reader.getPosition();
+    reader.readBytes(reader.readVariableByteInteger());
+    return reader.getBytes().subspan(start, reader.getPosition() - start);
+}
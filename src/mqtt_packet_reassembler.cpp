@@ -0,0 +1,236 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include <string.h>
+#include "mqtt_memory_pool.h"
+#include "mqtt_packet_reassembler.h"
+
+MqttPacketReassembler::MqttPacketReassembler()
+{
+    buffer_ = nullptr;
+    resetFrame();
+}
+
+MqttPacketReassembler::~MqttPacketReassembler()
+{
+    releaseBuffer();
+}
+
+/**
+ * Feeds one TCP segment into the reassembler. Every complete frame found is
+ * passed to cb before this returns; any trailing partial frame is kept until
+ * the next segment arrives.
+ * @return Success, or the reason the stream can't be decoded. After an error
+ *         the stream is out of sync and the connection should be closed.
+ */
+
+MqttPacketReassembler::Result MqttPacketReassembler::addSegment(const unsigned char *data, std::size_t len, FrameCb cb, void *obj)
+{
+    std::size_t pos = 0;
+
+    while (pos < len)
+    {
+        if (bufferedLength_ == 0)
+        {
+            // Nothing is pending, so if the whole frame is in this segment it can be
+            // handed up in place
+
+            std::size_t frameLength = 0;
+            HeaderResult header = decodeFrameLength(data + pos, len - pos, frameLength);
+
+            if (header == HeaderResult::Malformed)
+            {
+                MQTT_WARNING("malformed remaining length in received packet");
+                return Result::MalformedRemainingLength;
+            }
+
+            if (header == HeaderResult::Complete)
+            {
+                if (frameLength > MQTT_BUF_SIZE)
+                {
+                    MQTT_WARNING("received packet of %zu bytes is too large", frameLength);
+                    return Result::PacketTooLarge;
+                }
+
+                if (frameLength <= len - pos)
+                {
+                    cb(obj, std::span<const unsigned char>(data + pos, frameLength));
+                    pos += frameLength;
+                    continue;
+                }
+            }
+        }
+
+        // The frame runs past the end of this segment (or started in an earlier one)
+
+        std::size_t consumed = 0;
+        Result result = gatherPartialFrame(data + pos, len - pos, consumed, cb, obj);
+
+        if (result != Result::Success)
+        {
+            return result;
+        }
+        pos += consumed;
+    }
+
+    return Result::Success;
+}
+
+/**
+ * Discards any partially received frame
+ */
+
+void MqttPacketReassembler::reset()
+{
+    resetFrame();
+    releaseBuffer();
+}
+
+/**
+ * @return the number of bytes of an incomplete frame currently held
+ */
+
+std::size_t MqttPacketReassembler::getBufferedLength() const
+{
+    return bufferedLength_;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+MqttPacketReassembler::HeaderResult MqttPacketReassembler::decodeFrameLength(const unsigned char *data, std::size_t len, std::size_t &frameLength)
+{
+    std::size_t remainingLength = 0;
+    std::size_t multiplier = 1;
+
+    // byte 0 is the packet type and flags, the Remaining Length is at most 4 bytes
+
+    for (std::size_t i = 1; i <= 4; i++)
+    {
+        if (i >= len)
+        {
+            return HeaderResult::Incomplete;
+        }
+
+        remainingLength += (data[i] & 0x7F) * multiplier;
+
+        if ((data[i] & 0x80) == 0)
+        {
+            frameLength = 1 + i + remainingLength;
+            return HeaderResult::Complete;
+        }
+        multiplier *= 128;
+    }
+
+    return HeaderResult::Malformed;
+}
+
+MqttPacketReassembler::Result MqttPacketReassembler::gatherPartialFrame(const unsigned char *data, std::size_t len, std::size_t &consumed, FrameCb cb, void *obj)
+{
+    consumed = 0;
+
+    if (buffer_ == nullptr)
+    {
+        buffer_ = static_cast<unsigned char *>(MqttMemoryPool::getInstance().allocate(MQTT_BUF_SIZE));
+        if (buffer_ == nullptr)
+        {
+            MQTT_ERROR("no reassembly buffer available");
+            return Result::OutOfMemory;
+        }
+    }
+
+    // Decode the fixed header a byte at a time, as it may itself be split
+
+    while ((frameLength_ == 0) && (consumed < len))
+    {
+        unsigned char byte = data[consumed++];
+        buffer_[bufferedLength_++] = byte;
+
+        if (bufferedLength_ == 1)
+        {
+            continue; // packet type and flags
+        }
+
+        remainingLength_ |= static_cast<std::size_t>(byte & 0x7F) << (7 * lengthBytes_);
+        lengthBytes_++;
+
+        if ((byte & 0x80) == 0)
+        {
+            frameLength_ = 1 + lengthBytes_ + remainingLength_;
+
+            if (frameLength_ > MQTT_BUF_SIZE)
+            {
+                MQTT_WARNING("received packet of %zu bytes is too large", frameLength_);
+                return Result::PacketTooLarge;
+            }
+        }
+        else if (lengthBytes_ == 4)
+        {
+            MQTT_WARNING("malformed remaining length in received packet");
+            return Result::MalformedRemainingLength;
+        }
+    }
+
+    if (frameLength_ == 0)
+    {
+        return Result::Success; // still waiting for the rest of the header
+    }
+
+    // Copy as much of the body as this segment holds in one go
+
+    std::size_t wanted = frameLength_ - bufferedLength_;
+    std::size_t available = len - consumed;
+    std::size_t count = (wanted < available) ? wanted : available;
+
+    memcpy(&buffer_[bufferedLength_], data + consumed, count);
+    bufferedLength_ += count;
+    consumed += count;
+
+    if (bufferedLength_ == frameLength_)
+    {
+        std::size_t frameLength = frameLength_;
+        resetFrame();
+        cb(obj, std::span<const unsigned char>(buffer_, frameLength));
+        releaseBuffer();
+    }
+
+    return Result::Success;
+}
+
+void MqttPacketReassembler::resetFrame()
+{
+    bufferedLength_ = 0;
+    frameLength_ = 0;
+    remainingLength_ = 0;
+    lengthBytes_ = 0;
+}
+
+void MqttPacketReassembler::releaseBuffer()
+{
+    if (buffer_ != nullptr)
+    {
+        MqttMemoryPool::getInstance().deallocate(buffer_);
+        buffer_ = nullptr;
+    }
+}
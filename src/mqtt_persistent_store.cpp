@@ -0,0 +1,609 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_persistent_store.h"
+
+#ifdef MQTT_PERSISTENCE
+
+#include <array>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // lookup table for checksum(), reflected polynomial 0xEDB88320
+
+    constexpr std::array<std::uint32_t, 256> CRC_TABLE = [] {
+        std::array<std::uint32_t, 256> table = {};
+        for (std::uint32_t i = 0; i < 256; i++)
+        {
+            std::uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : (crc >> 1);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    // the log is little endian whatever the host is
+
+    void put16(unsigned char *p, std::uint32_t value)
+    {
+        p[0] = value & 0xFF;
+        p[1] = (value >> 8) & 0xFF;
+    }
+
+    void put32(unsigned char *p, std::uint32_t value)
+    {
+        put16(p, value);
+        put16(p + 2, value >> 16);
+    }
+
+    std::uint32_t get16(const unsigned char *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    std::uint32_t get32(const unsigned char *p)
+    {
+        return get16(p) | (get16(p + 2) << 16);
+    }
+}
+
+MqttPersistentStore::MqttPersistentStore()
+{
+    directory_[0] = '\0';
+    fd_ = -1;
+    base_ = nullptr;
+    used_ = 0;
+    firstSequence_ = 0;
+    activeSequence_ = 0;
+    logBytes_ = 0;
+    compactedBytes_ = 0;
+    checkpointBytes_ = 0;
+    replayed_ = 0;
+}
+
+MqttPersistentStore::~MqttPersistentStore()
+{
+    close();
+}
+
+/**
+ * Opens the log in a directory, creating it if need be, and replays every record
+ * from a position onwards through cb, oldest first. New records are appended
+ * after the last one that was intact.
+ * @return false if the directory or a segment can't be opened
+ */
+
+bool MqttPersistentStore::open(const char *directory, ReplayCb cb, void *obj, const Position &from)
+{
+    close();
+
+    std::size_t length = strlen(directory);
+    if (length >= sizeof(directory_)) // leaves room for a segment's name
+    {
+        MQTT_ERROR("persistent store path too long: %s", directory);
+        return false;
+    }
+    memcpy(directory_, directory, length + 1);
+
+    if ((mkdir(directory_, 0755) < 0) && (errno != EEXIST))
+    {
+        MQTT_ERROR("unable to create the persistent store %s: %s", directory_, strerror(errno));
+        return false;
+    }
+
+    DIR *dir = opendir(directory_);
+    if (dir == nullptr)
+    {
+        MQTT_ERROR("unable to read the persistent store %s: %s", directory_, strerror(errno));
+        return false;
+    }
+
+    std::uint32_t first = 0;
+    std::uint32_t last = 0;
+    bool found = false;
+
+    for (dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        unsigned int sequence;
+        char suffix[5];
+
+        if ((strlen(entry->d_name) == 12) && (sscanf(entry->d_name, "%8x.%3s", &sequence, suffix) == 2) &&
+            (strcmp(suffix, "seg") == 0))
+        {
+            first = (!found || (sequence < first)) ? sequence : first;
+            last = (!found || (sequence > last)) ? sequence : last;
+            found = true;
+        }
+    }
+    closedir(dir);
+
+    replayed_ = 0;
+    logBytes_ = 0;
+    compactedBytes_ = 0;
+    checkpointBytes_ = 0;
+
+    if (!found)
+    {
+        // never go back below a checkpoint, or the records after it would be skipped
+        firstSequence_ = activeSequence_ = (from.sequence > 1) ? from.sequence : 1;
+        return openSegment(activeSequence_, true);
+    }
+
+    std::size_t lastEnd = 0;
+    bool lastSizeDiffers = false;
+
+    for (std::uint32_t sequence = first; sequence <= last; sequence++)
+    {
+        if (sequence < from.sequence)
+        {
+            continue; // already in the owner's checkpoint
+        }
+
+        char path[MQTT_STORE_PATH_LENGTH];
+        if (!formatPath(sequence, path, sizeof(path)))
+        {
+            MQTT_ERROR("persistent store path too long: %s", directory_);
+            return false;
+        }
+
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            continue; // deleted by a compaction that didn't finish
+        }
+
+        struct stat info = {};
+        std::size_t end = 0;
+
+        if ((fstat(fd, &info) == 0) && (info.st_size > 0))
+        {
+            void *map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                std::size_t skip = (sequence == from.sequence) ? from.offset : 0;
+                end = replaySegment(static_cast<const unsigned char *>(map), info.st_size, skip, cb, obj);
+                logBytes_ += (end > skip) ? end - skip : 0;
+                munmap(map, info.st_size);
+            }
+        }
+        ::close(fd);
+
+        if (sequence == last)
+        {
+            lastEnd = end;
+            lastSizeDiffers = (static_cast<std::size_t>(info.st_size) != MQTT_STORE_SEGMENT_SIZE);
+        }
+    }
+
+    firstSequence_ = first;
+    activeSequence_ = last;
+
+    if (last < from.sequence)
+    {
+        activeSequence_ = from.sequence;
+        return openSegment(activeSequence_, true);
+    }
+
+    // a segment written with another MQTT_STORE_SEGMENT_SIZE is left as it is
+
+    if (lastSizeDiffers)
+    {
+        return openSegment(++activeSequence_, true);
+    }
+
+    if (!openSegment(activeSequence_, false))
+    {
+        return false;
+    }
+
+    // clear whatever a torn record left behind so it can't be read back later
+    used_ = lastEnd;
+    memset(base_ + used_, 0, MQTT_STORE_SEGMENT_SIZE - used_);
+    return true;
+}
+
+void MqttPersistentStore::close()
+{
+    closeSegment();
+    firstSequence_ = 0;
+    activeSequence_ = 0;
+}
+
+bool MqttPersistentStore::isOpen() const
+{
+    return base_ != nullptr;
+}
+
+/**
+ * Copies one record onto the end of the log, moving on to a new segment when the
+ * current one has no room for it.
+ * @return false if the store isn't open, the record is larger than a segment or
+ *         a new segment can't be created
+ */
+
+bool MqttPersistentStore::append(const Record &record)
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    std::size_t body = FIXED_BODY + record.clientId.size() + record.topic.size() + record.payload.size();
+
+    if ((record.clientId.size() > 0xFFFF) || (record.topic.size() > 0xFFFF) ||
+        (HEADER_SIZE + body > MQTT_STORE_SEGMENT_SIZE))
+    {
+        MQTT_WARNING("record too large for the persistent store");
+        return false;
+    }
+
+    if (used_ + HEADER_SIZE + body > MQTT_STORE_SEGMENT_SIZE)
+    {
+        closeSegment();
+        if (!openSegment(++activeSequence_, true))
+        {
+            return false;
+        }
+    }
+
+    unsigned char *out = base_ + used_ + HEADER_SIZE;
+
+    out[0] = static_cast<unsigned char>(record.type);
+    out[1] = record.qos;
+    put16(&out[2], record.clientId.size());
+    put16(&out[4], record.topic.size());
+    put32(&out[6], record.payload.size());
+    out += FIXED_BODY;
+
+    if (!record.clientId.empty())
+    {
+        memcpy(out, record.clientId.data(), record.clientId.size());
+        out += record.clientId.size();
+    }
+    if (!record.topic.empty())
+    {
+        memcpy(out, record.topic.data(), record.topic.size());
+        out += record.topic.size();
+    }
+    if (!record.payload.empty())
+    {
+        memcpy(out, record.payload.data(), record.payload.size());
+    }
+
+    // the length goes in last, until then the record reads as the end of the log
+
+    unsigned char *header = base_ + used_;
+    put32(&header[4], checksum(header + HEADER_SIZE, body));
+    put32(&header[0], body);
+
+    used_ += HEADER_SIZE + body;
+    logBytes_ += HEADER_SIZE + body;
+    return true;
+}
+
+/**
+ * Waits for the active segment to reach the disk. Without this the records are
+ * still safe from the broker crashing, but not from the machine losing power.
+ */
+
+bool MqttPersistentStore::sync()
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    if (msync(base_, used_, MS_SYNC) < 0)
+    {
+        MQTT_ERROR("unable to sync the persistent store: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool MqttPersistentStore::needsCompaction() const
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    return (getSegmentCount() >= MQTT_STORE_MAX_SEGMENTS) ||
+           ((logBytes_ > MQTT_STORE_SEGMENT_SIZE) && (logBytes_ > compactedBytes_ * MQTT_STORE_COMPACT_RATIO));
+}
+
+/**
+ * Rewrites the log as just the live state: a new segment is started, cb appends
+ * a record for everything that is still live, and only then are the older
+ * segments deleted.
+ * @return false if cb failed, in which case the older segments are kept
+ */
+
+bool MqttPersistentStore::compact(SnapshotCb cb, void *obj)
+{
+    if (!isOpen())
+    {
+        return false;
+    }
+
+    std::uint32_t oldFirst = firstSequence_;
+    std::uint32_t oldLast = activeSequence_;
+    std::size_t oldUsed = used_;
+    std::size_t oldBytes = logBytes_;
+
+    closeSegment();
+    if (!openSegment(oldLast + 1, true))
+    {
+        openSegment(oldLast, false);
+        used_ = oldUsed;
+        return false;
+    }
+    activeSequence_ = oldLast + 1;
+    logBytes_ = 0;
+
+    if (!cb(obj, *this) || !sync())
+    {
+        MQTT_WARNING("persistent store compaction failed, keeping the old log");
+        logBytes_ += oldBytes;
+        return false;
+    }
+
+    removeSegments(oldFirst, oldLast);
+    firstSequence_ = oldLast + 1;
+    compactedBytes_ = logBytes_;
+    return true;
+}
+
+/**
+ * Starts a new segment for the records that follow a checkpoint
+ * @return where the new segment starts, or {0, 0} if it couldn't be created
+ */
+
+MqttPersistentStore::Position MqttPersistentStore::beginCheckpoint()
+{
+    if (!isOpen())
+    {
+        return {0, 0};
+    }
+
+    if (used_ > 0)
+    {
+        std::size_t oldUsed = used_;
+        closeSegment();
+        if (!openSegment(activeSequence_ + 1, true))
+        {
+            openSegment(activeSequence_, false);
+            used_ = oldUsed;
+            return {0, 0};
+        }
+        activeSequence_++;
+    }
+
+    checkpointBytes_ = logBytes_;
+    return {activeSequence_, 0};
+}
+
+/**
+ * Drops the segments before a checkpoint once the owner's copy of the state is
+ * safe. snapshotBytes, the size of that copy, sets how far the log may grow
+ * before needsCompaction() asks for the next one.
+ */
+
+void MqttPersistentStore::endCheckpoint(const Position &position, std::size_t snapshotBytes)
+{
+    if (!isOpen() || (position.sequence <= firstSequence_) || (position.sequence > activeSequence_))
+    {
+        return;
+    }
+
+    removeSegments(firstSequence_, position.sequence - 1);
+    firstSequence_ = position.sequence;
+    logBytes_ = (logBytes_ > checkpointBytes_) ? logBytes_ - checkpointBytes_ : 0;
+    checkpointBytes_ = 0;
+    compactedBytes_ = snapshotBytes;
+}
+
+std::size_t MqttPersistentStore::getSegmentCount() const
+{
+    return isOpen() ? (activeSequence_ - firstSequence_ + 1) : 0;
+}
+
+std::size_t MqttPersistentStore::getLogBytes() const
+{
+    return logBytes_;
+}
+
+/**
+ * @return the number of records replayed by the last open()
+ */
+
+std::size_t MqttPersistentStore::getReplayedCount() const
+{
+    return replayed_;
+}
+
+const char *MqttPersistentStore::getDirectory() const
+{
+    return directory_;
+}
+
+/**
+ * CRC-32 as used by zlib and Ethernet
+ */
+
+std::uint32_t MqttPersistentStore::checksum(const unsigned char *data, std::size_t length)
+{
+    std::uint32_t crc = 0xFFFFFFFFu;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        crc = CRC_TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+bool MqttPersistentStore::formatPath(std::uint32_t sequence, char *path, std::size_t size) const
+{
+    int written = snprintf(path, size, "%s/%08x.seg", directory_, static_cast<unsigned int>(sequence));
+    return (written > 0) && (static_cast<std::size_t>(written) < size);
+}
+
+bool MqttPersistentStore::openSegment(std::uint32_t sequence, bool create)
+{
+    char path[MQTT_STORE_PATH_LENGTH];
+    if (!formatPath(sequence, path, sizeof(path)))
+    {
+        MQTT_ERROR("persistent store path too long: %s", directory_);
+        return false;
+    }
+
+    int fd = ::open(path, create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR, 0644);
+    if (fd < 0)
+    {
+        MQTT_ERROR("unable to open %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, MQTT_STORE_SEGMENT_SIZE) < 0)
+    {
+        MQTT_ERROR("unable to size %s: %s", path, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, MQTT_STORE_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        MQTT_ERROR("unable to map %s: %s", path, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    fd_ = fd;
+    base_ = static_cast<unsigned char *>(map);
+    used_ = 0;
+    return true;
+}
+
+void MqttPersistentStore::closeSegment()
+{
+    if (base_ != nullptr)
+    {
+        msync(base_, used_, MS_SYNC);
+        munmap(base_, MQTT_STORE_SEGMENT_SIZE);
+        base_ = nullptr;
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    used_ = 0;
+}
+
+/**
+ * Hands every intact record of one segment from the offset onwards to cb
+ * @return the offset just past the last intact record
+ */
+
+std::size_t MqttPersistentStore::replaySegment(const unsigned char *base, std::size_t size, std::size_t from, ReplayCb cb, void *obj)
+{
+    std::size_t offset = 0;
+
+    while (offset + HEADER_SIZE <= size)
+    {
+        const unsigned char *header = base + offset;
+        std::size_t body = get32(&header[0]);
+
+        if (body == 0)
+        {
+            break; // the end of the log
+        }
+
+        const unsigned char *in = header + HEADER_SIZE;
+
+        if ((body < FIXED_BODY) || (body > size - offset - HEADER_SIZE) || (checksum(in, body) != get32(&header[4])))
+        {
+            MQTT_WARNING("persistent store record at %zu is damaged, ignoring the rest of the segment", offset);
+            break;
+        }
+
+        std::size_t clientIdLength = get16(&in[2]);
+        std::size_t topicLength = get16(&in[4]);
+        std::size_t payloadLength = get32(&in[6]);
+
+        if (FIXED_BODY + clientIdLength + topicLength + payloadLength != body)
+        {
+            MQTT_WARNING("persistent store record at %zu has bad lengths, ignoring the rest of the segment", offset);
+            break;
+        }
+
+        const char *text = reinterpret_cast<const char *>(in + FIXED_BODY);
+        Record record = {static_cast<RecordType>(in[0]), in[1],
+                         std::string_view(text, clientIdLength),
+                         std::string_view(text + clientIdLength, topicLength),
+                         std::span<const unsigned char>(in + FIXED_BODY + clientIdLength + topicLength, payloadLength)};
+        if (offset >= from)
+        {
+            cb(obj, record);
+            replayed_++;
+        }
+
+        offset += HEADER_SIZE + body;
+    }
+    return offset;
+}
+
+void MqttPersistentStore::removeSegments(std::uint32_t first, std::uint32_t last)
+{
+    for (std::uint32_t sequence = first; sequence <= last; sequence++)
+    {
+        char path[MQTT_STORE_PATH_LENGTH];
+        if (!formatPath(sequence, path, sizeof(path)))
+        {
+            MQTT_WARNING("persistent store path too long: %s", directory_);
+            return;
+        }
+
+        if ((unlink(path) < 0) && (errno != ENOENT))
+        {
+            MQTT_WARNING("unable to remove %s: %s", path, strerror(errno));
+        }
+    }
+}
+
+#endif /* MQTT_PERSISTENCE */
@@ -40,16 +40,21 @@
 MqttPingreqParser::MqttPingreqParser() {}
 
 // Parse the PINGREQ message
-MqttMessageParser::ParseResult  MqttPingreqParser::parseMessage(const std::vector<unsigned char> &pingreqMessage)
+MqttMessageParser::ParseResult  MqttPingreqParser::parseMessage(std::span<const unsigned char> pingreqMessage)
 {
-    pingreqMessage_ = pingreqMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(pingreqMessage);
     parseFixedHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttPingreqParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = pingreqMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
+
+    // The remaining length, which must account for the rest of the packet
+    if (reader_.readVariableByteInteger() != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 }
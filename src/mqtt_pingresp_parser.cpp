@@ -37,16 +37,21 @@
 
 MqttPingrespParser::MqttPingrespParser() {}
 
-MqttMessageParser::ParseResult MqttPingrespParser::parseMessage(const std::vector<unsigned char> &pingrespMessage)
+MqttMessageParser::ParseResult MqttPingrespParser::parseMessage(std::span<const unsigned char> pingrespMessage)
 {
-    pingrespMessage_ = pingrespMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(pingrespMessage);
     parseFixedHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttPingrespParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = pingrespMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
+
+    // The remaining length, which must account for the rest of the packet
+    if (reader_.readVariableByteInteger() != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 }
@@ -0,0 +1,219 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_property_bag.h"
+#include "mqtt_reader.h"
+
+MqttPropertyBag::MqttPropertyBag()
+{
+    count_ = 0;
+    userCount_ = 0;
+}
+
+/**
+ * empties the bag and points it at the packet the next properties come from
+ */
+
+void MqttPropertyBag::reset(std::span<const unsigned char> message)
+{
+    message_ = message;
+    count_ = 0;
+    userCount_ = 0;
+}
+
+/**
+ * records where a property value sits in the packet. User Property may appear
+ * more than once, and so may Subscription Identifier in a PUBLISH (one per
+ * matching subscription); any other property appearing twice is a protocol
+ * error. User Properties past MAX_MQTT_USER_PROPERTIES are skipped rather than
+ * failing the packet.
+ * @return false if the property is a duplicate or the bag is full
+ */
+
+bool MqttPropertyBag::add(MqttPropertyTypes propertyId, std::size_t offset, std::size_t length, MqttPacketType packetType)
+{
+    if (propertyId == MqttPropertyTypes::UserProperty)
+    {
+        if (userCount_ == MAX_MQTT_USER_PROPERTIES)
+        {
+            MQTT_INFO("skipping user property past the first %d", MAX_MQTT_USER_PROPERTIES);
+            return true;
+        }
+
+        userProperties_[userCount_++] = {propertyId, static_cast<unsigned int>(offset), static_cast<unsigned int>(length)};
+        return true;
+    }
+
+    const bool repeatable = (propertyId == MqttPropertyTypes::SubscriptionIdentifier) && (packetType == MqttPacketType::Publish);
+
+    if (!repeatable && (find(propertyId) != nullptr))
+    {
+        MQTT_WARNING("property 0x%x included more than once", static_cast<unsigned char>(propertyId));
+        return false;
+    }
+
+    if (count_ == MAX_MQTT_PROPERTIES)
+    {
+        MQTT_WARNING("too many properties in packet");
+        return false;
+    }
+
+    properties_[count_++] = {propertyId, static_cast<unsigned int>(offset), static_cast<unsigned int>(length)};
+    return true;
+}
+
+std::size_t MqttPropertyBag::getCount() const
+{
+    return count_ + userCount_;
+}
+
+bool MqttPropertyBag::contains(MqttPropertyTypes propertyId) const
+{
+    return find(propertyId) != nullptr;
+}
+
+bool MqttPropertyBag::getByte(MqttPropertyTypes propertyId, unsigned char &value) const
+{
+    const Property *property = find(propertyId);
+
+    if ((property == nullptr) || !isWireType(propertyId, MqttMessageParser::MqttPropertyWireType::Byte))
+    {
+        return false;
+    }
+
+    value = message_[property->offset];
+    return true;
+}
+
+bool MqttPropertyBag::getTwoByteInteger(MqttPropertyTypes propertyId, unsigned short &value) const
+{
+    const Property *property = find(propertyId);
+
+    if ((property == nullptr) || !isWireType(propertyId, MqttMessageParser::MqttPropertyWireType::TwoByteInteger))
+    {
+        return false;
+    }
+
+    value = MqttReader(message_.subspan(property->offset, property->length)).readTwoByteInteger();
+    return true;
+}
+
+bool MqttPropertyBag::getFourByteInteger(MqttPropertyTypes propertyId, unsigned long &value) const
+{
+    const Property *property = find(propertyId);
+
+    if ((property == nullptr) || !isWireType(propertyId, MqttMessageParser::MqttPropertyWireType::FourByteInteger))
+    {
+        return false;
+    }
+
+    value = MqttReader(message_.subspan(property->offset, property->length)).readFourByteInteger();
+    return true;
+}
+
+bool MqttPropertyBag::getVariableByteInteger(MqttPropertyTypes propertyId, unsigned long &value) const
+{
+    const Property *property = find(propertyId);
+
+    if ((property == nullptr) || !isWireType(propertyId, MqttMessageParser::MqttPropertyWireType::VariableByteInteger))
+    {
+        return false;
+    }
+
+    value = MqttReader(message_.subspan(property->offset, property->length)).readVariableByteInteger();
+    return true;
+}
+
+bool MqttPropertyBag::getString(MqttPropertyTypes propertyId, std::string_view &value) const
+{
+    const Property *property = find(propertyId);
+
+    if ((property == nullptr) || !isWireType(propertyId, MqttMessageParser::MqttPropertyWireType::Utf8String))
+    {
+        return false;
+    }
+
+    value = std::string_view(reinterpret_cast<const char *>(message_.data()) + property->offset, property->length);
+    return true;
+}
+
+bool MqttPropertyBag::getBinaryData(MqttPropertyTypes propertyId, std::span<const unsigned char> &value) const
+{
+    const Property *property = find(propertyId);
+
+    if ((property == nullptr) || !isWireType(propertyId, MqttMessageParser::MqttPropertyWireType::BinaryData))
+    {
+        return false;
+    }
+
+    value = message_.subspan(property->offset, property->length);
+    return true;
+}
+
+std::size_t MqttPropertyBag::getUserPropertyCount() const
+{
+    return userCount_;
+}
+
+/**
+ * gets the n'th User Property, in the order they appeared in the packet
+ */
+
+bool MqttPropertyBag::getUserProperty(std::size_t n, std::string_view &name, std::string_view &value) const
+{
+    if (n >= userCount_)
+    {
+        return false;
+    }
+
+    MqttReader pair(message_.subspan(userProperties_[n].offset, userProperties_[n].length));
+    name = pair.readString();
+    value = pair.readString();
+    return true;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+const MqttPropertyBag::Property *MqttPropertyBag::find(MqttPropertyTypes propertyId) const
+{
+    if (propertyId == MqttPropertyTypes::UserProperty)
+    {
+        return (userCount_ > 0) ? &userProperties_[0] : nullptr;
+    }
+
+    for (unsigned char i = 0; i < count_; i++)
+    {
+        if (properties_[i].propertyId == propertyId)
+        {
+            return &properties_[i];
+        }
+    }
+    return nullptr;
+}
+
+bool MqttPropertyBag::isWireType(MqttPropertyTypes propertyId, MqttMessageParser::MqttPropertyWireType wireType) const
+{
+    return MqttMessageParser::getPropertyInfo(static_cast<unsigned char>(propertyId)).wireType == wireType;
+}
@@ -38,49 +38,36 @@
 
 MqttPubackParser::MqttPubackParser() {}
 
-MqttMessageParser::ParseResult MqttPubackParser::parseMessage(const std::vector<unsigned char> &pubackMessage)
+MqttMessageParser::ParseResult MqttPubackParser::parseMessage(std::span<const unsigned char> pubackMessage)
 {
-    pubackMessage_ = pubackMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(pubackMessage);
     parseFixedHeader();
     parseVariableHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttPubackParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = pubackMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttPubackParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttPubackParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = pubackMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttPubackParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (pubackMessage_[currentIndex_++] << 8) + pubackMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 int MqttPubackParser::getPacketIdentifier() const
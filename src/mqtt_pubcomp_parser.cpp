@@ -39,49 +39,36 @@
 
 MqttPubcompParser::MqttPubcompParser() {}
 
-MqttMessageParser::ParseResult MqttPubcompParser::parseMessage(const std::vector<unsigned char> &pubcompMessage)
+MqttMessageParser::ParseResult MqttPubcompParser::parseMessage(std::span<const unsigned char> pubcompMessage)
 {
-    pubcompMessage_ = pubcompMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(pubcompMessage);
     parseFixedHeader();
     parseVariableHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttPubcompParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = pubcompMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttPubcompParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttPubcompParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = pubcompMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttPubcompParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (pubcompMessage_[currentIndex_++] << 8) + pubcompMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 int MqttPubcompParser::getPacketIdentifier() const
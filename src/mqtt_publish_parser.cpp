@@ -40,26 +40,29 @@
 MqttPublishParser::MqttPublishParser() {}
 
 // Parse the PUBLISH message
-MqttMessageParser::ParseResult MqttPublishParser::parseMessage(const std::vector<unsigned char> &publishMessage)
+MqttMessageParser::ParseResult MqttPublishParser::parseMessage(std::span<const unsigned char> publishMessage)
 {
-    publishMessage_ = publishMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(publishMessage);
     parseFixedHeader();
     parseVariableHeader();
     parsePayload();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttPublishParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = publishMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttPublishParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parseTopicName();
@@ -76,35 +79,13 @@ void MqttPublishParser::parsePayload()
     // Note: This is a simplified example, and you might need to handle various cases
 }
 
-int MqttPublishParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = publishMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttPublishParser::parseTopicName()
 {
-    // Read the length of the topic name
-    int topicNameLength = (publishMessage_[currentIndex_++] << 8) + publishMessage_[currentIndex_++];
-
-    // Extract the topic name from the payload
-    topicName_ = std::string(publishMessage_.begin() + currentIndex_,
-                             publishMessage_.begin() + currentIndex_ + topicNameLength);
-
-    currentIndex_ += topicNameLength;
+    // The topic name is a view into the received message, not a copy of it
+    topicName_ = reader_.readString();
 }
 
 void MqttPublishParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (publishMessage_[currentIndex_++] << 8) + publishMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
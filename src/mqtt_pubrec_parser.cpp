@@ -39,49 +39,36 @@
 MqttPubrecParser::MqttPubrecParser() {}
 
 // Parse the PUBREC message
-MqttMessageParser::ParseResult MqttPubrecParser::parseMessage(const std::vector<unsigned char> &pubrecMessage)
+MqttMessageParser::ParseResult MqttPubrecParser::parseMessage(std::span<const unsigned char> pubrecMessage)
 {
-    pubrecMessage_ = pubrecMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(pubrecMessage);
     parseFixedHeader();
     parseVariableHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttPubrecParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = pubrecMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttPubrecParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttPubrecParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = pubrecMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttPubrecParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (pubrecMessage_[currentIndex_++] << 8) + pubrecMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 int MqttPubrecParser::getPacketIdentifier() const
@@ -38,49 +38,36 @@
 
 MqttPubrelParser::MqttPubrelParser() {}
 
-MqttMessageParser::ParseResult MqttPubrelParser::parseMessage(const std::vector<unsigned char> &pubrelMessage)
+MqttMessageParser::ParseResult MqttPubrelParser::parseMessage(std::span<const unsigned char> pubrelMessage)
 {
-    pubrelMessage_ = pubrelMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(pubrelMessage);
     parseFixedHeader();
     parseVariableHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttPubrelParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = pubrelMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttPubrelParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttPubrelParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = pubrelMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttPubrelParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (pubrelMessage_[currentIndex_++] << 8) + pubrelMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 int MqttPubrelParser::getPacketIdentifier() const
@@ -0,0 +1,552 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include <string.h>
+#include <type_traits>
+#include "mqtt_retained_store.h"
+#include "mqtt_topic.h"
+
+MqttRetainedStore::MqttRetainedStore()
+{
+    maxBytes_ = MAX_RETAINED_BYTES;
+    clear();
+}
+
+/**
+ * removes every retained message, the memory limit is kept
+ */
+
+void MqttRetainedStore::clear()
+{
+    for (std::size_t i = 0; i < CHILD_BUCKETS; i++)
+    {
+        buckets_[i] = NO_ENTRY;
+    }
+
+    // node 0 is the root and is never freed, the rest go on the free list
+
+    for (int i = 0; i < MAX_RETAINED_NODES; i++)
+    {
+        nodes_[i].parent = NO_ENTRY;
+        nodes_[i].nextInBucket = (i + 1 < MAX_RETAINED_NODES) ? i + 1 : NO_ENTRY;
+        nodes_[i].firstChild = NO_ENTRY;
+        nodes_[i].nextSibling = NO_ENTRY;
+        nodes_[i].childCount = 0;
+        nodes_[i].levelLength = 0;
+        messages_[i].publish.reset();
+        messages_[i].qos = 0;
+    }
+    nodes_[ROOT_NODE].nextInBucket = NO_ENTRY;
+    freeNodes_ = (MAX_RETAINED_NODES > 1) ? 1 : NO_ENTRY;
+    nodeCount_ = 1;
+    messageCount_ = 0;
+    bytesUsed_ = 0;
+}
+
+/**
+ * Retains a message for a topic, replacing whatever was retained there before.
+ * An empty payload removes the retained message instead, as the spec requires.
+ * @return false if the topic is not a valid topic name, or the store has no room
+ *         for the message within MAX_RETAINED_TOPICS and the memory limit
+ */
+
+bool MqttRetainedStore::store(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos)
+{
+    if (payload.empty())
+    {
+        remove(topic);
+        return true;
+    }
+    return store(MqttSharedPublish::create(topic, payload), qos);
+}
+
+/**
+ * Retains an already encoded PUBLISH, so the message the broker has just sent to
+ * its subscribers is kept without copying it again.
+ */
+
+bool MqttRetainedStore::store(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos)
+{
+    if (publish == nullptr)
+    {
+        return false;
+    }
+
+    std::string_view topic = publish->getTopic();
+
+    if (publish->getPayload().empty())
+    {
+        remove(topic);
+        return true;
+    }
+
+    MqttTopicScan scan;
+    MqttTopic::scan(topic, scan);
+
+    if (!scan.isValidTopicName() || !scan.levelsFit())
+    {
+        MQTT_WARNING("retained topic is empty, too long or has a wildcard");
+        return false;
+    }
+
+    if (scan.longestLevel >= MAX_TOPIC_LENGTH)
+    {
+        MQTT_WARNING("retained topic level too long");
+        return false;
+    }
+
+    int existing = findNode(topic);
+    bool replacing = (existing != NO_ENTRY) && (messages_[existing].publish != nullptr);
+    std::size_t oldBytes = replacing ? sizeOf(messages_[existing].publish) : 0;
+
+    if (bytesUsed_ - oldBytes + sizeOf(publish) > maxBytes_)
+    {
+        MQTT_WARNING("retained message store memory limit reached");
+        return false;
+    }
+
+    if (!replacing && (messageCount_ >= MAX_RETAINED_TOPICS))
+    {
+        MQTT_WARNING("no free retained messages");
+        return false;
+    }
+
+    int node = ROOT_NODE;
+
+    for (std::size_t i = 0; i < scan.levelCount; i++)
+    {
+        int child = findOrAddChild(node, scan.getLevel(topic, i));
+
+        if (child == NO_ENTRY)
+        {
+            MQTT_WARNING("no free retained message nodes");
+            releaseNodeIfUnused(node); // unwind any nodes created for this topic
+            return false;
+        }
+        node = child;
+    }
+
+    if (!replacing)
+    {
+        messageCount_++;
+    }
+    bytesUsed_ = bytesUsed_ - oldBytes + sizeOf(publish);
+    messages_[node].publish = publish;
+    messages_[node].qos = qos;
+    return true;
+}
+
+/**
+ * Drops the retained message of a topic, pruning any branch of the tree that no
+ * longer leads to a message.
+ * @return false if nothing was retained for the topic
+ */
+
+bool MqttRetainedStore::remove(std::string_view topic)
+{
+    int node = findNode(topic);
+
+    if ((node == NO_ENTRY) || (messages_[node].publish == nullptr))
+    {
+        return false;
+    }
+
+    bytesUsed_ -= sizeOf(messages_[node].publish);
+    messageCount_--;
+    messages_[node].publish.reset();
+    releaseNodeIfUnused(node);
+    return true;
+}
+
+/**
+ * Finds every retained message whose topic matches a subscription filter and
+ * passes each to cb. A leading wildcard does not match topics starting with '$'.
+ * @return the number of matching messages
+ */
+
+std::size_t MqttRetainedStore::match(std::string_view filter, MatchCb cb, void *obj) const
+{
+    std::string_view levels[MAX_TOPIC_LENGTH];
+    std::size_t levelCount;
+
+    if (filter.empty() || !MqttTopic::splitLevels(filter, levels, MAX_TOPIC_LENGTH, levelCount))
+    {
+        return 0;
+    }
+
+    return matchLevel(ROOT_NODE, levels, levelCount, 0, cb, obj);
+}
+
+/**
+ * Passes every retained message to cb, '$' topics included
+ * @return the number of messages
+ */
+
+std::size_t MqttRetainedStore::forEach(MatchCb cb, void *obj) const
+{
+    return emitSubtree(ROOT_NODE, false, cb, obj);
+}
+
+/**
+ * Caps the topic and payload bytes held by retained messages. Messages already
+ * retained are kept, the limit only refuses new ones.
+ */
+
+void MqttRetainedStore::setMemoryLimit(std::size_t maxBytes)
+{
+    maxBytes_ = maxBytes;
+}
+
+std::size_t MqttRetainedStore::getMemoryLimit() const
+{
+    return maxBytes_;
+}
+
+std::size_t MqttRetainedStore::getMemoryUsed() const
+{
+    return bytesUsed_;
+}
+
+std::size_t MqttRetainedStore::getMessageCount() const
+{
+    return messageCount_;
+}
+
+std::size_t MqttRetainedStore::getNodeCount() const
+{
+    return nodeCount_;
+}
+
+/**
+ * @return a value that changes with anything that alters the bytes of a saved
+ *         tree: the table sizes, the node layout and the byte order
+ */
+
+std::uint32_t MqttRetainedStore::getTreeLayout()
+{
+    const std::uint32_t one = 1;
+    const std::size_t fields[] = {sizeof(Node), alignof(Node), MAX_RETAINED_NODES, CHILD_BUCKETS, MAX_TOPIC_LENGTH,
+                                  sizeof(int), *reinterpret_cast<const unsigned char *>(&one)};
+
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t field : fields)
+    {
+        hash ^= static_cast<std::uint32_t>(field);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+std::size_t MqttRetainedStore::getTreeSize()
+{
+    static_assert(std::is_trivially_copyable_v<Node>, "the tree is saved and loaded with memcpy");
+
+    return sizeof(Node) * MAX_RETAINED_NODES + sizeof(int) * CHILD_BUCKETS + 2 * sizeof(int);
+}
+
+/**
+ * Copies the tree, without the messages, into getTreeSize() bytes at out
+ */
+
+void MqttRetainedStore::saveTree(unsigned char *out) const
+{
+    const int counts[2] = {freeNodes_, static_cast<int>(nodeCount_)};
+
+    memcpy(out, nodes_, sizeof(nodes_));
+    memcpy(out + sizeof(nodes_), buckets_, sizeof(buckets_));
+    memcpy(out + sizeof(nodes_) + sizeof(buckets_), counts, sizeof(counts));
+}
+
+/**
+ * Replaces the store with a tree from saveTree(), with no messages attached yet.
+ * Every link is checked to be in range, so a damaged tree can't send a lookup
+ * outside the tables.
+ * @return false, leaving the store empty, if the tree is not consistent
+ */
+
+bool MqttRetainedStore::loadTree(const unsigned char *in)
+{
+    clear();
+
+    int counts[2];
+    memcpy(nodes_, in, sizeof(nodes_));
+    memcpy(buckets_, in + sizeof(nodes_), sizeof(buckets_));
+    memcpy(counts, in + sizeof(nodes_) + sizeof(buckets_), sizeof(counts));
+
+    auto valid = [](int index) { return (index >= NO_ENTRY) && (index < MAX_RETAINED_NODES); };
+    bool consistent = valid(counts[0]) && (counts[1] >= 1) && (counts[1] <= MAX_RETAINED_NODES);
+
+    for (int i = 0; consistent && (i < MAX_RETAINED_NODES); i++)
+    {
+        consistent = valid(nodes_[i].parent) && valid(nodes_[i].nextInBucket) && valid(nodes_[i].firstChild) &&
+                     valid(nodes_[i].nextSibling) && (nodes_[i].levelLength < MAX_TOPIC_LENGTH);
+    }
+    for (std::size_t i = 0; consistent && (i < CHILD_BUCKETS); i++)
+    {
+        consistent = valid(buckets_[i]);
+    }
+
+    if (!consistent)
+    {
+        MQTT_WARNING("saved retained message tree is damaged");
+        clear();
+        return false;
+    }
+
+    freeNodes_ = counts[0];
+    nodeCount_ = counts[1];
+    return true;
+}
+
+/**
+ * Like forEach(), but with the node each message is attached to
+ */
+
+std::size_t MqttRetainedStore::forEachNode(NodeCb cb, void *obj) const
+{
+    std::size_t count = 0;
+
+    for (int node = 0; node < MAX_RETAINED_NODES; node++)
+    {
+        if (messages_[node].publish != nullptr)
+        {
+            cb(obj, node, {messages_[node].publish, messages_[node].qos});
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * Puts a message back on the node it was saved from, after loadTree()
+ * @return false if the node isn't in the tree, already has a message, or the
+ *         message doesn't fit the store's limits
+ */
+
+bool MqttRetainedStore::attach(std::uint32_t node, const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos)
+{
+    if ((publish == nullptr) || (node == ROOT_NODE) || (node >= MAX_RETAINED_NODES) ||
+        (nodes_[node].parent == NO_ENTRY) || (messages_[node].publish != nullptr))
+    {
+        return false;
+    }
+
+    if ((messageCount_ >= MAX_RETAINED_TOPICS) || (bytesUsed_ + sizeOf(publish) > maxBytes_))
+    {
+        MQTT_WARNING("retained message store full while attaching messages");
+        return false;
+    }
+
+    messages_[node].publish = publish;
+    messages_[node].qos = qos;
+    messageCount_++;
+    bytesUsed_ += sizeOf(publish);
+    return true;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+std::size_t MqttRetainedStore::sizeOf(const MqttSharedPublish::MqttSharedPublishPtr &publish)
+{
+    return publish->getTopic().size() + publish->getPayload().size();
+}
+
+std::size_t MqttRetainedStore::matchLevel(int node, const std::string_view *levels, std::size_t levelCount,
+                                          std::size_t depth, MatchCb cb, void *obj) const
+{
+    if (depth == levelCount)
+    {
+        return emit(node, cb, obj);
+    }
+
+    const std::string_view level = levels[depth];
+    const bool skipSystem = (depth == 0);
+
+    if (level == "#")
+    {
+        // "a/#" also matches "a" itself
+        return emitSubtree(node, skipSystem, cb, obj);
+    }
+
+    if (level == "+")
+    {
+        std::size_t matched = 0;
+
+        for (int child = nodes_[node].firstChild; child != NO_ENTRY; child = nodes_[child].nextSibling)
+        {
+            if (!skipSystem || (nodes_[child].levelLength == 0) || (nodes_[child].level[0] != '$'))
+            {
+                matched += matchLevel(child, levels, levelCount, depth + 1, cb, obj);
+            }
+        }
+        return matched;
+    }
+
+    int child = findChild(node, level);
+    return (child != NO_ENTRY) ? matchLevel(child, levels, levelCount, depth + 1, cb, obj) : 0;
+}
+
+std::size_t MqttRetainedStore::emit(int node, MatchCb cb, void *obj) const
+{
+    if (messages_[node].publish == nullptr)
+    {
+        return 0;
+    }
+
+    cb(obj, {messages_[node].publish, messages_[node].qos});
+    return 1;
+}
+
+std::size_t MqttRetainedStore::emitSubtree(int node, bool skipSystem, MatchCb cb, void *obj) const
+{
+    std::size_t matched = emit(node, cb, obj);
+
+    for (int child = nodes_[node].firstChild; child != NO_ENTRY; child = nodes_[child].nextSibling)
+    {
+        if (!skipSystem || (nodes_[child].levelLength == 0) || (nodes_[child].level[0] != '$'))
+        {
+            matched += emitSubtree(child, false, cb, obj);
+        }
+    }
+    return matched;
+}
+
+std::size_t MqttRetainedStore::bucketFor(int parent, std::string_view level) const
+{
+    // FNV-1a over the parent node and the level text
+
+    std::size_t hash = 2166136261u ^ static_cast<std::size_t>(parent);
+    hash *= 16777619u;
+
+    for (char c : level)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash & (CHILD_BUCKETS - 1);
+}
+
+int MqttRetainedStore::findChild(int parent, std::string_view level) const
+{
+    for (int node = buckets_[bucketFor(parent, level)]; node != NO_ENTRY; node = nodes_[node].nextInBucket)
+    {
+        if ((nodes_[node].parent == parent) &&
+            (nodes_[node].levelLength == level.size()) &&
+            (memcmp(nodes_[node].level, level.data(), level.size()) == 0))
+        {
+            return node;
+        }
+    }
+    return NO_ENTRY;
+}
+
+int MqttRetainedStore::findOrAddChild(int parent, std::string_view level)
+{
+    int existing = findChild(parent, level);
+
+    if (existing != NO_ENTRY)
+    {
+        return existing;
+    }
+
+    if (freeNodes_ == NO_ENTRY)
+    {
+        return NO_ENTRY;
+    }
+
+    int node = freeNodes_;
+    freeNodes_ = nodes_[node].nextInBucket;
+
+    std::size_t bucket = bucketFor(parent, level);
+
+    nodes_[node].parent = parent;
+    nodes_[node].firstChild = NO_ENTRY;
+    nodes_[node].childCount = 0;
+    nodes_[node].levelLength = static_cast<unsigned char>(level.size());
+    memcpy(nodes_[node].level, level.data(), level.size());
+    nodes_[node].nextInBucket = buckets_[bucket];
+    buckets_[bucket] = node;
+
+    // the sibling list is what a '+' or '#' in a filter walks
+
+    nodes_[node].nextSibling = nodes_[parent].firstChild;
+    nodes_[parent].firstChild = node;
+    nodes_[parent].childCount++;
+    nodeCount_++;
+    return node;
+}
+
+int MqttRetainedStore::findNode(std::string_view topic) const
+{
+    std::string_view levels[MAX_TOPIC_LENGTH];
+    std::size_t levelCount;
+
+    if (topic.empty() || !MqttTopic::splitLevels(topic, levels, MAX_TOPIC_LENGTH, levelCount))
+    {
+        return NO_ENTRY;
+    }
+
+    int node = ROOT_NODE;
+
+    for (std::size_t i = 0; (i < levelCount) && (node != NO_ENTRY); i++)
+    {
+        node = findChild(node, levels[i]);
+    }
+    return node;
+}
+
+void MqttRetainedStore::releaseNodeIfUnused(int node)
+{
+    // walk up the tree freeing nodes that have neither a message nor children
+
+    while ((node != NO_ENTRY) && (node != ROOT_NODE) &&
+           (messages_[node].publish == nullptr) && (nodes_[node].childCount == 0))
+    {
+        int parent = nodes_[node].parent;
+
+        int *link = &buckets_[bucketFor(parent, std::string_view(nodes_[node].level, nodes_[node].levelLength))];
+        while (*link != node)
+        {
+            link = &nodes_[*link].nextInBucket;
+        }
+        *link = nodes_[node].nextInBucket;
+
+        link = &nodes_[parent].firstChild;
+        while (*link != node)
+        {
+            link = &nodes_[*link].nextSibling;
+        }
+        *link = nodes_[node].nextSibling;
+
+        nodes_[parent].childCount--;
+        nodes_[node].parent = NO_ENTRY;
+        nodes_[node].nextSibling = NO_ENTRY;
+        nodes_[node].nextInBucket = freeNodes_;
+        freeNodes_ = node;
+        nodeCount_--;
+
+        node = parent;
+    }
+}
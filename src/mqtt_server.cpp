@@ -20,7 +20,9 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE.
  *******************************************************************************/
-#ifdef NATIVE_BUILD
+#if defined(MQTT_EPOLL_TRANSPORT)
+#include "epoll/tcp_server.h"
+#elif defined(NATIVE_BUILD)
 #include "../test/mocks/tcp_server.h"
 #else
 #include "tcp_server.h"
@@ -42,6 +44,79 @@ void tcpSessionConnectCb(void *obj, TcpSession::TcpSessionPtr tcpSession)
     mqttServer->handleTcpSessionConnect(tcpSession);
 }
 
+// The transport callbacks of a session go through the server, so that a session
+// ending during one is only destroyed once the callback has returned
+
+void sessionMessageReceivedCb(void *obj, char *pData, unsigned short len, TcpSession::TcpSessionPtr tcpSession)
+{
+    MqttServer::SessionSlot *slot = static_cast<MqttServer::SessionSlot *>(obj);
+    MqttSession *mqttSession = slot->server->enterSession(slot->sessionId);
+    if (mqttSession != nullptr)
+    {
+        mqttSession->handleTcpIncomingMessage(tcpSession, pData, len);
+    }
+    slot->server->leaveSession();
+}
+
+void sessionMessageSentCb(void *obj, TcpSession::TcpSessionPtr tcpSession)
+{
+    MqttServer::SessionSlot *slot = static_cast<MqttServer::SessionSlot *>(obj);
+    MqttSession *mqttSession = slot->server->enterSession(slot->sessionId);
+    if (mqttSession != nullptr)
+    {
+        mqttSession->handleTcpMessageSent(tcpSession);
+    }
+    slot->server->leaveSession();
+}
+
+void sessionTcpDisconnectCb(void *obj, TcpSession::TcpSessionPtr tcpSession)
+{
+    MqttServer::SessionSlot *slot = static_cast<MqttServer::SessionSlot *>(obj);
+    MqttSession *mqttSession = slot->server->enterSession(slot->sessionId);
+    if (mqttSession != nullptr)
+    {
+        mqttSession->handleTcpDisconnect(tcpSession);
+    }
+    slot->server->leaveSession();
+}
+
+void sessionTcpReconnectCb(void *obj, signed char err, TcpSession::TcpSessionPtr tcpSession)
+{
+    MqttServer::SessionSlot *slot = static_cast<MqttServer::SessionSlot *>(obj);
+    MqttSession *mqttSession = slot->server->enterSession(slot->sessionId);
+    if (mqttSession != nullptr)
+    {
+        mqttSession->handleTcpReconnect(err, tcpSession);
+    }
+    slot->server->leaveSession();
+}
+
+void subscriptionMatchCb(void *obj, const MqttSubscriptionIndex::Subscription &subscription)
+{
+    MqttServer::PublishFanOut *fanOut = static_cast<MqttServer::PublishFanOut *>(obj);
+    fanOut->server->handleSubscriptionMatch(*fanOut, subscription);
+}
+
+std::size_t subscriberLoadCb(void *obj, MqttSubscriptionIndex::SubscriberId subscriber)
+{
+    MqttServer *mqttServer = static_cast<MqttServer *>(obj);
+    return mqttServer->getSubscriberLoad(subscriber);
+}
+
+void retainedMatchCb(void *obj, const MqttRetainedStore::Retained &retained)
+{
+    MqttServer::RetainedFanOut *fanOut = static_cast<MqttServer::RetainedFanOut *>(obj);
+    fanOut->server->handleRetainedMatch(*fanOut, retained);
+}
+
+#ifdef MQTT_PERSISTENCE
+void persistedRecordCb(void *obj, const MqttPersistentStore::Record &record)
+{
+    MqttServer *mqttServer = static_cast<MqttServer *>(obj);
+    mqttServer->handlePersistedRecord(record);
+}
+#endif
+
 /*
  * ****************************************************************************
  * Start of the public classes
@@ -52,15 +127,27 @@ MqttServer::MqttServer()
 {
     ip4_addr_set_any(&ipAddress_);
     port_ = 0;
+    publishRouterCb_ = nullptr;
+    publishRouterObj_ = nullptr;
+    busyDepth_ = 0;
+    endedCount_ = 0;
+    subscriptions_.setLoadCb(subscriberLoadCb, (void *)this);
 
     for (int i = 0; i < MAX_MQTT_SESSIONS; i++)
     {
         sessionMapping_[i].mappingValid = false;
+        sessionMapping_[i].ended = false;
+        sessionMapping_[i].slot = {this, static_cast<MqttSession::SessionId>(i)};
         sessionMapping_[i].mqttSession = nullptr;
         sessionMapping_[i].tcpSession = nullptr;
     }
 }
 
+MqttServer::~MqttServer()
+{
+    removeAllSessions();
+}
+
 bool MqttServer::startMqttClient(ip_addr_t ipAddress, unsigned short port)
 {
     ipAddress_ = ipAddress;
@@ -80,39 +167,490 @@ bool MqttServer::startMqttClient(ip_addr_t ipAddress, unsigned short port)
 }
 
 bool MqttServer::startMqttServer(unsigned short port) 
+{
+    return startMqttServer(TcpServer::getInstance(), port);
+}
+
+/**
+ * Serve connections from the given TcpServer rather than the process wide one,
+ * so that several MqttServers can each run on their own transport and thread
+ */
+
+bool MqttServer::startMqttServer(TcpServer &tcpServer, unsigned short port)
 {
     ip4_addr_set_any(&ipAddress_);
     port_ = port;
-    
-    TcpServer& tcpServer = TcpServer::getInstance();
-    tcpServer.startTcpServer(port_, tcpSessionConnectCb, (void *)this);
-    
-    // for (int i = 0; i < MAX_TCP_SESSIONS; i++)
-    // {
-    //     sessionMapping_[i].mappingValid = false;
-    //     sessionMapping_[i].mqttSession = nullptr;
-    //     sessionMapping_[i].tcpSession = nullptr;
-    // }
 
+    return tcpServer.startTcpServer(port_, tcpSessionConnectCb, (void *)this);
+}
+
+std::size_t MqttServer::getSessionCount()
+{
+    std::size_t count = 0;
+
+    for (int i = 0; i < MAX_MQTT_SESSIONS; i++)
+    {
+        if (sessionMapping_[i].mappingValid)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+MqttSubscriptionIndex &MqttServer::getSubscriptionIndex()
+{
+    return subscriptions_;
+}
+
+/**
+ * Choose how a shared subscription group picks the session each message goes to
+ */
+
+void MqttServer::setShareStrategy(MqttSubscriptionIndex::ShareStrategy strategy)
+{
+    subscriptions_.setShareStrategy(strategy);
+}
+
+/**
+ * The PUBLISHes a session has waiting to go plus those waiting for an
+ * acknowledgement, which is how LeastInflight weighs the members of a group
+ */
+
+std::size_t MqttServer::getSubscriberLoad(MqttSession::SessionId sessionId) const
+{
+    if ((sessionId >= MAX_MQTT_SESSIONS) ||
+        !sessionMapping_[sessionId].mappingValid ||
+        (sessionMapping_[sessionId].mqttSession == nullptr))
+    {
+        return static_cast<std::size_t>(-1);
+    }
+
+    const MqttSession &session = *sessionMapping_[sessionId].mqttSession;
+    return session.getOutboundCount() + session.getInflightCount();
+}
+
+/**
+ * Send a PUBLISH to every session with a matching subscription. The topic and
+ * payload are encoded once and shared by all the outbound queues, each session
+ * only builds its own fixed header and packet identifier.
+ *
+ * @return the number of sessions the PUBLISH was queued for
+ */
+
+std::size_t MqttServer::publish(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos)
+{
+    if (publishRouterCb_ != nullptr)
+    {
+        return publishRouterCb_(publishRouterObj_, *this, topic, payload, qos);
+    }
+
+    PublishFanOut fanOut = {this, topic, payload, qos, nullptr, 0};
+    busyDepth_++;
+    subscriptions_.match(topic, subscriptionMatchCb, &fanOut);
+    busyDepth_--;
+    releaseEndedSessions();
+    return fanOut.delivered;
+}
+
+/**
+ * Deliver a PUBLISH that has already been encoded, to the sessions of this
+ * server only
+ */
+
+std::size_t MqttServer::publish(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos)
+{
+    if (publish == nullptr)
+    {
+        return 0;
+    }
+
+    PublishFanOut fanOut = {this, publish->getTopic(), publish->getPayload(), qos, publish, 0};
+    busyDepth_++;
+    subscriptions_.match(publish->getTopic(), subscriptionMatchCb, &fanOut);
+    busyDepth_--;
+    releaseEndedSessions();
+    return fanOut.delivered;
+}
+
+void MqttServer::setPublishRouter(PublishRouterCb cb, void *obj)
+{
+    publishRouterCb_ = cb;
+    publishRouterObj_ = obj;
+}
+
+void MqttServer::handleSubscriptionMatch(PublishFanOut &fanOut, const MqttSubscriptionIndex::Subscription &subscription)
+{
+    // subscribers are identified by their slot in sessionMapping_
+    if ((subscription.subscriber >= MAX_MQTT_SESSIONS) ||
+        !sessionMapping_[subscription.subscriber].mappingValid ||
+        (sessionMapping_[subscription.subscriber].mqttSession == nullptr))
+    {
+        return;
+    }
+
+    if (fanOut.encoded == nullptr)
+    {
+        fanOut.encoded = MqttSharedPublish::create(fanOut.topic, fanOut.payload);
+        if (fanOut.encoded == nullptr)
+        {
+            return;
+        }
+    }
+
+    unsigned char qos = (fanOut.qos < subscription.qos) ? fanOut.qos : subscription.qos;
+    if (sessionMapping_[subscription.subscriber].mqttSession->deliverPublish(fanOut.encoded, qos, false))
+    {
+        fanOut.delivered++;
+    }
+}
+
+MqttRetainedStore &MqttServer::getRetainedStore()
+{
+    return retained_;
+}
+
+/**
+ * Retain a message for its topic, or clear the topic if the payload is empty,
+ * recording the change in the persistent store when there is one
+ *
+ * @return false if the retained store had no room for the message
+ */
+
+bool MqttServer::retain(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos)
+{
+    return retain(MqttSharedPublish::create(topic, payload), qos);
+}
+
+bool MqttServer::retain(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos)
+{
+    if ((publish == nullptr) || !retained_.store(publish, qos))
+    {
+        return false;
+    }
+
+#ifdef MQTT_PERSISTENCE
+    if (persistentStore_.isOpen())
+    {
+        MqttPersistentStore::RecordType type = publish->getPayload().empty() ? MqttPersistentStore::RecordType::ClearRetained
+                                                                             : MqttPersistentStore::RecordType::Retain;
+        persistentStore_.append({type, qos, {}, publish->getTopic(), publish->getPayload()});
+    }
+#endif
     return true;
 }
 
+/**
+ * Queue the retained messages matching a filter the session has just subscribed
+ * to, each at the lower of its own QoS and the subscription's, with the retain
+ * flag set. Only the part of the store the filter covers is visited.
+ *
+ * @return the number of retained messages queued
+ */
+
+std::size_t MqttServer::sendRetained(MqttSession::SessionId sessionId, std::string_view filter, unsigned char qos)
+{
+    if ((sessionId >= MAX_MQTT_SESSIONS) ||
+        !sessionMapping_[sessionId].mappingValid ||
+        (sessionMapping_[sessionId].mqttSession == nullptr))
+    {
+        return 0;
+    }
+
+    RetainedFanOut fanOut = {this, sessionMapping_[sessionId].mqttSession.get(), qos, 0};
+    busyDepth_++;
+    retained_.match(filter, retainedMatchCb, &fanOut);
+    busyDepth_--;
+    releaseEndedSessions();
+    return fanOut.delivered;
+}
+
+void MqttServer::handleRetainedMatch(RetainedFanOut &fanOut, const MqttRetainedStore::Retained &retained)
+{
+    unsigned char qos = (retained.qos < fanOut.qos) ? retained.qos : fanOut.qos;
+    if (fanOut.session->deliverPublish(retained.publish, qos, true))
+    {
+        fanOut.delivered++;
+    }
+}
+
 void MqttServer::handleTcpSessionConnect(std::shared_ptr<TcpSession> tcpSession)
 {
     int i = 0;
 
-    // for (i = 0; i < MAX_TCP_SESSIONS; i++)
-    // {
-    //     if (sessionMapping_[i].mappingValid == false)
-    //     {
-    //         break;
-    //     }
-    // }
+    for (i = 0; i < MAX_MQTT_SESSIONS; i++)
+    {
+        if (sessionMapping_[i].mappingValid == false)
+        {
+            break;
+        }
+    }
 
-    // if (i < MAX_TCP_SESSIONS)
-    // {
-    //     sessionMapping_[i].tcpSession = tcpSession;
-    //     sessionMapping_[i].mqttSession = std::make_unique<MqttSession>(tcpSession);
-    //     sessionMapping_[i].mappingValid = true; 
-    // }
+    void *block = (i < MAX_MQTT_SESSIONS) ? sessionPool_.allocate() : nullptr;
+    if (block == nullptr)
+    {
+        MQTT_WARNING("no free MQTT session, connection refused");
+        tcpSession->disconnectSession();
+        return;
+    }
+
+    sessionMapping_[i].tcpSession = tcpSession;
+    sessionMapping_[i].mqttSession = std::unique_ptr<MqttSession, SessionDeleter>(new (block) MqttSession(tcpSession), SessionDeleter{this});
+    sessionMapping_[i].mqttSession->setOutboundPolicy(outboundPolicy_);
+    sessionMapping_[i].mqttSession->setTimerWheel(&timerWheel_);
+    sessionMapping_[i].mqttSession->setServer(this, i);
+    sessionMapping_[i].mappingValid = true;
+
+    // in place of the callbacks the session registered for itself
+    void *slot = (void *)&sessionMapping_[i].slot;
+    tcpSession->registerIncomingMessageCb(sessionMessageReceivedCb, slot);
+    tcpSession->registerMessageSentCb(sessionMessageSentCb, slot);
+    tcpSession->registerSessionDisconnectedCb(sessionTcpDisconnectCb, slot);
+    tcpSession->registerSessionReconnectCb(sessionTcpReconnectCb, slot);
+}
+
+/**
+ * A session has ended, so its subscriptions go and its slot is free for the next
+ * connection. It always ends from somewhere inside its own calls, so here it is
+ * only marked, and released by releaseEndedSessions() once nothing of the server's
+ * or the session's is left on the stack.
+ */
+
+void MqttServer::sessionDisconnected(MqttSession::SessionId sessionId)
+{
+    if ((sessionId >= MAX_MQTT_SESSIONS) || !sessionMapping_[sessionId].mappingValid || sessionMapping_[sessionId].ended)
+    {
+        return;
+    }
+
+    sessionMapping_[sessionId].ended = true;
+    endedCount_++;
+}
+
+/**
+ * Wraps a transport callback of a session, see leaveSession()
+ *
+ * @return the session, or nullptr if the slot is no longer in use
+ */
+
+MqttSession *MqttServer::enterSession(MqttSession::SessionId sessionId)
+{
+    busyDepth_++;
+
+    if ((sessionId >= MAX_MQTT_SESSIONS) || !sessionMapping_[sessionId].mappingValid)
+    {
+        return nullptr;
+    }
+    return sessionMapping_[sessionId].mqttSession.get();
+}
+
+void MqttServer::leaveSession()
+{
+    busyDepth_--;
+    releaseEndedSessions();
+}
+
+/**
+ * Set the outbound queue limits and slow consumer policy for every session, both
+ * those connected now and those still to come.
+ */
+
+void MqttServer::setOutboundPolicy(const MqttSession::OutboundPolicy &policy)
+{
+    outboundPolicy_ = policy;
+
+    for (int i = 0; i < MAX_MQTT_SESSIONS; i++)
+    {
+        if (sessionMapping_[i].mappingValid && (sessionMapping_[i].mqttSession != nullptr))
+        {
+            sessionMapping_[i].mqttSession->setOutboundPolicy(policy);
+        }
+    }
+}
+
+/**
+ * Move the timer wheel on by the time since the last call and run whatever has
+ * fallen due
+ *
+ * @return the number of timers fired
+ */
+
+std::size_t MqttServer::processTimers(std::uint64_t elapsedMs)
+{
+#ifdef MQTT_PERSISTENCE
+    MqttSnapshot::CheckpointState state = snapshot_.pollCheckpoint();
+
+    if (state != MqttSnapshot::CheckpointState::Idle)
+    {
+        finishCheckpoint(state);
+    }
+    else if (persistentStore_.needsCompaction())
+    {
+        checkpoint();
+    }
+#endif
+    busyDepth_++;
+    std::size_t fired = timerWheel_.advance(elapsedMs);
+    busyDepth_--;
+    releaseEndedSessions();
+    return fired;
+}
+
+MqttTimerWheel &MqttServer::getTimerWheel()
+{
+    return timerWheel_;
+}
+
+/**
+ * @return the number of sessions allocated now and at most since start up
+ */
+
+MqttPoolStats MqttServer::getSessionPoolStats() const
+{
+    return sessionPool_.getStats();
+}
+
+#ifdef MQTT_PERSISTENCE
+
+/**
+ * Restore the retained messages from the snapshot and log in directory, then
+ * keep them there from now on. Anything retained before this is replaced.
+ */
+
+bool MqttServer::enablePersistence(const char *directory)
+{
+    MqttPersistentStore::Position position = {0, 0};
+
+    if (!MqttSnapshot::load(directory, retained_, position))
+    {
+        retained_.clear();
+        position = {0, 0};
+    }
+
+    if (!persistentStore_.open(directory, persistedRecordCb, this, position))
+    {
+        return false;
+    }
+
+    MQTT_INFO("restored %zu retained messages, %zu from the log", retained_.getMessageCount(),
+              persistentStore_.getReplayedCount());
+
+    // a fresh checkpoint makes the next restart as quick as it can be
+    return (persistentStore_.getReplayedCount() == 0) || checkpoint();
+}
+
+/**
+ * Snapshot the retained messages, in the background unless wait is set. The log
+ * before the snapshot is deleted once it has been written, by processTimers()
+ * or straight away when waiting.
+ *
+ * @return false if a checkpoint is already running, or the one waited for failed
+ */
+
+bool MqttServer::checkpoint(bool wait)
+{
+    if (!persistentStore_.isOpen() || snapshot_.isCheckpointing())
+    {
+        return false;
+    }
+
+    MqttPersistentStore::Position position = persistentStore_.beginCheckpoint();
+    if ((position.sequence == 0) || !snapshot_.startCheckpoint(persistentStore_.getDirectory(), retained_, position))
+    {
+        return false;
+    }
+
+    if (!wait)
+    {
+        return true;
+    }
+
+    MqttSnapshot::CheckpointState state = snapshot_.waitForCheckpoint();
+    finishCheckpoint(state);
+    return state == MqttSnapshot::CheckpointState::Written;
+}
+
+MqttPersistentStore &MqttServer::getPersistentStore()
+{
+    return persistentStore_;
+}
+
+void MqttServer::handlePersistedRecord(const MqttPersistentStore::Record &record)
+{
+    switch (record.type)
+    {
+    case MqttPersistentStore::RecordType::Retain:
+        retained_.store(record.topic, record.payload, record.qos);
+        break;
+    case MqttPersistentStore::RecordType::ClearRetained:
+        retained_.remove(record.topic);
+        break;
+    default:
+        // persistent sessions are not restored yet
+        break;
+    }
+}
+
+#endif
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+void MqttServer::SessionDeleter::operator()(MqttSession *session) const
+{
+    session->~MqttSession();
+    server->sessionPool_.deallocate(session);
+}
+
+void MqttServer::removeSession(MqttSession::SessionId sessionId)
+{
+    if (sessionId >= MAX_MQTT_SESSIONS)
+    {
+        return;
+    }
+
+    if (sessionMapping_[sessionId].ended)
+    {
+        sessionMapping_[sessionId].ended = false;
+        endedCount_--;
+    }
+
+    subscriptions_.unsubscribeAll(sessionId);
+    sessionMapping_[sessionId].mappingValid = false;
+    sessionMapping_[sessionId].mqttSession = nullptr;
+    sessionMapping_[sessionId].tcpSession = nullptr;
+}
+
+void MqttServer::releaseEndedSessions()
+{
+    for (MqttSession::SessionId i = 0; (i < MAX_MQTT_SESSIONS) && (endedCount_ > 0) && (busyDepth_ == 0); i++)
+    {
+        if (sessionMapping_[i].ended)
+        {
+            removeSession(i);
+        }
+    }
+}
+
+#ifdef MQTT_PERSISTENCE
+void MqttServer::finishCheckpoint(MqttSnapshot::CheckpointState state)
+{
+    if (state == MqttSnapshot::CheckpointState::Written)
+    {
+        persistentStore_.endCheckpoint(snapshot_.getCheckpointPosition(), snapshot_.getCheckpointBytes());
+    }
+    else if (state == MqttSnapshot::CheckpointState::Failed)
+    {
+        MQTT_WARNING("checkpoint failed, the log is kept");
+    }
+}
+#endif
+
+void MqttServer::removeAllSessions()
+{
+    for (MqttSession::SessionId i = 0; i < MAX_MQTT_SESSIONS; i++)
+    {
+        removeSession(i);
+    }
 }
@@ -21,8 +21,11 @@
  * THE SOFTWARE.
  *******************************************************************************/
 
+#include <algorithm>
+#include <string.h>
 #include "mqtt_session.h"
-#include "mqtt_message_handler.h"
+#include "mqtt_property_bag.h"
+#include "mqtt_server.h"
 
 /*
  ******************************************************************************
@@ -56,12 +59,42 @@ void tcpReconnectCb(void *obj, signed char err, TcpSession::TcpSessionPtr tcpSes
     mqttSession->handleTcpReconnect(err, tcpSession);
 }
 
+void mqttFrameReceivedCb(void *obj, std::span<const unsigned char> frame)
+{
+    MqttSession *mqttSession = (MqttSession *)(obj);
+    mqttSession->handleIncomingFrame(frame);
+}
+
+void keepAliveExpiredCb(void *obj)
+{
+    MqttSession *mqttSession = (MqttSession *)(obj);
+    mqttSession->handleKeepAliveExpired();
+}
+
+void sessionExpiredCb(void *obj)
+{
+    MqttSession *mqttSession = (MqttSession *)(obj);
+    mqttSession->handleSessionExpired();
+}
+
+void retransmitCb(void *obj)
+{
+    MqttSession *mqttSession = (MqttSession *)(obj);
+    mqttSession->handleRetransmit();
+}
+
 /*
  ******************************************************************************
  * Public methods
  ******************************************************************************
  */
 
+MQTT_THREAD_LOCAL MqttSession::OutboundBatch MqttSession::outboundBatch_;
+
+#ifndef MQTT_VECTORED_SEND
+MQTT_THREAD_LOCAL unsigned char MqttSession::sendBuffer_[MQTT_BUF_SIZE];
+#endif
+
 MqttSession::MqttSession(TcpSession::TcpSessionPtr tcpSession)
 {
     tcpSession_ = tcpSession;
@@ -81,6 +114,17 @@ MqttSession::MqttSession(TcpSession::TcpSessionPtr tcpSession)
     }
 }
 
+MqttSession::~MqttSession()
+{
+    // the wheel outlives the session, so it mustn't be left holding this pointer
+    if (timerWheel_ != nullptr)
+    {
+        timerWheel_->cancel(keepAliveTimer_);
+        timerWheel_->cancel(sessionExpiryTimer_);
+        timerWheel_->cancel(retransmitTimer_);
+    }
+}
+
 void MqttSession::setSessionFalse()
 {
     sessionValid_ = false;
@@ -97,8 +141,31 @@ bool MqttSession::isSessionValid()
  * ****************************************************************************
  */
 
+/**
+ * The connection has gone. With a session expiry interval the session waits that
+ * long for the client to come back, otherwise it ends now and the server may
+ * destroy it before this returns.
+ */
+
 void MqttSession::handleTcpDisconnect(TcpSession::TcpSessionPtr tcpSession)
 {
+    if (timerWheel_ != nullptr)
+    {
+        timerWheel_->cancel(keepAliveTimer_);
+        keepAliveTimer_ = MqttTimerWheel::INVALID_TIMER;
+
+        if (sessionExpiryIntervalTimeout_ > 0)
+        {
+            timerWheel_->cancel(sessionExpiryTimer_);
+            sessionExpiryTimer_ = timerWheel_->start(static_cast<std::uint64_t>(sessionExpiryIntervalTimeout_) * 1000, sessionExpiredCb, (void *)this);
+            return;
+        }
+    }
+
+    if (server_ != nullptr)
+    {
+        server_->sessionDisconnected(sessionId_);
+    }
 }
 
 void MqttSession::handleTcpReconnect(signed char err, TcpSession::TcpSessionPtr tcpSession)
@@ -107,10 +174,958 @@ void MqttSession::handleTcpReconnect(signed char err, TcpSession::TcpSessionPtr
 
 void MqttSession::handleTcpMessageSent(TcpSession::TcpSessionPtr tcpSession)
 {
+    sendOutbound();
 }
 
 void MqttSession::handleTcpIncomingMessage(TcpSession::TcpSessionPtr tcpSession, char *pdata, unsigned short len)
 {
+    // any traffic at all counts as the client being alive, but the connect
+    // timeout only ends with the CONNECT itself
+    if (connectReceived_ && (keepAliveTimer_ != MqttTimerWheel::INVALID_TIMER))
+    {
+        timerWheel_->restart(keepAliveTimer_, keepAliveMs_);
+    }
+
+    // The segment can hold any number of packets, or just part of one. Complete
+    // frames come back through mqttFrameReceivedCb before addSegment returns.
+
+    MqttPacketReassembler::Result result =
+        reassembler_.addSegment(reinterpret_cast<const unsigned char *>(pdata), len, mqttFrameReceivedCb, (void *)this);
+
+    if (result != MqttPacketReassembler::Result::Success)
+    {
+        MQTT_ERROR("unable to decode the incoming stream, disconnecting");
+        closing_ = true;
+    }
+
+    if (closing_)
+    {
+        reassembler_.reset();
+        tcpSession->disconnectSession();
+    }
+}
+
+/**
+ * One complete packet from the client, decoded in place and handed to the
+ * handle method for its type. A packet that can't be decoded closes the
+ * connection, as the spec requires.
+ */
+
+void MqttSession::handleIncomingFrame(std::span<const unsigned char> frame)
+{
+    if (closing_)
+    {
+        return;
+    }
+
+    // the first packet from the client must be its CONNECT
+    if (!connectReceived_ && ((frame[0] >> 4) != static_cast<unsigned char>(MqttMessageParser::MqttPacketType::Connect)))
+    {
+        MQTT_ERROR("packet type %d before CONNECT, disconnecting", frame[0] >> 4);
+        closing_ = true;
+        return;
+    }
+
+    MqttPacketDecoder::Result result = MqttPacketDecoder::dispatch(frame, protocolLevel_, *this);
+
+    if (result != MqttPacketDecoder::Result::Success)
+    {
+        MQTT_ERROR("packet type %d refused (%d), disconnecting", frame[0] >> 4, static_cast<int>(result));
+        closing_ = true;
+    }
+}
+
+/**
+ * The protocol level, keepalive and v5 session settings of the connection. A
+ * second CONNECT is a protocol error.
+ */
+
+void MqttSession::handleConnect(const MqttConnectView &view)
+{
+    if (connectReceived_)
+    {
+        MQTT_ERROR("second CONNECT on a connection, disconnecting");
+        closing_ = true;
+        return;
+    }
+
+    connectReceived_ = true;
+    protocolLevel_ = view.protocolLevel;
+    inflight_.setProtocolLevel(protocolLevel_);
+    clean_session_ = view.cleanStart;
+    will_qos_ = view.willQos;
+    will_retain_ = view.willRetain;
+
+    std::size_t length = std::min(view.clientId.size(), sizeof(clientId_) - 1);
+    memcpy(clientId_, view.clientId.data(), length);
+    clientId_[length] = '\0';
+
+    startKeepAlive(view.keepAlive);
+
+    MqttPropertyBag properties;
+    std::size_t index = 0;
+
+    unsigned short receiveMaximum;
+    unsigned long sessionExpiryInterval;
+    unsigned short topicAliasMaximum = 0;
+
+    if (!MqttMessageParser::parseProperties(view.properties, index, MqttMessageParser::MqttPacketType::Connect, properties))
+    {
+        MQTT_ERROR("malformed CONNECT properties, disconnecting");
+        closing_ = true;
+        return;
+    }
+
+    if (properties.getTwoByteInteger(MqttMessageParser::MqttPropertyTypes::ReceiveMaximum, receiveMaximum))
+    {
+        setReceiveMaximum(receiveMaximum);
+    }
+    if (properties.getFourByteInteger(MqttMessageParser::MqttPropertyTypes::SessionExpiryInterval, sessionExpiryInterval))
+    {
+        setSessionExpiryInterval(sessionExpiryInterval);
+    }
+
+    // aliases belong to the connection, so both sides start again with none
+    properties.getTwoByteInteger(MqttMessageParser::MqttPropertyTypes::TopicAliasMaximum, topicAliasMaximum);
+    outboundAliases_.setMaximum(topicAliasMaximum);
+
+    // no CONNACK goes out yet to advertise a Topic Alias Maximum, so the client may use none
+    inboundAliases_.setMaximum(0);
+}
+
+void MqttSession::handlePublish(const MqttPublishView &view)
+{
+    std::string_view topic = view.topic;
+
+    // from v5 there is always a Property Length, so more than that byte means properties
+    if (((view.properties.size() > 1) || topic.empty()) && !resolveTopicAlias(view, topic))
+    {
+        closing_ = true;
+        return;
+    }
+
+    MQTT_INFO("PUBLISH to %.*s, %u bytes at QoS %u", static_cast<int>(topic.size()), topic.data(),
+              static_cast<unsigned int>(view.payload.size()), view.qos);
+
+    if (server_ == nullptr)
+    {
+        return;
+    }
+
+    if (view.retain)
+    {
+        server_->retain(topic, view.payload, view.qos);
+    }
+    server_->publish(topic, view.payload, view.qos);
+}
+
+/**
+ * PUBACK, PUBREC or PUBCOMP for a PUBLISH we sent. Each frees or advances its
+ * inflight entry, which may let a queued PUBLISH go, or needs a PUBREL sent.
+ */
+
+void MqttSession::handleAck(MqttMessageParser::MqttPacketType type, const MqttAckView &view)
+{
+    bool known = false;
+
+    switch (type)
+    {
+    case MqttMessageParser::MqttPacketType::Puback:
+        known = inflight_.acknowledge(view.packetIdentifier);
+        break;
+
+    case MqttMessageParser::MqttPacketType::Pubrec:
+        known = inflight_.received(view.packetIdentifier);
+        break;
+
+    case MqttMessageParser::MqttPacketType::Pubcomp:
+        known = inflight_.complete(view.packetIdentifier);
+        break;
+
+    default:
+        // PUBREL, for a QoS 2 PUBLISH from the client
+        MQTT_INFO("PUBREL %u", view.packetIdentifier);
+        return;
+    }
+
+    if (!known)
+    {
+        MQTT_WARNING("acknowledgement for a packet identifier not inflight");
+        return;
+    }
+    sendOutbound();
+}
+
+/**
+ * Apply the Topic Alias of a v5 PUBLISH, if it has one. With a topic it sets the
+ * alias, and with an empty topic the alias gives the topic, which was checked
+ * when the alias was set. A Subscription Identifier is only for the server to
+ * send, so one from the client is a protocol error.
+ *
+ * @param topic the topic of the PUBLISH, replaced by the alias's topic if empty
+ * @return false if the properties or the alias are a protocol error
+ */
+
+bool MqttSession::resolveTopicAlias(const MqttPublishView &view, std::string_view &topic)
+{
+    MqttPropertyBag properties;
+    std::size_t index = 0;
+    unsigned short topicAlias = 0;
+
+    if (!MqttMessageParser::parseProperties(view.properties, index, MqttMessageParser::MqttPacketType::Publish, properties))
+    {
+        MQTT_ERROR("malformed PUBLISH properties, disconnecting");
+        return false;
+    }
+
+    if (properties.contains(MqttMessageParser::MqttPropertyTypes::SubscriptionIdentifier))
+    {
+        MQTT_ERROR("PUBLISH from the client with a Subscription Identifier, disconnecting");
+        return false;
+    }
+
+    properties.getTwoByteInteger(MqttMessageParser::MqttPropertyTypes::TopicAlias, topicAlias);
+
+    if (topicAlias == 0)
+    {
+        if (topic.empty())
+        {
+            MQTT_ERROR("PUBLISH with neither a topic nor a topic alias, disconnecting");
+            return false;
+        }
+        return true;
+    }
+
+    if (topicAlias > inboundAliases_.getMaximum())
+    {
+        MQTT_ERROR("topic alias %u above the maximum, disconnecting", topicAlias);
+        return false;
+    }
+
+    if (!topic.empty())
+    {
+        return inboundAliases_.set(topicAlias, topic);
+    }
+
+    topic = inboundAliases_.find(topicAlias);
+    if (topic.empty())
+    {
+        MQTT_ERROR("topic alias %u used before it was set, disconnecting", topicAlias);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Each filter goes into the server's subscription index, at the QoS the client
+ * asked for, and is sent the retained messages it matches
+ */
+
+void MqttSession::handleSubscribe(const MqttSubscribeView &view)
+{
+    MQTT_INFO("SUBSCRIBE %u with %u filters", view.packetIdentifier, static_cast<unsigned int>(view.filterCount));
+
+    if (server_ == nullptr)
+    {
+        return;
+    }
+
+    std::span<const unsigned char> filters = view.filters;
+    std::string_view filter;
+    unsigned char options;
+
+    while (MqttPacketDecoder::nextFilter(filters, filter, options))
+    {
+        unsigned char qos = options & 0x03;
+
+        if (!server_->getSubscriptionIndex().subscribe(filter, sessionId_, qos))
+        {
+            MQTT_WARNING("no room for the subscription to %.*s", static_cast<int>(filter.size()), filter.data());
+            continue;
+        }
+        server_->sendRetained(sessionId_, filter, qos);
+    }
+}
+
+void MqttSession::handleUnsubscribe(const MqttSubscribeView &view)
+{
+    MQTT_INFO("UNSUBSCRIBE %u with %u filters", view.packetIdentifier, static_cast<unsigned int>(view.filterCount));
+
+    if (server_ == nullptr)
+    {
+        return;
+    }
+
+    std::span<const unsigned char> filters = view.filters;
+    std::string_view filter;
+
+    while (MqttPacketDecoder::nextFilter(filters, filter))
+    {
+        server_->getSubscriptionIndex().unsubscribe(filter, sessionId_);
+    }
+}
+
+void MqttSession::handlePingreq()
+{
+    // the keepalive was already restarted when the bytes arrived
+    MQTT_INFO("PINGREQ");
+}
+
+/**
+ * The client is going. From v5 it may change the session expiry interval on the
+ * way out.
+ */
+
+void MqttSession::handleDisconnect(const MqttReasonView &view)
+{
+    MqttPropertyBag properties;
+    std::size_t index = 0;
+    unsigned long sessionExpiryInterval;
+
+    if (MqttMessageParser::parseProperties(view.properties, index, MqttMessageParser::MqttPacketType::Disconnect, properties) &&
+        properties.getFourByteInteger(MqttMessageParser::MqttPropertyTypes::SessionExpiryInterval, sessionExpiryInterval))
+    {
+        setSessionExpiryInterval(sessionExpiryInterval);
+    }
+
+    MQTT_INFO("DISCONNECT, reason 0x%x", view.reasonCode);
+    closing_ = true;
+}
+
+void MqttSession::handleAuth([[maybe_unused]] const MqttReasonView &view)
+{
+    // no authentication methods are offered, so there is nothing to continue
+    MQTT_WARNING("AUTH without an authentication method, disconnecting");
+    closing_ = true;
+}
+
+/*
+ * ****************************************************************************
+ * Keepalive and session expiry
+ * ****************************************************************************
+ */
+
+/**
+ * Sets the wheel the session's timers run on. A connection that hasn't sent its
+ * CONNECT yet gets MQTT_CONNECT_TIMEOUT_MS to do so.
+ */
+
+void MqttSession::setTimerWheel(MqttTimerWheel *timerWheel)
+{
+    timerWheel_ = timerWheel;
+
+    if ((timerWheel_ != nullptr) && !connectReceived_ && (keepAliveTimer_ == MqttTimerWheel::INVALID_TIMER))
+    {
+        keepAliveTimer_ = timerWheel_->start(MQTT_CONNECT_TIMEOUT_MS, keepAliveExpiredCb, (void *)this);
+    }
+}
+
+void MqttSession::setServer(MqttServer *server, SessionId sessionId)
+{
+    server_ = server;
+    sessionId_ = sessionId;
+}
+
+/**
+ * Start, or restart with a new period, the keepalive from a CONNECT. The client is
+ * allowed one and a half keepalive periods between packets before it is dropped,
+ * and a keepalive of zero turns the check off.
+ *
+ * @return false if there is no timer wheel or no free timer
+ */
+
+bool MqttSession::startKeepAlive(unsigned short keepAliveSeconds)
+{
+    if (timerWheel_ == nullptr)
+    {
+        return false;
+    }
+
+    timerWheel_->cancel(keepAliveTimer_);
+    keepAliveTimer_ = MqttTimerWheel::INVALID_TIMER;
+
+    if (keepAliveSeconds == 0)
+    {
+        return true;
+    }
+
+    keepAliveMs_ = static_cast<std::uint64_t>(keepAliveSeconds) * 1500;
+    keepAliveTimer_ = timerWheel_->start(keepAliveMs_, keepAliveExpiredCb, (void *)this);
+    return keepAliveTimer_ != MqttTimerWheel::INVALID_TIMER;
+}
+
+/**
+ * Set the session expiry interval from a CONNECT or DISCONNECT. A CONNECT can't
+ * resume a session yet, so a session kept after its connection closes only holds
+ * on to a slot, and the interval is capped at MQTT_MAX_SESSION_EXPIRY_INTERVAL.
+ */
+
+void MqttSession::setSessionExpiryInterval(unsigned long seconds)
+{
+    sessionExpiryIntervalTimeout_ = std::min<unsigned long>(seconds, MQTT_MAX_SESSION_EXPIRY_INTERVAL);
+    if (timerWheel_ != nullptr)
+    {
+        timerWheel_->cancel(sessionExpiryTimer_);
+        sessionExpiryTimer_ = MqttTimerWheel::INVALID_TIMER;
+    }
+}
+
+void MqttSession::handleKeepAliveExpired()
+{
+    keepAliveTimer_ = MqttTimerWheel::INVALID_TIMER;
+    if (connectReceived_)
+    {
+        MQTT_WARNING("keepalive expired, disconnecting");
+    }
+    else
+    {
+        MQTT_WARNING("no CONNECT within %d ms, disconnecting", MQTT_CONNECT_TIMEOUT_MS);
+    }
+
+    if (tcpSession_ != nullptr)
+    {
+        tcpSession_->disconnectSession();
+    }
+}
+
+/**
+ * The client hasn't come back within the session expiry interval, so the session
+ * ends and the server may destroy it before this returns
+ */
+
+void MqttSession::handleSessionExpired()
+{
+    sessionExpiryTimer_ = MqttTimerWheel::INVALID_TIMER;
+    MQTT_INFO("session expired");
+
+    clearOutbound();
+    setSessionFalse();
+
+    if (server_ != nullptr)
+    {
+        server_->sessionDisconnected(sessionId_);
+    }
+}
+
+/*
+ * ****************************************************************************
+ * QoS 1 and 2 delivery
+ * ****************************************************************************
+ */
+
+void MqttSession::setReceiveMaximum(unsigned short receiveMaximum)
+{
+    inflight_.setReceiveMaximum(receiveMaximum);
+}
+
+/**
+ * Send every unacknowledged frame again, with DUP set on the PUBLISH frames, as
+ * the client expects when it resumes a session. There is no resume yet, so for
+ * now only the owner of the session can call this.
+ */
+
+void MqttSession::retransmitInflight()
+{
+    inflight_.markForResend(UINT64_MAX);
+    sendOutbound();
+}
+
+void MqttSession::handleRetransmit()
+{
+    retransmitTimer_ = MqttTimerWheel::INVALID_TIMER;
+
+    std::uint64_t interval = MQTT_RETRANSMIT_MS / MQTT_TIMER_TICK_MS;
+    std::uint64_t now = getTick();
+    if ((now >= interval) && (inflight_.markForResend(now - interval) > 0))
+    {
+        sendOutbound();
+    }
+
+    if ((inflight_.getCount() > 0) && !timerWheel_->isActive(retransmitTimer_))
+    {
+        retransmitTimer_ = timerWheel_->start(MQTT_RETRANSMIT_MS, retransmitCb, (void *)this);
+    }
+}
+
+std::size_t MqttSession::getInflightCount() const
+{
+    return inflight_.getCount();
+}
+
+/*
+ * ****************************************************************************
+ * Outbound PUBLISH frames
+ * ****************************************************************************
+ */
+
+/**
+ * Set the limits on the outbound queue and what happens when they are reached.
+ * The message limit can't be raised above MAX_OUTBOUND_DELIVERIES.
+ */
+
+void MqttSession::setOutboundPolicy(const OutboundPolicy &policy)
+{
+    outboundPolicy_ = policy;
+    if ((outboundPolicy_.maxMessages == 0) || (outboundPolicy_.maxMessages > MAX_OUTBOUND_DELIVERIES))
+    {
+        outboundPolicy_.maxMessages = MAX_OUTBOUND_DELIVERIES;
+    }
+}
+
+/**
+ * Queue a PUBLISH that may also be queued for any number of other sessions. Only
+ * the header for this delivery is built here, the topic and payload stay shared.
+ * When the queue is full the slow consumer policy decides what gives way.
+ *
+ * @return true if the PUBLISH was queued or spilled, false if it was dropped
+ */
+
+bool MqttSession::deliverPublish(const MqttSharedPublish::MqttSharedPublishPtr &publish, unsigned char qos, bool retain)
+{
+    if (outboundClosed_)
+    {
+        return false;
+    }
+
+    // QoS 1 and 2 take a packet identifier from the inflight window when sent
+    MqttPublishDelivery delivery(publish, qos, retain, 0);
+    if (!delivery.isValid() || ((protocolLevel_ >= 5) && !delivery.setProperties(0, true)))
+    {
+        return false;
+    }
+
+    // once anything has been spilled the rest follows it, to keep the order
+    if (spilling_ || !hasOutboundRoom(delivery.getFrameLength()))
+    {
+        switch (outboundPolicy_.slowConsumer)
+        {
+        case SlowConsumerPolicy::Spill:
+            return spillPublish(delivery);
+
+        case SlowConsumerPolicy::DropOldestQoS0:
+            while (!hasOutboundRoom(delivery.getFrameLength()))
+            {
+                if (!makeOutboundRoom())
+                {
+                    outboundDrops_++;
+                    MQTT_WARNING("outbound queue full of QoS 1 and 2, PUBLISH dropped");
+                    return false;
+                }
+            }
+            break;
+
+        case SlowConsumerPolicy::Disconnect:
+            MQTT_WARNING("outbound queue full, disconnecting slow consumer");
+            outboundDrops_ += outboundCount_ + 1;
+            clearOutbound();
+            outboundClosed_ = true;
+            if (tcpSession_ != nullptr)
+            {
+                tcpSession_->disconnectSession();
+            }
+            return false;
+
+        case SlowConsumerPolicy::DropNewest:
+        default:
+            outboundDrops_++;
+            MQTT_WARNING("outbound queue full, PUBLISH dropped");
+            return false;
+        }
+    }
+
+    outboundBytes_ += delivery.getFrameLength();
+    outbound_[(outboundHead_ + outboundCount_) % MAX_OUTBOUND_DELIVERIES] = std::move(delivery);
+    outboundCount_++;
+
+    sendOutbound();
+    return true;
+}
+
+std::size_t MqttSession::getOutboundCount() const
+{
+    return outboundCount_;
+}
+
+std::size_t MqttSession::getOutboundBytes() const
+{
+    return outboundBytes_;
+}
+
+/**
+ * @return the number of PUBLISH frames dropped by the slow consumer policy
+ */
+
+std::size_t MqttSession::getOutboundDropCount() const
+{
+    return outboundDrops_;
+}
+
+std::size_t MqttSession::getOutboundSpillCount() const
+{
+    return outboundSpills_;
+}
+
+bool MqttSession::isOutboundFull() const
+{
+    return spilling_ || (outboundCount_ >= outboundPolicy_.maxMessages) ||
+           ((outboundCount_ > 0) && (outboundBytes_ >= outboundPolicy_.maxBytes));
+}
+
+/*
+ * ****************************************************************************
+ * Private methods
+ * ****************************************************************************
+ */
+
+std::uint64_t MqttSession::getTick() const
+{
+    return (timerWheel_ != nullptr) ? timerWheel_->getTick() : 0;
+}
+
+/**
+ * Hand the transport the inflight frames due to go again, then as many queued
+ * frames as it will take in one go, rather than one send per frame and a wait for
+ * the sent callback in between. A QoS 1 or 2 PUBLISH waits in the queue while the
+ * inflight window is full.
+ */
+
+void MqttSession::sendOutbound()
+{
+    while (tcpSession_ != nullptr)
+    {
+        gatherOutbound();
+        if (outboundBatch_.frameCount == 0)
+        {
+            break;
+        }
+
+        std::size_t sent = 0;
+        TcpSession::sendResult result = sendOutboundBatch(sent);
+        commitOutbound(sent);
+
+        if (result == TcpSession::RETRY)
+        {
+            // try again from handleTcpMessageSent once the last send completes
+            return;
+        }
+        if (result == TcpSession::FAILED_ABORTED)
+        {
+            // QoS 1 and 2 frames already inflight are kept to send again on reconnect
+            MQTT_ERROR("unable to send PUBLISH, disconnecting");
+            clearOutbound();
+            tcpSession_->disconnectSession();
+            return;
+        }
+    }
+
+    if ((outboundCount_ == 0) && spilling_)
+    {
+        // drainedCb may deliver the spilled messages again straight away
+        spilling_ = false;
+        if (outboundPolicy_.drainedCb != nullptr)
+        {
+            outboundPolicy_.drainedCb(outboundPolicy_.spillObj, *this);
+        }
+    }
+}
+
+/**
+ * Collect the next frames to send: inflight entries waiting to go again first, as
+ * they are older, then the head of the outbound queue. A QoS 1 or 2 PUBLISH from
+ * the queue takes its inflight slot here, and gives it back in commitOutbound if
+ * the send doesn't happen.
+ */
+
+void MqttSession::gatherOutbound()
+{
+    OutboundBatch &batch = outboundBatch_;
+    batch.frameCount = 0;
+    batch.resendCount = 0;
+    batch.segmentCount = 0;
+
+    unsigned short resends[MAX_OUTBOUND_DELIVERIES];
+    std::size_t resendCount = inflight_.getPendingResends(resends);
+
+    for (std::size_t i = 0; i < resendCount; i++)
+    {
+        std::span<const unsigned char> segments[MqttPublishDelivery::MAX_SEGMENTS];
+        addOutboundFrame(segments, inflight_.getSegments(resends[i], segments), resends[i], 0);
+        batch.resendCount++;
+    }
+
+    for (std::size_t i = 0; (i < outboundCount_) && (batch.frameCount < OUTBOUND_BATCH_FRAMES); i++)
+    {
+        MqttPublishDelivery &delivery = outbound_[(outboundHead_ + i) % MAX_OUTBOUND_DELIVERIES];
+        std::span<const unsigned char> segments[MqttPublishDelivery::MAX_SEGMENTS];
+        unsigned short packetIdentifier = 0;
+        unsigned short topicAlias = 0;
+        std::size_t count = 0;
+
+        if (delivery.getQoS() > 0)
+        {
+            packetIdentifier = inflight_.add(delivery, getTick());
+            if (packetIdentifier == 0)
+            {
+                break; // the rest waits for an acknowledgement to free a slot
+            }
+            count = inflight_.getSegments(packetIdentifier, segments);
+        }
+        else
+        {
+            topicAlias = applyTopicAlias(delivery);
+            count = delivery.getSegments(segments);
+        }
+        addOutboundFrame(segments, count, packetIdentifier, topicAlias);
+    }
+}
+
+void MqttSession::addOutboundFrame(std::span<const unsigned char> (&segments)[MqttPublishDelivery::MAX_SEGMENTS],
+                                   std::size_t count, unsigned short packetIdentifier, unsigned short topicAlias)
+{
+    OutboundBatch &batch = outboundBatch_;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        batch.segments[batch.segmentCount++] = segments[i];
+    }
+    batch.packetIdentifiers[batch.frameCount] = packetIdentifier;
+    batch.topicAliases[batch.frameCount] = topicAlias;
+    batch.frameEnd[batch.frameCount++] = batch.segmentCount;
+}
+
+/**
+ * Put a QoS 0 PUBLISH from the queue on a topic alias, if the client takes them.
+ * This is done as the frame is gathered rather than when it is queued, so the
+ * aliases are set in the order the frames go out; if a frame then isn't sent,
+ * commitOutbound forgets the alias it set and it is worked out again next time.
+ *
+ * @return the alias if this frame is the one that sets it, otherwise 0
+ */
+
+unsigned short MqttSession::applyTopicAlias(MqttPublishDelivery &delivery)
+{
+    if (outboundAliases_.getMaximum() == 0)
+    {
+        return 0;
+    }
+
+    bool established;
+    unsigned short topicAlias = outboundAliases_.assign(delivery.getPublish()->getTopic(), established);
+    const std::size_t frameLength = delivery.getFrameLength();
+
+    if ((topicAlias == 0) || !delivery.setProperties(topicAlias, established))
+    {
+        if (established)
+        {
+            outboundAliases_.forget(topicAlias);
+        }
+        return 0;
+    }
+
+    outboundBytes_ = outboundBytes_ - frameLength + delivery.getFrameLength();
+    return established ? topicAlias : 0;
+}
+
+/**
+ * Settle the batch once the transport has taken the first sent frames of it. Those
+ * leave the queue, and the inflight ones start waiting for their acknowledgement.
+ * Anything not sent stays where it was for the next attempt.
+ */
+
+void MqttSession::commitOutbound(std::size_t sent)
+{
+    OutboundBatch &batch = outboundBatch_;
+    std::uint64_t now = getTick();
+
+    for (std::size_t i = 0; (i < batch.frameCount) && (i < sent); i++)
+    {
+        if (i < batch.resendCount)
+        {
+            inflight_.markSent(batch.packetIdentifiers[i], now);
+        }
+        else
+        {
+            popOutbound();
+        }
+    }
+
+    // latest first, so the same identifiers are handed out next time
+    for (std::size_t i = batch.frameCount; i > sent; i--)
+    {
+        if ((i > batch.resendCount) && (batch.packetIdentifiers[i - 1] != 0))
+        {
+            inflight_.unwind(batch.packetIdentifiers[i - 1]);
+        }
+        if (batch.topicAliases[i - 1] != 0)
+        {
+            outboundAliases_.forget(batch.topicAliases[i - 1]);
+        }
+    }
+
+    if ((protocolLevel_ < 5) && (inflight_.getCount() > 0) && (timerWheel_ != nullptr) && !timerWheel_->isActive(retransmitTimer_))
+    {
+        retransmitTimer_ = timerWheel_->start(MQTT_RETRANSMIT_MS, retransmitCb, (void *)this);
+    }
+}
+
+#ifdef MQTT_VECTORED_SEND
+
+/**
+ * Send the batch as segments, the shared topic and payload included, so nothing
+ * is copied unless the transport has to hold part of it back.
+ *
+ * @param sent set to the number of frames the transport took
+ */
+
+TcpSession::sendResult MqttSession::sendOutboundBatch(std::size_t &sent)
+{
+    OutboundBatch &batch = outboundBatch_;
+    TcpSession::sendResult result =
+        tcpSession_->sendMessageVector(std::span<const std::span<const unsigned char>>(batch.segments, batch.segmentCount));
+
+    sent = (result == TcpSession::SEND_OK) ? batch.frameCount : 0;
+    return result;
+}
+
+#else
+
+/**
+ * Copy as many frames of the batch as fit into the send buffer and send them
+ * together. A frame too big for the buffer on its own is dropped.
+ *
+ * @param sent set to the number of frames the transport took
+ */
+
+TcpSession::sendResult MqttSession::sendOutboundBatch(std::size_t &sent)
+{
+    OutboundBatch &batch = outboundBatch_;
+    std::size_t length = 0;
+    std::size_t segment = 0;
+
+    for (sent = 0; sent < batch.frameCount; sent++)
+    {
+        std::size_t frameLength = 0;
+        for (std::size_t i = segment; i < batch.frameEnd[sent]; i++)
+        {
+            frameLength += batch.segments[i].size();
+        }
+        if (length + frameLength > MQTT_BUF_SIZE)
+        {
+            break;
+        }
+
+        for (; segment < batch.frameEnd[sent]; segment++)
+        {
+            memcpy(sendBuffer_ + length, batch.segments[segment].data(), batch.segments[segment].size());
+            length += batch.segments[segment].size();
+        }
+    }
+
+    if (sent == 0)
+    {
+        MQTT_ERROR("frame does not fit the send buffer, dropped");
+        if (batch.packetIdentifiers[0] != 0)
+        {
+            inflight_.remove(batch.packetIdentifiers[0]);
+            batch.packetIdentifiers[0] = 0;
+        }
+        if (batch.topicAliases[0] != 0)
+        {
+            outboundAliases_.forget(batch.topicAliases[0]);
+            batch.topicAliases[0] = 0;
+        }
+        sent = (batch.resendCount == 0) ? 1 : 0;
+        return TcpSession::SEND_OK;
+    }
+
+    TcpSession::sendResult result = tcpSession_->sendMessage(sendBuffer_, static_cast<unsigned short>(length));
+    if (result != TcpSession::SEND_OK)
+    {
+        sent = 0;
+    }
+    return result;
+}
+
+#endif
+
+/**
+ * A frame bigger than the byte limit is still let into an empty queue, otherwise
+ * it could never be sent at all.
+ */
+
+bool MqttSession::hasOutboundRoom(std::size_t frameLength) const
+{
+    if (outboundCount_ >= outboundPolicy_.maxMessages)
+    {
+        return false;
+    }
+    return (outboundCount_ == 0) || ((outboundBytes_ + frameLength) <= outboundPolicy_.maxBytes);
+}
+
+/**
+ * Drop the oldest queued QoS 0 PUBLISH. Nothing in the queue has been passed to
+ * the transport yet, so any entry can go, the head included.
+ *
+ * @return false if there is no QoS 0 PUBLISH to drop
+ */
+
+bool MqttSession::makeOutboundRoom()
+{
+    for (std::size_t i = 0; i < outboundCount_; i++)
+    {
+        if (outbound_[(outboundHead_ + i) % MAX_OUTBOUND_DELIVERIES].getQoS() == 0)
+        {
+            removeOutbound(i);
+            outboundDrops_++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MqttSession::spillPublish(const MqttPublishDelivery &delivery)
+{
+    if ((outboundPolicy_.spillCb == nullptr) ||
+        !outboundPolicy_.spillCb(outboundPolicy_.spillObj, *this, delivery))
+    {
+        outboundDrops_++;
+        MQTT_WARNING("outbound queue full and PUBLISH not spilled, dropped");
+        return false;
+    }
+
+    spilling_ = true;
+    outboundSpills_++;
+    return true;
+}
+
+void MqttSession::removeOutbound(std::size_t position)
+{
+    outboundBytes_ -= outbound_[(outboundHead_ + position) % MAX_OUTBOUND_DELIVERIES].getFrameLength();
+
+    // close the gap by moving the younger deliveries forward one place
+    for (std::size_t i = position; (i + 1) < outboundCount_; i++)
+    {
+        outbound_[(outboundHead_ + i) % MAX_OUTBOUND_DELIVERIES] =
+            std::move(outbound_[(outboundHead_ + i + 1) % MAX_OUTBOUND_DELIVERIES]);
+    }
+    outboundCount_--;
+    outbound_[(outboundHead_ + outboundCount_) % MAX_OUTBOUND_DELIVERIES].reset();
+}
+
+void MqttSession::popOutbound()
+{
+    outboundBytes_ -= outbound_[outboundHead_].getFrameLength();
+    outbound_[outboundHead_].reset();
+    outboundHead_ = (outboundHead_ + 1) % MAX_OUTBOUND_DELIVERIES;
+    outboundCount_--;
+}
+
+void MqttSession::clearOutbound()
+{
+    while (outboundCount_ > 0)
+    {
+        popOutbound();
+    }
 }
 
 /*
@@ -0,0 +1,276 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#ifdef MQTT_EPOLL_TRANSPORT
+
+#include <chrono>
+
+#include "mqtt_sharded_broker.h"
+
+/*
+ ******************************************************************************
+ * Callback functions from the shard's MqttServer. These are outside the class
+ * so that the server remains indifferent to how the broker is put together.
+ ******************************************************************************
+ */
+
+std::size_t shardPublishRouterCb(void *obj, [[maybe_unused]] MqttServer &server, std::string_view topic,
+                                 std::span<const unsigned char> payload, unsigned char qos)
+{
+    MqttShardedBroker::Shard *shard = static_cast<MqttShardedBroker::Shard *>(obj);
+    return shard->broker->handleShardPublish(*shard, topic, payload, qos);
+}
+
+/*
+ * ****************************************************************************
+ * Public methods
+ * ****************************************************************************
+ */
+
+MqttShardedBroker::MqttShardedBroker(std::size_t shardCount)
+{
+    running_ = false;
+    dropped_ = 0;
+    port_ = 0;
+
+    // the topic table all the shards intern into is sized for MQTT_MAX_SHARDS
+    if (shardCount > MQTT_MAX_SHARDS)
+    {
+        MQTT_WARNING("%zu shards asked for, only %d allowed", shardCount, MQTT_MAX_SHARDS);
+        shardCount = MQTT_MAX_SHARDS;
+    }
+
+    for (std::size_t i = 0; i < shardCount; i++)
+    {
+        shards_.push_back(std::make_unique<Shard>());
+        shards_[i]->broker = this;
+        shards_[i]->index = i;
+    }
+}
+
+MqttShardedBroker::~MqttShardedBroker()
+{
+    stop();
+}
+
+/**
+ * Open the listening socket on every shard and start the worker threads. A port
+ * of 0 picks a free port, which getListenPort() then reports.
+ */
+
+bool MqttShardedBroker::start(unsigned short port)
+{
+    if (running_ || shards_.empty())
+    {
+        return false;
+    }
+
+    port_ = port;
+
+    for (std::unique_ptr<Shard> &shard : shards_)
+    {
+        shard->tcpServer.setReusePort(true);
+        if (!shard->mqttServer.startMqttServer(shard->tcpServer, port_))
+        {
+            MQTT_ERROR("shard %zu unable to listen on port %u", shard->index, static_cast<unsigned int>(port_));
+            for (std::unique_ptr<Shard> &started : shards_)
+            {
+                started->tcpServer.cleanup();
+            }
+            return false;
+        }
+
+        // the first shard to bind port 0 decides the port for the rest
+        port_ = shard->tcpServer.getListenPort();
+        shard->mqttServer.setPublishRouter(shardPublishRouterCb, shard.get());
+    }
+
+    running_ = true;
+    for (std::unique_ptr<Shard> &shard : shards_)
+    {
+        Shard *worker = shard.get();
+        shard->thread = std::thread([this, worker] { runShard(*worker); });
+    }
+    return true;
+}
+
+/**
+ * Stop the worker threads and close every connection
+ */
+
+void MqttShardedBroker::stop()
+{
+    if (!running_.exchange(false))
+    {
+        return;
+    }
+
+    for (std::unique_ptr<Shard> &shard : shards_)
+    {
+        shard->tcpServer.wakeup();
+    }
+
+    for (std::unique_ptr<Shard> &shard : shards_)
+    {
+        shard->thread.join();
+        drainInbox(*shard); // release anything still queued
+        shard->tcpServer.cleanup();
+    }
+}
+
+std::size_t MqttShardedBroker::getShardCount() const
+{
+    return shards_.size();
+}
+
+unsigned short MqttShardedBroker::getListenPort() const
+{
+    return port_;
+}
+
+/**
+ * @return the number of PUBLISH and tasks dropped because a shard's inbox was full
+ */
+
+unsigned long MqttShardedBroker::getDroppedCount() const
+{
+    return dropped_;
+}
+
+/**
+ * Publish from outside the shards, from any thread. The frame is encoded once
+ * here and every shard delivers it to its own subscribers.
+ *
+ * @return the number of shards it was queued for
+ */
+
+std::size_t MqttShardedBroker::publish(std::string_view topic, std::span<const unsigned char> payload, unsigned char qos)
+{
+    MqttSharedPublish::MqttSharedPublishPtr encoded = MqttSharedPublish::create(topic, payload);
+    if (encoded == nullptr)
+    {
+        return 0;
+    }
+
+    std::size_t queued = 0;
+    for (std::unique_ptr<Shard> &shard : shards_)
+    {
+        if (sendToShard(*shard, {encoded, qos, nullptr, nullptr}))
+        {
+            queued++;
+        }
+    }
+    return queued;
+}
+
+/**
+ * Run cb on the shard's own thread with its MqttServer, which is the only safe
+ * way to touch a shard from outside. Safe from any thread.
+ */
+
+bool MqttShardedBroker::post(std::size_t shard, ShardTaskCb cb, void *obj)
+{
+    if ((shard >= shards_.size()) || (cb == nullptr))
+    {
+        return false;
+    }
+    return sendToShard(*shards_[shard], {nullptr, 0, cb, obj});
+}
+
+/**
+ * A PUBLISH arriving on one of the shards' sessions. Runs on that shard's thread.
+ *
+ * @return the number of local sessions it was delivered to
+ */
+
+std::size_t MqttShardedBroker::handleShardPublish(Shard &shard, std::string_view topic, std::span<const unsigned char> payload, unsigned char qos)
+{
+    MqttSharedPublish::MqttSharedPublishPtr encoded = MqttSharedPublish::create(topic, payload);
+    if (encoded == nullptr)
+    {
+        return 0;
+    }
+
+    for (std::unique_ptr<Shard> &other : shards_)
+    {
+        if (other.get() != &shard)
+        {
+            sendToShard(*other, {encoded, qos, nullptr, nullptr});
+        }
+    }
+
+    return shard.mqttServer.publish(encoded, qos);
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+void MqttShardedBroker::runShard(Shard &shard)
+{
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    while (running_.load(std::memory_order_acquire))
+    {
+        shard.tcpServer.poll(MQTT_SHARD_POLL_MS);
+        drainInbox(shard);
+
+        // only whole milliseconds are taken off, the rest counts next time round
+        std::chrono::milliseconds elapsed =
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - last);
+        shard.mqttServer.processTimers(elapsed.count());
+        last += elapsed;
+    }
+}
+
+void MqttShardedBroker::drainInbox(Shard &shard)
+{
+    Shard::Message message;
+
+    while (shard.inbox.pop(message))
+    {
+        if (message.task != nullptr)
+        {
+            message.task(message.obj, shard.mqttServer);
+        }
+        else
+        {
+            shard.mqttServer.publish(message.publish, message.qos);
+        }
+    }
+}
+
+bool MqttShardedBroker::sendToShard(Shard &shard, Shard::Message message)
+{
+    if (!shard.inbox.push(std::move(message)))
+    {
+        dropped_++;
+        MQTT_WARNING("shard %zu inbox full, message dropped", shard.index);
+        return false;
+    }
+
+    shard.tcpServer.wakeup();
+    return true;
+}
+
+#endif /* MQTT_EPOLL_TRANSPORT */
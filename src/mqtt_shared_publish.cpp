@@ -0,0 +1,291 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include <string.h>
+#include "mqtt_message_encoder.h"
+#include "mqtt_shared_publish.h"
+
+// the topic of a PUBLISH sent by Topic Alias alone
+static const unsigned char emptyTopicBlock[2] = {0x00, 0x00};
+
+/*****************************************************************************
+ * MqttSharedPublish
+******************************************************************************/
+
+/**
+ * Encode the topic and payload once. Returns nullptr if the topic is too long
+ * to carry a two byte length prefix.
+ */
+
+MqttSharedPublish::MqttSharedPublishPtr MqttSharedPublish::create(std::string_view topic, std::span<const unsigned char> payload)
+{
+    if (topic.size() > 0xFFFF)
+    {
+        return nullptr;
+    }
+    return std::allocate_shared<MqttSharedPublish>(MqttPoolAllocator<MqttSharedPublish>(), topic, payload);
+}
+
+MqttSharedPublish::MqttSharedPublish(std::string_view topic, std::span<const unsigned char> payload)
+{
+    topicLength_ = topic.size();
+    body_.resize(2 + topic.size() + payload.size());
+
+    body_[0] = (topic.size() >> 8) & 0xFF; // Topic Length MSB
+    body_[1] = topic.size() & 0xFF;        // Topic Length LSB
+
+    if (!topic.empty())
+    {
+        memcpy(&body_[2], topic.data(), topic.size());
+    }
+    if (!payload.empty())
+    {
+        memcpy(&body_[2 + topic.size()], payload.data(), payload.size());
+    }
+}
+
+std::string_view MqttSharedPublish::getTopic() const
+{
+    return std::string_view(reinterpret_cast<const char *>(body_.data()) + 2, topicLength_);
+}
+
+std::span<const unsigned char> MqttSharedPublish::getPayload() const
+{
+    return std::span<const unsigned char>(body_.data() + 2 + topicLength_, body_.size() - 2 - topicLength_);
+}
+
+/**
+ * @return the topic with its two byte length prefix, as it appears on the wire
+ */
+
+std::span<const unsigned char> MqttSharedPublish::getTopicBlock() const
+{
+    return std::span<const unsigned char>(body_.data(), 2 + topicLength_);
+}
+
+/*****************************************************************************
+ * MqttPublishDelivery
+******************************************************************************/
+
+MqttPublishDelivery::MqttPublishDelivery()
+{
+    reset();
+}
+
+MqttPublishDelivery::MqttPublishDelivery(MqttSharedPublish::MqttSharedPublishPtr publish, unsigned char qos,
+                                         bool retain, unsigned short packetIdentifier)
+{
+    reset();
+
+    if (publish == nullptr)
+    {
+        return;
+    }
+
+    qos_ = qos & 0x03;
+    packetIdentifier_[0] = (packetIdentifier >> 8) & 0xFF;
+    packetIdentifier_[1] = packetIdentifier & 0xFF;
+
+    std::size_t remainingLength = getRemainingLength(*publish, 0, false);
+    if (remainingLength > MqttMessageEncoder::MAX_REMAINING_LENGTH)
+    {
+        return;
+    }
+
+    header_[0] = 0x30 | (retain ? 0x01 : 0x00) | (qos_ << 1); // PUBLISH | Retain | QoS
+    headerLength_ = 1 + MqttMessageEncoder::encodeRemainingLength(&header_[1], remainingLength);
+    publish_ = std::move(publish);
+}
+
+bool MqttPublishDelivery::isValid() const
+{
+    return publish_ != nullptr;
+}
+
+/**
+ * Drop the reference to the shared PUBLISH, the last delivery to do so frees it
+ */
+
+void MqttPublishDelivery::reset()
+{
+    publish_ = nullptr;
+    headerLength_ = 0;
+    packetIdentifier_[0] = 0;
+    packetIdentifier_[1] = 0;
+    propertiesLength_ = 0;
+    topicOmitted_ = false;
+    qos_ = 0;
+}
+
+unsigned char MqttPublishDelivery::getQoS() const
+{
+    return qos_;
+}
+
+unsigned short MqttPublishDelivery::getPacketIdentifier() const
+{
+    return static_cast<unsigned short>((packetIdentifier_[0] << 8) | packetIdentifier_[1]);
+}
+
+/**
+ * Packet identifiers are handed out when the frame is sent rather than when it is
+ * queued, so they are only taken while the PUBLISH is actually inflight
+ */
+
+void MqttPublishDelivery::setPacketIdentifier(unsigned short packetIdentifier)
+{
+    packetIdentifier_[0] = (packetIdentifier >> 8) & 0xFF;
+    packetIdentifier_[1] = packetIdentifier & 0xFF;
+}
+
+/**
+ * Set the DUP flag for a QoS 1 or 2 PUBLISH that is being sent again
+ */
+
+void MqttPublishDelivery::setDuplicate()
+{
+    if (isValid() && (qos_ > 0))
+    {
+        header_[0] |= 0x08;
+    }
+}
+
+/**
+ * Give the frame the properties a v5 PUBLISH needs, which the shared part can't
+ * hold as they differ between connections: just the Property Length, or a Topic
+ * Alias too if topicAlias isn't 0. The topic is left out if it isn't to be sent.
+ * Can be called again to change them.
+ *
+ * @return false, with the frame unchanged, if it would grow past the largest
+ * Remaining Length
+ */
+
+bool MqttPublishDelivery::setProperties(unsigned short topicAlias, bool sendTopic)
+{
+    if (!isValid())
+    {
+        return false;
+    }
+
+    const std::size_t propertiesLength = (topicAlias != 0) ? 4 : 1;
+    const bool topicOmitted = (topicAlias != 0) && !sendTopic;
+    const std::size_t remainingLength = getRemainingLength(*publish_, propertiesLength, topicOmitted);
+
+    if (remainingLength > MqttMessageEncoder::MAX_REMAINING_LENGTH)
+    {
+        return false;
+    }
+
+    properties_[0] = static_cast<unsigned char>(propertiesLength - 1);
+    properties_[1] = 0x23; // Topic Alias
+    properties_[2] = (topicAlias >> 8) & 0xFF;
+    properties_[3] = topicAlias & 0xFF;
+    propertiesLength_ = static_cast<unsigned char>(propertiesLength);
+    topicOmitted_ = topicOmitted;
+    headerLength_ = 1 + MqttMessageEncoder::encodeRemainingLength(&header_[1], remainingLength);
+    return true;
+}
+
+const MqttSharedPublish::MqttSharedPublishPtr &MqttPublishDelivery::getPublish() const
+{
+    return publish_;
+}
+
+std::size_t MqttPublishDelivery::getFrameLength() const
+{
+    std::span<const unsigned char> segments[MAX_SEGMENTS];
+    std::size_t length = 0;
+
+    for (std::size_t i = 0, count = getSegments(segments); i < count; i++)
+    {
+        length += segments[i].size();
+    }
+    return length;
+}
+
+/**
+ * Fill in the pieces of the frame in the order they go on the wire, without
+ * copying any of them.
+ *
+ * @return the number of segments, 0 if the delivery is not valid
+ */
+
+std::size_t MqttPublishDelivery::getSegments(std::span<const unsigned char> (&segments)[MAX_SEGMENTS]) const
+{
+    if (!isValid())
+    {
+        return 0;
+    }
+
+    std::size_t count = 0;
+    segments[count++] = std::span<const unsigned char>(header_, headerLength_);
+    segments[count++] = topicOmitted_ ? std::span<const unsigned char>(emptyTopicBlock) : publish_->getTopicBlock();
+    if (qos_ > 0)
+    {
+        segments[count++] = std::span<const unsigned char>(packetIdentifier_, 2);
+    }
+    if (propertiesLength_ > 0)
+    {
+        segments[count++] = std::span<const unsigned char>(properties_, propertiesLength_);
+    }
+    if (!publish_->getPayload().empty())
+    {
+        segments[count++] = publish_->getPayload();
+    }
+    return count;
+}
+
+/**
+ * Gather the frame into a contiguous buffer for transports that need one.
+ *
+ * @return the bytes written, or 0 if the buffer is too small
+ */
+
+std::size_t MqttPublishDelivery::copyTo(std::span<unsigned char> buffer) const
+{
+    std::span<const unsigned char> segments[MAX_SEGMENTS];
+    std::size_t count = getSegments(segments);
+
+    if ((count == 0) || (buffer.size() < getFrameLength()))
+    {
+        return 0;
+    }
+
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        memcpy(buffer.data() + length, segments[i].data(), segments[i].size());
+        length += segments[i].size();
+    }
+    return length;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+std::size_t MqttPublishDelivery::getRemainingLength(const MqttSharedPublish &publish, std::size_t propertiesLength, bool topicOmitted) const
+{
+    return (topicOmitted ? sizeof(emptyTopicBlock) : publish.getTopicBlock().size()) + (qos_ > 0 ? 2 : 0) +
+           propertiesLength + publish.getPayload().size();
+}
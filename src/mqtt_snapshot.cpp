@@ -0,0 +1,520 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_snapshot.h"
+
+#ifdef MQTT_PERSISTENCE
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // the snapshot is little endian whatever the host is
+
+    void put32(unsigned char *p, std::uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            p[i] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    void put64(unsigned char *p, std::uint64_t value)
+    {
+        put32(p, value & 0xFFFFFFFFu);
+        put32(p + 4, value >> 32);
+    }
+
+    std::uint32_t get32(const unsigned char *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+    }
+
+    std::uint64_t get64(const unsigned char *p)
+    {
+        return get32(p) | (static_cast<std::uint64_t>(get32(p + 4)) << 32);
+    }
+
+    bool writeAll(int fd, const unsigned char *data, std::size_t length)
+    {
+        while (length > 0)
+        {
+            ssize_t written = write(fd, data, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    const char SNAPSHOT_FILE[] = "retained.snap";
+}
+
+void retainedNodeCb(void *obj, std::uint32_t node, const MqttRetainedStore::Retained &retained)
+{
+    MqttSnapshot *snapshot = static_cast<MqttSnapshot *>(obj);
+    snapshot->handleRetainedNode(node, retained);
+}
+
+MqttSnapshot::MqttSnapshot()
+{
+    sections_[0] = sections_[1] = {0, 0};
+    messageCount_ = 0;
+    directory_[0] = '\0';
+    position_ = {0, 0};
+    state_ = CheckpointState::Idle;
+}
+
+MqttSnapshot::~MqttSnapshot()
+{
+    if (writer_.joinable())
+    {
+        writer_.join();
+    }
+}
+
+/**
+ * Loads the snapshot in a directory into the retained store, replacing whatever
+ * was in it, after checking every CRC.
+ * @param position set to where the log should be replayed from
+ * @return false if there is no usable snapshot, in which case the store is left
+ *         empty and the whole log should be replayed
+ */
+
+bool MqttSnapshot::load(const char *directory, MqttRetainedStore &retained, MqttPersistentStore::Position &position)
+{
+    char path[MQTT_STORE_PATH_LENGTH];
+    if (!formatPath(directory, "", path, sizeof(path)))
+    {
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false; // nothing checkpointed yet
+    }
+
+    struct stat info = {};
+    void *map = MAP_FAILED;
+
+    if ((fstat(fd, &info) == 0) && (static_cast<std::size_t>(info.st_size) >= HEADER_SIZE))
+    {
+        map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        MQTT_WARNING("unable to map the snapshot %s", path);
+        return false;
+    }
+
+    const unsigned char *base = static_cast<const unsigned char *>(map);
+    const std::size_t size = info.st_size;
+    bool loaded = false;
+
+    do
+    {
+        if ((get32(&base[0]) != MAGIC) || (get32(&base[4]) != VERSION) || (get32(&base[12]) != SECTIONS) ||
+            (get32(&base[24]) != MQTT_SNAPSHOT_CHUNK_SIZE))
+        {
+            MQTT_WARNING("%s is not a snapshot this broker can read", path);
+            break;
+        }
+
+        Section sections[SECTIONS];
+        std::size_t tableEnd = HEADER_SIZE + SECTIONS * SECTION_ENTRY_SIZE;
+        bool inside = true;
+
+        for (std::size_t i = 0; i < SECTIONS; i++)
+        {
+            const unsigned char *entry = base + HEADER_SIZE + i * SECTION_ENTRY_SIZE;
+            sections[i] = {get64(&entry[8]), get64(&entry[16])};
+            inside = inside && (get32(&entry[0]) == i + 1) && (get32(&entry[4]) == chunksIn(sections[i].length)) &&
+                     (sections[i].offset <= size) && (sections[i].length <= size - sections[i].offset);
+            tableEnd += 4 * chunksIn(sections[i].length);
+        }
+
+        if (!inside || (tableEnd > size))
+        {
+            MQTT_WARNING("snapshot %s is truncated", path);
+            break;
+        }
+
+        // the header CRC covers the header, the section table and the chunk CRCs
+
+        std::vector<unsigned char> header(base, base + tableEnd);
+        put32(&header[28], 0);
+        if ((MqttPersistentStore::checksum(header.data(), header.size()) != get32(&base[28])) ||
+            !verifyChunks(base, sections, base + HEADER_SIZE + SECTIONS * SECTION_ENTRY_SIZE))
+        {
+            MQTT_WARNING("snapshot %s is damaged", path);
+            break;
+        }
+
+        const Section &tree = sections[static_cast<std::size_t>(SectionType::RetainedTree) - 1];
+        const Section &messages = sections[static_cast<std::size_t>(SectionType::RetainedMessages) - 1];
+
+        bool sameLayout = (get32(&base[8]) == MqttRetainedStore::getTreeLayout()) &&
+                          (tree.length == MqttRetainedStore::getTreeSize());
+        bool attach = sameLayout && retained.loadTree(base + tree.offset);
+
+        if (!attach)
+        {
+            retained.clear();
+        }
+
+        if (!loadMessages(base + messages.offset, messages.length, attach, retained))
+        {
+            MQTT_WARNING("snapshot %s has a malformed message", path);
+            retained.clear();
+            break;
+        }
+
+        position = {get32(&base[16]), get32(&base[20])};
+        loaded = true;
+    } while (false);
+
+    munmap(map, size);
+    return loaded;
+}
+
+/**
+ * Copies the retained store and starts writing it to the directory in the
+ * background. position is where the log carries on after this state, normally
+ * from MqttPersistentStore::beginCheckpoint().
+ * @return false if a checkpoint is already being written
+ */
+
+bool MqttSnapshot::startCheckpoint(const char *directory, const MqttRetainedStore &retained,
+                                   const MqttPersistentStore::Position &position)
+{
+    if (state_ == CheckpointState::Writing)
+    {
+        return false;
+    }
+
+    if (writer_.joinable())
+    {
+        writer_.join();
+    }
+
+    std::size_t length = strlen(directory);
+    if (length >= sizeof(directory_))
+    {
+        return false;
+    }
+    memcpy(directory_, directory, length + 1);
+    position_ = position;
+
+    // the sections, each 8 byte aligned; the header is put in front when written
+
+    image_.resize(MqttRetainedStore::getTreeSize());
+    retained.saveTree(image_.data());
+    sections_[0] = {0, image_.size()};
+
+    image_.resize((image_.size() + 7) & ~std::size_t(7));
+    sections_[1].offset = image_.size();
+    image_.resize(image_.size() + 4);
+    messageCount_ = 0;
+    retained.forEachNode(retainedNodeCb, this);
+    put32(&image_[sections_[1].offset], messageCount_);
+    sections_[1].length = image_.size() - sections_[1].offset;
+
+    state_ = CheckpointState::Writing;
+    writer_ = std::thread(writeCheckpoint, this);
+    return true;
+}
+
+bool MqttSnapshot::isCheckpointing() const
+{
+    return state_ != CheckpointState::Idle;
+}
+
+/**
+ * @return Written or Failed once when the background write has finished, then
+ *         Idle until the next checkpoint
+ */
+
+MqttSnapshot::CheckpointState MqttSnapshot::pollCheckpoint()
+{
+    CheckpointState state = state_;
+
+    if ((state == CheckpointState::Written) || (state == CheckpointState::Failed))
+    {
+        writer_.join();
+        state_ = CheckpointState::Idle;
+    }
+    return state;
+}
+
+MqttSnapshot::CheckpointState MqttSnapshot::waitForCheckpoint()
+{
+    while (state_ == CheckpointState::Writing)
+    {
+        std::this_thread::yield();
+    }
+    return pollCheckpoint();
+}
+
+const MqttPersistentStore::Position &MqttSnapshot::getCheckpointPosition() const
+{
+    return position_;
+}
+
+std::size_t MqttSnapshot::getCheckpointBytes() const
+{
+    return image_.size();
+}
+
+void MqttSnapshot::handleRetainedNode(std::uint32_t node, const MqttRetainedStore::Retained &retained)
+{
+    std::string_view topic = retained.publish->getTopic();
+    std::span<const unsigned char> payload = retained.publish->getPayload();
+    std::size_t offset = image_.size();
+
+    image_.resize(offset + MESSAGE_ENTRY_SIZE + topic.size() + payload.size());
+
+    unsigned char *entry = &image_[offset];
+    put32(&entry[0], node);
+    put32(&entry[4], topic.size());
+    put32(&entry[8], payload.size());
+    entry[12] = retained.qos;
+    memcpy(&entry[MESSAGE_ENTRY_SIZE], topic.data(), topic.size());
+    memcpy(&entry[MESSAGE_ENTRY_SIZE + topic.size()], payload.data(), payload.size());
+    messageCount_++;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+bool MqttSnapshot::formatPath(const char *directory, const char *suffix, char *path, std::size_t size)
+{
+    int written = snprintf(path, size, "%s/%s%s", directory, SNAPSHOT_FILE, suffix);
+    return (written > 0) && (static_cast<std::size_t>(written) < size);
+}
+
+std::size_t MqttSnapshot::chunksIn(std::uint64_t length)
+{
+    return (length + MQTT_SNAPSHOT_CHUNK_SIZE - 1) / MQTT_SNAPSHOT_CHUNK_SIZE;
+}
+
+/**
+ * Checks the CRC of every chunk of every section, sharing the chunks out between
+ * up to MQTT_SNAPSHOT_THREADS threads
+ */
+
+bool MqttSnapshot::verifyChunks(const unsigned char *base, const Section (&sections)[SECTIONS], const unsigned char *crcs)
+{
+    struct Chunk
+    {
+        const unsigned char *data;
+        std::size_t length;
+        std::uint32_t crc;
+    };
+
+    std::vector<Chunk> chunks;
+    for (const Section &section : sections)
+    {
+        for (std::uint64_t done = 0; done < section.length; done += MQTT_SNAPSHOT_CHUNK_SIZE)
+        {
+            std::size_t length = std::min<std::uint64_t>(MQTT_SNAPSHOT_CHUNK_SIZE, section.length - done);
+            chunks.push_back({base + section.offset + done, length, get32(crcs)});
+            crcs += 4;
+        }
+    }
+
+    std::atomic<std::size_t> next = 0;
+    std::atomic<bool> intact = true;
+
+    auto verify = [&] {
+        for (std::size_t i = next++; (i < chunks.size()) && intact; i = next++)
+        {
+            if (MqttPersistentStore::checksum(chunks[i].data, chunks[i].length) != chunks[i].crc)
+            {
+                intact = false;
+            }
+        }
+    };
+
+    std::size_t helpers = std::min<std::size_t>(MQTT_SNAPSHOT_THREADS, chunks.size());
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < helpers; i++)
+    {
+        threads.emplace_back(verify);
+    }
+    verify();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    return intact;
+}
+
+/**
+ * Puts the messages back in the store, on the node each came from when the tree
+ * was loaded, or by topic when it wasn't or the node can't take it
+ */
+
+bool MqttSnapshot::loadMessages(const unsigned char *messages, std::size_t length, bool attach, MqttRetainedStore &retained)
+{
+    if (length < 4)
+    {
+        return false;
+    }
+
+    std::uint32_t count = get32(messages);
+    std::size_t offset = 4;
+
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+        if (length - offset < MESSAGE_ENTRY_SIZE)
+        {
+            return false;
+        }
+
+        const unsigned char *entry = messages + offset;
+        std::uint32_t node = get32(&entry[0]);
+        std::size_t topicLength = get32(&entry[4]);
+        std::size_t payloadLength = get32(&entry[8]);
+        unsigned char qos = entry[12];
+
+        if ((topicLength > length - offset - MESSAGE_ENTRY_SIZE) ||
+            (payloadLength > length - offset - MESSAGE_ENTRY_SIZE - topicLength))
+        {
+            return false;
+        }
+
+        std::string_view topic(reinterpret_cast<const char *>(&entry[MESSAGE_ENTRY_SIZE]), topicLength);
+        std::span<const unsigned char> payload(&entry[MESSAGE_ENTRY_SIZE + topicLength], payloadLength);
+        MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create(topic, payload);
+
+        if (!(attach && retained.attach(node, publish, qos)))
+        {
+            retained.store(publish, qos);
+        }
+        offset += MESSAGE_ENTRY_SIZE + topicLength + payloadLength;
+    }
+    return true;
+}
+
+void MqttSnapshot::writeCheckpoint(MqttSnapshot *snapshot)
+{
+    snapshot->state_ = snapshot->writeFile() ? CheckpointState::Written : CheckpointState::Failed;
+}
+
+/**
+ * Runs on the writer thread: puts the header and CRCs in front of the sections,
+ * writes them under a temporary name and renames the file into place once it is
+ * on the disk
+ */
+
+bool MqttSnapshot::writeFile()
+{
+    std::size_t tableEnd = HEADER_SIZE + SECTIONS * SECTION_ENTRY_SIZE;
+    for (const Section &section : sections_)
+    {
+        tableEnd += 4 * chunksIn(section.length);
+    }
+    const std::size_t dataStart = (tableEnd + 7) & ~std::size_t(7);
+
+    std::vector<unsigned char> header(dataStart, 0);
+    put32(&header[0], MAGIC);
+    put32(&header[4], VERSION);
+    put32(&header[8], MqttRetainedStore::getTreeLayout());
+    put32(&header[12], SECTIONS);
+    put32(&header[16], position_.sequence);
+    put32(&header[20], position_.offset);
+    put32(&header[24], MQTT_SNAPSHOT_CHUNK_SIZE);
+
+    unsigned char *crc = &header[HEADER_SIZE + SECTIONS * SECTION_ENTRY_SIZE];
+
+    for (std::size_t i = 0; i < SECTIONS; i++)
+    {
+        unsigned char *entry = &header[HEADER_SIZE + i * SECTION_ENTRY_SIZE];
+        put32(&entry[0], i + 1);
+        put32(&entry[4], chunksIn(sections_[i].length));
+        put64(&entry[8], dataStart + sections_[i].offset);
+        put64(&entry[16], sections_[i].length);
+
+        for (std::uint64_t done = 0; done < sections_[i].length; done += MQTT_SNAPSHOT_CHUNK_SIZE)
+        {
+            std::size_t length = std::min<std::uint64_t>(MQTT_SNAPSHOT_CHUNK_SIZE, sections_[i].length - done);
+            put32(crc, MqttPersistentStore::checksum(&image_[sections_[i].offset + done], length));
+            crc += 4;
+        }
+    }
+    put32(&header[28], MqttPersistentStore::checksum(header.data(), tableEnd));
+
+    char temporary[MQTT_STORE_PATH_LENGTH];
+    char path[MQTT_STORE_PATH_LENGTH];
+    if (!formatPath(directory_, ".tmp", temporary, sizeof(temporary)) || !formatPath(directory_, "", path, sizeof(path)))
+    {
+        return false;
+    }
+
+    int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        MQTT_ERROR("unable to create %s: %s", temporary, strerror(errno));
+        return false;
+    }
+
+    bool written = writeAll(fd, header.data(), header.size()) && writeAll(fd, image_.data(), image_.size()) &&
+                   (fsync(fd) == 0);
+    close(fd);
+
+    if (!written || (rename(temporary, path) < 0))
+    {
+        MQTT_ERROR("unable to write %s: %s", path, strerror(errno));
+        unlink(temporary);
+        return false;
+    }
+
+    // make the rename itself durable before the log behind it is deleted
+    int dir = open(directory_, O_RDONLY);
+    if (dir >= 0)
+    {
+        fsync(dir);
+        close(dir);
+    }
+    return true;
+}
+
+#endif /* MQTT_PERSISTENCE */
@@ -39,62 +39,45 @@
 
 MqttSubackParser::MqttSubackParser() {}
 
-MqttMessageParser::ParseResult MqttSubackParser::parseMessage(const std::vector<unsigned char> &subackMessage)
+MqttMessageParser::ParseResult MqttSubackParser::parseMessage(std::span<const unsigned char> subackMessage)
 {
-    subackMessage_ = subackMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(subackMessage);
     parseFixedHeader();
     parseVariableHeader();
     parsePayload();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttSubackParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = subackMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttSubackParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttSubackParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = subackMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttSubackParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (subackMessage_[currentIndex_++] << 8) + subackMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 void MqttSubackParser::parsePayload()
 {
-    // Parse the QoS levels from the payload
-    while (currentIndex_ < subackMessage_.size())
+    // Step over the reason code of each subscription
+    while (!reader_.atEnd())
     {
-        // Parse the QoS level
-        unsigned char qosLevel = subackMessage_[currentIndex_++];
-
-        // Display parsed QoS level
-        MQTT_INFO("QoS Level: %d", qosLevel);
+        reader_.readByte();
     }
 }
 
@@ -39,74 +39,53 @@
 
 MqttSubscribeParser::MqttSubscribeParser() {}
 
-MqttMessageParser::ParseResult MqttSubscribeParser::parseMessage(const std::vector<unsigned char> &subscribeMessage)
+MqttMessageParser::ParseResult MqttSubscribeParser::parseMessage(std::span<const unsigned char> subscribeMessage)
 {
-    subscribeMessage_ = subscribeMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(subscribeMessage);
     parseFixedHeader();
     parseVariableHeader();
     parsePayload();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttSubscribeParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = subscribeMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttSubscribeParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttSubscribeParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = subscribeMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttSubscribeParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (subscribeMessage_[currentIndex_++] << 8) + subscribeMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 void MqttSubscribeParser::parsePayload()
 {
-    // Parse each subscription topic and QoS pair
-    while (currentIndex_ < subscribeMessage_.size())
+    // Step over each topic filter and its subscription options, a short read
+    // leaves the reader at the end
+    while (!reader_.atEnd())
     {
-        // Parse the topic name
-        std::string topicName = parseString();
-
-        // Parse the QoS level
-        unsigned char qosLevel = subscribeMessage_[currentIndex_++];
-
-        // Display parsed subscription information
-        std::cout << "Subscription: Topic=" << topicName << ", QoS=" << static_cast<int>(qosLevel) << std::endl;
+        parseString();
+        reader_.readByte();
     }
 }
 
-std::string MqttSubscribeParser::parseString()
+std::string_view MqttSubscribeParser::parseString()
 {
-    int stringLength = (subscribeMessage_[currentIndex_++] << 8) + subscribeMessage_[currentIndex_++];
-    std::string str(subscribeMessage_.begin() + currentIndex_, subscribeMessage_.begin() + currentIndex_ + stringLength);
-    currentIndex_ += stringLength;
-    return str;
+    return reader_.readString();
 }
 
 int MqttSubscribeParser::getPacketIdentifier() const
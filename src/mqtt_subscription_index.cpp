@@ -0,0 +1,737 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_subscription_index.h"
+#include "mqtt_topic.h"
+
+namespace
+{
+    std::uint32_t mixHash(std::uint32_t hash)
+    {
+        hash ^= hash >> 15;
+        hash *= 2246822519u;
+        hash ^= hash >> 13;
+        hash *= 3266489917u;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    std::uint32_t hashTopic(std::string_view topic)
+    {
+        std::uint32_t hash = 2166136261u; // FNV-1a
+
+        for (char c : topic)
+        {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+        }
+        return hash;
+    }
+}
+
+MqttSubscriptionIndex::MqttSubscriptionIndex()
+{
+    // make sure the topic table outlives any index that holds its tokens
+    MqttTopicTable::getInstance();
+    shareStrategy_ = ShareStrategy::RoundRobin;
+    loadCb_ = nullptr;
+    loadObj_ = nullptr;
+    reset();
+}
+
+MqttSubscriptionIndex::~MqttSubscriptionIndex()
+{
+    clear();
+}
+
+/**
+ * removes every subscription
+ */
+
+void MqttSubscriptionIndex::clear()
+{
+    MqttTopicTable &topics = MqttTopicTable::getInstance();
+
+    for (int i = 0; i < MAX_SUBSCRIPTION_NODES; i++)
+    {
+        if ((nodes_[i].parent != NO_ENTRY) && (nodes_[i].token != MqttTopicTable::NO_TOKEN))
+        {
+            topics.release(nodes_[i].token);
+        }
+    }
+
+    for (int i = 0; i < MAX_SHARE_GROUPS; i++)
+    {
+        if (groups_[i].node != NO_ENTRY)
+        {
+            topics.release(groups_[i].shareName);
+        }
+    }
+    reset();
+}
+
+/**
+ * Adds a subscription. If the subscriber already has this filter its QoS is
+ * replaced, as required by the spec. A "$share/{ShareName}/{filter}" makes the
+ * subscriber a member of that share group on {filter}.
+ * @return false if the filter is malformed or the index is full
+ */
+
+bool MqttSubscriptionIndex::subscribe(std::string_view filter, SubscriberId subscriber, unsigned char qos)
+{
+    // check the whole filter before changing anything
+
+    std::string_view shareName;
+    bool shared = MqttTopic::splitSharedFilter(filter, shareName, filter);
+
+    if (shared && (shareName.empty() || (shareName.find_first_of("+#") != std::string_view::npos) ||
+                   (shareName.size() >= MAX_TOPIC_LENGTH) || filter.empty()))
+    {
+        MQTT_WARNING("malformed shared subscription");
+        return false;
+    }
+
+    MqttTopicScan scan;
+    MqttTopic::scan(filter, scan);
+
+    if ((scan.length == 0) || !scan.levelsFit())
+    {
+        MQTT_WARNING("subscription filter is empty or too long");
+        return false;
+    }
+
+    if (scan.longestLevel >= MAX_TOPIC_LENGTH)
+    {
+        MQTT_WARNING("subscription filter level too long");
+        return false;
+    }
+
+    if (!scan.isValidFilter())
+    {
+        MQTT_WARNING("misplaced wildcard in subscription filter");
+        return false;
+    }
+
+    int node = ROOT_NODE;
+
+    for (std::size_t i = 0; i < scan.levelCount; i++)
+    {
+        int child = findOrAddChild(node, scan.getLevel(filter, i));
+
+        if (child == NO_ENTRY)
+        {
+            MQTT_WARNING("no free subscription nodes");
+            releaseNodeIfUnused(node); // unwind any nodes created for this filter
+            return false;
+        }
+        node = child;
+    }
+
+    int group = NO_ENTRY;
+    int *first = &nodes_[node].firstSubscription;
+
+    if (shared)
+    {
+        group = findOrAddGroup(node, shareName);
+        if (group == NO_ENTRY)
+        {
+            MQTT_WARNING("no free share groups");
+            releaseNodeIfUnused(node);
+            return false;
+        }
+        first = &groups_[group].firstMember;
+    }
+
+    for (int entry = *first; entry != NO_ENTRY; entry = entries_[entry].next)
+    {
+        if (entries_[entry].subscription.subscriber == subscriber)
+        {
+            entries_[entry].subscription.qos = qos;
+            return true;
+        }
+    }
+
+    if (freeEntries_ == NO_ENTRY)
+    {
+        MQTT_WARNING("no free subscriptions");
+        releaseGroupIfUnused(group);
+        releaseNodeIfUnused(node);
+        return false;
+    }
+
+    int entry = freeEntries_;
+    freeEntries_ = entries_[entry].next;
+
+    entries_[entry].subscription = {subscriber, qos};
+    entries_[entry].node = node;
+    entries_[entry].group = group;
+    entries_[entry].next = *first;
+    *first = entry;
+    if (group != NO_ENTRY)
+    {
+        groups_[group].memberCount++;
+    }
+    subscriptionCount_++;
+    return true;
+}
+
+/**
+ * Removes one subscriber's subscription to a filter, pruning any branch of the
+ * tree that no longer leads to a subscription.
+ * @return false if there was no such subscription
+ */
+
+bool MqttSubscriptionIndex::unsubscribe(std::string_view filter, SubscriberId subscriber)
+{
+    std::string_view shareName;
+    bool shared = MqttTopic::splitSharedFilter(filter, shareName, filter);
+    int node = findNode(filter);
+    int group = NO_ENTRY;
+
+    if ((node != NO_ENTRY) && shared)
+    {
+        Token token = MqttTopicTable::getInstance().find(shareName);
+        group = (token != MqttTopicTable::NO_TOKEN) ? findGroup(node, token) : NO_ENTRY;
+    }
+
+    if ((node == NO_ENTRY) || (shared && (group == NO_ENTRY)))
+    {
+        return false;
+    }
+
+    int first = shared ? groups_[group].firstMember : nodes_[node].firstSubscription;
+
+    for (int entry = first; entry != NO_ENTRY; entry = entries_[entry].next)
+    {
+        if (entries_[entry].subscription.subscriber == subscriber)
+        {
+            removeEntry(node, entry);
+            releaseGroupIfUnused(group);
+            releaseNodeIfUnused(node);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Removes every subscription held by a subscriber, used when a session ends.
+ * This visits each subscription once, which is fine off the publish path.
+ */
+
+void MqttSubscriptionIndex::unsubscribeAll(SubscriberId subscriber)
+{
+    for (int entry = 0; entry < MAX_SUBSCRIPTIONS; entry++)
+    {
+        int node = entries_[entry].node;
+
+        if ((node != NO_ENTRY) && (entries_[entry].subscription.subscriber == subscriber))
+        {
+            int group = entries_[entry].group;
+
+            removeEntry(node, entry);
+            releaseGroupIfUnused(group);
+            releaseNodeIfUnused(node);
+        }
+    }
+}
+
+/**
+ * Finds every subscription whose filter matches a published topic and passes
+ * each to cb, and one member of each matching share group. Topics starting with
+ * '$' are not matched by a leading wildcard.
+ * @return the number of subscriptions passed to cb
+ */
+
+std::size_t MqttSubscriptionIndex::match(std::string_view topic, MatchCb cb, void *obj) const
+{
+    Token tokens[MAX_TOPIC_LENGTH];
+    std::size_t levelCount = MqttTopicTable::getInstance().resolve(topic, tokens, MAX_TOPIC_LENGTH);
+
+    if (levelCount == 0)
+    {
+        return 0;
+    }
+
+    Walk walk = {topic, tokens, levelCount, topic[0] == '$', cb, obj, 0, false};
+    return matchLevel(ROOT_NODE, 0, walk);
+}
+
+/**
+ * Choose how every share group picks the member a message goes to. LeastInflight
+ * needs a LoadCb, and without one works as RoundRobin.
+ */
+
+void MqttSubscriptionIndex::setShareStrategy(ShareStrategy strategy)
+{
+    shareStrategy_ = strategy;
+}
+
+void MqttSubscriptionIndex::setLoadCb(LoadCb cb, void *obj)
+{
+    loadCb_ = cb;
+    loadObj_ = obj;
+}
+
+std::size_t MqttSubscriptionIndex::getSubscriptionCount() const
+{
+    return subscriptionCount_;
+}
+
+std::size_t MqttSubscriptionIndex::getNodeCount() const
+{
+    return nodeCount_;
+}
+
+std::size_t MqttSubscriptionIndex::getShareGroupCount() const
+{
+    return groupCount_;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+void MqttSubscriptionIndex::reset()
+{
+    for (std::size_t i = 0; i < CHILD_BUCKETS; i++)
+    {
+        buckets_[i] = NO_ENTRY;
+    }
+
+    // node 0 is the root and is never freed, the rest go on the free list
+
+    for (int i = 0; i < MAX_SUBSCRIPTION_NODES; i++)
+    {
+        nodes_[i].parent = NO_ENTRY;
+        nodes_[i].nextInBucket = (i + 1 < MAX_SUBSCRIPTION_NODES) ? i + 1 : NO_ENTRY;
+        nodes_[i].plusChild = NO_ENTRY;
+        nodes_[i].hashChild = NO_ENTRY;
+        nodes_[i].firstSubscription = NO_ENTRY;
+        nodes_[i].firstGroup = NO_ENTRY;
+        nodes_[i].childCount = 0;
+        nodes_[i].token = MqttTopicTable::NO_TOKEN;
+    }
+    nodes_[ROOT_NODE].nextInBucket = NO_ENTRY;
+    freeNodes_ = (MAX_SUBSCRIPTION_NODES > 1) ? 1 : NO_ENTRY;
+    nodeCount_ = 1;
+
+    for (int i = 0; i < MAX_SUBSCRIPTIONS; i++)
+    {
+        entries_[i].node = NO_ENTRY;
+        entries_[i].group = NO_ENTRY;
+        entries_[i].next = (i + 1 < MAX_SUBSCRIPTIONS) ? i + 1 : NO_ENTRY;
+    }
+    freeEntries_ = 0;
+    subscriptionCount_ = 0;
+
+    for (int i = 0; i < MAX_SHARE_GROUPS; i++)
+    {
+        groups_[i].node = NO_ENTRY;
+        groups_[i].firstMember = NO_ENTRY;
+        groups_[i].next = (i + 1 < MAX_SHARE_GROUPS) ? i + 1 : NO_ENTRY;
+    }
+    freeGroups_ = (MAX_SHARE_GROUPS > 0) ? 0 : NO_ENTRY;
+    groupCount_ = 0;
+}
+
+std::size_t MqttSubscriptionIndex::matchLevel(int node, std::size_t depth, Walk &walk) const
+{
+    std::size_t matched = 0;
+    const Node &current = nodes_[node];
+
+    if (depth == walk.levelCount)
+    {
+        // "a/#" also matches "a" itself
+
+        matched += emit(node, walk);
+        if (current.hashChild != NO_ENTRY)
+        {
+            matched += emit(current.hashChild, walk);
+        }
+        return matched;
+    }
+
+    if ((depth != 0) || !walk.systemTopic)
+    {
+        if (current.hashChild != NO_ENTRY)
+        {
+            matched += emit(current.hashChild, walk);
+        }
+
+        if (current.plusChild != NO_ENTRY)
+        {
+            matched += matchLevel(current.plusChild, depth + 1, walk);
+        }
+    }
+
+    // a level no filter uses has no token, so only the wildcards above can match it
+
+    int child = (walk.tokens[depth] != MqttTopicTable::NO_TOKEN) ? findChild(node, walk.tokens[depth]) : NO_ENTRY;
+    if (child != NO_ENTRY)
+    {
+        matched += matchLevel(child, depth + 1, walk);
+    }
+
+    return matched;
+}
+
+std::size_t MqttSubscriptionIndex::emit(int node, Walk &walk) const
+{
+    std::size_t matched = 0;
+
+    for (int entry = nodes_[node].firstSubscription; entry != NO_ENTRY; entry = entries_[entry].next)
+    {
+        walk.cb(walk.obj, entries_[entry].subscription);
+        matched++;
+    }
+
+    // a group is never left without members, so there is always one to pick
+
+    for (int group = nodes_[node].firstGroup; group != NO_ENTRY; group = groups_[group].next)
+    {
+        walk.cb(walk.obj, entries_[pickMember(groups_[group], walk)].subscription);
+        matched++;
+    }
+    return matched;
+}
+
+/**
+ * The member of a share group the message being matched goes to. Round robin,
+ * and the search for the least loaded member, start from the member after the
+ * one picked last time so that ties are shared out as well. Sticky hashing
+ * scores every member against the topic and takes the highest (rendezvous
+ * hashing), so a member joining or leaving only moves the topics it wins or won.
+ */
+
+int MqttSubscriptionIndex::pickMember(const Group &group, Walk &walk) const
+{
+    int member = group.firstMember;
+
+    if (group.memberCount == 1)
+    {
+        return member;
+    }
+
+    if (shareStrategy_ == ShareStrategy::StickyHash)
+    {
+        if (!walk.topicHashed)
+        {
+            walk.topicHash = hashTopic(walk.topic);
+            walk.topicHashed = true;
+        }
+
+        int chosen = member;
+        std::uint32_t best = 0;
+
+        for (; member != NO_ENTRY; member = entries_[member].next)
+        {
+            std::uint32_t subscriber = static_cast<std::uint32_t>(entries_[member].subscription.subscriber);
+            std::uint32_t score = mixHash(walk.topicHash ^ (subscriber * 2654435761u));
+
+            if (score >= best)
+            {
+                best = score;
+                chosen = member;
+            }
+        }
+        return chosen;
+    }
+
+    for (unsigned int skip = group.turn++ % group.memberCount; skip > 0; skip--)
+    {
+        member = entries_[member].next;
+    }
+
+    if ((shareStrategy_ != ShareStrategy::LeastInflight) || (loadCb_ == nullptr))
+    {
+        return member;
+    }
+
+    int chosen = member;
+    std::size_t least = static_cast<std::size_t>(-1);
+
+    for (unsigned short i = 0; (i < group.memberCount) && (least != 0); i++)
+    {
+        std::size_t load = loadCb_(loadObj_, entries_[member].subscription.subscriber);
+
+        if (load < least)
+        {
+            least = load;
+            chosen = member;
+        }
+
+        member = (entries_[member].next != NO_ENTRY) ? entries_[member].next : group.firstMember;
+    }
+    return chosen;
+}
+
+std::size_t MqttSubscriptionIndex::bucketFor(int parent, Token token) const
+{
+    // mix the parent node and the token, both already small integers
+
+    std::uint32_t hash = (static_cast<std::uint32_t>(parent) * 2654435761u) ^ token;
+    hash ^= hash >> 15;
+    hash *= 2246822519u;
+    hash ^= hash >> 13;
+    return hash & (CHILD_BUCKETS - 1);
+}
+
+int MqttSubscriptionIndex::findChild(int parent, Token token) const
+{
+    for (int node = buckets_[bucketFor(parent, token)]; node != NO_ENTRY; node = nodes_[node].nextInBucket)
+    {
+        if ((nodes_[node].parent == parent) && (nodes_[node].token == token))
+        {
+            return node;
+        }
+    }
+    return NO_ENTRY;
+}
+
+int MqttSubscriptionIndex::findOrAddChild(int parent, std::string_view level)
+{
+    bool plus = (level == "+");
+    bool hash = (level == "#");
+    Token token = MqttTopicTable::NO_TOKEN;
+
+    if (plus || hash)
+    {
+        int existing = plus ? nodes_[parent].plusChild : nodes_[parent].hashChild;
+        if (existing != NO_ENTRY)
+        {
+            return existing;
+        }
+    }
+    else
+    {
+        // the node keeps this reference until it is freed
+
+        token = MqttTopicTable::getInstance().intern(level);
+        if (token == MqttTopicTable::NO_TOKEN)
+        {
+            return NO_ENTRY;
+        }
+
+        int existing = findChild(parent, token);
+        if (existing != NO_ENTRY)
+        {
+            MqttTopicTable::getInstance().release(token);
+            return existing;
+        }
+    }
+
+    if (freeNodes_ == NO_ENTRY)
+    {
+        if (token != MqttTopicTable::NO_TOKEN)
+        {
+            MqttTopicTable::getInstance().release(token);
+        }
+        return NO_ENTRY;
+    }
+
+    int node = freeNodes_;
+    freeNodes_ = nodes_[node].nextInBucket;
+
+    nodes_[node].parent = parent;
+    nodes_[node].plusChild = NO_ENTRY;
+    nodes_[node].hashChild = NO_ENTRY;
+    nodes_[node].firstSubscription = NO_ENTRY;
+    nodes_[node].firstGroup = NO_ENTRY;
+    nodes_[node].childCount = 0;
+    nodes_[node].token = token;
+    nodes_[node].nextInBucket = NO_ENTRY;
+
+    if (plus)
+    {
+        nodes_[parent].plusChild = node;
+    }
+    else if (hash)
+    {
+        nodes_[parent].hashChild = node;
+    }
+    else
+    {
+        std::size_t bucket = bucketFor(parent, token);
+        nodes_[node].nextInBucket = buckets_[bucket];
+        buckets_[bucket] = node;
+    }
+
+    nodes_[parent].childCount++;
+    nodeCount_++;
+    return node;
+}
+
+int MqttSubscriptionIndex::findNode(std::string_view filter) const
+{
+    std::string_view levels[MAX_TOPIC_LENGTH];
+    std::size_t levelCount;
+
+    if (filter.empty() || !MqttTopic::splitLevels(filter, levels, MAX_TOPIC_LENGTH, levelCount))
+    {
+        return NO_ENTRY;
+    }
+
+    int node = ROOT_NODE;
+    MqttTopicTable &topics = MqttTopicTable::getInstance();
+
+    for (std::size_t i = 0; (i < levelCount) && (node != NO_ENTRY); i++)
+    {
+        if ((levels[i] == "+") || (levels[i] == "#"))
+        {
+            node = (levels[i] == "+") ? nodes_[node].plusChild : nodes_[node].hashChild;
+        }
+        else
+        {
+            Token token = topics.find(levels[i]);
+            node = (token != MqttTopicTable::NO_TOKEN) ? findChild(node, token) : NO_ENTRY;
+        }
+    }
+    return node;
+}
+
+int MqttSubscriptionIndex::findGroup(int node, Token shareName) const
+{
+    for (int group = nodes_[node].firstGroup; group != NO_ENTRY; group = groups_[group].next)
+    {
+        if (groups_[group].shareName == shareName)
+        {
+            return group;
+        }
+    }
+    return NO_ENTRY;
+}
+
+int MqttSubscriptionIndex::findOrAddGroup(int node, std::string_view shareName)
+{
+    // the group keeps this reference until it is freed
+
+    Token token = MqttTopicTable::getInstance().intern(shareName);
+    if (token == MqttTopicTable::NO_TOKEN)
+    {
+        return NO_ENTRY;
+    }
+
+    int group = findGroup(node, token);
+    if ((group != NO_ENTRY) || (freeGroups_ == NO_ENTRY))
+    {
+        MqttTopicTable::getInstance().release(token);
+        return group;
+    }
+
+    group = freeGroups_;
+    freeGroups_ = groups_[group].next;
+
+    groups_[group].shareName = token;
+    groups_[group].node = node;
+    groups_[group].firstMember = NO_ENTRY;
+    groups_[group].memberCount = 0;
+    groups_[group].turn = 0;
+    groups_[group].next = nodes_[node].firstGroup;
+    nodes_[node].firstGroup = group;
+    groupCount_++;
+    return group;
+}
+
+void MqttSubscriptionIndex::releaseGroupIfUnused(int group)
+{
+    if ((group == NO_ENTRY) || (groups_[group].firstMember != NO_ENTRY))
+    {
+        return;
+    }
+
+    int *link = &nodes_[groups_[group].node].firstGroup;
+
+    while (*link != group)
+    {
+        link = &groups_[*link].next;
+    }
+    *link = groups_[group].next;
+
+    MqttTopicTable::getInstance().release(groups_[group].shareName);
+    groups_[group].node = NO_ENTRY;
+    groups_[group].next = freeGroups_;
+    freeGroups_ = group;
+    groupCount_--;
+}
+
+void MqttSubscriptionIndex::removeEntry(int node, int entry)
+{
+    int group = entries_[entry].group;
+    int *link = (group != NO_ENTRY) ? &groups_[group].firstMember : &nodes_[node].firstSubscription;
+
+    while (*link != entry)
+    {
+        link = &entries_[*link].next;
+    }
+    *link = entries_[entry].next;
+
+    if (group != NO_ENTRY)
+    {
+        groups_[group].memberCount--;
+    }
+
+    entries_[entry].node = NO_ENTRY;
+    entries_[entry].group = NO_ENTRY;
+    entries_[entry].next = freeEntries_;
+    freeEntries_ = entry;
+    subscriptionCount_--;
+}
+
+void MqttSubscriptionIndex::releaseNodeIfUnused(int node)
+{
+    // walk up the tree freeing nodes that have no subscriptions, groups or children
+
+    while ((node != NO_ENTRY) && (node != ROOT_NODE) &&
+           (nodes_[node].firstSubscription == NO_ENTRY) && (nodes_[node].firstGroup == NO_ENTRY) &&
+           (nodes_[node].childCount == 0))
+    {
+        int parent = nodes_[node].parent;
+
+        if (nodes_[parent].plusChild == node)
+        {
+            nodes_[parent].plusChild = NO_ENTRY;
+        }
+        else if (nodes_[parent].hashChild == node)
+        {
+            nodes_[parent].hashChild = NO_ENTRY;
+        }
+        else
+        {
+            int *link = &buckets_[bucketFor(parent, nodes_[node].token)];
+            while (*link != node)
+            {
+                link = &nodes_[*link].nextInBucket;
+            }
+            *link = nodes_[node].nextInBucket;
+            MqttTopicTable::getInstance().release(nodes_[node].token);
+        }
+
+        nodes_[parent].childCount--;
+        nodes_[node].parent = NO_ENTRY;
+        nodes_[node].nextInBucket = freeNodes_;
+        freeNodes_ = node;
+        nodeCount_--;
+
+        node = parent;
+    }
+}
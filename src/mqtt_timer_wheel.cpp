@@ -0,0 +1,310 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_timer_wheel.h"
+
+MqttTimerWheel::MqttTimerWheel()
+{
+    for (std::size_t i = 0; i < MAX_MQTT_TIMERS; i++)
+    {
+        timers_[i].next = (i + 1 < MAX_MQTT_TIMERS) ? static_cast<int>(i + 1) : NO_TIMER;
+        timers_[i].prev = NO_TIMER;
+        timers_[i].slot = NO_SLOT;
+        timers_[i].generation = 1;
+        timers_[i].cb = nullptr;
+        timers_[i].obj = nullptr;
+        timers_[i].expiry = 0;
+    }
+    for (std::size_t i = 0; i < LEVELS * SLOTS; i++)
+    {
+        slots_[i] = NO_TIMER;
+    }
+    freeTimers_ = (MAX_MQTT_TIMERS > 0) ? 0 : NO_TIMER;
+    activeCount_ = 0;
+    now_ = 0;
+    remainderMs_ = 0;
+}
+
+/**
+ * Call cb(obj) once, delayMs from now. The delay is rounded up to whole ticks, so
+ * the timer never fires early, but may fire up to a tick late.
+ *
+ * @return the timer, or INVALID_TIMER if every timer is in use
+ */
+
+MqttTimerWheel::TimerId MqttTimerWheel::start(std::uint64_t delayMs, TimerCb cb, void *obj)
+{
+    if ((freeTimers_ == NO_TIMER) || (cb == nullptr))
+    {
+        MQTT_WARNING("no free timer");
+        return INVALID_TIMER;
+    }
+
+    int index = freeTimers_;
+    Timer &timer = timers_[index];
+    freeTimers_ = timer.next;
+
+    timer.expiry = now_ + ticksFor(delayMs);
+    timer.cb = cb;
+    timer.obj = obj;
+    link(index);
+    activeCount_++;
+
+    return (static_cast<TimerId>(timer.generation) << 32) | static_cast<TimerId>(index);
+}
+
+/**
+ * Push a running timer back so it fires delayMs from now, as a keepalive does every
+ * time a packet arrives.
+ *
+ * @return false if the timer has already fired or been cancelled
+ */
+
+bool MqttTimerWheel::restart(TimerId timer, std::uint64_t delayMs)
+{
+    int index = indexOf(timer);
+    if (index == NO_TIMER)
+    {
+        return false;
+    }
+
+    unlink(index);
+    timers_[index].expiry = now_ + ticksFor(delayMs);
+    link(index);
+    return true;
+}
+
+/**
+ * @return false if the timer has already fired or been cancelled
+ */
+
+bool MqttTimerWheel::cancel(TimerId timer)
+{
+    int index = indexOf(timer);
+    if (index == NO_TIMER)
+    {
+        return false;
+    }
+
+    unlink(index);
+    release(index);
+    return true;
+}
+
+bool MqttTimerWheel::isActive(TimerId timer) const
+{
+    return indexOf(timer) != NO_TIMER;
+}
+
+/**
+ * Move time on by elapsedMs and fire every timer that is now due, earliest first.
+ * The callbacks may start, restart and cancel timers, their own included. Time
+ * that doesn't add up to a whole tick is carried over to the next call.
+ *
+ * @return the number of timers fired
+ */
+
+std::size_t MqttTimerWheel::advance(std::uint64_t elapsedMs)
+{
+    remainderMs_ += elapsedMs;
+    std::uint64_t ticks = remainderMs_ / MQTT_TIMER_TICK_MS;
+    remainderMs_ %= MQTT_TIMER_TICK_MS;
+
+    std::size_t fired = 0;
+    while (ticks-- > 0)
+    {
+        if (activeCount_ == 0)
+        {
+            // nothing to cascade or fire, so jump straight there
+            now_ += ticks + 1;
+            break;
+        }
+        fired += tick();
+    }
+    return fired;
+}
+
+std::size_t MqttTimerWheel::getActiveCount() const
+{
+    return activeCount_;
+}
+
+/**
+ * @return the number of ticks since the wheel was created
+ */
+
+std::uint64_t MqttTimerWheel::getTick() const
+{
+    return now_;
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+int MqttTimerWheel::indexOf(TimerId timer) const
+{
+    std::uint64_t index = timer & 0xFFFFFFFF;
+    if ((index >= MAX_MQTT_TIMERS) ||
+        (timers_[index].generation != static_cast<std::uint32_t>(timer >> 32)) ||
+        (timers_[index].slot == NO_SLOT))
+    {
+        return NO_TIMER;
+    }
+    return static_cast<int>(index);
+}
+
+std::uint64_t MqttTimerWheel::ticksFor(std::uint64_t delayMs) const
+{
+    // at least one tick, so a timer started from a callback never lands in the
+    // slot being fired
+    std::uint64_t ticks = (delayMs + MQTT_TIMER_TICK_MS - 1) / MQTT_TIMER_TICK_MS;
+    return (ticks > 0) ? ticks : 1;
+}
+
+/**
+ * Put the timer in the slot for its expiry: level 0 if it is due in the next 64
+ * ticks, otherwise the lowest level whose span reaches it. A timer beyond the top
+ * level goes in its furthest slot and is placed again when that slot cascades.
+ */
+
+void MqttTimerWheel::link(int index)
+{
+    Timer &timer = timers_[index];
+    std::uint64_t expiry = timer.expiry;
+
+    if (expiry - now_ >= MAX_TICKS)
+    {
+        expiry = now_ + MAX_TICKS - 1;
+    }
+
+    std::size_t level = 0;
+    while ((level + 1 < LEVELS) && ((expiry - now_) >= (std::uint64_t(1) << (SLOT_BITS * (level + 1)))))
+    {
+        level++;
+    }
+
+    int slot = static_cast<int>((level * SLOTS) + ((expiry >> (SLOT_BITS * level)) & (SLOTS - 1)));
+    timer.slot = slot;
+    timer.prev = NO_TIMER;
+    timer.next = slots_[slot];
+    if (timer.next != NO_TIMER)
+    {
+        timers_[timer.next].prev = index;
+    }
+    slots_[slot] = index;
+}
+
+void MqttTimerWheel::unlink(int index)
+{
+    Timer &timer = timers_[index];
+
+    if (timer.prev != NO_TIMER)
+    {
+        timers_[timer.prev].next = timer.next;
+    }
+    else
+    {
+        slots_[timer.slot] = timer.next;
+    }
+    if (timer.next != NO_TIMER)
+    {
+        timers_[timer.next].prev = timer.prev;
+    }
+    timer.prev = NO_TIMER;
+    timer.next = NO_TIMER;
+}
+
+void MqttTimerWheel::release(int index)
+{
+    Timer &timer = timers_[index];
+
+    timer.slot = NO_SLOT;
+    timer.cb = nullptr;
+    timer.obj = nullptr;
+    if (++timer.generation == 0)
+    {
+        timer.generation = 1; // keep every TimerId distinct from INVALID_TIMER
+    }
+    timer.next = freeTimers_;
+    freeTimers_ = index;
+    activeCount_--;
+}
+
+/**
+ * Spread the timers in the current slot of a level out over the levels below
+ */
+
+void MqttTimerWheel::cascade(std::size_t level)
+{
+    int slot = static_cast<int>((level * SLOTS) + ((now_ >> (SLOT_BITS * level)) & (SLOTS - 1)));
+
+    // take the whole list first, a timer beyond the top level can land back here
+    int index = slots_[slot];
+    slots_[slot] = NO_TIMER;
+
+    while (index != NO_TIMER)
+    {
+        int next = timers_[index].next;
+        link(index);
+        index = next;
+    }
+}
+
+std::size_t MqttTimerWheel::tick()
+{
+    now_++;
+
+    // a level 0 revolution is complete, bring the next slot of each level down
+    for (std::size_t level = 1; level < LEVELS; level++)
+    {
+        if ((now_ & ((std::uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0)
+        {
+            break;
+        }
+        cascade(level);
+    }
+
+    std::size_t fired = 0;
+    int slot = static_cast<int>(now_ & (SLOTS - 1));
+
+    while (slots_[slot] != NO_TIMER)
+    {
+        int index = slots_[slot];
+        Timer &timer = timers_[index];
+        unlink(index);
+
+        if (timer.expiry > now_)
+        {
+            link(index); // beyond the top level last time round
+            continue;
+        }
+
+        TimerCb cb = timer.cb;
+        void *obj = timer.obj;
+        release(index);
+        cb(obj);
+        fired++;
+    }
+    return fired;
+}
@@ -0,0 +1,182 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_topic_alias.h"
+
+/*****************************************************************************
+ * MqttInboundTopicAliases
+******************************************************************************/
+
+void MqttInboundTopicAliases::clear()
+{
+    for (auto &topic : topics_)
+    {
+        topic.clear();
+    }
+}
+
+/**
+ * Take the Topic Alias Maximum the CONNACK sends, capped at MQTT_TOPIC_ALIAS_MAXIMUM.
+ * Zero, the default until a CONNACK has sent one, means the client may use none.
+ */
+
+void MqttInboundTopicAliases::setMaximum(unsigned short maximum)
+{
+    maximum_ = (maximum < MQTT_TOPIC_ALIAS_MAXIMUM) ? maximum : MQTT_TOPIC_ALIAS_MAXIMUM;
+    clear();
+}
+
+/**
+ * @return the largest alias the client may use
+ */
+
+unsigned short MqttInboundTopicAliases::getMaximum() const
+{
+    return maximum_;
+}
+
+/**
+ * Point an alias at a topic, replacing whatever it was before. The topic must
+ * already have been checked.
+ * @return false if the alias is 0 or above the maximum
+ */
+
+bool MqttInboundTopicAliases::set(unsigned short topicAlias, std::string_view topic)
+{
+    if ((topicAlias == 0) || (topicAlias > maximum_) || topic.empty())
+    {
+        return false;
+    }
+
+    topics_[topicAlias - 1].assign(topic.begin(), topic.end());
+    return true;
+}
+
+/**
+ * @return the topic the alias was last set to, empty if it hasn't been
+ */
+
+std::string_view MqttInboundTopicAliases::find(unsigned short topicAlias) const
+{
+    if ((topicAlias == 0) || (topicAlias > maximum_))
+    {
+        return {};
+    }
+
+    const auto &topic = topics_[topicAlias - 1];
+    return std::string_view(topic.data(), topic.size());
+}
+
+/*****************************************************************************
+ * MqttOutboundTopicAliases
+******************************************************************************/
+
+MqttOutboundTopicAliases::MqttOutboundTopicAliases()
+{
+    maximum_ = 0;
+    clear();
+}
+
+void MqttOutboundTopicAliases::clear()
+{
+    for (Slot &slot : slots_)
+    {
+        slot.topic.clear();
+        slot.lastUsed = 0;
+    }
+    clock_ = 0;
+}
+
+/**
+ * Take the client's Topic Alias Maximum, capped at MQTT_TOPIC_ALIAS_MAXIMUM. Zero,
+ * the default, means the client takes no aliases.
+ */
+
+void MqttOutboundTopicAliases::setMaximum(unsigned short maximum)
+{
+    maximum_ = (maximum < MQTT_TOPIC_ALIAS_MAXIMUM) ? maximum : MQTT_TOPIC_ALIAS_MAXIMUM;
+    clear();
+}
+
+unsigned short MqttOutboundTopicAliases::getMaximum() const
+{
+    return maximum_;
+}
+
+/**
+ * Find the alias for a topic, giving it one if it has none. The search for the
+ * topic also finds the free or least recently used alias, so there is one pass
+ * over at most maximum_ entries.
+ *
+ * @param established set if the alias has just been given to the topic, and so
+ * has to go out with the topic in full
+ * @return the alias, 0 if the client takes none
+ */
+
+unsigned short MqttOutboundTopicAliases::assign(std::string_view topic, bool &established)
+{
+    established = false;
+
+    if ((maximum_ == 0) || topic.empty())
+    {
+        return 0;
+    }
+
+    std::size_t victim = 0;
+
+    for (std::size_t i = 0; i < maximum_; i++)
+    {
+        const auto &text = slots_[i].topic;
+
+        if (std::string_view(text.data(), text.size()) == topic)
+        {
+            slots_[i].lastUsed = ++clock_;
+            return static_cast<unsigned short>(i + 1);
+        }
+
+        // a free alias has a lastUsed of 0, so it goes before any in use
+        if (slots_[i].lastUsed < slots_[victim].lastUsed)
+        {
+            victim = i;
+        }
+    }
+
+    slots_[victim].topic.assign(topic.begin(), topic.end());
+    slots_[victim].lastUsed = ++clock_;
+    established = true;
+    return static_cast<unsigned short>(victim + 1);
+}
+
+/**
+ * Free an alias the client might not have seen set, because the PUBLISH setting
+ * it was never sent. The next PUBLISH for the topic sets an alias again.
+ */
+
+void MqttOutboundTopicAliases::forget(unsigned short topicAlias)
+{
+    if ((topicAlias != 0) && (topicAlias <= maximum_))
+    {
+        slots_[topicAlias - 1].topic.clear();
+        slots_[topicAlias - 1].lastUsed = 0;
+    }
+}
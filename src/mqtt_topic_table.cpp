@@ -0,0 +1,331 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include <string.h>
+#include <algorithm>
+#include "mqtt_topic_table.h"
+
+MqttTopicTable &MqttTopicTable::getInstance()
+{
+    static MqttTopicTable instance;
+    return instance;
+}
+
+MqttTopicTable::MqttTopicTable()
+{
+    for (std::size_t i = 0; i < BUCKETS; i++)
+    {
+        buckets_[i].store(NO_ENTRY, std::memory_order_relaxed);
+    }
+
+    for (int i = 0; i < MAX_TOPIC_TOKENS; i++)
+    {
+        entries_[i].hash.store(0, std::memory_order_relaxed);
+        entries_[i].nextInBucket.store((i + 1 < MAX_TOPIC_TOKENS) ? i + 1 : NO_ENTRY, std::memory_order_relaxed);
+        entries_[i].token.store(static_cast<Token>(i + 1), std::memory_order_relaxed);
+        entries_[i].length.store(0, std::memory_order_relaxed);
+        for (std::size_t word = 0; word < TEXT_WORDS; word++)
+        {
+            entries_[i].text[word].store(0, std::memory_order_relaxed);
+        }
+        entries_[i].references = 0;
+    }
+    freeEntries_ = 0;
+    count_.store(0, std::memory_order_relaxed);
+    version_.store(0, std::memory_order_release);
+}
+
+/**
+ * Finds the token for a topic level, adding the level if it is new. Each call
+ * takes a reference, which the caller gives back with release().
+ * @return the token, or NO_TOKEN if the level is too long or the table is full
+ */
+
+MqttTopicTable::Token MqttTopicTable::intern(std::string_view level)
+{
+    if (level.size() >= MAX_TOPIC_LENGTH)
+    {
+        return NO_TOKEN;
+    }
+
+    const std::uint32_t hash = hashOf(level);
+    Token token = NO_TOKEN;
+
+    lock();
+    int entry = findEntry(level, hash);
+
+    if ((entry == NO_ENTRY) && (freeEntries_ != NO_ENTRY))
+    {
+        entry = freeEntries_;
+        freeEntries_ = entries_[entry].nextInBucket.load(std::memory_order_relaxed);
+
+        // the entry is not linked yet, so only the link itself needs the version bump
+
+        entries_[entry].hash.store(hash, std::memory_order_relaxed);
+        entries_[entry].length.store(static_cast<unsigned char>(level.size()), std::memory_order_relaxed);
+        for (std::size_t word = 0; word < TEXT_WORDS; word++)
+        {
+            entries_[entry].text[word].store(textWord(level, word), std::memory_order_relaxed);
+        }
+        entries_[entry].references = 0;
+
+        std::atomic<int> &bucket = buckets_[hash & (BUCKETS - 1)];
+        entries_[entry].nextInBucket.store(bucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        const std::uint32_t version = version_.load(std::memory_order_relaxed);
+        version_.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bucket.store(entry, std::memory_order_relaxed);
+        version_.store(version + 2, std::memory_order_release);
+
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (entry != NO_ENTRY)
+    {
+        entries_[entry].references++;
+        token = entries_[entry].token.load(std::memory_order_relaxed);
+    }
+    unlock();
+
+    if (token == NO_TOKEN)
+    {
+        MQTT_WARNING("topic table full");
+    }
+    return token;
+}
+
+/**
+ * Gives back a reference taken by intern(), freeing the level when it was the
+ * last one. A token that is no longer current is ignored.
+ */
+
+void MqttTopicTable::release(Token token)
+{
+    lock();
+    int entry = entryOf(token);
+
+    if ((entry != NO_ENTRY) && (--entries_[entry].references == 0))
+    {
+        const std::uint32_t version = version_.load(std::memory_order_relaxed);
+        version_.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::atomic<int> *link = &buckets_[entries_[entry].hash.load(std::memory_order_relaxed) & (BUCKETS - 1)];
+        while (link->load(std::memory_order_relaxed) != entry)
+        {
+            link = &entries_[link->load(std::memory_order_relaxed)].nextInBucket;
+        }
+        link->store(entries_[entry].nextInBucket.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+        // the next generation of this entry gets a different token, so copies of this one go stale
+
+        entries_[entry].token.store(token + (1u << INDEX_BITS), std::memory_order_relaxed);
+        entries_[entry].nextInBucket.store(freeEntries_, std::memory_order_relaxed);
+        version_.store(version + 2, std::memory_order_release);
+
+        freeEntries_ = entry;
+        count_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    unlock();
+}
+
+/**
+ * Looks up a level without adding it or taking a reference
+ * @return the token, or NO_TOKEN if the level is not in the table
+ */
+
+MqttTopicTable::Token MqttTopicTable::find(std::string_view level) const
+{
+    Token token;
+    return (resolve(level, &token, 1) == 1) ? token : NO_TOKEN;
+}
+
+/**
+ * Splits a topic into levels and looks each one up. Levels that are not in the
+ * table come back as NO_TOKEN. This runs for every publish, so it takes no lock:
+ * if the table changed while it looked, it looks again.
+ * @return the number of levels, or 0 if the topic is empty or has more than maxLevels
+ */
+
+std::size_t MqttTopicTable::resolve(std::string_view topic, Token *tokens, std::size_t maxLevels) const
+{
+    if (topic.empty())
+    {
+        return 0;
+    }
+
+    const char *end = topic.data() + topic.size();
+
+    while (true)
+    {
+        const std::uint32_t version = version_.load(std::memory_order_acquire);
+
+        if ((version & 1) != 0)
+        {
+            continue; // a change is being made
+        }
+
+        // a level is hashed as it is scanned, so the topic is read once per try
+
+        const char *level = topic.data();
+        std::size_t levelCount = 0;
+        bool complete = false;
+
+        while (!complete && (levelCount < maxLevels))
+        {
+            std::uint32_t hash = 2166136261u;
+            const char *c = level;
+
+            for (; (c != end) && (*c != '/'); c++)
+            {
+                hash ^= static_cast<unsigned char>(*c);
+                hash *= 16777619u;
+            }
+
+            int entry = findEntry(std::string_view(level, c - level), hash);
+            tokens[levelCount++] = (entry != NO_ENTRY) ? entries_[entry].token.load(std::memory_order_relaxed) : NO_TOKEN;
+
+            complete = (c == end);
+            level = c + 1;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (version_.load(std::memory_order_relaxed) == version)
+        {
+            return complete ? levelCount : 0;
+        }
+    }
+}
+
+std::size_t MqttTopicTable::getReferenceCount(Token token)
+{
+    lock();
+    int entry = entryOf(token);
+    std::size_t references = (entry != NO_ENTRY) ? entries_[entry].references : 0;
+    unlock();
+
+    return references;
+}
+
+std::size_t MqttTopicTable::getCount() const
+{
+    return count_.load(std::memory_order_relaxed);
+}
+
+/*****************************************************************************
+ * Private methods
+******************************************************************************/
+
+std::uint32_t MqttTopicTable::hashOf(std::string_view level)
+{
+    // FNV-1a, also inlined in resolve()
+
+    std::uint32_t hash = 2166136261u;
+
+    for (char c : level)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+std::uint32_t MqttTopicTable::textWord(std::string_view level, std::size_t word)
+{
+    std::uint32_t value = 0;
+    std::size_t offset = word * sizeof(value);
+
+    if (offset < level.size())
+    {
+        memcpy(&value, level.data() + offset, std::min(sizeof(value), level.size() - offset));
+    }
+    return value;
+}
+
+int MqttTopicTable::findEntry(std::string_view level, std::uint32_t hash) const
+{
+    if (level.size() >= MAX_TOPIC_LENGTH)
+    {
+        return NO_ENTRY;
+    }
+
+    // a lookup without the lock can see a chain half way through a change, so the
+    // walk is bounded; the caller sees the version move and looks again
+
+    int entry = buckets_[hash & (BUCKETS - 1)].load(std::memory_order_relaxed);
+
+    for (int steps = 0; (entry != NO_ENTRY) && (steps < MAX_TOPIC_TOKENS); steps++)
+    {
+        const Entry &candidate = entries_[entry];
+
+        if ((candidate.hash.load(std::memory_order_relaxed) == hash) &&
+            (candidate.length.load(std::memory_order_relaxed) == level.size()))
+        {
+            // the words past the length are zero in both, so they need no check
+            const std::size_t words = (level.size() + 3) / 4;
+            std::size_t word = 0;
+
+            while ((word < words) && (candidate.text[word].load(std::memory_order_relaxed) == textWord(level, word)))
+            {
+                word++;
+            }
+            if (word == words)
+            {
+                return entry;
+            }
+        }
+        entry = candidate.nextInBucket.load(std::memory_order_relaxed);
+    }
+    return NO_ENTRY;
+}
+
+int MqttTopicTable::entryOf(Token token) const
+{
+    std::size_t index = token & ((1u << INDEX_BITS) - 1);
+
+    if ((index == 0) || (index > MAX_TOPIC_TOKENS))
+    {
+        return NO_ENTRY;
+    }
+
+    int entry = static_cast<int>(index - 1);
+    if ((entries_[entry].references == 0) || (entries_[entry].token.load(std::memory_order_relaxed) != token))
+    {
+        return NO_ENTRY;
+    }
+    return entry;
+}
+
+void MqttTopicTable::lock()
+{
+    // only changes take the lock, lookups go by the version count instead
+    while (busy_.test_and_set(std::memory_order_acquire))
+    {
+    }
+}
+
+void MqttTopicTable::unlock()
+{
+    busy_.clear(std::memory_order_release);
+}
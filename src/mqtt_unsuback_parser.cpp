@@ -39,49 +39,36 @@
 MqttUnsubackParser::MqttUnsubackParser() {}
 
 // Parse the UNSUBACK message
-MqttMessageParser::ParseResult MqttUnsubackParser::parseMessage(const std::vector<unsigned char> &unsubackMessage)
+MqttMessageParser::ParseResult MqttUnsubackParser::parseMessage(std::span<const unsigned char> unsubackMessage)
 {
-    unsubackMessage_ = unsubackMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(unsubackMessage);
     parseFixedHeader();
     parseVariableHeader();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttUnsubackParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = unsubackMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttUnsubackParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttUnsubackParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = unsubackMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttUnsubackParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (unsubackMessage_[currentIndex_++] << 8) + unsubackMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 int MqttUnsubackParser::getPacketIdentifier() const
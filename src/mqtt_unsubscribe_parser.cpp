@@ -40,71 +40,51 @@
 
 MqttUnsubscribeParser::MqttUnsubscribeParser() {}
 
-MqttMessageParser::ParseResult MqttUnsubscribeParser::parseMessage(const std::vector<unsigned char> &unsubscribeMessage)
+MqttMessageParser::ParseResult MqttUnsubscribeParser::parseMessage(std::span<const unsigned char> unsubscribeMessage)
 {
-    unsubscribeMessage_ = unsubscribeMessage;
-    currentIndex_ = 0;
+    reader_ = MqttReader(unsubscribeMessage);
     parseFixedHeader();
     parseVariableHeader();
     parsePayload();
-    return ParseResult::Success;
+    return reader_.isValid() ? ParseResult::Success : ParseResult::InvalidMessageStructure;
 }
 
 void MqttUnsubscribeParser::parseFixedHeader()
 {
     // The first byte of the message is the fixed header
-    fixedHeader_ = unsubscribeMessage_[currentIndex_++];
+    fixedHeader_ = reader_.readByte();
 }
 
 void MqttUnsubscribeParser::parseVariableHeader()
 {
-    // The next two bytes represent the remaining length
-    remainingLength_ = parseRemainingLength();
+    // The remaining length, which must account for the rest of the packet
+    remainingLength_ = reader_.readVariableByteInteger();
+    if (remainingLength_ != reader_.getRemaining())
+    {
+        reader_.fail();
+    }
 
     // The next bytes are part of the variable header
     parsePacketIdentifier();
 }
 
-int MqttUnsubscribeParser::parseRemainingLength()
-{
-    int multiplier = 1;
-    int value = 0;
-    unsigned char byte;
-
-    do
-    {
-        byte = unsubscribeMessage_[currentIndex_++];
-        value += (byte & 127) * multiplier;
-        multiplier *= 128;
-    } while ((byte & 128) != 0);
-
-    return value;
-}
-
 void MqttUnsubscribeParser::parsePacketIdentifier()
 {
-    packetIdentifier_ = (unsubscribeMessage_[currentIndex_++] << 8) + unsubscribeMessage_[currentIndex_++];
+    packetIdentifier_ = reader_.readTwoByteInteger();
 }
 
 void MqttUnsubscribeParser::parsePayload()
 {
-    // Parse each unsubscribe topic
-    while (currentIndex_ < unsubscribeMessage_.size())
+    // Step over each topic filter, a short read leaves the reader at the end
+    while (!reader_.atEnd())
     {
-        // Parse the topic name
-        std::string topicName = parseString();
-
-        // Display parsed topic information
-        MQTT_INFO("Unsubscribe: Topic=%s", topicName);
+        parseString();
     }
 }
 
-std::string MqttUnsubscribeParser::parseString()
+std::string_view MqttUnsubscribeParser::parseString()
 {
-    int stringLength = (unsubscribeMessage_[currentIndex_++] << 8) + unsubscribeMessage_[currentIndex_++];
-    std::string str(unsubscribeMessage_.begin() + currentIndex_, unsubscribeMessage_.begin() + currentIndex_ + stringLength);
-    currentIndex_ += stringLength;
-    return str;
+    return reader_.readString();
 }
 
 int MqttUnsubscribeParser::getPacketIdentifier() const
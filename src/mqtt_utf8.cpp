@@ -0,0 +1,100 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+
+#include "mqtt_utf8.h"
+
+/**
+ * The rest of the text from the first byte that isn't plain ASCII. Each
+ * multi-byte sequence is decoded and checked on its own, and the ASCII search
+ * picks up again after it.
+ *
+ * @return true if the text is well formed UTF-8 that MQTT allows
+ */
+
+bool MqttUtf8::isValidFrom(const unsigned char *bytes, std::size_t i, std::size_t length)
+{
+    while ((i = skipAscii(bytes, i, length)) < length)
+    {
+        const unsigned char lead = bytes[i];
+
+        if (lead == 0)
+        {
+            return false;
+        }
+
+        // the lead byte gives the number of continuation bytes, and the smallest
+        // code point that may use that many, so overlong encodings are caught
+
+        std::size_t continuation;
+        unsigned long codePoint;
+        unsigned long smallest;
+
+        if ((lead & 0xE0) == 0xC0)
+        {
+            continuation = 1;
+            codePoint = lead & 0x1F;
+            smallest = 0x80;
+        }
+        else if ((lead & 0xF0) == 0xE0)
+        {
+            continuation = 2;
+            codePoint = lead & 0x0F;
+            smallest = 0x800;
+        }
+        else if ((lead & 0xF8) == 0xF0)
+        {
+            continuation = 3;
+            codePoint = lead & 0x07;
+            smallest = 0x10000;
+        }
+        else
+        {
+            return false; // a continuation byte with no lead, or 0xF8 and above
+        }
+
+        if (length - i - 1 < continuation)
+        {
+            return false;
+        }
+
+        for (std::size_t k = 1; k <= continuation; k++)
+        {
+            const unsigned char next = bytes[i + k];
+
+            if ((next & 0xC0) != 0x80)
+            {
+                return false;
+            }
+            codePoint = (codePoint << 6) | (next & 0x3F);
+        }
+
+        if ((codePoint < smallest) || (codePoint > 0x10FFFF) || ((codePoint >= 0xD800) && (codePoint <= 0xDFFF)))
+        {
+            return false;
+        }
+
+        i += continuation + 1;
+    }
+
+    return true;
+}
@@ -25,6 +25,7 @@
 #define TCP_SESSION_H
 
 #include <memory>    // For std::shared_ptr, std::unique_ptr
+#include <span>
 #include <stdexcept> // For std::runtime_error
 
 #include "../test/mocks/ip_addr.h"
@@ -48,6 +49,7 @@ public:
     SessionId getSessionId();
     void disconnectSession();
     sendResult sendMessage(unsigned char *pData, unsigned short len);
+    sendResult sendMessageVector(std::span<const std::span<const unsigned char>> segments);
 
     bool registerSessionDisconnectedCb(void (*cb)(void *obj, TcpSessionPtr session), void *obj);
     bool registerSessionReconnectCb(void (*cb)(void *obj, signed char err, TcpSessionPtr session), void *obj);
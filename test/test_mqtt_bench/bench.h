@@ -0,0 +1,114 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef MQTT_BENCH_H
+#define MQTT_BENCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// A small benchmark harness in the style of google-benchmark. Each benchmark is a
+// callable run in batches sized so one batch takes a couple of microseconds, which
+// keeps the clock's own cost out of the figures. It reports the mean time per
+// operation, the 99th percentile of the per-batch means, throughput, and how many
+// heap allocations each operation made (counted by the operator new in main.cpp).
+
+namespace bench
+{
+  inline std::atomic<unsigned long> allocations{0};
+
+  // keeps the compiler from optimising away a result nobody reads
+  template <typename T>
+  inline void doNotOptimize(const T &value)
+  {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  struct Result
+  {
+    double nsPerOp;
+    double p99NsPerOp;
+    double opsPerSecond;
+    double megabytesPerSecond;
+    double allocationsPerOp;
+  };
+
+  constexpr int SAMPLES = 2000;
+  constexpr double MIN_BATCH_NS = 2000.0;
+
+  template <typename Fn>
+  Result run(const char *name, std::size_t bytesPerOp, Fn &&fn)
+  {
+    using clock = std::chrono::steady_clock;
+
+    // warm the caches and size the batch
+    std::size_t batch = 1;
+    for (;;)
+    {
+      clock::time_point start = clock::now();
+      for (std::size_t i = 0; i < batch; i++)
+      {
+        fn();
+      }
+      double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+      if ((ns >= MIN_BATCH_NS) || (batch >= (1u << 20)))
+      {
+        break;
+      }
+      batch *= 2;
+    }
+
+    std::vector<double> perOp(SAMPLES);
+    unsigned long allocationsBefore = allocations.load();
+    double totalNs = 0;
+
+    for (int sample = 0; sample < SAMPLES; sample++)
+    {
+      clock::time_point start = clock::now();
+      for (std::size_t i = 0; i < batch; i++)
+      {
+        fn();
+      }
+      double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+      perOp[sample] = ns / batch;
+      totalNs += ns;
+    }
+
+    double ops = static_cast<double>(SAMPLES) * batch;
+    Result result;
+    result.allocationsPerOp = (allocations.load() - allocationsBefore) / ops;
+    result.nsPerOp = totalNs / ops;
+    std::sort(perOp.begin(), perOp.end());
+    result.p99NsPerOp = perOp[(SAMPLES * 99) / 100];
+    result.opsPerSecond = 1e9 / result.nsPerOp;
+    result.megabytesPerSecond = (bytesPerOp * result.opsPerSecond) / (1024.0 * 1024.0);
+
+    printf("%-36s %9.1f ns/op %9.1f p99 %12.0f ops/s %9.1f MB/s %6.2f allocs/op\n",
+           name, result.nsPerOp, result.p99NsPerOp, result.opsPerSecond, result.megabytesPerSecond, result.allocationsPerOp);
+    return result;
+  }
+}
+
+#endif // MQTT_BENCH_H
@@ -0,0 +1,106 @@
+/*******************************************************************************
+ * Copyright (c) 2023 George Consultants Ltd.
+ * richard.john.george.3@gmail.com
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the “Software”),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *******************************************************************************/
+#ifndef MQTT_BENCH_CORPUS_H
+#define MQTT_BENCH_CORPUS_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+// Packets as a broker sees them from typical IoT clients: short sensor topics,
+// small readings, the odd larger payload, and the acknowledgements that go with
+// them. All are MQTT v3.1.1 except where the packet only exists in v5 form.
+
+namespace corpus
+{
+  inline std::vector<unsigned char> payload(std::size_t length)
+  {
+    std::vector<unsigned char> bytes(length);
+    for (std::size_t i = 0; i < length; i++)
+    {
+      bytes[i] = static_cast<unsigned char>('a' + (i % 26));
+    }
+    return bytes;
+  }
+
+  inline std::vector<unsigned char> publish(const char *topic, std::size_t payloadLength, unsigned char qos)
+  {
+    std::size_t topicLength = strlen(topic);
+    std::size_t remainingLength = 2 + topicLength + (qos > 0 ? 2 : 0) + payloadLength;
+    std::vector<unsigned char> frame = {static_cast<unsigned char>(0x30 | (qos << 1))};
+
+    do
+    {
+      unsigned char digit = remainingLength % 128;
+      remainingLength /= 128;
+      frame.push_back((remainingLength > 0) ? (digit | 0x80) : digit);
+    } while (remainingLength > 0);
+
+    frame.push_back(static_cast<unsigned char>(topicLength >> 8));
+    frame.push_back(static_cast<unsigned char>(topicLength & 0xFF));
+    frame.insert(frame.end(), topic, topic + topicLength);
+    if (qos > 0)
+    {
+      frame.push_back(0x12);
+      frame.push_back(0x34);
+    }
+    std::vector<unsigned char> body = payload(payloadLength);
+    frame.insert(frame.end(), body.begin(), body.end());
+    return frame;
+  }
+
+  inline const std::vector<unsigned char> connect = {
+      0x10, 0x17,                         // CONNECT, Remaining Length
+      0x00, 0x04, 'M', 'Q', 'T', 'T',     // Protocol Name
+      0x04,                               // Protocol Level
+      0x02,                               // Clean Session
+      0x00, 0x3C,                         // Keep Alive
+      0x00, 0x0B, 's', 'e', 'n', 's', 'o', 'r', '-', '0', '0', '4', '2'};
+
+  inline const std::vector<unsigned char> connack = {0x20, 0x02, 0x00, 0x00};
+  inline const std::vector<unsigned char> publishSmall = publish("home/livingroom/temperature", 4, 0);
+  inline const std::vector<unsigned char> publishLarge = publish("factory/line3/camera/frame", 1024, 1);
+  inline const std::vector<unsigned char> puback = {0x40, 0x02, 0x12, 0x34};
+  inline const std::vector<unsigned char> pubrec = {0x50, 0x02, 0x12, 0x34};
+  inline const std::vector<unsigned char> pubrel = {0x62, 0x02, 0x12, 0x34};
+  inline const std::vector<unsigned char> pubcomp = {0x70, 0x02, 0x12, 0x34};
+
+  inline const std::vector<unsigned char> subscribe = {
+      0x82, 0x2F, 0x00, 0x01,
+      0x00, 0x0C, 'h', 'o', 'm', 'e', '/', '+', '/', 't', 'e', 'm', 'p', 's', 0x01,
+      0x00, 0x0E, 'h', 'o', 'm', 'e', '/', 'k', 'i', 't', 'c', 'h', 'e', 'n', '/', '#', 0x00,
+      0x00, 0x0A, 'a', 'l', 'a', 'r', 'm', 's', '/', 'a', 'l', 'l', 0x02};
+
+  inline const std::vector<unsigned char> suback = {0x90, 0x05, 0x00, 0x01, 0x01, 0x00, 0x02};
+
+  inline const std::vector<unsigned char> unsubscribe = {
+      0xA2, 0x10, 0x00, 0x02,
+      0x00, 0x0C, 'h', 'o', 'm', 'e', '/', '+', '/', 't', 'e', 'm', 'p', 's'};
+
+  inline const std::vector<unsigned char> unsuback = {0xB0, 0x02, 0x00, 0x02};
+  inline const std::vector<unsigned char> pingreq = {0xC0, 0x00};
+  inline const std::vector<unsigned char> pingresp = {0xD0, 0x00};
+  inline const std::vector<unsigned char> disconnect = {0xE0, 0x00};
+}
+
+#endif // MQTT_BENCH_CORPUS_H
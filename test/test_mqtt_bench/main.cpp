@@ -0,0 +1,473 @@
+#define DOCTEST_CONFIG_IMPLEMENT // REQUIRED: Enable custom main()
+#define DOCTEST_THREAD_LOCAL
+#include <doctest.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "mqtt_connect_parser.h"
+#include "mqtt_connack_parser.h"
+#include "mqtt_publish_parser.h"
+#include "mqtt_puback_parser.h"
+#include "mqtt_pubrec_parser.h"
+#include "mqtt_pubrel_parser.h"
+#include "mqtt_pubcomp_parser.h"
+#include "mqtt_subscribe_parser.h"
+#include "mqtt_suback_parser.h"
+#include "mqtt_unsubscribe_parser.h"
+#include "mqtt_unsuback_parser.h"
+#include "mqtt_pingreq_parser.h"
+#include "mqtt_pingresp_parser.h"
+#include "mqtt_disconnect_parser.h"
+#include "mqtt_message.h"
+#include "mqtt_message_encoder.h"
+#include "mqtt_packet_decoder.h"
+#include "mqtt_retained_store.h"
+#include "mqtt_snapshot.h"
+#include "mqtt_subscription_index.h"
+#include "mqtt_timer_wheel.h"
+#include "mqtt_topic.h"
+#include "mqtt_topic_alias.h"
+#include "mqtt_utf8.h"
+
+#include "bench.h"
+#include "corpus.h"
+
+// Counts every heap allocation so each benchmark can report allocs/op. The broker
+// is meant to run without touching the heap on the hot path, so anything above zero
+// on a parser or the subscription index is worth a look.
+void *operator new(std::size_t size)
+{
+  bench::allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1))
+  {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+template <typename Parser>
+static void benchParser(const char *name, const std::vector<unsigned char> &packet)
+{
+  Parser parser;
+  std::span<const unsigned char> bytes(packet);
+
+  bench::Result result = bench::run(name, packet.size(), [&] {
+    bench::doNotOptimize(parser.parseMessage(bytes));
+  });
+  CHECK(result.nsPerOp > 0);
+}
+
+TEST_CASE("bench: parsers")
+{
+  benchParser<MqttConnectParser>("parse CONNECT", corpus::connect);
+  benchParser<MqttConnackParser>("parse CONNACK", corpus::connack);
+  benchParser<MqttPublishParser>("parse PUBLISH qos0 4B", corpus::publishSmall);
+  benchParser<MqttPublishParser>("parse PUBLISH qos1 1KB", corpus::publishLarge);
+  benchParser<MqttPubackParser>("parse PUBACK", corpus::puback);
+  benchParser<MqttPubrecParser>("parse PUBREC", corpus::pubrec);
+  benchParser<MqttPubrelParser>("parse PUBREL", corpus::pubrel);
+  benchParser<MqttPubcompParser>("parse PUBCOMP", corpus::pubcomp);
+  benchParser<MqttSubscribeParser>("parse SUBSCRIBE 3 topics", corpus::subscribe);
+  benchParser<MqttSubackParser>("parse SUBACK", corpus::suback);
+  benchParser<MqttUnsubscribeParser>("parse UNSUBSCRIBE", corpus::unsubscribe);
+  benchParser<MqttUnsubackParser>("parse UNSUBACK", corpus::unsuback);
+  benchParser<MqttPingreqParser>("parse PINGREQ", corpus::pingreq);
+  benchParser<MqttPingrespParser>("parse PINGRESP", corpus::pingresp);
+  benchParser<MqttDisconnectParser>("parse DISCONNECT", corpus::disconnect);
+}
+
+// Counts the packets the decoder hands over, so dispatch() can't be optimized away
+struct BenchDecodeHandler
+{
+  std::size_t packets = 0;
+
+  void handleConnect(const MqttConnectView &view) { packets += view.clientId.size(); }
+  void handlePublish(const MqttPublishView &view) { packets += view.payload.size(); }
+  void handleAck(MqttMessageParser::MqttPacketType, const MqttAckView &view) { packets += view.packetIdentifier; }
+  void handleSubscribe(const MqttSubscribeView &view) { packets += view.filterCount; }
+  void handleUnsubscribe(const MqttSubscribeView &view) { packets += view.filterCount; }
+  void handlePingreq() { packets++; }
+  void handleDisconnect(const MqttReasonView &) { packets++; }
+  void handleAuth(const MqttReasonView &) { packets++; }
+};
+
+static void benchDecoder(const char *name, const std::vector<unsigned char> &packet)
+{
+  BenchDecodeHandler handler;
+  std::span<const unsigned char> bytes(packet);
+
+  REQUIRE_EQ(MqttPacketDecoder::dispatch(bytes, 4, handler), MqttPacketDecoder::Result::Success);
+  bench::Result result = bench::run(name, packet.size(), [&] {
+    bench::doNotOptimize(MqttPacketDecoder::dispatch(bytes, 4, handler));
+  });
+  bench::doNotOptimize(handler.packets);
+  CHECK(result.nsPerOp > 0);
+}
+
+TEST_CASE("bench: packet decoder")
+{
+  benchDecoder("decode CONNECT", corpus::connect);
+  benchDecoder("decode PUBLISH qos0 4B", corpus::publishSmall);
+  benchDecoder("decode PUBLISH qos1 1KB", corpus::publishLarge);
+  benchDecoder("decode PUBACK", corpus::puback);
+  benchDecoder("decode PUBREL", corpus::pubrel);
+  benchDecoder("decode SUBSCRIBE 3 topics", corpus::subscribe);
+  benchDecoder("decode UNSUBSCRIBE", corpus::unsubscribe);
+  benchDecoder("decode PINGREQ", corpus::pingreq);
+  benchDecoder("decode DISCONNECT", corpus::disconnect);
+}
+
+// A malformed packet must cost no more to refuse than a good one costs to decode
+TEST_CASE("bench: malformed packets")
+{
+  std::vector<unsigned char> longTopic = corpus::publishSmall;
+  longTopic[3] = 0xFF; // topic length runs past the end of the packet
+  std::vector<unsigned char> longFilter = corpus::subscribe;
+  longFilter[5] = 0xFF;
+  const std::vector<unsigned char> endlessLength = {0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x12, 0x34};
+
+  struct
+  {
+    const char *name;
+    const std::vector<unsigned char> &packet;
+  } cases[] = {{"decode PUBLISH bad topic length", longTopic},
+               {"decode SUBSCRIBE bad filter length", longFilter},
+               {"decode PUBACK bad remaining length", endlessLength}};
+
+  for (const auto &malformed : cases)
+  {
+    BenchDecodeHandler handler;
+    std::span<const unsigned char> bytes(malformed.packet);
+
+    REQUIRE_NE(MqttPacketDecoder::dispatch(bytes, 4, handler), MqttPacketDecoder::Result::Success);
+    bench::Result result = bench::run(malformed.name, malformed.packet.size(), [&] {
+      bench::doNotOptimize(MqttPacketDecoder::dispatch(bytes, 4, handler));
+    });
+    CHECK(result.nsPerOp > 0);
+  }
+
+  MqttPublishParser parser;
+  std::span<const unsigned char> bytes(longTopic);
+  REQUIRE_EQ(parser.parseMessage(bytes), MqttMessageParser::ParseResult::InvalidMessageStructure);
+  bench::Result result = bench::run("parse PUBLISH bad topic length", longTopic.size(), [&] {
+    bench::doNotOptimize(parser.parseMessage(bytes));
+  });
+  CHECK(result.nsPerOp > 0);
+}
+
+TEST_CASE("bench: MqttMessage builders")
+{
+  MqttMessage message;
+  const std::string topic = "home/livingroom/temperature";
+  const std::string smallPayload = "21.5";
+  const std::string largePayload(1024, 'x');
+  const std::vector<std::string> topics = {"home/+/temps", "home/kitchen/#", "alarms/all"};
+  const std::vector<unsigned char> grantedQoS = {1, 0, 2};
+
+  bench::run("create CONNECT", 0, [&] { message.createConnect("sensor-0042"); });
+  bench::run("create CONNACK", 0, [&] { message.createMqttConnackMessage(false, MqttMessage::CONNECTION_ACCEPTED); });
+  bench::run("create PUBLISH qos0 4B", smallPayload.size(), [&] {
+    message.createMqttPublishMessage(topic, smallPayload, false, 0, 0);
+  });
+  bench::run("create PUBLISH qos1 1KB", largePayload.size(), [&] {
+    message.createMqttPublishMessage(topic, largePayload, false, 1, 0x1234);
+  });
+  bench::run("create PUBACK", 0, [&] { message.createMqttPubackMessage(0x1234); });
+  bench::run("create PUBREC", 0, [&] { message.createMqttPubrecMessage(0x1234); });
+  bench::run("create PUBREL", 0, [&] { message.createMqttPubrelMessage(0x1234); });
+  bench::run("create PUBCOMP", 0, [&] { message.createMqttPubcompMessage(0x1234); });
+  bench::run("create SUBSCRIBE 3 topics", 0, [&] { message.createMqttSubscribeMessage(topics); });
+  bench::run("create SUBACK", 0, [&] { message.createMqttSubackMessage(1, grantedQoS); });
+  bench::run("create UNSUBSCRIBE", 0, [&] { message.createMqttUnsubscribeMessage(topics); });
+  bench::run("create UNSUBACK", 0, [&] { message.createMqttUnsubackMessage(2); });
+  bench::run("create PINGREQ", 0, [&] { message.createMqttPingreqMessage(); });
+  bench::run("create PINGRESP", 0, [&] { message.createMqttPingrespMessage(); });
+  bench::run("create DISCONNECT", 0, [&] { message.createMqttDisconnectMessage(); });
+
+  CHECK(message.getMessage().size() == 2);
+}
+
+TEST_CASE("bench: encoder into caller buffer")
+{
+  unsigned char buffer[2048];
+  const std::vector<unsigned char> smallPayload = corpus::payload(4);
+  const std::vector<unsigned char> largePayload = corpus::payload(1024);
+  std::size_t written = 0;
+
+  bench::run("encode PUBLISH qos0 4B", smallPayload.size(), [&] {
+    written = MqttMessageEncoder::encodePublish(buffer, "home/livingroom/temperature", smallPayload, false, 0, 0);
+    bench::doNotOptimize(buffer);
+  });
+  CHECK(written == corpus::publishSmall.size());
+
+  bench::run("encode PUBLISH qos1 1KB", largePayload.size(), [&] {
+    written = MqttMessageEncoder::encodePublish(buffer, "factory/line3/camera/frame", largePayload, false, 1, 0x1234);
+    bench::doNotOptimize(buffer);
+  });
+  CHECK(written == corpus::publishLarge.size());
+
+  bench::run("encode PUBACK", 0, [&] {
+    written = MqttMessageEncoder::encodePuback(buffer, 0x1234);
+    bench::doNotOptimize(buffer);
+  });
+  CHECK(written == corpus::puback.size());
+}
+
+TEST_CASE("bench: topics")
+{
+  MqttTopic topic("home/livingroom/temperature");
+  MqttTopic same("home/livingroom/temperature");
+  MqttTopic other("home/livingroom/humidity");
+
+  bench::run("MqttTopic::setTopic", 0, [&] { bench::doNotOptimize(topic.setTopic("home/livingroom/temperature")); });
+  bench::run("MqttTopic::isValidName", 0, [&] { bench::doNotOptimize(topic.isValidName()); });
+  bench::run("MqttTopic::operator== (equal)", 0, [&] { bench::doNotOptimize(topic == same); });
+  bench::run("MqttTopic::operator== (differ)", 0, [&] { bench::doNotOptimize(topic == other); });
+  MqttTopicScan scan;
+  bench::run("MqttTopic::scan (filter)", 0, [&] {
+    MqttTopic::scan("site/+/building7/floor2/+/sensors/temperature/#", scan);
+    bench::doNotOptimize(scan.isValidFilter());
+  });
+  bench::run("MqttTopic::isValidTopicName", 0, [&] {
+    bench::doNotOptimize(MqttTopic::isValidTopicName("site/north/building7/floor2/room12/sensors/temperature"));
+  });
+  CHECK(topic == same);
+}
+
+TEST_CASE("bench: UTF-8 validation")
+{
+  const std::string_view ascii = "site/north/building7/floor2/room12/sensors/temperature";
+  const std::string_view mixed = "site/n\xC3\xB6rd/geb\xC3\xA4ude7/stock2/raum12/f\xC3\xBChler/temperatur";
+
+  CHECK(MqttUtf8::isValid(ascii));
+  CHECK(MqttUtf8::isValid(mixed));
+  bench::run("MqttUtf8::isValid (ascii topic)", ascii.size(), [&] { bench::doNotOptimize(MqttUtf8::isValid(ascii)); });
+  bench::run("MqttUtf8::isValid (some 2 byte)", mixed.size(), [&] { bench::doNotOptimize(MqttUtf8::isValid(mixed)); });
+}
+
+TEST_CASE("bench: topic aliases")
+{
+  // device telemetry: 60 byte topics on a 20 byte payload
+  std::vector<std::string> topics;
+  for (int device = 0; device < MQTT_TOPIC_ALIAS_MAXIMUM; device++)
+  {
+    topics.push_back("site/north/building7/floor2/devices/sensor-000" + std::to_string(device) + "/temperature");
+  }
+  const unsigned char payload[20] = {};
+
+  MqttOutboundTopicAliases outbound;
+  outbound.setMaximum(MQTT_TOPIC_ALIAS_MAXIMUM);
+  bool established;
+  std::size_t next = 0;
+  for (const std::string &topic : topics)
+  {
+    outbound.assign(topic, established);
+  }
+  bench::run("outbound alias assign (hit)", 0, [&] {
+    bench::doNotOptimize(outbound.assign(topics[next++ % topics.size()], established));
+  });
+
+  MqttInboundTopicAliases inbound;
+  inbound.setMaximum(MQTT_TOPIC_ALIAS_MAXIMUM);
+  for (std::size_t i = 0; i < topics.size(); i++)
+  {
+    inbound.set(static_cast<unsigned short>(i + 1), topics[i]);
+  }
+  bench::run("inbound alias find", 0, [&] {
+    bench::doNotOptimize(inbound.find(static_cast<unsigned short>(next++ % topics.size() + 1)).size());
+  });
+
+  MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create(topics[0], payload);
+  MqttPublishDelivery full(publish, 0, false, 0);
+  MqttPublishDelivery aliased(publish, 0, false, 0);
+  REQUIRE(full.setProperties(0, true));
+  REQUIRE(aliased.setProperties(1, false));
+  printf("%-36s %9zu bytes, %zu by alias\n", "PUBLISH frame", full.getFrameLength(), aliased.getFrameLength());
+  CHECK(aliased.getFrameLength() * 2 < full.getFrameLength());
+}
+
+static void countMatch(void *obj, const MqttSubscriptionIndex::Subscription &)
+{
+  (*static_cast<std::size_t *>(obj))++;
+}
+
+TEST_CASE("bench: subscription index match")
+{
+  static MqttSubscriptionIndex index;
+  index.clear();
+
+  const char *rooms[] = {"livingroom", "kitchen", "bedroom", "hall", "garage"};
+  const char *sensors[] = {"temperature", "humidity", "motion", "light"};
+  std::size_t subscriber = 0;
+  for (const char *room : rooms)
+  {
+    for (const char *sensor : sensors)
+    {
+      index.subscribe(std::string("home/") + room + "/" + sensor, subscriber++ % MAX_MQTT_SESSIONS, 0);
+    }
+  }
+  index.subscribe("home/+/temperature", 0, 1);
+  index.subscribe("home/#", 1, 0);
+
+  // deep filters with '+' at several levels, so each topic level is compared on many branches
+  const char *deep[] = {"site/+/+/+/level", "site/+/floor2/+/level", "+/+/floor2/+/level", "site/north/+/room5/+",
+                        "+/north/+/+/level", "site/+/+/room5/level", "+/+/+/+/level", "site/north/floor2/+/+"};
+  for (const char *filter : deep)
+  {
+    index.subscribe(filter, subscriber++ % MAX_MQTT_SESSIONS, 0);
+  }
+
+  std::size_t matches = 0;
+  bench::run("index match (exact + '+' + '#')", 0, [&] {
+    bench::doNotOptimize(index.match("home/livingroom/temperature", countMatch, &matches));
+  });
+  bench::run("index match (deep, many '+')", 0, [&] {
+    bench::doNotOptimize(index.match("site/north/floor2/room5/level", countMatch, &matches));
+  });
+  bench::run("index match (no subscribers)", 0, [&] {
+    bench::doNotOptimize(index.match("office/desk/temperature", countMatch, &matches));
+  });
+  CHECK(matches > 0);
+}
+
+static std::size_t benchLoad(void *, MqttSubscriptionIndex::SubscriberId subscriber)
+{
+  return subscriber % 3;
+}
+
+TEST_CASE("bench: shared subscription match")
+{
+  static MqttSubscriptionIndex index;
+  index.clear();
+
+  // one group of eight workers, the way a horizontally scaled backend subscribes
+  for (std::size_t subscriber = 0; subscriber < 8; subscriber++)
+  {
+    index.subscribe("$share/workers/jobs/+/run", subscriber, 1);
+  }
+  index.setLoadCb(benchLoad, nullptr);
+
+  std::size_t matches = 0;
+  index.setShareStrategy(MqttSubscriptionIndex::ShareStrategy::RoundRobin);
+  bench::run("shared match (round robin)", 0, [&] {
+    bench::doNotOptimize(index.match("jobs/print/run", countMatch, &matches));
+  });
+  index.setShareStrategy(MqttSubscriptionIndex::ShareStrategy::LeastInflight);
+  bench::run("shared match (least inflight)", 0, [&] {
+    bench::doNotOptimize(index.match("jobs/print/run", countMatch, &matches));
+  });
+  index.setShareStrategy(MqttSubscriptionIndex::ShareStrategy::StickyHash);
+  bench::run("shared match (sticky hash)", 0, [&] {
+    bench::doNotOptimize(index.match("jobs/print/run", countMatch, &matches));
+  });
+  CHECK(matches > 0);
+}
+
+static void countRetained(void *obj, const MqttRetainedStore::Retained &)
+{
+  (*static_cast<std::size_t *>(obj))++;
+}
+
+TEST_CASE("bench: retained store match")
+{
+  static MqttRetainedStore store;
+  store.clear();
+
+  const unsigned char value[] = {'2', '1'};
+  for (int site = 0; site < MAX_RETAINED_TOPICS / 2; site++)
+  {
+    store.store("site/" + std::to_string(site) + "/sensors/temperature", value, 0);
+    store.store("site/" + std::to_string(site) + "/status", value, 0);
+  }
+
+  std::size_t matches = 0;
+  bench::run("retained match (exact)", 0, [&] {
+    bench::doNotOptimize(store.match("site/3/status", countRetained, &matches));
+  });
+  bench::run("retained match ('+' and '#')", 0, [&] {
+    bench::doNotOptimize(store.match("site/+/sensors/#", countRetained, &matches));
+  });
+  CHECK(matches > 0);
+}
+
+TEST_CASE("bench: snapshot load")
+{
+  static MqttRetainedStore saved;
+  static MqttRetainedStore loaded;
+  saved.clear();
+
+  const unsigned char value[] = {'2', '1', '.', '5'};
+  for (int i = 0; i < MAX_RETAINED_TOPICS; i++)
+  {
+    saved.store("site/" + std::to_string(i / 8) + "/sensor/" + std::to_string(i % 8), value, 0);
+  }
+
+  char pattern[] = "/tmp/mqtt_bench_XXXXXX";
+  const char *directory = mkdtemp(pattern);
+  MqttSnapshot snapshot;
+  REQUIRE(snapshot.startCheckpoint(directory, saved, {1, 0}));
+  REQUIRE_EQ(snapshot.waitForCheckpoint(), MqttSnapshot::CheckpointState::Written);
+
+  MqttPersistentStore::Position position;
+  bench::run("snapshot load (MAX_RETAINED_TOPICS)", snapshot.getCheckpointBytes(), [&] {
+    bench::doNotOptimize(MqttSnapshot::load(directory, loaded, position));
+  });
+  CHECK_EQ(loaded.getMessageCount(), saved.getMessageCount());
+  std::filesystem::remove_all(directory);
+}
+
+static void timerNoopCb(void *)
+{
+}
+
+TEST_CASE("bench: timer wheel")
+{
+  static MqttTimerWheel wheel;
+
+  // every timer parked as an idle keepalive, then one restarted per packet
+  MqttTimerWheel::TimerId timers[MAX_MQTT_TIMERS];
+  for (int i = 0; i < MAX_MQTT_TIMERS; i++)
+  {
+    timers[i] = wheel.start(60000 + i * MQTT_TIMER_TICK_MS, timerNoopCb, nullptr);
+  }
+
+  std::size_t next = 0;
+  bench::run("timer restart (keepalive)", 0, [&] {
+    wheel.restart(timers[next], 90000);
+    next = (next + 1) % MAX_MQTT_TIMERS;
+  });
+  bench::run("timer advance one tick", 0, [&] { bench::doNotOptimize(wheel.advance(MQTT_TIMER_TICK_MS)); });
+  bench::run("timer start + cancel", 0, [&] {
+    wheel.cancel(timers[0]);
+    timers[0] = wheel.start(90000, timerNoopCb, nullptr);
+  });
+  CHECK(wheel.getActiveCount() > 0);
+}
+
+int main(int argc, char **argv)
+{
+  doctest::Context context;
+
+  // BEGIN:: PLATFORMIO REQUIRED OPTIONS
+  context.setOption("success", true);     // Report successful tests
+  context.setOption("no-exitcode", true); // Do not return non-zero code on failed test case
+  // END:: PLATFORMIO REQUIRED OPTIONS
+
+  // YOUR CUSTOM DOCTEST OPTIONS
+  context.applyCommandLine(argc, argv);
+  return context.run();
+}
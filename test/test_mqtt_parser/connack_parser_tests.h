@@ -92,4 +92,13 @@ TEST_SUITE("MqttConnackParser")
         REQUIRE_EQ(result, MqttMessageParser::ParseResult::InvalidReturnCode);
         REQUIRE_EQ(parser.getConnackReturnCode(), MqttConnackParser::MqttConnackReturnCode::InvalidReturnCode);
     }
+
+    TEST_CASE("CONNACK parsed in place from a raw receive buffer")
+    {
+        const unsigned char bytes[] = {0x20, 0x02, 0x01, 0x87};
+        MqttConnackParser parser = MqttConnackParser();
+        MqttMessageParser::ParseResult result = parser.parseMessage(std::span<const unsigned char>(bytes, sizeof(bytes)));
+        REQUIRE_EQ(result, MqttMessageParser::ParseResult::Success);
+        REQUIRE_EQ(parser.getConnackReturnCode(), MqttConnackParser::MqttConnackReturnCode::NotAuthorized);
+    }
 }
\ No newline at end of file
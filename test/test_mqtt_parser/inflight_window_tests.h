@@ -0,0 +1,133 @@
+#include <doctest.h>
+#include <vector>
+#include "mqtt_inflight_window.h"
+#include "mqtt_shared_publish.h"
+
+namespace
+{
+    MqttPublishDelivery inflightDelivery(unsigned char qos)
+    {
+        const unsigned char payload[] = {'o', 'n'};
+        return MqttPublishDelivery(MqttSharedPublish::create("a/b", payload), qos, false, 0);
+    }
+
+    std::vector<unsigned char> inflightFrame(const MqttInflightWindow &window, unsigned short packetIdentifier)
+    {
+        std::span<const unsigned char> segments[MqttPublishDelivery::MAX_SEGMENTS];
+        std::vector<unsigned char> frame;
+        for (std::size_t i = 0, count = window.getSegments(packetIdentifier, segments); i < count; i++)
+        {
+            frame.insert(frame.end(), segments[i].begin(), segments[i].end());
+        }
+        return frame;
+    }
+}
+
+TEST_SUITE("MqttInflightWindow")
+{
+    TEST_CASE("QoS 1 flow")
+    {
+        static MqttInflightWindow window;
+        window.clear();
+
+        unsigned short id = window.add(inflightDelivery(1), 0);
+        REQUIRE_EQ(id, 1);
+        REQUIRE_EQ(window.getState(id), MqttInflightWindow::State::AwaitPuback);
+        REQUIRE_EQ(inflightFrame(window, id), std::vector<unsigned char>({0x32, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x01, 'o', 'n'}));
+
+        REQUIRE_FALSE(window.complete(id));
+        REQUIRE(window.acknowledge(id));
+        REQUIRE_FALSE(window.acknowledge(id));
+        REQUIRE_EQ(window.getCount(), 0);
+    }
+
+    TEST_CASE("QoS 2 flow sends PUBREL once PUBREC is in")
+    {
+        static MqttInflightWindow window;
+        window.clear();
+
+        const unsigned char payload[] = {'o', 'n'};
+        MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("a/b", payload);
+        unsigned short id = window.add(MqttPublishDelivery(publish, 2, false, 0), 0);
+        REQUIRE_EQ(window.getState(id), MqttInflightWindow::State::AwaitPubrec);
+        REQUIRE_FALSE(window.acknowledge(id));
+
+        REQUIRE(window.received(id));
+        REQUIRE_EQ(publish.use_count(), 1);
+        REQUIRE_EQ(window.getState(id), MqttInflightWindow::State::AwaitPubcomp);
+        unsigned short pending[4];
+        REQUIRE_EQ(window.getPendingResends(pending), 1);
+        REQUIRE_EQ(inflightFrame(window, id), std::vector<unsigned char>({0x62, 0x02, 0x00, 0x01}));
+
+        window.markSent(id, 5);
+        REQUIRE_EQ(window.getPendingResends(pending), 0);
+        REQUIRE(window.complete(id));
+        REQUIRE_EQ(window.getCount(), 0);
+
+        // a v5 PUBREL carries a reason code and property length
+        window.setProtocolLevel(5);
+        id = window.add(MqttPublishDelivery(publish, 2, false, 0), 10);
+        REQUIRE(window.received(id));
+        REQUIRE_EQ(inflightFrame(window, id), std::vector<unsigned char>({0x62, 0x04, 0x00, 0x02, 0x00, 0x00}));
+        window.setProtocolLevel(4);
+    }
+
+    TEST_CASE("identifiers are handed out round robin below Receive Maximum")
+    {
+        static MqttInflightWindow window;
+        window.clear();
+        window.setReceiveMaximum(3);
+
+        REQUIRE_EQ(window.add(inflightDelivery(1), 0), 1);
+        REQUIRE_EQ(window.add(inflightDelivery(1), 0), 2);
+        REQUIRE_EQ(window.add(inflightDelivery(1), 0), 3);
+        REQUIRE(window.isFull());
+        REQUIRE_EQ(window.add(inflightDelivery(1), 0), 0);
+
+        REQUIRE(window.acknowledge(2));
+        REQUIRE(window.acknowledge(1));
+        REQUIRE_EQ(window.add(inflightDelivery(1), 0), 1);
+        REQUIRE_EQ(window.add(inflightDelivery(1), 0), 2);
+
+        // a frame that was never sent gives its identifier back
+        REQUIRE(window.acknowledge(3));
+        unsigned short id = window.add(inflightDelivery(1), 0);
+        REQUIRE_EQ(id, 3);
+        window.unwind(id);
+        REQUIRE_EQ(window.add(inflightDelivery(1), 0), 3);
+
+        REQUIRE_EQ(window.add(inflightDelivery(0), 0), 0);
+    }
+
+    TEST_CASE("old entries go again with DUP set")
+    {
+        static MqttInflightWindow window;
+        window.clear();
+
+        unsigned short early = window.add(inflightDelivery(1), 10);
+        unsigned short late = window.add(inflightDelivery(2), 20);
+        REQUIRE_EQ(window.markForResend(15), 1);
+
+        unsigned short pending[4];
+        REQUIRE_EQ(window.getPendingResends(pending), 1);
+        REQUIRE_EQ(pending[0], early);
+        REQUIRE_EQ(inflightFrame(window, early)[0], 0x3A);
+        REQUIRE_EQ(inflightFrame(window, late)[0], 0x34);
+
+        window.markSent(early, 30);
+        REQUIRE_EQ(window.markForResend(UINT64_MAX), 2);
+        REQUIRE_EQ(window.getPendingResends(pending), 2);
+    }
+
+    TEST_CASE("packet identifiers outside the window are ignored")
+    {
+        static MqttInflightWindow window;
+        window.clear();
+
+        REQUIRE_FALSE(window.acknowledge(0));
+        REQUIRE_FALSE(window.received(MQTT_MAX_INFLIGHT + 1));
+        REQUIRE_FALSE(window.complete(65535));
+        window.remove(0);
+        REQUIRE_EQ(window.getCount(), 0);
+    }
+}
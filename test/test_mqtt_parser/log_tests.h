@@ -0,0 +1,62 @@
+#include <doctest.h>
+#include <string>
+#include <vector>
+#include "mqtt_log.h"
+
+namespace
+{
+    void collectRecord(void *obj, const MqttLog::Record &record)
+    {
+        static_cast<std::vector<MqttLog::Record> *>(obj)->push_back(record);
+    }
+}
+
+TEST_SUITE("MqttLog")
+{
+    TEST_CASE("records are drained in order")
+    {
+        std::vector<MqttLog::Record> records;
+        MqttLog::drain(collectRecord, &records); // anything logged by earlier tests
+        records.clear();
+
+        MqttLog::RateLimiter limiter;
+        MqttLog::write(MqttLog::Level::Warning, "a.cpp", 1, limiter, "first %d", 1);
+        MqttLog::write(MqttLog::Level::Error, "a.cpp", 2, limiter, "second %s", "line");
+
+        REQUIRE_EQ(MqttLog::drain(collectRecord, &records), 2);
+        REQUIRE_EQ(std::string(records[0].text), "first 1");
+        REQUIRE_EQ(records[1].level, MqttLog::Level::Error);
+        REQUIRE_EQ(MqttLog::drain(collectRecord, &records), 0);
+    }
+
+    TEST_CASE("a call site is rate limited")
+    {
+        std::vector<MqttLog::Record> records;
+        MqttLog::drain(collectRecord, &records);
+        records.clear();
+
+        MqttLog::RateLimiter limiter;
+        for (int i = 0; i < MQTT_LOG_RATE_LIMIT + 5; i++)
+        {
+            MqttLog::write(MqttLog::Level::Warning, "a.cpp", 3, limiter, "line %d", i);
+        }
+        REQUIRE_EQ(MqttLog::drain(collectRecord, &records), MQTT_LOG_RATE_LIMIT);
+    }
+
+    TEST_CASE("a full ring drops rather than blocks")
+    {
+        std::vector<MqttLog::Record> records;
+        MqttLog::drain(collectRecord, &records);
+        records.clear();
+
+        unsigned long dropped = MqttLog::getDroppedCount();
+        for (int i = 0; i < MQTT_LOG_RING_SIZE + 3; i++)
+        {
+            MqttLog::RateLimiter limiter;
+            MqttLog::write(MqttLog::Level::Info, "a.cpp", 4, limiter, "line %d", i);
+        }
+        REQUIRE_EQ(MqttLog::getDroppedCount() - dropped, 3);
+        REQUIRE_EQ(MqttLog::drain(collectRecord, &records), MQTT_LOG_RING_SIZE);
+        REQUIRE_EQ(std::string(records[0].text), "line 0");
+    }
+}
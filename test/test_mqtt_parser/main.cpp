@@ -2,6 +2,22 @@
 #define DOCTEST_THREAD_LOCAL
 
 #include "connack_parser_tests.h"
+#include "packet_reassembler_tests.h"
+#include "packet_decoder_tests.h"
+#include "reader_tests.h"
+#include "utf8_tests.h"
+#include "property_bag_tests.h"
+#include "log_tests.h"
+#include "message_encoder_tests.h"
+#include "shared_publish_tests.h"
+#include "topic_alias_tests.h"
+#include "memory_pool_tests.h"
+#include "mpsc_queue_tests.h"
+#include "outbound_queue_tests.h"
+#include "timer_wheel_tests.h"
+#include "inflight_window_tests.h"
+#include "persistent_store_tests.h"
+#include "snapshot_tests.h"
 
 int main(int argc, char **argv)
 {
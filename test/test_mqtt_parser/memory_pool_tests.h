@@ -0,0 +1,107 @@
+#include <doctest.h>
+#include <vector>
+#include "mqtt_memory_pool.h"
+#include "mqtt_packet_reassembler.h"
+
+namespace
+{
+    void ignoreFrame(void *obj, [[maybe_unused]] std::span<const unsigned char> frame)
+    {
+        (*static_cast<std::size_t *>(obj))++;
+    }
+}
+
+TEST_SUITE("MqttMemoryPool")
+{
+    TEST_CASE("block pool hands out every block once")
+    {
+        MqttBlockPool<32, 3> pool;
+        void *a = pool.allocate();
+        void *b = pool.allocate();
+        void *c = pool.allocate();
+        REQUIRE(a != nullptr);
+        REQUIRE(b != nullptr);
+        REQUIRE(c != nullptr);
+        REQUIRE(a != b);
+        REQUIRE(pool.allocate() == nullptr);
+        REQUIRE(pool.owns(b));
+
+        pool.deallocate(b);
+        REQUIRE_EQ(pool.allocate(), b);
+
+        MqttPoolStats stats = pool.getStats();
+        REQUIRE_EQ(stats.blockSize, 32);
+        REQUIRE_EQ(stats.inUse, 3);
+        REQUIRE_EQ(stats.highWater, 3);
+        REQUIRE_EQ(stats.failures, 1);
+    }
+
+    TEST_CASE("high water mark survives frees")
+    {
+        MqttBlockPool<16, 4> pool;
+        void *a = pool.allocate();
+        void *b = pool.allocate();
+        pool.deallocate(a);
+        pool.deallocate(b);
+        REQUIRE_EQ(pool.getStats().inUse, 0);
+        REQUIRE_EQ(pool.getStats().highWater, 2);
+    }
+
+    TEST_CASE("allocations go to the smallest class that fits")
+    {
+        MqttMemoryPool pool;
+        void *small = pool.allocate(MQTT_POOL_SMALL_BLOCK_SIZE);
+        void *medium = pool.allocate(MQTT_POOL_SMALL_BLOCK_SIZE + 1);
+        void *large = pool.allocate(MQTT_BUF_SIZE);
+        REQUIRE_EQ(pool.getStats(0).inUse, 1);
+        REQUIRE_EQ(pool.getStats(1).inUse, 1);
+        REQUIRE_EQ(pool.getStats(2).inUse, 1);
+        REQUIRE(pool.allocate(MqttMemoryPool::LARGE_BLOCK_SIZE + 1) == nullptr);
+
+        pool.deallocate(small);
+        pool.deallocate(medium);
+        pool.deallocate(large);
+        REQUIRE_EQ(pool.getStats(0).inUse, 0);
+        REQUIRE_EQ(pool.getStats(1).inUse, 0);
+        REQUIRE_EQ(pool.getStats(2).inUse, 0);
+    }
+
+    TEST_CASE("allocator falls back to the heap when a class is exhausted")
+    {
+        MqttMemoryPool pool;
+        std::vector<void *> held;
+        for (int i = 0; i < MQTT_POOL_LARGE_BLOCKS; i++)
+        {
+            held.push_back(pool.allocate(MqttMemoryPool::LARGE_BLOCK_SIZE));
+        }
+
+        {
+            std::vector<unsigned char, MqttPoolAllocator<unsigned char>> bytes{MqttPoolAllocator<unsigned char>(pool)};
+            bytes.resize(MqttMemoryPool::LARGE_BLOCK_SIZE);
+            REQUIRE_FALSE(pool.owns(bytes.data()));
+            REQUIRE_EQ(pool.getHeapFallbackCount(), 1);
+        }
+
+        for (void *block : held)
+        {
+            pool.deallocate(block);
+        }
+    }
+
+    TEST_CASE("reassembly buffer is only held while a frame is incomplete")
+    {
+        MqttMemoryPool &pool = MqttMemoryPool::getInstance();
+        std::size_t largeInUse = pool.getStats(2).inUse;
+
+        const unsigned char first[] = {0x40, 0x02, 0x01};
+        const unsigned char second[] = {0x23};
+        std::size_t frames = 0;
+        MqttPacketReassembler reassembler;
+
+        REQUIRE_EQ(reassembler.addSegment(first, sizeof(first), ignoreFrame, &frames), MqttPacketReassembler::Result::Success);
+        REQUIRE_EQ(pool.getStats(2).inUse, largeInUse + 1);
+        REQUIRE_EQ(reassembler.addSegment(second, sizeof(second), ignoreFrame, &frames), MqttPacketReassembler::Result::Success);
+        REQUIRE_EQ(frames, 1);
+        REQUIRE_EQ(pool.getStats(2).inUse, largeInUse);
+    }
+}
@@ -0,0 +1,91 @@
+#include <doctest.h>
+#include <string_view>
+#include <vector>
+#include "mqtt_message.h"
+#include "mqtt_message_encoder.h"
+
+TEST_SUITE("MqttMessageEncoder")
+{
+    TEST_CASE("remaining length boundaries")
+    {
+        unsigned char buffer[4];
+        REQUIRE_EQ(MqttMessageEncoder::remainingLengthSize(127), 1);
+        REQUIRE_EQ(MqttMessageEncoder::remainingLengthSize(128), 2);
+        REQUIRE_EQ(MqttMessageEncoder::remainingLengthSize(16384), 3);
+        REQUIRE_EQ(MqttMessageEncoder::remainingLengthSize(MqttMessageEncoder::MAX_REMAINING_LENGTH), 4);
+        REQUIRE_EQ(MqttMessageEncoder::encodeRemainingLength(buffer, 321), 2);
+        REQUIRE_EQ(buffer[0], 0xC1);
+        REQUIRE_EQ(buffer[1], 0x02);
+    }
+
+    TEST_CASE("publish has a length prefixed topic and exact size")
+    {
+        const unsigned char payload[] = {'h', 'i'};
+        std::size_t size = MqttMessageEncoder::publishSize("a/b", sizeof(payload), 1);
+        REQUIRE_EQ(size, 11);
+
+        std::vector<unsigned char> buffer(size);
+        REQUIRE_EQ(MqttMessageEncoder::encodePublish(buffer, "a/b", payload, true, 1, 0x1234), size);
+        REQUIRE_EQ(buffer, std::vector<unsigned char>({0x33, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x12, 0x34, 'h', 'i'}));
+    }
+
+    TEST_CASE("qos 0 publish has no packet identifier")
+    {
+        std::vector<unsigned char> payload(200, 0x55);
+        std::size_t size = MqttMessageEncoder::publishSize("t", payload.size(), 0);
+        REQUIRE_EQ(size, 1 + 2 + 3 + 200);
+
+        std::vector<unsigned char> buffer(size);
+        REQUIRE_EQ(MqttMessageEncoder::encodePublish(buffer, "t", payload, false, 0, 7), size);
+        REQUIRE_EQ(buffer[0], 0x30);
+        REQUIRE_EQ(buffer[1], 0xCB); // 203 = 0x4B | continuation
+        REQUIRE_EQ(buffer[2], 0x01);
+        REQUIRE_EQ(buffer[5], 't');
+        REQUIRE_EQ(buffer[6], 0x55);
+    }
+
+    TEST_CASE("short buffer is rejected")
+    {
+        unsigned char buffer[5];
+        const unsigned char payload[] = {1, 2, 3};
+        REQUIRE_EQ(MqttMessageEncoder::encodePublish(buffer, "topic", payload, false, 0, 0), 0);
+        REQUIRE_EQ(MqttMessageEncoder::encodeConnect(buffer, "client", 30), 0);
+        REQUIRE_EQ(MqttMessageEncoder::encodePubrel(std::span<unsigned char>(buffer, 5), 1), 0);
+    }
+
+    TEST_CASE("subscribe skips over long topics")
+    {
+        std::string tooLong(MAX_TOPIC_LENGTH + 1, 'x');
+        const std::string_view topics[] = {"a", tooLong, "bc"};
+        std::size_t size = MqttMessageEncoder::subscribeSize(topics);
+        REQUIRE_EQ(size, 2 + 2 + 4 + 5);
+
+        std::vector<unsigned char> buffer(size);
+        REQUIRE_EQ(MqttMessageEncoder::encodeSubscribe(buffer, topics, 0x0102), size);
+        REQUIRE_EQ(buffer, std::vector<unsigned char>({0x82, 0x0B, 0x01, 0x02, 0x00, 0x01, 'a', 0x00, 0x00, 0x02, 'b', 'c', 0x00}));
+    }
+
+    TEST_CASE("connect carries the client id")
+    {
+        MqttMessage message;
+        message.createConnect("id");
+        std::span<const unsigned char> frame = message.getMessage();
+        REQUIRE_EQ(frame.size(), 16);
+        REQUIRE_EQ(frame[1], 14);
+        REQUIRE_EQ(frame[12], 0x00);
+        REQUIRE_EQ(frame[13], 0x02);
+        REQUIRE_EQ(frame[14], 'i');
+        REQUIRE_EQ(frame[15], 'd');
+    }
+
+    TEST_CASE("message is replaced by the next create")
+    {
+        MqttMessage message;
+        message.createMqttPubackMessage(0x0A0B);
+        message.createMqttPingreqMessage();
+        std::span<const unsigned char> frame = message.getMessage();
+        REQUIRE_EQ(frame.size(), 2);
+        REQUIRE_EQ(frame[0], 0xC0);
+        REQUIRE_EQ(frame[1], 0x00);
+    }
+}
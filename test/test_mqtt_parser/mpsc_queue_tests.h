@@ -0,0 +1,77 @@
+#include <doctest.h>
+#include <thread>
+#include <vector>
+#include "mqtt_mpsc_queue.h"
+
+TEST_SUITE("MqttMpscQueue")
+{
+    TEST_CASE("items come out in the order they went in")
+    {
+        MqttMpscQueue<int, 4> queue;
+        int item = 0;
+        REQUIRE_FALSE(queue.pop(item));
+        REQUIRE(queue.push(1));
+        REQUIRE(queue.push(2));
+        REQUIRE(queue.pop(item));
+        REQUIRE_EQ(item, 1);
+        REQUIRE(queue.pop(item));
+        REQUIRE_EQ(item, 2);
+        REQUIRE_FALSE(queue.pop(item));
+    }
+
+    TEST_CASE("full queue refuses the push")
+    {
+        MqttMpscQueue<int, 2> queue;
+        int item = 0;
+        REQUIRE(queue.push(1));
+        REQUIRE(queue.push(2));
+        REQUIRE_FALSE(queue.push(3));
+        REQUIRE(queue.pop(item));
+        REQUIRE(queue.push(3));
+        REQUIRE(queue.pop(item));
+        REQUIRE(queue.pop(item));
+        REQUIRE_EQ(item, 3);
+    }
+
+    TEST_CASE("several producers, nothing lost or reordered")
+    {
+        const int producers = 4;
+        const int perProducer = 20000;
+        MqttMpscQueue<int, 256> queue;
+        std::vector<std::thread> threads;
+
+        for (int p = 0; p < producers; p++)
+        {
+            threads.emplace_back([&queue, p, perProducer] {
+                for (int i = 0; i < perProducer; i++)
+                {
+                    while (!queue.push(p * perProducer + i))
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        std::vector<int> next(producers, 0);
+        int received = 0;
+        bool ordered = true;
+        while (received < producers * perProducer)
+        {
+            int item = 0;
+            if (queue.pop(item))
+            {
+                int p = item / perProducer;
+                ordered = ordered && (item % perProducer == next[p]);
+                next[p]++;
+                received++;
+            }
+        }
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+        REQUIRE(ordered);
+        REQUIRE_EQ(received, producers * perProducer);
+    }
+}
@@ -0,0 +1,154 @@
+#include <doctest.h>
+#include <vector>
+#include "mqtt_session.h"
+#include "mqtt_shared_publish.h"
+
+// The sessions here have no TCP session, so nothing ever leaves the queue and it
+// behaves like one belonging to a subscriber that has stopped reading.
+
+namespace
+{
+    struct SpillLog
+    {
+        std::vector<unsigned char> qos;
+        bool accept = true;
+    };
+
+    bool spillCb(void *obj, MqttSession &, const MqttPublishDelivery &delivery)
+    {
+        SpillLog *log = static_cast<SpillLog *>(obj);
+        if (log->accept)
+        {
+            log->qos.push_back(delivery.getQoS());
+        }
+        return log->accept;
+    }
+
+    MqttSharedPublish::MqttSharedPublishPtr outboundPublish(std::size_t payloadLength = 1)
+    {
+        std::vector<unsigned char> payload(payloadLength, 'x');
+        return MqttSharedPublish::create("t", payload);
+    }
+}
+
+TEST_SUITE("MqttSession outbound queue")
+{
+    TEST_CASE("message limit drops the newest by default")
+    {
+        MqttSession session;
+        MqttSession::OutboundPolicy policy;
+        policy.maxMessages = 2;
+        session.setOutboundPolicy(policy);
+
+        REQUIRE(session.deliverPublish(outboundPublish(), 0, false));
+        REQUIRE(session.deliverPublish(outboundPublish(), 0, false));
+        REQUIRE(session.isOutboundFull());
+        REQUIRE_FALSE(session.deliverPublish(outboundPublish(), 0, false));
+        REQUIRE_EQ(session.getOutboundCount(), 2);
+        REQUIRE_EQ(session.getOutboundDropCount(), 1);
+    }
+
+    TEST_CASE("byte limit counts whole frames")
+    {
+        MqttSession session;
+        MqttSession::OutboundPolicy policy;
+        policy.maxBytes = 300;
+        session.setOutboundPolicy(policy);
+
+        // each frame is 2 + 2 + 1 + 100 bytes
+        REQUIRE(session.deliverPublish(outboundPublish(100), 0, false));
+        REQUIRE(session.deliverPublish(outboundPublish(100), 0, false));
+        REQUIRE_EQ(session.getOutboundBytes(), 210);
+        REQUIRE_FALSE(session.deliverPublish(outboundPublish(100), 0, false));
+        REQUIRE(session.deliverPublish(outboundPublish(10), 0, false));
+        REQUIRE_EQ(session.getOutboundBytes(), 225);
+    }
+
+    TEST_CASE("an oversized frame still gets into an empty queue")
+    {
+        MqttSession session;
+        MqttSession::OutboundPolicy policy;
+        policy.maxBytes = 16;
+        session.setOutboundPolicy(policy);
+
+        REQUIRE(session.deliverPublish(outboundPublish(64), 0, false));
+        REQUIRE_FALSE(session.deliverPublish(outboundPublish(1), 0, false));
+    }
+
+    TEST_CASE("drop oldest QoS 0 keeps QoS 1 and the newest messages")
+    {
+        MqttSession session;
+        MqttSession::OutboundPolicy policy;
+        policy.maxMessages = 3;
+        policy.slowConsumer = MqttSession::SlowConsumerPolicy::DropOldestQoS0;
+        session.setOutboundPolicy(policy);
+
+        REQUIRE(session.deliverPublish(outboundPublish(), 1, false));
+        REQUIRE(session.deliverPublish(outboundPublish(), 0, false));
+        REQUIRE(session.deliverPublish(outboundPublish(), 0, false));
+        REQUIRE(session.deliverPublish(outboundPublish(), 1, false));
+        REQUIRE(session.deliverPublish(outboundPublish(), 1, false));
+        REQUIRE_EQ(session.getOutboundCount(), 3);
+        REQUIRE_EQ(session.getOutboundDropCount(), 2);
+
+        // only QoS 1 is left, so there is nothing to make room with
+        REQUIRE_FALSE(session.deliverPublish(outboundPublish(), 0, false));
+        REQUIRE_EQ(session.getOutboundDropCount(), 3);
+    }
+
+    TEST_CASE("disconnect policy empties the queue and refuses more")
+    {
+        MqttSharedPublish::MqttSharedPublishPtr publish = outboundPublish();
+        MqttSession session;
+        MqttSession::OutboundPolicy policy;
+        policy.maxMessages = 2;
+        policy.slowConsumer = MqttSession::SlowConsumerPolicy::Disconnect;
+        session.setOutboundPolicy(policy);
+
+        REQUIRE(session.deliverPublish(publish, 0, false));
+        REQUIRE(session.deliverPublish(publish, 0, false));
+        REQUIRE_FALSE(session.deliverPublish(publish, 0, false));
+        REQUIRE_EQ(session.getOutboundCount(), 0);
+        REQUIRE_EQ(session.getOutboundBytes(), 0);
+        REQUIRE_EQ(publish.use_count(), 1);
+        REQUIRE_FALSE(session.deliverPublish(publish, 0, false));
+    }
+
+    TEST_CASE("spill keeps order by spilling everything after the first")
+    {
+        SpillLog log;
+        MqttSession session;
+        MqttSession::OutboundPolicy policy;
+        policy.maxMessages = 1;
+        policy.slowConsumer = MqttSession::SlowConsumerPolicy::Spill;
+        policy.spillCb = spillCb;
+        policy.spillObj = &log;
+        session.setOutboundPolicy(policy);
+
+        REQUIRE(session.deliverPublish(outboundPublish(), 1, false));
+        REQUIRE(session.deliverPublish(outboundPublish(), 2, false));
+        REQUIRE(session.deliverPublish(outboundPublish(), 0, false));
+        REQUIRE_EQ(session.getOutboundCount(), 1);
+        REQUIRE_EQ(session.getOutboundSpillCount(), 2);
+        REQUIRE_EQ(log.qos, std::vector<unsigned char>({2, 0}));
+
+        log.accept = false;
+        REQUIRE_FALSE(session.deliverPublish(outboundPublish(), 1, false));
+        REQUIRE_EQ(session.getOutboundDropCount(), 1);
+    }
+
+    TEST_CASE("message limit can't exceed the queue size")
+    {
+        MqttSession session;
+        MqttSession::OutboundPolicy policy;
+        policy.maxMessages = MAX_OUTBOUND_DELIVERIES * 2;
+        policy.maxBytes = MQTT_BUF_SIZE * MAX_OUTBOUND_DELIVERIES * 2;
+        session.setOutboundPolicy(policy);
+
+        for (int i = 0; i < MAX_OUTBOUND_DELIVERIES; i++)
+        {
+            REQUIRE(session.deliverPublish(outboundPublish(), 0, false));
+        }
+        REQUIRE_FALSE(session.deliverPublish(outboundPublish(), 0, false));
+    }
+}
@@ -0,0 +1,270 @@
+#include <doctest.h>
+#include <string>
+#include <vector>
+#include "mqtt_packet_decoder.h"
+#include "mqtt_property_bag.h"
+
+namespace
+{
+    // Remembers which handle method dispatch() called, and with what
+    struct DecodedPackets
+    {
+        std::vector<MqttMessageParser::MqttPacketType> types;
+        MqttConnectView connect;
+        MqttPublishView publish;
+        MqttAckView ack;
+        MqttSubscribeView subscribe;
+        MqttReasonView reason;
+
+        void handleConnect(const MqttConnectView &view)
+        {
+            types.push_back(MqttMessageParser::MqttPacketType::Connect);
+            connect = view;
+        }
+        void handlePublish(const MqttPublishView &view)
+        {
+            types.push_back(MqttMessageParser::MqttPacketType::Publish);
+            publish = view;
+        }
+        void handleAck(MqttMessageParser::MqttPacketType type, const MqttAckView &view)
+        {
+            types.push_back(type);
+            ack = view;
+        }
+        void handleSubscribe(const MqttSubscribeView &view)
+        {
+            types.push_back(MqttMessageParser::MqttPacketType::Subscribe);
+            subscribe = view;
+        }
+        void handleUnsubscribe(const MqttSubscribeView &view)
+        {
+            types.push_back(MqttMessageParser::MqttPacketType::Unsubscribe);
+            subscribe = view;
+        }
+        void handlePingreq()
+        {
+            types.push_back(MqttMessageParser::MqttPacketType::Pingreq);
+        }
+        void handleDisconnect(const MqttReasonView &view)
+        {
+            types.push_back(MqttMessageParser::MqttPacketType::Disconnect);
+            reason = view;
+        }
+        void handleAuth(const MqttReasonView &view)
+        {
+            types.push_back(MqttMessageParser::MqttPacketType::Auth);
+            reason = view;
+        }
+    };
+
+    MqttPacketDecoder::Result decodeFrame(std::vector<unsigned char> frame, DecodedPackets &decoded, unsigned char protocolLevel = 4)
+    {
+        static std::vector<unsigned char> keep; // the views point into the frame
+        keep = std::move(frame);
+        return MqttPacketDecoder::dispatch(keep, protocolLevel, decoded);
+    }
+}
+
+TEST_SUITE("MqttPacketDecoder")
+{
+    TEST_CASE("CONNECT v3.1.1 with will, user name and password")
+    {
+        DecodedPackets decoded;
+        REQUIRE_EQ(decodeFrame({0x10, 0x1C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0xEE, 0x00, 0x3C,
+                                0x00, 0x02, 'c', '1',
+                                0x00, 0x01, 'w', 0x00, 0x02, 'b', 'y',
+                                0x00, 0x01, 'u', 0x00, 0x02, 'p', 'w'},
+                               decoded),
+                   MqttPacketDecoder::Result::Success);
+
+        REQUIRE_EQ(decoded.types.size(), 1);
+        REQUIRE_EQ(decoded.connect.protocolLevel, 4);
+        REQUIRE(decoded.connect.cleanStart);
+        REQUIRE(decoded.connect.will);
+        REQUIRE_EQ(decoded.connect.willQos, 1);
+        REQUIRE(decoded.connect.willRetain);
+        REQUIRE_EQ(decoded.connect.keepAlive, 60);
+        REQUIRE_EQ(decoded.connect.clientId, "c1");
+        REQUIRE_EQ(decoded.connect.willTopic, "w");
+        REQUIRE_EQ(decoded.connect.willPayload.size(), 2);
+        REQUIRE_EQ(decoded.connect.userName, "u");
+        REQUIRE_EQ(decoded.connect.password.size(), 2);
+        REQUIRE(decoded.connect.properties.empty());
+    }
+
+    TEST_CASE("CONNECT v5 keeps the property block")
+    {
+        DecodedPackets decoded;
+        REQUIRE_EQ(decodeFrame({0x10, 0x12, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x02, 0x00, 0x0A,
+                                0x03, 0x21, 0x00, 0x14,
+                                0x00, 0x02, 'c', '2'},
+                               decoded),
+                   MqttPacketDecoder::Result::Success);
+
+        REQUIRE_EQ(decoded.connect.protocolLevel, 5);
+        REQUIRE_EQ(decoded.connect.clientId, "c2");
+        REQUIRE_EQ(decoded.connect.properties.size(), 4);
+
+        MqttPropertyBag properties;
+        std::size_t index = 0;
+        unsigned short receiveMaximum;
+        REQUIRE(MqttMessageParser::parseProperties(decoded.connect.properties, index, MqttMessageParser::MqttPacketType::Connect, properties));
+        REQUIRE(properties.getTwoByteInteger(MqttMessageParser::MqttPropertyTypes::ReceiveMaximum, receiveMaximum));
+        REQUIRE_EQ(receiveMaximum, 20);
+    }
+
+    TEST_CASE("CONNECT refusals")
+    {
+        DecodedPackets decoded;
+
+        // unknown protocol level
+        REQUIRE_EQ(decodeFrame({0x10, 0x0C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x06, 0x02, 0x00, 0x0A, 0x00, 0x00}, decoded),
+                   MqttPacketDecoder::Result::UnsupportedProtocol);
+        // reserved connect flag set
+        REQUIRE_EQ(decodeFrame({0x10, 0x0C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x03, 0x00, 0x0A, 0x00, 0x00}, decoded),
+                   MqttPacketDecoder::Result::MalformedPacket);
+        // will QoS without a will
+        REQUIRE_EQ(decodeFrame({0x10, 0x0C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x0A, 0x00, 0x0A, 0x00, 0x00}, decoded),
+                   MqttPacketDecoder::Result::MalformedPacket);
+        // client identifier runs past the end
+        REQUIRE_EQ(decodeFrame({0x10, 0x0C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x0A, 0x00, 0x05}, decoded),
+                   MqttPacketDecoder::Result::MalformedPacket);
+        // flags on the fixed header
+        REQUIRE_EQ(decodeFrame({0x11, 0x0C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x0A, 0x00, 0x00}, decoded),
+                   MqttPacketDecoder::Result::InvalidFlags);
+
+        REQUIRE(decoded.types.empty());
+    }
+
+    TEST_CASE("PUBLISH at each QoS")
+    {
+        DecodedPackets decoded;
+
+        REQUIRE_EQ(decodeFrame({0x31, 0x07, 0x00, 0x03, 'a', '/', 'b', 'o', 'n'}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.publish.qos, 0);
+        REQUIRE(decoded.publish.retain);
+        REQUIRE_EQ(decoded.publish.topic, "a/b");
+        REQUIRE_EQ(decoded.publish.packetIdentifier, 0);
+        REQUIRE_EQ(decoded.publish.payload.size(), 2);
+
+        REQUIRE_EQ(decodeFrame({0x3C, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x12, 0x34, 'o', 'n'}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.publish.qos, 2);
+        REQUIRE(decoded.publish.duplicate);
+        REQUIRE_EQ(decoded.publish.packetIdentifier, 0x1234);
+        REQUIRE_EQ(decoded.publish.payload.size(), 2);
+
+        // v5 properties between the packet identifier and the payload
+        REQUIRE_EQ(decodeFrame({0x32, 0x0C, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x01, 0x02, 0x01, 0x01, 'o', 'n'}, decoded, 5),
+                   MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.publish.properties.size(), 3);
+        REQUIRE_EQ(decoded.publish.payload.size(), 2);
+    }
+
+    TEST_CASE("PUBLISH refusals")
+    {
+        DecodedPackets decoded;
+
+        // QoS 3
+        REQUIRE_EQ(decodeFrame({0x36, 0x07, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x01}, decoded), MqttPacketDecoder::Result::InvalidFlags);
+        // DUP at QoS 0
+        REQUIRE_EQ(decodeFrame({0x38, 0x05, 0x00, 0x03, 'a', '/', 'b'}, decoded), MqttPacketDecoder::Result::InvalidFlags);
+        // packet identifier 0
+        REQUIRE_EQ(decodeFrame({0x32, 0x07, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x00}, decoded), MqttPacketDecoder::Result::MalformedPacket);
+        // wildcards in a topic name
+        REQUIRE_EQ(decodeFrame({0x30, 0x05, 0x00, 0x03, 'a', '/', '+'}, decoded), MqttPacketDecoder::Result::ProtocolError);
+        REQUIRE_EQ(decodeFrame({0x30, 0x03, 0x00, 0x01, '#'}, decoded), MqttPacketDecoder::Result::ProtocolError);
+        // an empty topic needs a topic alias, so v5
+        REQUIRE_EQ(decodeFrame({0x30, 0x02, 0x00, 0x00}, decoded), MqttPacketDecoder::Result::ProtocolError);
+        REQUIRE_EQ(decodeFrame({0x30, 0x03, 0x00, 0x00, 0x00}, decoded, 5), MqttPacketDecoder::Result::Success);
+        // remaining length doesn't match the frame
+        REQUIRE_EQ(decodeFrame({0x30, 0x06, 0x00, 0x03, 'a', '/', 'b'}, decoded), MqttPacketDecoder::Result::MalformedPacket);
+
+        REQUIRE_EQ(decoded.types.size(), 1);
+    }
+
+    TEST_CASE("acknowledgements")
+    {
+        DecodedPackets decoded;
+
+        REQUIRE_EQ(decodeFrame({0x40, 0x02, 0x00, 0x07}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decodeFrame({0x50, 0x02, 0x00, 0x08}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decodeFrame({0x62, 0x02, 0x00, 0x09}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decodeFrame({0x70, 0x02, 0x00, 0x0A}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.types, std::vector<MqttMessageParser::MqttPacketType>(
+                                      {MqttMessageParser::MqttPacketType::Puback, MqttMessageParser::MqttPacketType::Pubrec,
+                                       MqttMessageParser::MqttPacketType::Pubrel, MqttMessageParser::MqttPacketType::Pubcomp}));
+        REQUIRE_EQ(decoded.ack.packetIdentifier, 0x0A);
+
+        // PUBREL must have flags 0010
+        REQUIRE_EQ(decodeFrame({0x60, 0x02, 0x00, 0x09}, decoded), MqttPacketDecoder::Result::InvalidFlags);
+        // a reason code before v5 is one byte too many
+        REQUIRE_EQ(decodeFrame({0x40, 0x03, 0x00, 0x07, 0x10}, decoded), MqttPacketDecoder::Result::MalformedPacket);
+
+        REQUIRE_EQ(decodeFrame({0x40, 0x03, 0x00, 0x07, 0x10}, decoded, 5), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.ack.reasonCode, 0x10);
+        REQUIRE(decoded.ack.properties.empty());
+    }
+
+    TEST_CASE("SUBSCRIBE and UNSUBSCRIBE filters")
+    {
+        DecodedPackets decoded;
+
+        REQUIRE_EQ(decodeFrame({0x82, 0x0C, 0x00, 0x05, 0x00, 0x03, 'a', '/', '#', 0x01, 0x00, 0x01, '+', 0x02}, decoded),
+                   MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.subscribe.packetIdentifier, 5);
+        REQUIRE_EQ(decoded.subscribe.filterCount, 2);
+
+        std::vector<std::string> filters;
+        std::string_view filter;
+        unsigned char options;
+        while (MqttPacketDecoder::nextFilter(decoded.subscribe.filters, filter, options))
+        {
+            filters.push_back(std::string(filter) + ":" + std::to_string(options));
+        }
+        REQUIRE_EQ(filters, std::vector<std::string>({"a/#:1", "+:2"}));
+
+        // no filters at all
+        REQUIRE_EQ(decodeFrame({0x82, 0x02, 0x00, 0x05}, decoded), MqttPacketDecoder::Result::ProtocolError);
+        // options with reserved bits, fine for v5 but not before
+        REQUIRE_EQ(decodeFrame({0x82, 0x06, 0x00, 0x05, 0x00, 0x01, 'a', 0x04}, decoded), MqttPacketDecoder::Result::MalformedPacket);
+        REQUIRE_EQ(decodeFrame({0x82, 0x07, 0x00, 0x05, 0x00, 0x00, 0x01, 'a', 0x04}, decoded, 5), MqttPacketDecoder::Result::Success);
+        // SUBSCRIBE must have flags 0010
+        REQUIRE_EQ(decodeFrame({0x80, 0x06, 0x00, 0x05, 0x00, 0x01, 'a', 0x00}, decoded), MqttPacketDecoder::Result::InvalidFlags);
+
+        REQUIRE_EQ(decodeFrame({0xA2, 0x07, 0x00, 0x06, 0x00, 0x03, 'a', '/', 'b'}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.subscribe.filterCount, 1);
+        REQUIRE(MqttPacketDecoder::nextFilter(decoded.subscribe.filters, filter));
+        REQUIRE_EQ(filter, "a/b");
+        REQUIRE_FALSE(MqttPacketDecoder::nextFilter(decoded.subscribe.filters, filter));
+    }
+
+    TEST_CASE("PINGREQ, DISCONNECT and AUTH")
+    {
+        DecodedPackets decoded;
+
+        REQUIRE_EQ(decodeFrame({0xC0, 0x00}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decodeFrame({0xC0, 0x01, 0x00}, decoded), MqttPacketDecoder::Result::MalformedPacket);
+        REQUIRE_EQ(decodeFrame({0xE0, 0x00}, decoded), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decodeFrame({0xE0, 0x01, 0x04}, decoded), MqttPacketDecoder::Result::MalformedPacket);
+        REQUIRE_EQ(decodeFrame({0xE0, 0x01, 0x04}, decoded, 5), MqttPacketDecoder::Result::Success);
+        REQUIRE_EQ(decoded.reason.reasonCode, 0x04);
+
+        REQUIRE_EQ(decodeFrame({0xF0, 0x00}, decoded), MqttPacketDecoder::Result::ProtocolError);
+        REQUIRE_EQ(decodeFrame({0xF0, 0x00}, decoded, 5), MqttPacketDecoder::Result::Success);
+
+        REQUIRE_EQ(decoded.types, std::vector<MqttMessageParser::MqttPacketType>(
+                                      {MqttMessageParser::MqttPacketType::Pingreq, MqttMessageParser::MqttPacketType::Disconnect,
+                                       MqttMessageParser::MqttPacketType::Disconnect, MqttMessageParser::MqttPacketType::Auth}));
+    }
+
+    TEST_CASE("packets only a server sends")
+    {
+        DecodedPackets decoded;
+
+        REQUIRE_EQ(decodeFrame({0x20, 0x02, 0x00, 0x00}, decoded), MqttPacketDecoder::Result::UnexpectedPacket);
+        REQUIRE_EQ(decodeFrame({0x90, 0x03, 0x00, 0x01, 0x00}, decoded), MqttPacketDecoder::Result::UnexpectedPacket);
+        REQUIRE_EQ(decodeFrame({0xD0, 0x00}, decoded), MqttPacketDecoder::Result::UnexpectedPacket);
+        REQUIRE_EQ(decodeFrame({0x00, 0x00}, decoded), MqttPacketDecoder::Result::MalformedPacket);
+        REQUIRE(decoded.types.empty());
+    }
+}
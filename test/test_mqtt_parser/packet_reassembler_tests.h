@@ -0,0 +1,85 @@
+#include <doctest.h>
+#include <vector>
+#include "mqtt_packet_reassembler.h"
+
+namespace
+{
+    struct ReceivedFrames
+    {
+        std::vector<std::vector<unsigned char>> frames;
+    };
+
+    void frameReceived(void *obj, std::span<const unsigned char> frame)
+    {
+        ReceivedFrames *received = static_cast<ReceivedFrames *>(obj);
+        received->frames.emplace_back(frame.begin(), frame.end());
+    }
+}
+
+TEST_SUITE("MqttPacketReassembler")
+{
+    TEST_CASE("several packets in one segment")
+    {
+        const unsigned char bytes[] = {0xC0, 0x00, 0x40, 0x02, 0x01, 0x23, 0xE0, 0x00};
+        ReceivedFrames received;
+        MqttPacketReassembler reassembler;
+        REQUIRE_EQ(reassembler.addSegment(bytes, sizeof(bytes), frameReceived, &received), MqttPacketReassembler::Result::Success);
+        REQUIRE_EQ(received.frames.size(), 3);
+        REQUIRE_EQ(received.frames[1], std::vector<unsigned char>({0x40, 0x02, 0x01, 0x23}));
+        REQUIRE_EQ(reassembler.getBufferedLength(), 0);
+    }
+
+    TEST_CASE("packet split at every byte")
+    {
+        std::vector<unsigned char> publish = {0x30, 0x82, 0x01}; // remaining length 130
+        for (int i = 0; i < 130; i++)
+        {
+            publish.push_back(static_cast<unsigned char>(i));
+        }
+        publish.push_back(0xC0);
+        publish.push_back(0x00);
+
+        ReceivedFrames received;
+        MqttPacketReassembler reassembler;
+        for (unsigned char byte : publish)
+        {
+            REQUIRE_EQ(reassembler.addSegment(&byte, 1, frameReceived, &received), MqttPacketReassembler::Result::Success);
+        }
+        REQUIRE_EQ(received.frames.size(), 2);
+        REQUIRE_EQ(received.frames[0].size(), 133);
+        REQUIRE_EQ(received.frames[0], std::vector<unsigned char>(publish.begin(), publish.begin() + 133));
+        REQUIRE_EQ(received.frames[1], std::vector<unsigned char>({0xC0, 0x00}));
+    }
+
+    TEST_CASE("packet completed by the start of the next segment")
+    {
+        const unsigned char first[] = {0xC0, 0x00, 0x40, 0x02, 0x01};
+        const unsigned char second[] = {0x23, 0xD0, 0x00};
+        ReceivedFrames received;
+        MqttPacketReassembler reassembler;
+        REQUIRE_EQ(reassembler.addSegment(first, sizeof(first), frameReceived, &received), MqttPacketReassembler::Result::Success);
+        REQUIRE_EQ(received.frames.size(), 1);
+        REQUIRE_EQ(reassembler.getBufferedLength(), 3);
+        REQUIRE_EQ(reassembler.addSegment(second, sizeof(second), frameReceived, &received), MqttPacketReassembler::Result::Success);
+        REQUIRE_EQ(received.frames.size(), 3);
+        REQUIRE_EQ(received.frames[1], std::vector<unsigned char>({0x40, 0x02, 0x01, 0x23}));
+    }
+
+    TEST_CASE("remaining length longer than four bytes")
+    {
+        const unsigned char bytes[] = {0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+        ReceivedFrames received;
+        MqttPacketReassembler reassembler;
+        REQUIRE_EQ(reassembler.addSegment(bytes, sizeof(bytes), frameReceived, &received), MqttPacketReassembler::Result::MalformedRemainingLength);
+        REQUIRE_EQ(received.frames.size(), 0);
+    }
+
+    TEST_CASE("packet larger than the receive buffer")
+    {
+        const unsigned char bytes[] = {0x30, 0xFF, 0x7F};
+        ReceivedFrames received;
+        MqttPacketReassembler reassembler;
+        REQUIRE_EQ(reassembler.addSegment(bytes, 2, frameReceived, &received), MqttPacketReassembler::Result::Success);
+        REQUIRE_EQ(reassembler.addSegment(bytes + 2, 1, frameReceived, &received), MqttPacketReassembler::Result::PacketTooLarge);
+    }
+}
@@ -0,0 +1,177 @@
+#include <doctest.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mqtt_persistent_store.h"
+#include "mqtt_server.h"
+
+namespace
+{
+    struct Replayed
+    {
+        std::vector<std::string> topics;
+        std::vector<std::string> payloads;
+    };
+
+    void replayCb(void *obj, const MqttPersistentStore::Record &record)
+    {
+        Replayed *replayed = static_cast<Replayed *>(obj);
+        replayed->topics.emplace_back(record.topic);
+        replayed->payloads.emplace_back(record.payload.begin(), record.payload.end());
+    }
+
+    bool appendRetain(MqttPersistentStore &store, std::string_view topic, std::string_view payload)
+    {
+        return store.append({MqttPersistentStore::RecordType::Retain, 0, {}, topic,
+                             std::span<const unsigned char>(reinterpret_cast<const unsigned char *>(payload.data()), payload.size())});
+    }
+
+    bool snapshotOneCb([[maybe_unused]] void *obj, MqttPersistentStore &store)
+    {
+        return appendRetain(store, "live", "kept");
+    }
+
+    // a fresh directory for each test, removed when it goes out of scope
+    struct StoreDirectory
+    {
+        StoreDirectory()
+        {
+            char pattern[] = "/tmp/mqtt_store_XXXXXX";
+            path = mkdtemp(pattern);
+        }
+
+        ~StoreDirectory()
+        {
+            std::filesystem::remove_all(path);
+        }
+
+        std::size_t segmentFiles() const
+        {
+            std::size_t count = 0;
+            for (const auto &entry : std::filesystem::directory_iterator(path))
+            {
+                count += (entry.path().extension() == ".seg") ? 1 : 0;
+            }
+            return count;
+        }
+
+        std::string path;
+    };
+}
+
+TEST_SUITE("MqttPersistentStore")
+{
+    TEST_CASE("records are replayed in order after a restart")
+    {
+        StoreDirectory directory;
+        Replayed replayed;
+        {
+            MqttPersistentStore store;
+            REQUIRE(store.open(directory.path.c_str(), replayCb, &replayed));
+            REQUIRE(appendRetain(store, "a/b", "1"));
+            REQUIRE(appendRetain(store, "a/c", ""));
+            REQUIRE(store.append({MqttPersistentStore::RecordType::Subscribe, 1, "client", "a/#", {}}));
+        }
+        REQUIRE(replayed.topics.empty());
+
+        MqttPersistentStore store;
+        REQUIRE(store.open(directory.path.c_str(), replayCb, &replayed));
+        REQUIRE_EQ(store.getReplayedCount(), 3);
+        REQUIRE_EQ(replayed.topics, std::vector<std::string>({"a/b", "a/c", "a/#"}));
+        REQUIRE_EQ(replayed.payloads, std::vector<std::string>({"1", "", ""}));
+    }
+
+    TEST_CASE("a torn record ends the replay and is overwritten")
+    {
+        StoreDirectory directory;
+        Replayed replayed;
+        {
+            MqttPersistentStore store;
+            REQUIRE(store.open(directory.path.c_str(), replayCb, &replayed));
+            REQUIRE(appendRetain(store, "first", "1"));
+            REQUIRE(appendRetain(store, "second", "2"));
+        }
+
+        // flip the last payload byte of the second record
+        int fd = open((directory.path + "/00000001.seg").c_str(), O_RDWR);
+        REQUIRE(fd >= 0);
+        const unsigned char damaged = 'x';
+        REQUIRE_EQ(pwrite(fd, &damaged, 1, (8 + 10 + 5 + 1) + (8 + 10 + 6)), 1);
+        close(fd);
+
+        {
+            MqttPersistentStore store;
+            REQUIRE(store.open(directory.path.c_str(), replayCb, &replayed));
+            REQUIRE_EQ(replayed.topics, std::vector<std::string>({"first"}));
+            REQUIRE(appendRetain(store, "third", "3"));
+        }
+
+        replayed = {};
+        MqttPersistentStore store;
+        REQUIRE(store.open(directory.path.c_str(), replayCb, &replayed));
+        REQUIRE_EQ(replayed.topics, std::vector<std::string>({"first", "third"}));
+    }
+
+    TEST_CASE("segments roll over and compaction removes the old ones")
+    {
+        StoreDirectory directory;
+        Replayed replayed;
+        MqttPersistentStore store;
+        REQUIRE(store.open(directory.path.c_str(), replayCb, &replayed));
+
+        std::string large(MQTT_STORE_SEGMENT_SIZE / 3, 'p');
+        for (int i = 0; i < 4; i++)
+        {
+            REQUIRE(appendRetain(store, "big", large));
+        }
+        REQUIRE_EQ(store.getSegmentCount(), 2);
+        REQUIRE(store.needsCompaction());
+        REQUIRE_FALSE(appendRetain(store, "huge", std::string(MQTT_STORE_SEGMENT_SIZE, 'p')));
+
+        REQUIRE(store.compact(snapshotOneCb, nullptr));
+        REQUIRE_EQ(store.getSegmentCount(), 1);
+        REQUIRE_EQ(directory.segmentFiles(), 1);
+        REQUIRE_FALSE(store.needsCompaction());
+        store.close();
+
+        REQUIRE(store.open(directory.path.c_str(), replayCb, &replayed));
+        REQUIRE_EQ(replayed.topics, std::vector<std::string>({"live"}));
+    }
+
+    TEST_CASE("a directory is refused unless a segment's path fits")
+    {
+        StoreDirectory directory;
+        Replayed replayed;
+        MqttPersistentStore store;
+
+        // "/%08x.seg" and the '\0' have to fit after the directory
+        std::string longest = directory.path + "/" + std::string(MQTT_STORE_PATH_LENGTH - 14 - directory.path.size() - 1, 'd');
+        REQUIRE_FALSE(store.open((longest + "d").c_str(), replayCb, &replayed));
+        REQUIRE(store.open(longest.c_str(), replayCb, &replayed));
+        REQUIRE(appendRetain(store, "a/b", "1"));
+        REQUIRE_EQ(std::filesystem::directory_iterator(longest)->path().string().size(), MQTT_STORE_PATH_LENGTH - 1);
+    }
+
+    TEST_CASE("the server restores its retained messages")
+    {
+        StoreDirectory directory;
+        const unsigned char payload[] = {'2', '1'};
+        {
+            auto server = std::make_unique<MqttServer>();
+            REQUIRE(server->enablePersistence(directory.path.c_str()));
+            REQUIRE(server->retain("house/kitchen/temp", payload, 1));
+            REQUIRE(server->retain("house/hall/temp", payload, 0));
+            REQUIRE(server->retain("house/hall/temp", {}, 0));
+        }
+
+        auto server = std::make_unique<MqttServer>();
+        REQUIRE(server->enablePersistence(directory.path.c_str()));
+        REQUIRE_EQ(server->getRetainedStore().getMessageCount(), 1);
+        REQUIRE_EQ(server->getRetainedStore().getMemoryUsed(), 18 + 2);
+        REQUIRE_EQ(server->getPersistentStore().getReplayedCount(), 3);
+    }
+}
@@ -0,0 +1,133 @@
+#include <doctest.h>
+#include <cstring>
+#include <string_view>
+#include "mqtt_connack_parser.h"
+#include "mqtt_property_bag.h"
+
+using MqttPropertyTypes = MqttMessageParser::MqttPropertyTypes;
+using MqttPropertyWireType = MqttMessageParser::MqttPropertyWireType;
+using MqttPacketType = MqttMessageParser::MqttPacketType;
+
+static_assert(MqttMessageParser::getPropertyInfo(0x23).wireType == MqttPropertyWireType::TwoByteInteger);
+static_assert(MqttMessageParser::getPropertyInfo(0x26).wireType == MqttPropertyWireType::Utf8StringPair);
+static_assert(MqttMessageParser::getPropertyInfo(0x04).wireType == MqttPropertyWireType::Invalid);
+
+TEST_SUITE("MqttPropertyBag")
+{
+    TEST_CASE("PUBLISH properties are recorded and decoded on demand")
+    {
+        const unsigned char properties[] = {
+            0x16,                                     // property length
+            0x23, 0x00, 0x05,                         // topic alias 5
+            0x02, 0x00, 0x00, 0x0E, 0x10,             // message expiry 3600
+            0x26, 0x00, 0x01, 'k', 0x00, 0x02, 'v', 'v', // user property k=vv
+            0x0B, 0x81, 0x01,                         // subscription identifier 129
+            0x03, 0x00, 0x00};                        // empty content type
+        MqttPropertyBag bag;
+        size_t index = 0;
+        REQUIRE(MqttMessageParser::parseProperties(std::span<const unsigned char>(properties, sizeof(properties)), index, MqttPacketType::Publish, bag));
+        REQUIRE_EQ(index, sizeof(properties));
+        REQUIRE_EQ(bag.getCount(), 5);
+
+        unsigned short alias;
+        REQUIRE(bag.getTwoByteInteger(MqttPropertyTypes::TopicAlias, alias));
+        REQUIRE_EQ(alias, 5);
+
+        unsigned long expiry;
+        REQUIRE(bag.getFourByteInteger(MqttPropertyTypes::MessageExpiryInterval, expiry));
+        REQUIRE_EQ(expiry, 3600);
+
+        unsigned long subscriptionId;
+        REQUIRE(bag.getVariableByteInteger(MqttPropertyTypes::SubscriptionIdentifier, subscriptionId));
+        REQUIRE_EQ(subscriptionId, 129);
+
+        std::string_view name, value;
+        REQUIRE_EQ(bag.getUserPropertyCount(), 1);
+        REQUIRE(bag.getUserProperty(0, name, value));
+        REQUIRE_EQ(name, "k");
+        REQUIRE_EQ(value, "vv");
+
+        std::string_view contentType;
+        REQUIRE(bag.getString(MqttPropertyTypes::ContentType, contentType));
+        REQUIRE(contentType.empty());
+
+        unsigned char wrongType;
+        REQUIRE_FALSE(bag.getByte(MqttPropertyTypes::TopicAlias, wrongType));
+    }
+
+    TEST_CASE("property not allowed in the packet type")
+    {
+        const unsigned char properties[] = {0x03, 0x23, 0x00, 0x05}; // topic alias in a CONNACK
+        MqttPropertyBag bag;
+        size_t index = 0;
+        REQUIRE_FALSE(MqttMessageParser::parseProperties(std::span<const unsigned char>(properties, sizeof(properties)), index, MqttPacketType::Connack, bag));
+    }
+
+    TEST_CASE("duplicate property")
+    {
+        const unsigned char properties[] = {0x06, 0x23, 0x00, 0x05, 0x23, 0x00, 0x06};
+        MqttPropertyBag bag;
+        size_t index = 0;
+        REQUIRE_FALSE(MqttMessageParser::parseProperties(std::span<const unsigned char>(properties, sizeof(properties)), index, MqttPacketType::Publish, bag));
+    }
+
+    TEST_CASE("subscription identifier only repeats in a PUBLISH")
+    {
+        const unsigned char properties[] = {0x04, 0x0B, 0x01, 0x0B, 0x02};
+        MqttPropertyBag bag;
+        size_t index = 0;
+        REQUIRE(MqttMessageParser::parseProperties(std::span<const unsigned char>(properties, sizeof(properties)), index, MqttPacketType::Publish, bag));
+        index = 0;
+        REQUIRE_FALSE(MqttMessageParser::parseProperties(std::span<const unsigned char>(properties, sizeof(properties)), index, MqttPacketType::Subscribe, bag));
+    }
+
+    TEST_CASE("string running past the property length")
+    {
+        const unsigned char properties[] = {0x04, 0x03, 0x00, 0x05, 'a', 'b', 'c', 'd', 'e'};
+        MqttPropertyBag bag;
+        size_t index = 0;
+        REQUIRE_FALSE(MqttMessageParser::parseProperties(std::span<const unsigned char>(properties, sizeof(properties)), index, MqttPacketType::Publish, bag));
+    }
+
+    TEST_CASE("user properties past the cap are skipped")
+    {
+        // 17 user properties a=b followed by a topic alias, which must still be kept
+        unsigned char properties[1 + 17 * 7 + 3];
+        size_t length = 0;
+        properties[length++] = sizeof(properties) - 1;
+        for (int i = 0; i < 17; i++)
+        {
+            const unsigned char pair[] = {0x26, 0x00, 0x01, static_cast<unsigned char>('a' + i), 0x00, 0x01, 'b'};
+            std::memcpy(properties + length, pair, sizeof(pair));
+            length += sizeof(pair);
+        }
+        const unsigned char alias[] = {0x23, 0x00, 0x07};
+        std::memcpy(properties + length, alias, sizeof(alias));
+
+        MqttPropertyBag bag;
+        size_t index = 0;
+        REQUIRE(MqttMessageParser::parseProperties(std::span<const unsigned char>(properties, sizeof(properties)), index, MqttPacketType::Publish, bag));
+        REQUIRE_EQ(index, sizeof(properties));
+        REQUIRE_EQ(bag.getUserPropertyCount(), MAX_MQTT_USER_PROPERTIES);
+
+        std::string_view name, value;
+        REQUIRE(bag.getUserProperty(MAX_MQTT_USER_PROPERTIES - 1, name, value));
+        REQUIRE_EQ(name.size(), 1);
+        REQUIRE_EQ(name[0], 'a' + MAX_MQTT_USER_PROPERTIES - 1);
+        REQUIRE_FALSE(bag.getUserProperty(MAX_MQTT_USER_PROPERTIES, name, value));
+
+        unsigned short topicAlias;
+        REQUIRE(bag.getTwoByteInteger(MqttPropertyTypes::TopicAlias, topicAlias));
+        REQUIRE_EQ(topicAlias, 7);
+    }
+
+    TEST_CASE("CONNACK with properties")
+    {
+        const unsigned char bytes[] = {0x20, 0x06, 0x00, 0x00, 0x03, 0x21, 0x00, 0x0A};
+        MqttConnackParser parser = MqttConnackParser();
+        REQUIRE_EQ(parser.parseMessage(std::span<const unsigned char>(bytes, sizeof(bytes))), MqttMessageParser::ParseResult::Success);
+        unsigned short receiveMaximum;
+        REQUIRE(parser.getProperties().getTwoByteInteger(MqttPropertyTypes::ReceiveMaximum, receiveMaximum));
+        REQUIRE_EQ(receiveMaximum, 10);
+    }
+}
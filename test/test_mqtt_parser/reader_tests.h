@@ -0,0 +1,113 @@
+#include <doctest.h>
+#include <vector>
+#include "mqtt_reader.h"
+#include "mqtt_publish_parser.h"
+#include "mqtt_subscribe_parser.h"
+#include "mqtt_puback_parser.h"
+#include "mqtt_connect_parser.h"
+
+TEST_SUITE("MqttReader")
+{
+    TEST_CASE("fields are read big endian")
+    {
+        const unsigned char bytes[] = {0x7F, 0x12, 0x34, 0xDE, 0xAD, 0xBE, 0xEF, 0x00, 0x02, 'h', 'i', 0xFF};
+        MqttReader reader(bytes);
+
+        REQUIRE_EQ(reader.readByte(), 0x7F);
+        REQUIRE_EQ(reader.readTwoByteInteger(), 0x1234);
+        REQUIRE_EQ(reader.readFourByteInteger(), 0xDEADBEEF);
+        REQUIRE_EQ(reader.readString(), "hi");
+        REQUIRE_EQ(reader.getRemaining(), 1);
+        REQUIRE_EQ(reader.getRest().size(), 1);
+        REQUIRE(reader.ensure(1));
+        REQUIRE_EQ(reader.takeByte(), 0xFF);
+        REQUIRE(reader.atEnd());
+        REQUIRE(reader.isValid());
+    }
+
+    TEST_CASE("variable byte integers")
+    {
+        const std::vector<std::vector<unsigned char>> encodings = {
+            {0x00}, {0x7F}, {0x80, 0x01}, {0xFF, 0x7F}, {0x80, 0x80, 0x01}, {0xFF, 0xFF, 0xFF, 0x7F}};
+        const unsigned long values[] = {0, 127, 128, 16383, 16384, 268435455};
+
+        for (std::size_t i = 0; i < encodings.size(); i++)
+        {
+            MqttReader reader(encodings[i]);
+            REQUIRE_EQ(reader.readVariableByteInteger(), values[i]);
+            REQUIRE(reader.isValid());
+            REQUIRE(reader.atEnd());
+        }
+
+        // a fifth byte is malformed, even if it is there
+        const unsigned char tooLong[] = {0x80, 0x80, 0x80, 0x80, 0x01};
+        MqttReader reader(tooLong);
+        REQUIRE_EQ(reader.readVariableByteInteger(), 0);
+        REQUIRE_FALSE(reader.isValid());
+
+        // and so is one that stops with the continuation bit still set
+        const unsigned char truncated[] = {0x80, 0x80};
+        MqttReader shortReader(truncated);
+        shortReader.readVariableByteInteger();
+        REQUIRE_FALSE(shortReader.isValid());
+    }
+
+    TEST_CASE("a short read fails every read after it")
+    {
+        const unsigned char bytes[] = {0x00, 0x05, 'a', 'b', 0x12, 0x34};
+        MqttReader reader(bytes);
+
+        REQUIRE(reader.readString().empty());
+        REQUIRE_FALSE(reader.isValid());
+        REQUIRE(reader.atEnd());
+        REQUIRE_EQ(reader.readTwoByteInteger(), 0);
+        REQUIRE(reader.readBinary().empty());
+        REQUIRE_FALSE(reader.ensure(0));
+        REQUIRE_FALSE(reader.isValid());
+    }
+}
+
+TEST_SUITE("Parsers on malformed packets")
+{
+    TEST_CASE("truncated packets are refused, not read past")
+    {
+        MqttPublishParser publish;
+        MqttSubscribeParser subscribe;
+        MqttPubackParser puback;
+        MqttConnectParser connect;
+
+        // topic length longer than the packet
+        const unsigned char publishBytes[] = {0x30, 0x04, 0x00, 0x10, 'a', 'b'};
+        REQUIRE_EQ(publish.parseMessage(publishBytes), MqttMessageParser::ParseResult::InvalidMessageStructure);
+
+        // a filter with no options byte after it
+        const unsigned char subscribeBytes[] = {0x82, 0x05, 0x00, 0x01, 0x00, 0x01, 'a'};
+        REQUIRE_EQ(subscribe.parseMessage(subscribeBytes), MqttMessageParser::ParseResult::InvalidMessageStructure);
+
+        // remaining length that never ends
+        const unsigned char pubackBytes[] = {0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+        REQUIRE_EQ(puback.parseMessage(pubackBytes), MqttMessageParser::ParseResult::InvalidMessageStructure);
+        REQUIRE_EQ(puback.parseMessage(std::span<const unsigned char>()), MqttMessageParser::ParseResult::InvalidMessageStructure);
+
+        // CONNECT cut off in the middle of the keep alive
+        const unsigned char connectBytes[] = {0x10, 0x09, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00};
+        REQUIRE_EQ(connect.parseMessage(connectBytes), MqttMessageParser::ParseResult::InvalidMessageStructure);
+    }
+
+    TEST_CASE("well formed packets still parse")
+    {
+        MqttPublishParser publish;
+        MqttSubscribeParser subscribe;
+        MqttConnectParser connect;
+
+        const unsigned char publishBytes[] = {0x32, 0x07, 0x00, 0x01, 'a', 0x00, 0x01, 'o', 'n'};
+        REQUIRE_EQ(publish.parseMessage(publishBytes), MqttMessageParser::ParseResult::Success);
+
+        const unsigned char subscribeBytes[] = {0x82, 0x06, 0x00, 0x07, 0x00, 0x01, 'a', 0x01};
+        REQUIRE_EQ(subscribe.parseMessage(subscribeBytes), MqttMessageParser::ParseResult::Success);
+        REQUIRE_EQ(subscribe.getPacketIdentifier(), 7);
+
+        const unsigned char connectBytes[] = {0x10, 0x0C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3C, 0x00, 0x00};
+        REQUIRE_EQ(connect.parseMessage(connectBytes), MqttMessageParser::ParseResult::Success);
+    }
+}
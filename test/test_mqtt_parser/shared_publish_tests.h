@@ -0,0 +1,81 @@
+#include <doctest.h>
+#include <vector>
+#include "mqtt_session.h"
+#include "mqtt_shared_publish.h"
+
+TEST_SUITE("MqttSharedPublish")
+{
+    TEST_CASE("delivery frames differ only in the header")
+    {
+        const unsigned char payload[] = {'o', 'n'};
+        MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("a/b", payload);
+        REQUIRE(publish != nullptr);
+        REQUIRE_EQ(publish->getTopic(), "a/b");
+
+        MqttPublishDelivery qos0(publish, 0, false, 0);
+        MqttPublishDelivery qos1(publish, 1, true, 0x0102);
+        REQUIRE_EQ(publish.use_count(), 3);
+
+        std::vector<unsigned char> frame(qos0.getFrameLength());
+        REQUIRE_EQ(qos0.copyTo(frame), 9);
+        REQUIRE_EQ(frame, std::vector<unsigned char>({0x30, 0x07, 0x00, 0x03, 'a', '/', 'b', 'o', 'n'}));
+
+        frame.resize(qos1.getFrameLength());
+        REQUIRE_EQ(qos1.copyTo(frame), 11);
+        REQUIRE_EQ(frame, std::vector<unsigned char>({0x33, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x01, 0x02, 'o', 'n'}));
+    }
+
+    TEST_CASE("segments point into the shared buffer")
+    {
+        const unsigned char payload[] = {1, 2, 3};
+        MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("t", payload);
+        MqttPublishDelivery first(publish, 1, false, 1);
+        MqttPublishDelivery second(publish, 1, false, 2);
+
+        std::span<const unsigned char> a[MqttPublishDelivery::MAX_SEGMENTS];
+        std::span<const unsigned char> b[MqttPublishDelivery::MAX_SEGMENTS];
+        REQUIRE_EQ(first.getSegments(a), 4);
+        REQUIRE_EQ(second.getSegments(b), 4);
+        REQUIRE_EQ(a[1].data(), b[1].data());
+        REQUIRE_EQ(a[3].data(), b[3].data());
+        REQUIRE_EQ(a[3].data(), publish->getPayload().data());
+        REQUIRE_EQ(b[2][1], 2);
+    }
+
+    TEST_CASE("short buffer is rejected")
+    {
+        const unsigned char payload[] = {1, 2, 3};
+        MqttPublishDelivery delivery(MqttSharedPublish::create("topic", payload), 0, false, 0);
+        unsigned char buffer[4];
+        REQUIRE_EQ(delivery.copyTo(buffer), 0);
+        REQUIRE_FALSE(MqttPublishDelivery().isValid());
+    }
+
+    TEST_CASE("sessions queue a reference, not a copy")
+    {
+        const unsigned char payload[] = {'x'};
+        MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("t", payload);
+        MqttSession sessions[3];
+
+        for (MqttSession &session : sessions)
+        {
+            REQUIRE(session.deliverPublish(publish, 1, false));
+            REQUIRE_EQ(session.getOutboundCount(), 1);
+        }
+        REQUIRE_EQ(publish.use_count(), 4);
+    }
+
+    TEST_CASE("full outbound queue refuses more")
+    {
+        const unsigned char payload[] = {'x'};
+        MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("t", payload);
+        MqttSession session;
+
+        for (int i = 0; i < MAX_OUTBOUND_DELIVERIES; i++)
+        {
+            REQUIRE(session.deliverPublish(publish, 0, false));
+        }
+        REQUIRE_FALSE(session.deliverPublish(publish, 0, false));
+        REQUIRE_EQ(session.getOutboundCount(), MAX_OUTBOUND_DELIVERIES);
+    }
+}
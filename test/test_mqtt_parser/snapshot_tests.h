@@ -0,0 +1,116 @@
+#include <doctest.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mqtt_retained_store.h"
+#include "mqtt_server.h"
+#include "mqtt_snapshot.h"
+
+// StoreDirectory comes from persistent_store_tests.h
+
+namespace
+{
+    void collectSnapshotTopic(void *obj, const MqttRetainedStore::Retained &retained)
+    {
+        static_cast<std::vector<std::string> *>(obj)->emplace_back(retained.publish->getTopic());
+    }
+
+    std::vector<std::string> retainedTopics(const MqttRetainedStore &store, const char *filter)
+    {
+        std::vector<std::string> topics;
+        store.match(filter, collectSnapshotTopic, &topics);
+        std::sort(topics.begin(), topics.end());
+        return topics;
+    }
+}
+
+TEST_SUITE("MqttSnapshot")
+{
+    TEST_CASE("a checkpoint loads back with the same tree and messages")
+    {
+        StoreDirectory directory;
+        static MqttRetainedStore saved;
+        static MqttRetainedStore loaded;
+        saved.clear();
+        saved.setMemoryLimit(4 * 1024 * 1024);
+        loaded.setMemoryLimit(4 * 1024 * 1024);
+
+        // big enough for several CRC chunks, so the check runs on several threads
+        std::vector<unsigned char> payload(MQTT_SNAPSHOT_CHUNK_SIZE / 2, 'v');
+        const char *topics[] = {"site/a/sensors/temp", "site/b/sensors/temp", "site/b/status", "$SYS/uptime",
+                                "site/c/sensors/humidity", "site"};
+        for (const char *topic : topics)
+        {
+            REQUIRE(saved.store(topic, payload, 1));
+        }
+
+        MqttSnapshot snapshot;
+        REQUIRE(snapshot.startCheckpoint(directory.path.c_str(), saved, {7, 40}));
+        REQUIRE_FALSE(snapshot.startCheckpoint(directory.path.c_str(), saved, {7, 40}));
+        REQUIRE_EQ(snapshot.waitForCheckpoint(), MqttSnapshot::CheckpointState::Written);
+        REQUIRE_EQ(snapshot.pollCheckpoint(), MqttSnapshot::CheckpointState::Idle);
+
+        MqttPersistentStore::Position position = {0, 0};
+        REQUIRE(MqttSnapshot::load(directory.path.c_str(), loaded, position));
+        REQUIRE_EQ(position.sequence, 7);
+        REQUIRE_EQ(position.offset, 40);
+        REQUIRE_EQ(loaded.getMessageCount(), 6);
+        REQUIRE_EQ(loaded.getNodeCount(), saved.getNodeCount());
+        REQUIRE_EQ(loaded.getMemoryUsed(), saved.getMemoryUsed());
+        REQUIRE_EQ(retainedTopics(loaded, "site/+/sensors/#"), retainedTopics(saved, "site/+/sensors/#"));
+        REQUIRE_EQ(retainedTopics(loaded, "$SYS/#"), std::vector<std::string>({"$SYS/uptime"}));
+
+        // the loaded tree takes updates like one built by store()
+        REQUIRE(loaded.remove("site/b/status"));
+        REQUIRE(loaded.store("site/b/status", payload, 0));
+        REQUIRE_EQ(loaded.getNodeCount(), saved.getNodeCount());
+    }
+
+    TEST_CASE("a damaged snapshot is refused")
+    {
+        StoreDirectory directory;
+        static MqttRetainedStore store;
+        store.clear();
+        const unsigned char payload[] = {'1'};
+        REQUIRE(store.store("a/b", payload, 0));
+
+        MqttSnapshot snapshot;
+        REQUIRE(snapshot.startCheckpoint(directory.path.c_str(), store, {1, 0}));
+        REQUIRE_EQ(snapshot.waitForCheckpoint(), MqttSnapshot::CheckpointState::Written);
+
+        int fd = open((directory.path + "/retained.snap").c_str(), O_RDWR);
+        REQUIRE(fd >= 0);
+        off_t size = lseek(fd, 0, SEEK_END);
+        const unsigned char damaged = 0xFF;
+        REQUIRE_EQ(pwrite(fd, &damaged, 1, size - 1), 1);
+        close(fd);
+
+        MqttPersistentStore::Position position = {0, 0};
+        REQUIRE_FALSE(MqttSnapshot::load(directory.path.c_str(), store, position));
+        REQUIRE_EQ(position.sequence, 0);
+    }
+
+    TEST_CASE("a restart loads the checkpoint and replays only the log after it")
+    {
+        StoreDirectory directory;
+        const unsigned char payload[] = {'2', '1'};
+        {
+            auto server = std::make_unique<MqttServer>();
+            REQUIRE(server->enablePersistence(directory.path.c_str()));
+            REQUIRE(server->retain("house/kitchen/temp", payload, 1));
+            REQUIRE(server->retain("house/hall/temp", payload, 0));
+            REQUIRE(server->checkpoint(true));
+            REQUIRE_EQ(directory.segmentFiles(), 1);
+            REQUIRE(server->retain("house/hall/temp", {}, 0));
+            REQUIRE(server->retain("garden/temp", payload, 0));
+        }
+
+        auto server = std::make_unique<MqttServer>();
+        REQUIRE(server->enablePersistence(directory.path.c_str()));
+        REQUIRE_EQ(server->getPersistentStore().getReplayedCount(), 2);
+        REQUIRE_EQ(retainedTopics(server->getRetainedStore(), "#"), std::vector<std::string>({"garden/temp", "house/kitchen/temp"}));
+    }
+}
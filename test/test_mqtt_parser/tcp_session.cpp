@@ -57,6 +57,11 @@ TcpSession::sendResult TcpSession::sendMessage(unsigned char *pData, unsigned sh
     return SEND_OK;
 }
 
+TcpSession::sendResult TcpSession::sendMessageVector(std::span<const std::span<const unsigned char>> segments)
+{
+    return SEND_OK;
+}
+
 // Register the callback listener and the callbacls
 
 bool TcpSession::registerSessionDisconnectedCb(void (*cb)(void *, TcpSessionPtr session), void *obj)
@@ -0,0 +1,217 @@
+#include <doctest.h>
+#include <cstdint>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "mqtt_session.h"
+#include "mqtt_timer_wheel.h"
+
+namespace
+{
+    struct TimerFired
+    {
+        MqttTimerWheel *wheel = nullptr;
+        std::vector<std::uint64_t> ticks = {};
+        MqttTimerWheel::TimerId restartTimer = MqttTimerWheel::INVALID_TIMER;
+    };
+
+    void timerFiredCb(void *obj)
+    {
+        TimerFired *fired = static_cast<TimerFired *>(obj);
+        fired->ticks.push_back(fired->wheel->getTick());
+    }
+
+    void timerRestartingCb(void *obj)
+    {
+        TimerFired *fired = static_cast<TimerFired *>(obj);
+        fired->ticks.push_back(fired->wheel->getTick());
+        if (fired->ticks.size() < 3)
+        {
+            fired->restartTimer = fired->wheel->start(MQTT_TIMER_TICK_MS, timerRestartingCb, obj);
+        }
+    }
+}
+
+TEST_SUITE("MqttTimerWheel")
+{
+    TEST_CASE("fires once, on the tick it is due")
+    {
+        static MqttTimerWheel wheel;
+        TimerFired fired{&wheel};
+
+        MqttTimerWheel::TimerId timer = wheel.start(5 * MQTT_TIMER_TICK_MS, timerFiredCb, &fired);
+        REQUIRE_NE(timer, MqttTimerWheel::INVALID_TIMER);
+        REQUIRE(wheel.isActive(timer));
+
+        REQUIRE_EQ(wheel.advance(4 * MQTT_TIMER_TICK_MS), 0);
+        REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS), 1);
+        REQUIRE_EQ(fired.ticks, std::vector<std::uint64_t>({5}));
+        REQUIRE_FALSE(wheel.isActive(timer));
+        REQUIRE_EQ(wheel.advance(100 * MQTT_TIMER_TICK_MS), 0);
+        REQUIRE_EQ(wheel.getActiveCount(), 0);
+    }
+
+    TEST_CASE("part ticks carry over and delays round up")
+    {
+        static MqttTimerWheel wheel;
+        TimerFired fired{&wheel};
+
+        wheel.start(MQTT_TIMER_TICK_MS + 1, timerFiredCb, &fired);
+        REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS / 2), 0);
+        REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS / 2), 0);
+        REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS / 2), 0);
+        REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS / 2), 1);
+        REQUIRE_EQ(fired.ticks, std::vector<std::uint64_t>({2}));
+    }
+
+    TEST_CASE("restart and cancel")
+    {
+        static MqttTimerWheel wheel;
+        TimerFired fired{&wheel};
+
+        MqttTimerWheel::TimerId keepAlive = wheel.start(10 * MQTT_TIMER_TICK_MS, timerFiredCb, &fired);
+        MqttTimerWheel::TimerId cancelled = wheel.start(10 * MQTT_TIMER_TICK_MS, timerFiredCb, &fired);
+        REQUIRE(wheel.cancel(cancelled));
+        REQUIRE_FALSE(wheel.cancel(cancelled));
+
+        for (int i = 0; i < 5; i++)
+        {
+            wheel.advance(8 * MQTT_TIMER_TICK_MS);
+            REQUIRE(wheel.restart(keepAlive, 10 * MQTT_TIMER_TICK_MS));
+        }
+        REQUIRE(fired.ticks.empty());
+        wheel.advance(10 * MQTT_TIMER_TICK_MS);
+        REQUIRE_EQ(fired.ticks, std::vector<std::uint64_t>({50}));
+        REQUIRE_FALSE(wheel.restart(keepAlive, MQTT_TIMER_TICK_MS));
+    }
+
+    TEST_CASE("a reused entry doesn't answer to the old id")
+    {
+        static MqttTimerWheel wheel;
+        TimerFired fired{&wheel};
+
+        MqttTimerWheel::TimerId first = wheel.start(MQTT_TIMER_TICK_MS, timerFiredCb, &fired);
+        wheel.cancel(first);
+        MqttTimerWheel::TimerId second = wheel.start(MQTT_TIMER_TICK_MS, timerFiredCb, &fired);
+        REQUIRE_NE(first, second);
+        REQUIRE_FALSE(wheel.cancel(first));
+        REQUIRE(wheel.isActive(second));
+    }
+
+    TEST_CASE("callbacks can start timers")
+    {
+        static MqttTimerWheel wheel;
+        TimerFired fired{&wheel};
+
+        wheel.start(MQTT_TIMER_TICK_MS, timerRestartingCb, &fired);
+        wheel.advance(10 * MQTT_TIMER_TICK_MS);
+        REQUIRE_EQ(fired.ticks, std::vector<std::uint64_t>({1, 2, 3}));
+        REQUIRE_EQ(wheel.getActiveCount(), 0);
+    }
+
+    TEST_CASE("runs out of timers rather than allocating")
+    {
+        static MqttTimerWheel wheel;
+        TimerFired fired{&wheel};
+
+        for (int i = 0; i < MAX_MQTT_TIMERS; i++)
+        {
+            REQUIRE_NE(wheel.start(MQTT_TIMER_TICK_MS, timerFiredCb, &fired), MqttTimerWheel::INVALID_TIMER);
+        }
+        REQUIRE_EQ(wheel.start(MQTT_TIMER_TICK_MS, timerFiredCb, &fired), MqttTimerWheel::INVALID_TIMER);
+        REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS), MAX_MQTT_TIMERS);
+    }
+
+    TEST_CASE("every level and beyond fires on time")
+    {
+        static MqttTimerWheel wheel;
+        TimerFired fired{&wheel};
+        std::mt19937_64 random(7);
+
+        // delays spread over all the levels, some past the top one
+        std::vector<std::uint64_t> expected;
+        wheel.advance(12345 * MQTT_TIMER_TICK_MS);
+        for (int i = 0; i < MAX_MQTT_TIMERS; i++)
+        {
+            std::uint64_t ticks = 1 + (random() % (std::uint64_t(1) << (6 * (1 + (i % MQTT_TIMER_LEVELS)))));
+            if (i % 7 == 0)
+            {
+                ticks += std::uint64_t(1) << (6 * MQTT_TIMER_LEVELS);
+            }
+            expected.push_back(wheel.getTick() + ticks);
+            REQUIRE_NE(wheel.start(ticks * MQTT_TIMER_TICK_MS, timerFiredCb, &fired), MqttTimerWheel::INVALID_TIMER);
+        }
+        std::sort(expected.begin(), expected.end());
+
+        while (wheel.getActiveCount() > 0)
+        {
+            wheel.advance(997 * MQTT_TIMER_TICK_MS);
+        }
+        REQUIRE_EQ(fired.ticks.size(), expected.size());
+        bool onTime = true;
+        for (std::size_t i = 0; i < expected.size(); i++)
+        {
+            onTime = onTime && (fired.ticks[i] == expected[i]);
+        }
+        REQUIRE(onTime);
+    }
+
+    TEST_CASE("keepalive allows one and a half periods of silence")
+    {
+        static MqttTimerWheel wheel;
+        MqttSession session;
+        session.setTimerWheel(&wheel);
+
+        // a v3.1.1 CONNECT with a keep alive of 10 seconds
+        char connect[] = {0x10, 0x0C, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x0A, 0x00, 0x00};
+        session.handleTcpIncomingMessage(nullptr, connect, sizeof(connect));
+        wheel.advance(14000);
+        REQUIRE_EQ(wheel.getActiveCount(), 1);
+
+        char pingreq[] = {static_cast<char>(0xC0), 0x00};
+        session.handleTcpIncomingMessage(nullptr, pingreq, sizeof(pingreq));
+        wheel.advance(14000);
+        REQUIRE_EQ(wheel.getActiveCount(), 1);
+        REQUIRE_EQ(wheel.advance(1000), 1);
+
+        REQUIRE(session.startKeepAlive(0));
+        REQUIRE_EQ(wheel.getActiveCount(), 0);
+    }
+
+    TEST_CASE("session expiry counts from the disconnect")
+    {
+        static MqttTimerWheel wheel;
+        {
+            MqttSession session;
+            session.setTimerWheel(&wheel);
+            session.setSessionExpiryInterval(30);
+            REQUIRE(session.startKeepAlive(60));
+
+            session.handleTcpDisconnect(nullptr);
+            REQUIRE_EQ(wheel.getActiveCount(), 1);
+            REQUIRE_EQ(wheel.advance(29900), 0);
+            REQUIRE_EQ(wheel.advance(100), 1);
+            REQUIRE_FALSE(session.isSessionValid());
+
+            session.handleTcpDisconnect(nullptr);
+            REQUIRE_EQ(wheel.getActiveCount(), 1);
+        }
+
+        // a session going away takes its timers with it
+        REQUIRE_EQ(wheel.getActiveCount(), 0);
+    }
+
+    TEST_CASE("session expiry is capped")
+    {
+        static MqttTimerWheel wheel;
+        MqttSession session;
+        session.setTimerWheel(&wheel);
+        session.setSessionExpiryInterval(0xFFFFFFFF);
+        REQUIRE(session.startKeepAlive(0));
+
+        session.handleTcpDisconnect(nullptr);
+        REQUIRE_EQ(wheel.advance(MQTT_MAX_SESSION_EXPIRY_INTERVAL * 1000 - MQTT_TIMER_TICK_MS), 0);
+        REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS), 1);
+        REQUIRE_FALSE(session.isSessionValid());
+    }
+}
@@ -0,0 +1,112 @@
+#include <doctest.h>
+#include <string>
+#include <vector>
+#include "mqtt_shared_publish.h"
+#include "mqtt_topic_alias.h"
+
+TEST_SUITE("MqttTopicAlias")
+{
+    TEST_CASE("inbound aliases are set and used")
+    {
+        MqttInboundTopicAliases aliases;
+
+        // none until the broker has advertised a maximum
+        REQUIRE_EQ(aliases.getMaximum(), 0);
+        REQUIRE_FALSE(aliases.set(1, "a/b"));
+        REQUIRE_EQ(aliases.find(1), "");
+
+        aliases.setMaximum(MQTT_TOPIC_ALIAS_MAXIMUM + 100);
+        REQUIRE_EQ(aliases.getMaximum(), MQTT_TOPIC_ALIAS_MAXIMUM);
+
+        REQUIRE_EQ(aliases.find(1), "");
+        REQUIRE(aliases.set(1, "devices/0001/temperature"));
+        REQUIRE(aliases.set(MQTT_TOPIC_ALIAS_MAXIMUM, "devices/0002/temperature"));
+        REQUIRE_EQ(aliases.find(1), "devices/0001/temperature");
+        REQUIRE_EQ(aliases.find(MQTT_TOPIC_ALIAS_MAXIMUM), "devices/0002/temperature");
+
+        // setting an alias again moves it to the new topic
+        REQUIRE(aliases.set(1, "a/b"));
+        REQUIRE_EQ(aliases.find(1), "a/b");
+
+        REQUIRE_FALSE(aliases.set(0, "a/b"));
+        REQUIRE_FALSE(aliases.set(MQTT_TOPIC_ALIAS_MAXIMUM + 1, "a/b"));
+        REQUIRE_FALSE(aliases.set(2, ""));
+        REQUIRE_EQ(aliases.find(0), "");
+        REQUIRE_EQ(aliases.find(MQTT_TOPIC_ALIAS_MAXIMUM + 1), "");
+
+        aliases.clear();
+        REQUIRE_EQ(aliases.find(1), "");
+    }
+
+    TEST_CASE("outbound aliases are given out and the least recently used reassigned")
+    {
+        MqttOutboundTopicAliases aliases;
+        bool established;
+
+        // none until the client says it takes them
+        REQUIRE_EQ(aliases.assign("a", established), 0);
+        REQUIRE_FALSE(established);
+
+        aliases.setMaximum(3);
+        REQUIRE_EQ(aliases.getMaximum(), 3);
+        REQUIRE_EQ(aliases.assign("a", established), 1);
+        REQUIRE(established);
+        REQUIRE_EQ(aliases.assign("a", established), 1);
+        REQUIRE_FALSE(established);
+        REQUIRE_EQ(aliases.assign("b", established), 2);
+        REQUIRE_EQ(aliases.assign("c", established), 3);
+
+        // "a" was used since "b", so "b" is the one to go
+        REQUIRE_EQ(aliases.assign("a", established), 1);
+        REQUIRE_EQ(aliases.assign("d", established), 2);
+        REQUIRE(established);
+        REQUIRE_EQ(aliases.assign("b", established), 3);
+        REQUIRE(established);
+
+        // a forgotten alias is the next one given out, and its topic sets one again
+        aliases.forget(1);
+        REQUIRE_EQ(aliases.assign("e", established), 1);
+        REQUIRE(established);
+        REQUIRE_EQ(aliases.assign("d", established), 2);
+        REQUIRE_FALSE(established);
+
+        REQUIRE_EQ(aliases.assign("", established), 0);
+
+        aliases.setMaximum(MQTT_TOPIC_ALIAS_MAXIMUM + 100);
+        REQUIRE_EQ(aliases.getMaximum(), MQTT_TOPIC_ALIAS_MAXIMUM);
+        REQUIRE_EQ(aliases.assign("d", established), 1);
+        REQUIRE(established);
+    }
+
+    TEST_CASE("a delivery carries its properties and can leave the topic out")
+    {
+        const unsigned char payload[] = {'o', 'n'};
+        MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("a/b", payload);
+        std::vector<unsigned char> frame;
+
+        MqttPublishDelivery plain(publish, 0, false, 0);
+        REQUIRE(plain.setProperties(0, true));
+        frame.resize(plain.getFrameLength());
+        REQUIRE_EQ(plain.copyTo(frame), 10);
+        REQUIRE_EQ(frame, std::vector<unsigned char>({0x30, 0x08, 0x00, 0x03, 'a', '/', 'b', 0x00, 'o', 'n'}));
+
+        MqttPublishDelivery aliased(publish, 0, false, 0);
+        REQUIRE(aliased.setProperties(0x0102, true));
+        frame.resize(aliased.getFrameLength());
+        REQUIRE_EQ(aliased.copyTo(frame), 13);
+        REQUIRE_EQ(frame, std::vector<unsigned char>({0x30, 0x0B, 0x00, 0x03, 'a', '/', 'b', 0x03, 0x23, 0x01, 0x02, 'o', 'n'}));
+
+        REQUIRE(aliased.setProperties(0x0102, false));
+        frame.resize(aliased.getFrameLength());
+        REQUIRE_EQ(aliased.copyTo(frame), 10);
+        REQUIRE_EQ(frame, std::vector<unsigned char>({0x30, 0x08, 0x00, 0x00, 0x03, 0x23, 0x01, 0x02, 'o', 'n'}));
+
+        MqttPublishDelivery qos1(publish, 1, false, 0x0005);
+        REQUIRE(qos1.setProperties(0, true));
+        std::span<const unsigned char> segments[MqttPublishDelivery::MAX_SEGMENTS];
+        REQUIRE_EQ(qos1.getSegments(segments), 5);
+        REQUIRE_EQ(segments[3].size(), 1);
+
+        REQUIRE_FALSE(MqttPublishDelivery().setProperties(1, false));
+    }
+}
@@ -0,0 +1,127 @@
+#include <doctest.h>
+#include <string>
+#include <vector>
+#include "mqtt_utf8.h"
+#include "mqtt_packet_decoder.h"
+#include "mqtt_property_bag.h"
+
+namespace
+{
+    // A byte at a time decoder straight from the definition, to check the fast one against
+    bool referenceUtf8(const std::string &text)
+    {
+        for (std::size_t i = 0; i < text.size();)
+        {
+            const unsigned char lead = text[i];
+            std::size_t count = (lead < 0x80) ? 0 : ((lead >> 5) == 0x06) ? 1 : ((lead >> 4) == 0x0E) ? 2 : ((lead >> 3) == 0x1E) ? 3 : 4;
+            if ((count == 4) || (i + count >= text.size()))
+            {
+                return false;
+            }
+
+            unsigned long codePoint = (count == 0) ? lead : (lead & (0x3F >> count));
+            for (std::size_t k = 1; k <= count; k++)
+            {
+                const unsigned char next = text[i + k];
+                if ((next >> 6) != 0x02)
+                {
+                    return false;
+                }
+                codePoint = (codePoint << 6) | (next & 0x3F);
+            }
+
+            const unsigned long smallest[] = {0x00, 0x80, 0x800, 0x10000};
+            if ((codePoint == 0) || (codePoint < smallest[count]) || (codePoint > 0x10FFFF) ||
+                ((codePoint >= 0xD800) && (codePoint <= 0xDFFF)))
+            {
+                return false;
+            }
+            i += count + 1;
+        }
+        return true;
+    }
+}
+
+TEST_SUITE("MqttUtf8")
+{
+    TEST_CASE("well formed text")
+    {
+        REQUIRE(MqttUtf8::isValid(""));
+        REQUIRE(MqttUtf8::isValid("sensors/kitchen/temperature/celsius/reading"));
+        REQUIRE(MqttUtf8::isValid("caf\xC3\xA9/\xE2\x82\xAC/\xF0\x9F\x98\x80"));  // é, €, 😀
+        REQUIRE(MqttUtf8::isValid("\xEF\xBF\xBF\xF4\x8F\xBF\xBF"));               // U+FFFF, U+10FFFF
+        REQUIRE(MqttUtf8::isValid("a long ascii prefix to get past a block \xC3\xA9 and a long ascii suffix after it"));
+    }
+
+    TEST_CASE("malformed text")
+    {
+        REQUIRE_FALSE(MqttUtf8::isValid(std::string_view("a\0b", 3)));                       // U+0000
+        REQUIRE_FALSE(MqttUtf8::isValid(std::string_view("0123456789abcdef\0", 17)));         // U+0000 in a block
+        REQUIRE_FALSE(MqttUtf8::isValid("\xED\xA0\x80"));                                     // U+D800
+        REQUIRE_FALSE(MqttUtf8::isValid("\xED\xBF\xBF"));                                     // U+DFFF
+        REQUIRE_FALSE(MqttUtf8::isValid("\xC0\xAF"));                                         // overlong '/'
+        REQUIRE_FALSE(MqttUtf8::isValid("\xE0\x80\xAF"));                                     // overlong '/'
+        REQUIRE_FALSE(MqttUtf8::isValid("\xC0\x80"));                                         // overlong U+0000
+        REQUIRE_FALSE(MqttUtf8::isValid("\xF4\x90\x80\x80"));                                 // past U+10FFFF
+        REQUIRE_FALSE(MqttUtf8::isValid("\xF8\x88\x80\x80\x80"));                             // five bytes
+        REQUIRE_FALSE(MqttUtf8::isValid("abc\x80"));                                          // stray continuation
+        REQUIRE_FALSE(MqttUtf8::isValid("abc\xE2\x82"));                                      // cut short
+        REQUIRE_FALSE(MqttUtf8::isValid("0123456789abcdef0123456789abcde\xC3"));              // cut short at a block end
+    }
+
+    TEST_CASE("agrees with a byte at a time decoder")
+    {
+        const unsigned char alphabet[] = {'a', '/', 0x00, 0x7F, 0x80, 0xBF, 0xC2, 0xC0, 0xE0, 0xED, 0xA0, 0xF0, 0xF4, 0x90, 0xFF};
+        unsigned int seed = 4242;
+
+        for (int round = 0; round < 20000; round++)
+        {
+            // mostly ASCII, so the block search is exercised either side of the odd byte
+            std::string text(round % 48, 'x');
+            for (char &c : text)
+            {
+                seed = seed * 1103515245u + 12345u;
+                c = ((seed >> 16) % 4 == 0) ? static_cast<char>(alphabet[(seed >> 20) % sizeof(alphabet)]) : 'x';
+            }
+            REQUIRE_EQ(MqttUtf8::isValid(text), referenceUtf8(text));
+        }
+    }
+
+    TEST_CASE("strings in packets are checked where they lie")
+    {
+        struct Ignore
+        {
+            void handleConnect(const MqttConnectView &) {}
+            void handlePublish(const MqttPublishView &) {}
+            void handleAck(MqttMessageParser::MqttPacketType, const MqttAckView &) {}
+            void handleSubscribe(const MqttSubscribeView &) {}
+            void handleUnsubscribe(const MqttSubscribeView &) {}
+            void handlePingreq() {}
+            void handleDisconnect(const MqttReasonView &) {}
+            void handleAuth(const MqttReasonView &) {}
+        } ignore;
+
+        // client id with a surrogate
+        const unsigned char connect[] = {0x10, 0x0F, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x0A, 0x00, 0x03, 0xED, 0xA0, 0x80};
+        REQUIRE_EQ(MqttPacketDecoder::dispatch(connect, 4, ignore), MqttPacketDecoder::Result::MalformedPacket);
+
+        // topic names
+        const unsigned char publishGood[] = {0x30, 0x05, 0x00, 0x03, 'a', 0xC3, 0xA9};
+        REQUIRE_EQ(MqttPacketDecoder::dispatch(publishGood, 4, ignore), MqttPacketDecoder::Result::Success);
+        const unsigned char publishBad[] = {0x30, 0x05, 0x00, 0x03, 'a', 0xC0, 0xAF};
+        REQUIRE_EQ(MqttPacketDecoder::dispatch(publishBad, 4, ignore), MqttPacketDecoder::Result::ProtocolError);
+
+        // a filter
+        const unsigned char subscribe[] = {0x82, 0x07, 0x00, 0x01, 0x00, 0x02, 'a', 0xFF, 0x00};
+        REQUIRE_EQ(MqttPacketDecoder::dispatch(subscribe, 4, ignore), MqttPacketDecoder::Result::MalformedPacket);
+
+        // a Reason String property
+        const unsigned char reasonGood[] = {0x05, 0x1F, 0x00, 0x02, 0xC3, 0xA9};
+        const unsigned char reasonBad[] = {0x05, 0x1F, 0x00, 0x02, 0xC3, 0x28};
+        MqttPropertyBag properties;
+        std::size_t index = 0;
+        REQUIRE(MqttMessageParser::parseProperties(reasonGood, index, MqttMessageParser::MqttPacketType::Disconnect, properties));
+        index = 0;
+        REQUIRE_FALSE(MqttMessageParser::parseProperties(reasonBad, index, MqttMessageParser::MqttPacketType::Disconnect, properties));
+    }
+}
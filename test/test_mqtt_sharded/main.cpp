@@ -0,0 +1,221 @@
+#define DOCTEST_CONFIG_IMPLEMENT  // REQUIRED: Enable custom main()
+#define DOCTEST_THREAD_LOCAL
+#include <doctest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "mqtt_sharded_broker.h"
+
+// The broker runs on its own threads here; the tests talk to it over loopback
+// and only touch the shards through post().
+
+namespace
+{
+  struct ShardProbe
+  {
+    std::atomic<std::size_t> sessions{0};
+    std::atomic<int> done{0};
+  };
+
+  void countSessionsTask(void *obj, MqttServer &server)
+  {
+    ShardProbe *probe = static_cast<ShardProbe *>(obj);
+    probe->sessions += server.getSessionCount();
+    probe->done++;
+  }
+
+  void subscribeEveryoneTask(void *obj, MqttServer &server)
+  {
+    // subscribers are session slots, so subscribing every slot covers every client
+    for (MqttSubscriptionIndex::SubscriberId slot = 0; slot < MAX_MQTT_SESSIONS; slot++)
+    {
+      server.getSubscriptionIndex().subscribe("t/#", slot, 0);
+    }
+    static_cast<ShardProbe *>(obj)->done++;
+  }
+
+  void countSubscriptionsTask(void *obj, MqttServer &server)
+  {
+    ShardProbe *probe = static_cast<ShardProbe *>(obj);
+    probe->sessions += server.getSubscriptionIndex().getSubscriptionCount();
+    probe->done++;
+  }
+
+  void publishFromShardTask(void *obj, MqttServer &server)
+  {
+    const unsigned char payload[] = {'s'};
+    server.publish("t/y", payload, 0);
+    static_cast<ShardProbe *>(obj)->done++;
+  }
+
+  template <typename Predicate>
+  bool waitFor(Predicate done)
+  {
+    for (int i = 0; (i < 500) && !done(); i++)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return done();
+  }
+
+  std::size_t countOnShards(MqttShardedBroker &broker, void (*task)(void *, MqttServer &))
+  {
+    ShardProbe probe;
+    for (std::size_t shard = 0; shard < broker.getShardCount(); shard++)
+    {
+      broker.post(shard, task, &probe);
+    }
+    waitFor([&] { return probe.done == static_cast<int>(broker.getShardCount()); });
+    return probe.sessions;
+  }
+
+  std::size_t countSessions(MqttShardedBroker &broker)
+  {
+    return countOnShards(broker, countSessionsTask);
+  }
+
+  int connectTo(unsigned short port)
+  {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+      close(fd);
+      return -1;
+    }
+
+    timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+  }
+
+  std::vector<unsigned char> receiveFrame(int fd, std::size_t length)
+  {
+    std::vector<unsigned char> frame(length);
+    ssize_t count = recv(fd, frame.data(), frame.size(), MSG_WAITALL);
+    frame.resize((count > 0) ? count : 0);
+    return frame;
+  }
+}
+
+TEST_CASE("connections are spread over the shards")
+{
+  MqttShardedBroker broker(4);
+  REQUIRE(broker.start(0));
+  REQUIRE_NE(broker.getListenPort(), 0);
+
+  std::vector<int> clients;
+  for (int i = 0; i < 8; i++)
+  {
+    clients.push_back(connectTo(broker.getListenPort()));
+    REQUIRE_GE(clients.back(), 0);
+  }
+  REQUIRE(waitFor([&] { return countSessions(broker) == 8; }));
+
+  for (int fd : clients)
+  {
+    close(fd);
+  }
+  broker.stop();
+}
+
+TEST_CASE("publish reaches subscribers on every shard")
+{
+  MqttShardedBroker broker(4);
+  REQUIRE(broker.start(0));
+
+  std::vector<int> clients;
+  for (int i = 0; i < 8; i++)
+  {
+    clients.push_back(connectTo(broker.getListenPort()));
+  }
+  REQUIRE(waitFor([&] { return countSessions(broker) == 8; }));
+
+  ShardProbe subscribed;
+  for (std::size_t shard = 0; shard < broker.getShardCount(); shard++)
+  {
+    REQUIRE(broker.post(shard, subscribeEveryoneTask, &subscribed));
+  }
+  REQUIRE(waitFor([&] { return subscribed.done == 4; }));
+
+  // from outside the shards
+  const unsigned char payload[] = {'h', 'i'};
+  REQUIRE_EQ(broker.publish("t/x", payload, 0), 4);
+  for (int fd : clients)
+  {
+    REQUIRE_EQ(receiveFrame(fd, 9), std::vector<unsigned char>({0x30, 0x07, 0x00, 0x03, 't', '/', 'x', 'h', 'i'}));
+  }
+
+  // from one shard's own MqttServer, which routes through the broker
+  ShardProbe published;
+  REQUIRE(broker.post(0, publishFromShardTask, &published));
+  for (int fd : clients)
+  {
+    REQUIRE_EQ(receiveFrame(fd, 8), std::vector<unsigned char>({0x30, 0x06, 0x00, 0x03, 't', '/', 'y', 's'}));
+  }
+  REQUIRE_EQ(broker.getDroppedCount(), 0);
+
+  for (int fd : clients)
+  {
+    close(fd);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  doctest::Context context;
+
+  // BEGIN:: PLATFORMIO REQUIRED OPTIONS
+  context.setOption("success", true);     // Report successful tests
+  context.setOption("no-exitcode", true); // Do not return non-zero code on failed test case
+  // END:: PLATFORMIO REQUIRED OPTIONS
+
+  // YOUR CUSTOM DOCTEST OPTIONS
+  context.applyCommandLine(argc, argv);
+  return context.run();
+}
+
+TEST_CASE("a client PUBLISH reaches subscribers on the other shards")
+{
+  MqttShardedBroker broker(4);
+  REQUIRE(broker.start(0));
+
+  const unsigned char connect[] = {0x10, 0x0E, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x00, 0x00, 0x02, 'c', '1'};
+  const unsigned char subscribe[] = {0x82, 0x08, 0x00, 0x01, 0x00, 0x03, 't', '/', '#', 0x00};
+
+  std::vector<int> subscribers;
+  for (int i = 0; i < 8; i++)
+  {
+    subscribers.push_back(connectTo(broker.getListenPort()));
+    REQUIRE_EQ(send(subscribers.back(), connect, sizeof(connect), 0), sizeof(connect));
+    REQUIRE_EQ(send(subscribers.back(), subscribe, sizeof(subscribe), 0), sizeof(subscribe));
+  }
+  REQUIRE(waitFor([&] { return countOnShards(broker, countSubscriptionsTask) == 8; }));
+
+  int publisher = connectTo(broker.getListenPort());
+  REQUIRE_EQ(send(publisher, connect, sizeof(connect), 0), sizeof(connect));
+  const unsigned char publish[] = {0x30, 0x07, 0x00, 0x03, 't', '/', 'x', 'h', 'i'};
+  REQUIRE_EQ(send(publisher, publish, sizeof(publish), 0), sizeof(publish));
+
+  for (int fd : subscribers)
+  {
+    REQUIRE_EQ(receiveFrame(fd, sizeof(publish)), std::vector<unsigned char>(publish, publish + sizeof(publish)));
+    close(fd);
+  }
+  close(publisher);
+  broker.stop();
+}
+
+TEST_CASE("no more shards than the topic table is sized for")
+{
+  MqttShardedBroker broker(MQTT_MAX_SHARDS + 1);
+  REQUIRE_EQ(broker.getShardCount(), MQTT_MAX_SHARDS);
+}
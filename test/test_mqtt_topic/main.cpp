@@ -2,6 +2,14 @@
 #define DOCTEST_THREAD_LOCAL
 #include <doctest.h>
 #include <mqtt_topic.h>
+#include <mqtt_subscription_index.h>
+#include <mqtt_topic_table.h>
+#include <mqtt_retained_store.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 
 TEST_CASE("insantiation (empty)") {
   MqttTopic topic = MqttTopic();
@@ -144,6 +152,447 @@ TEST_CASE("== operator (+ operations)") {
    REQUIRE_EQ(topic1 == topic5, false);
 }
 
+TEST_CASE("topic scan (levels and wildcards)") {
+   std::string_view filter("house/+/kitchen/cupboard/shelf/#");
+   MqttTopicScan scan;
+   MqttTopic::scan(filter, scan);
+
+   REQUIRE_EQ(scan.levelCount, 6);
+   REQUIRE_EQ(scan.getLevel(filter, 0), "house");
+   REQUIRE_EQ(scan.getLevel(filter, 3), "cupboard");
+   REQUIRE_EQ(scan.getLevel(filter, 5), "#");
+   REQUIRE_EQ(scan.longestLevel, 8);
+   REQUIRE_EQ(scan.firstPlus, 6);
+   REQUIRE_EQ(scan.firstHash, filter.size() - 1);
+   REQUIRE(scan.wildcardsAlone);
+   REQUIRE(scan.isValidFilter());
+   REQUIRE_FALSE(scan.isValidTopicName());
+
+   MqttTopic::scan("house/kitchen/cupboard/", scan);
+   REQUIRE(scan.isValidTopicName());
+   REQUIRE(MqttTopic::isValidTopicName("house/kitchen/cupboard/"));
+   REQUIRE_FALSE(MqttTopic::isValidTopicName("house/kitchen/cupboard/+"));
+   REQUIRE_FALSE(MqttTopic::isValidTopicName(""));
+   REQUIRE_EQ(scan.levelCount, 4);
+
+   MqttTopic::scan(std::string_view("house/kit\0chen", 14), scan);
+   REQUIRE(scan.hasNul);
+   REQUIRE_FALSE(scan.isValidTopicName());
+   REQUIRE_FALSE(scan.isValidFilter());
+
+   MqttTopic::scan("house/caf\xC3\xA9/\xF0\x9F\x98\x80/#", scan);
+   REQUIRE(scan.validUtf8);
+   REQUIRE(scan.isValidFilter());
+   MqttTopic::scan("house/a long level to fill a block/caf\xC3/#", scan);
+   REQUIRE_FALSE(scan.validUtf8);
+   REQUIRE_FALSE(scan.isValidFilter());
+   REQUIRE_FALSE(MqttTopic::isValidTopicName("house/a long level to fill a block/caf\xC3"));
+   REQUIRE(MqttTopic::isValidTopicName("house/a long level to fill a block/caf\xC3\xA9"));
+   REQUIRE_FALSE(MqttTopic("house/\xED\xA0\x80").isValidName());
+
+   const char *badFilters[] = {"", "house/#/kitchen", "house/kitchen#", "house/+kitchen", "#/#", "house/kitchen/cupboard/shelf+"};
+   for (const char *bad : badFilters)
+   {
+      MqttTopic::scan(bad, scan);
+      REQUIRE_FALSE(scan.isValidFilter());
+   }
+}
+
+TEST_CASE("topic scan (agrees with a byte at a time search)") {
+   // topics of every length up to a few 16 byte blocks, with the special
+   // characters placed either side of each block boundary
+   const char alphabet[] = {'a', 'b', '/', '+', '#', ' ', '\0'};
+   unsigned int seed = 12345;
+
+   for (int round = 0; round < 2000; round++)
+   {
+      std::string topic(round % 70, 'x');
+      for (char &c : topic)
+      {
+         seed = seed * 1103515245u + 12345u;
+         c = alphabet[(seed >> 16) % sizeof(alphabet)];
+      }
+
+      MqttTopicScan scan;
+      MqttTopic::scan(topic, scan);
+
+      std::size_t slashes = 0, plus = 0, hash = 0, longest = 0, start = 0;
+      bool space = false, nul = false, doubleSlash = false;
+      for (std::size_t i = 0; i < topic.size(); i++)
+      {
+         if (topic[i] == '/')
+         {
+            doubleSlash = doubleSlash || ((i > 0) && (topic[i - 1] == '/'));
+            longest = std::max(longest, i - start);
+            start = i + 1;
+            slashes++;
+         }
+         plus += (topic[i] == '+');
+         hash += (topic[i] == '#');
+         space = space || (topic[i] == ' ');
+         nul = nul || (topic[i] == '\0');
+      }
+      longest = std::max(longest, topic.size() - start);
+
+      REQUIRE_EQ(scan.levelCount, slashes + 1);
+      REQUIRE_EQ(scan.plusCount, plus);
+      REQUIRE_EQ(scan.hashCount, hash);
+      REQUIRE_EQ(scan.longestLevel, longest);
+      REQUIRE_EQ(scan.hasSpace, space);
+      REQUIRE_EQ(scan.hasNul, nul);
+      REQUIRE_EQ(scan.doubleSlash, doubleSlash);
+      REQUIRE_EQ(MqttTopic::isValidTopicName(topic), scan.isValidTopicName());
+
+      // joining the levels back up gives the topic
+      std::string joined;
+      for (std::size_t level = 0; level < scan.levelCount; level++)
+      {
+         joined += std::string(scan.getLevel(topic, level)) + ((level + 1 < scan.levelCount) ? "/" : "");
+      }
+      REQUIRE_EQ(joined, topic);
+   }
+}
+
+static void collectSubscriber(void *obj, const MqttSubscriptionIndex::Subscription &subscription)
+{
+   static_cast<std::vector<MqttSubscriptionIndex::SubscriberId> *>(obj)->push_back(subscription.subscriber);
+}
+
+static std::vector<MqttSubscriptionIndex::SubscriberId> matchSubscribers(MqttSubscriptionIndex &index, const char *topic)
+{
+   std::vector<MqttSubscriptionIndex::SubscriberId> subscribers;
+   index.match(topic, collectSubscriber, &subscribers);
+   std::sort(subscribers.begin(), subscribers.end());
+   return subscribers;
+}
+
+TEST_CASE("subscription index (exact and wildcard filters)") {
+   MqttSubscriptionIndex index;
+
+   REQUIRE(index.subscribe("house/frontroom/tempurature", 1, 0));
+   REQUIRE(index.subscribe("house/+/tempurature", 2, 1));
+   REQUIRE(index.subscribe("house/#", 3, 2));
+   REQUIRE(index.subscribe("#", 4, 0));
+   REQUIRE(index.subscribe("house/+/humidity", 5, 0));
+
+   REQUIRE_EQ(matchSubscribers(index, "house/frontroom/tempurature"), std::vector<MqttSubscriptionIndex::SubscriberId>({1, 2, 3, 4}));
+   REQUIRE_EQ(matchSubscribers(index, "house/kitchen/tempurature"), std::vector<MqttSubscriptionIndex::SubscriberId>({2, 3, 4}));
+   REQUIRE_EQ(matchSubscribers(index, "house"), std::vector<MqttSubscriptionIndex::SubscriberId>({3, 4}));
+   REQUIRE_EQ(matchSubscribers(index, "garden/shed"), std::vector<MqttSubscriptionIndex::SubscriberId>({4}));
+   REQUIRE_EQ(matchSubscribers(index, "$SYS/uptime"), std::vector<MqttSubscriptionIndex::SubscriberId>());
+}
+
+TEST_CASE("subscription index (unsubscribe prunes the tree)") {
+   MqttSubscriptionIndex index;
+
+   REQUIRE(index.subscribe("house/+/tempurature", 1, 0));
+   REQUIRE(index.subscribe("house/+/tempurature", 2, 0));
+   REQUIRE(index.subscribe("house/+/tempurature", 1, 1)); // resubscribe replaces
+   REQUIRE_EQ(index.getSubscriptionCount(), 2);
+
+   REQUIRE(index.unsubscribe("house/+/tempurature", 1));
+   REQUIRE_FALSE(index.unsubscribe("house/+/tempurature", 1));
+   REQUIRE_EQ(matchSubscribers(index, "house/kitchen/tempurature"), std::vector<MqttSubscriptionIndex::SubscriberId>({2}));
+
+   index.unsubscribeAll(2);
+   REQUIRE_EQ(index.getSubscriptionCount(), 0);
+   REQUIRE_EQ(index.getNodeCount(), 1);
+}
+
+TEST_CASE("subscription index (malformed filters)") {
+   MqttSubscriptionIndex index;
+
+   REQUIRE_FALSE(index.subscribe("house/#/tempurature", 1, 0));
+   REQUIRE_FALSE(index.subscribe("house/front+/tempurature", 1, 0));
+   REQUIRE_FALSE(index.subscribe("", 1, 0));
+   REQUIRE_EQ(index.getNodeCount(), 1);
+}
+
+static std::vector<MqttSubscriptionIndex::SubscriberId> matchInOrder(MqttSubscriptionIndex &index, const char *topic, int times)
+{
+   std::vector<MqttSubscriptionIndex::SubscriberId> subscribers;
+   for (int i = 0; i < times; i++)
+   {
+      index.match(topic, collectSubscriber, &subscribers);
+   }
+   return subscribers;
+}
+
+static std::size_t loadOfSubscriber(void *obj, MqttSubscriptionIndex::SubscriberId subscriber)
+{
+   return static_cast<std::vector<std::size_t> *>(obj)->at(subscriber);
+}
+
+TEST_CASE("shared subscriptions (one member of each group per message)") {
+   MqttSubscriptionIndex index;
+
+   REQUIRE(index.subscribe("$share/workers/jobs/+", 1, 1));
+   REQUIRE(index.subscribe("$share/workers/jobs/+", 2, 1));
+   REQUIRE(index.subscribe("$share/workers/jobs/+", 3, 1));
+   REQUIRE(index.subscribe("$share/audit/jobs/#", 4, 0));
+   REQUIRE(index.subscribe("jobs/+", 5, 0));
+   REQUIRE(index.subscribe("$share/workers/jobs/+", 2, 0)); // resubscribe replaces
+   REQUIRE_EQ(index.getSubscriptionCount(), 5);
+   REQUIRE_EQ(index.getShareGroupCount(), 2);
+
+   // each message goes to the plain subscriber, to the one audit member and to one worker
+   std::vector<MqttSubscriptionIndex::SubscriberId> counts(6);
+   for (int i = 0; i < 30; i++)
+   {
+      std::vector<MqttSubscriptionIndex::SubscriberId> subscribers;
+      REQUIRE_EQ(index.match("jobs/print", collectSubscriber, &subscribers), 3);
+      for (MqttSubscriptionIndex::SubscriberId subscriber : subscribers)
+      {
+         counts[subscriber]++;
+      }
+   }
+   REQUIRE_EQ(counts, std::vector<MqttSubscriptionIndex::SubscriberId>({0, 10, 10, 10, 30, 30}));
+
+   // the shared filter is matched as the filter after the share name
+   REQUIRE_EQ(matchSubscribers(index, "jobs"), std::vector<MqttSubscriptionIndex::SubscriberId>({4}));
+   REQUIRE_EQ(matchSubscribers(index, "$share/workers/jobs/print"), std::vector<MqttSubscriptionIndex::SubscriberId>());
+
+   REQUIRE_FALSE(index.unsubscribe("$share/workers/jobs/+", 4));
+   REQUIRE_FALSE(index.unsubscribe("$share/other/jobs/+", 1));
+   REQUIRE(index.unsubscribe("$share/workers/jobs/+", 1));
+   REQUIRE_EQ(matchInOrder(index, "jobs/print", 4).size(), 12);
+
+   index.unsubscribeAll(2);
+   index.unsubscribeAll(3);
+   REQUIRE_EQ(index.getShareGroupCount(), 1);
+   REQUIRE(index.unsubscribe("$share/audit/jobs/#", 4));
+   REQUIRE(index.unsubscribe("jobs/+", 5));
+   REQUIRE_EQ(index.getSubscriptionCount(), 0);
+   REQUIRE_EQ(index.getShareGroupCount(), 0);
+   REQUIRE_EQ(index.getNodeCount(), 1);
+}
+
+TEST_CASE("shared subscriptions (strategies)") {
+   MqttSubscriptionIndex index;
+
+   for (MqttSubscriptionIndex::SubscriberId subscriber = 0; subscriber < 4; subscriber++)
+   {
+      REQUIRE(index.subscribe("$share/g/sensor/#", subscriber, 0));
+   }
+
+   std::vector<MqttSubscriptionIndex::SubscriberId> picked = matchInOrder(index, "sensor/a", 8);
+   std::vector<MqttSubscriptionIndex::SubscriberId> firstTurn(picked.begin(), picked.begin() + 4);
+   std::sort(firstTurn.begin(), firstTurn.end());
+   REQUIRE_EQ(firstTurn, std::vector<MqttSubscriptionIndex::SubscriberId>({0, 1, 2, 3}));
+   REQUIRE(std::equal(picked.begin(), picked.begin() + 4, picked.begin() + 4));
+
+   // the least loaded member wins, and members with the same load take turns
+   std::vector<std::size_t> load = {5, 2, 7, 2};
+   index.setShareStrategy(MqttSubscriptionIndex::ShareStrategy::LeastInflight);
+   index.setLoadCb(loadOfSubscriber, &load);
+   picked = matchInOrder(index, "sensor/a", 4);
+   REQUIRE(std::all_of(picked.begin(), picked.end(), [](MqttSubscriptionIndex::SubscriberId id) { return (id == 1) || (id == 3); }));
+   REQUIRE_EQ(std::count(picked.begin(), picked.end(), 1), 2);
+   load[2] = 0;
+   REQUIRE_EQ(matchInOrder(index, "sensor/a", 3), std::vector<MqttSubscriptionIndex::SubscriberId>({2, 2, 2}));
+
+   // a topic keeps going to the same member, and different topics are spread out
+   index.setShareStrategy(MqttSubscriptionIndex::ShareStrategy::StickyHash);
+   std::vector<MqttSubscriptionIndex::SubscriberId> owners;
+   for (int i = 0; i < 64; i++)
+   {
+      std::string topic = "sensor/" + std::to_string(i);
+      std::vector<MqttSubscriptionIndex::SubscriberId> again = matchInOrder(index, topic.c_str(), 3);
+      REQUIRE_EQ(std::count(again.begin(), again.end(), again[0]), 3);
+      owners.push_back(again[0]);
+   }
+   for (MqttSubscriptionIndex::SubscriberId subscriber = 0; subscriber < 4; subscriber++)
+   {
+      REQUIRE_GT(std::count(owners.begin(), owners.end(), subscriber), 4);
+   }
+
+   // when a member leaves only the topics it had move
+   REQUIRE(index.unsubscribe("$share/g/sensor/#", 2));
+   for (int i = 0; i < 64; i++)
+   {
+      std::string topic = "sensor/" + std::to_string(i);
+      std::vector<MqttSubscriptionIndex::SubscriberId> now = matchInOrder(index, topic.c_str(), 1);
+      if (owners[i] != 2)
+      {
+         REQUIRE_EQ(now[0], owners[i]);
+      }
+   }
+}
+
+TEST_CASE("shared subscriptions (malformed)") {
+   MqttSubscriptionIndex index;
+
+   REQUIRE_FALSE(index.subscribe("$share/", 1, 0));
+   REQUIRE_FALSE(index.subscribe("$share//jobs", 1, 0));
+   REQUIRE_FALSE(index.subscribe("$share/workers", 1, 0));
+   REQUIRE_FALSE(index.subscribe("$share/workers/", 1, 0));
+   REQUIRE_FALSE(index.subscribe("$share/work+ers/jobs", 1, 0));
+   REQUIRE_FALSE(index.subscribe("$share/#/jobs", 1, 0));
+   REQUIRE_FALSE(index.subscribe("$share/workers/jobs/#/more", 1, 0));
+   REQUIRE_EQ(index.getNodeCount(), 1);
+   REQUIRE_EQ(index.getShareGroupCount(), 0);
+
+   std::string_view shareName;
+   std::string_view filter;
+   REQUIRE(MqttTopic::splitSharedFilter("$share/workers/jobs/+", shareName, filter));
+   REQUIRE_EQ(shareName, "workers");
+   REQUIRE_EQ(filter, "jobs/+");
+   REQUIRE_FALSE(MqttTopic::splitSharedFilter("$shared/workers/jobs", shareName, filter));
+   REQUIRE_FALSE(MqttTopic::splitSharedFilter("jobs/+", shareName, filter));
+}
+
+TEST_CASE("topic table (levels are interned once)") {
+   MqttTopicTable &table = MqttTopicTable::getInstance();
+   const std::size_t count = table.getCount();
+
+   MqttTopicTable::Token kitchen = table.intern("kitchen");
+   REQUIRE_NE(kitchen, MqttTopicTable::NO_TOKEN);
+   REQUIRE_EQ(table.intern("kitchen"), kitchen);
+   REQUIRE_EQ(table.find("kitchen"), kitchen);
+   REQUIRE_EQ(table.getReferenceCount(kitchen), 2);
+   REQUIRE_EQ(table.getCount(), count + 1);
+
+   MqttTopicTable::Token tokens[4];
+   REQUIRE_EQ(table.resolve("house/kitchen/", tokens, 4), 3);
+   REQUIRE_EQ(tokens[1], kitchen);
+   REQUIRE_EQ(table.resolve("a/b/c/d/e", tokens, 4), 0);
+
+   table.release(kitchen);
+   table.release(kitchen);
+   REQUIRE_EQ(table.find("kitchen"), MqttTopicTable::NO_TOKEN);
+   REQUIRE_EQ(table.getCount(), count);
+
+   // the freed entry comes back with a new generation, so the old token stays dead
+   MqttTopicTable::Token cellar = table.intern("cellar");
+   REQUIRE_NE(cellar, kitchen);
+   REQUIRE_EQ(table.getReferenceCount(kitchen), 0);
+   table.release(kitchen);
+   REQUIRE_EQ(table.getReferenceCount(cellar), 1);
+   table.release(cellar);
+}
+
+TEST_CASE("topic table (subscription indexes share and release tokens)") {
+   MqttTopicTable &table = MqttTopicTable::getInstance();
+   const std::size_t count = table.getCount();
+   {
+      MqttSubscriptionIndex first;
+      MqttSubscriptionIndex second;
+
+      REQUIRE(first.subscribe("house/+/tempurature", 1, 0));
+      REQUIRE(second.subscribe("house/kitchen/#", 1, 0));
+      REQUIRE_EQ(table.getCount(), count + 3);
+      REQUIRE_EQ(table.getReferenceCount(table.find("house")), 2);
+
+      // "garden" was never interned, only the '#' can match it
+      REQUIRE(first.subscribe("#", 2, 0));
+      REQUIRE_EQ(matchSubscribers(first, "house/garden/tempurature"), std::vector<MqttSubscriptionIndex::SubscriberId>({1, 2}));
+      REQUIRE_EQ(matchSubscribers(second, "house/garden/tempurature"), std::vector<MqttSubscriptionIndex::SubscriberId>());
+
+      REQUIRE(first.unsubscribe("house/+/tempurature", 1));
+      REQUIRE_EQ(table.getReferenceCount(table.find("house")), 1);
+      REQUIRE_EQ(table.find("tempurature"), MqttTopicTable::NO_TOKEN);
+   }
+   REQUIRE_EQ(table.getCount(), count);
+}
+
+TEST_CASE("topic table (lookups while levels come and go)") {
+   MqttTopicTable &table = MqttTopicTable::getInstance();
+   MqttTopicTable::Token house = table.intern("house");
+   std::atomic<bool> done(false);
+
+   std::thread churn([&] {
+      for (int i = 0; i < 2000; i++)
+      {
+         MqttTopicTable::Token token = table.intern("level" + std::to_string(i % 7));
+         table.release(token);
+      }
+      done = true;
+   });
+
+   std::size_t wrong = 0;
+   while (!done)
+   {
+      MqttTopicTable::Token tokens[2];
+      if ((table.resolve("house/level3", tokens, 2) != 2) || (tokens[0] != house))
+      {
+         wrong++;
+      }
+   }
+   churn.join();
+
+   REQUIRE_EQ(wrong, 0);
+   table.release(house);
+}
+
+static void collectRetained(void *obj, const MqttRetainedStore::Retained &retained)
+{
+   static_cast<std::vector<std::string> *>(obj)->emplace_back(retained.publish->getTopic());
+}
+
+static std::vector<std::string> matchRetained(const MqttRetainedStore &store, const char *filter)
+{
+   std::vector<std::string> topics;
+   store.match(filter, collectRetained, &topics);
+   std::sort(topics.begin(), topics.end());
+   return topics;
+}
+
+static bool retain(MqttRetainedStore &store, const char *topic, const char *payload, unsigned char qos = 0)
+{
+   std::string_view text(payload);
+   return store.store(topic, std::span<const unsigned char>(reinterpret_cast<const unsigned char *>(text.data()), text.size()), qos);
+}
+
+TEST_CASE("retained store (wildcard lookup)") {
+   MqttRetainedStore store;
+
+   REQUIRE(retain(store, "site/a/sensors/temp", "20"));
+   REQUIRE(retain(store, "site/a/sensors/humidity", "40"));
+   REQUIRE(retain(store, "site/b/sensors/temp", "21"));
+   REQUIRE(retain(store, "site/b/actuators/fan", "on"));
+   REQUIRE(retain(store, "site", "root"));
+   REQUIRE(retain(store, "$SYS/uptime", "1"));
+
+   REQUIRE_EQ(matchRetained(store, "site/+/sensors/#"), std::vector<std::string>({"site/a/sensors/humidity", "site/a/sensors/temp", "site/b/sensors/temp"}));
+   REQUIRE_EQ(matchRetained(store, "site/+/+/temp"), std::vector<std::string>({"site/a/sensors/temp", "site/b/sensors/temp"}));
+   REQUIRE_EQ(matchRetained(store, "site/b/actuators/fan"), std::vector<std::string>({"site/b/actuators/fan"}));
+   REQUIRE_EQ(matchRetained(store, "site/#").size(), 5);
+   REQUIRE_EQ(matchRetained(store, "#").size(), 5);
+   REQUIRE_EQ(matchRetained(store, "+/uptime"), std::vector<std::string>());
+   REQUIRE_EQ(matchRetained(store, "$SYS/#"), std::vector<std::string>({"$SYS/uptime"}));
+   REQUIRE_EQ(matchRetained(store, "site/c/#"), std::vector<std::string>());
+}
+
+TEST_CASE("retained store (replace and remove)") {
+   MqttRetainedStore store;
+
+   REQUIRE(retain(store, "house/kitchen/temp", "20", 1));
+   REQUIRE(retain(store, "house/kitchen/temp", "2150", 2));
+   REQUIRE_EQ(store.getMessageCount(), 1);
+   REQUIRE_EQ(store.getMemoryUsed(), 18 + 4);
+
+   // an empty payload clears the topic and prunes the tree
+   REQUIRE(retain(store, "house/kitchen/temp", ""));
+   REQUIRE_EQ(store.getMessageCount(), 0);
+   REQUIRE_EQ(store.getMemoryUsed(), 0);
+   REQUIRE_EQ(store.getNodeCount(), 1);
+   REQUIRE_FALSE(store.remove("house/kitchen/temp"));
+
+   REQUIRE_FALSE(retain(store, "house/+/temp", "20"));
+   REQUIRE_FALSE(retain(store, "", "20"));
+}
+
+TEST_CASE("retained store (memory limit)") {
+   MqttRetainedStore store;
+   store.setMemoryLimit(10);
+
+   REQUIRE(retain(store, "a/b", "12345"));
+   REQUIRE_FALSE(retain(store, "a/c", "12345"));
+   REQUIRE(retain(store, "a/b", "1234567")); // replacing only counts the difference
+   REQUIRE_EQ(store.getMemoryUsed(), 10);
+   REQUIRE_EQ(store.getNodeCount(), 3);
+}
+
 int main(int argc, char **argv)
 {
   doctest::Context context;
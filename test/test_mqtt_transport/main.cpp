@@ -0,0 +1,787 @@
+#define DOCTEST_CONFIG_IMPLEMENT  // REQUIRED: Enable custom main()
+#define DOCTEST_THREAD_LOCAL
+#include <doctest.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "epoll/tcp_server.h"
+#include "mqtt_server.h"
+#include "mqtt_session.h"
+#include "mqtt_shared_publish.h"
+
+// Loopback tests for the epoll transport. The far end of each connection is a
+// plain blocking socket, the broker end only runs when poll() is called.
+
+namespace
+{
+  struct Observed
+  {
+    std::vector<TcpSession::TcpSessionPtr> sessions;
+    std::string received;
+    int sent = 0;
+    int disconnected = 0;
+  };
+
+  void incomingCb(void *obj, char *pData, unsigned short len, [[maybe_unused]] TcpSession::TcpSessionPtr session)
+  {
+    static_cast<Observed *>(obj)->received.append(pData, len);
+  }
+
+  void sentCb(void *obj, [[maybe_unused]] TcpSession::TcpSessionPtr session)
+  {
+    static_cast<Observed *>(obj)->sent++;
+  }
+
+  void disconnectedCb(void *obj, [[maybe_unused]] TcpSession::TcpSessionPtr session)
+  {
+    static_cast<Observed *>(obj)->disconnected++;
+  }
+
+  void connectCb(void *obj, TcpSession::TcpSessionPtr session)
+  {
+    Observed *observed = static_cast<Observed *>(obj);
+    observed->sessions.push_back(session);
+    session->registerIncomingMessageCb(incomingCb, obj);
+    session->registerMessageSentCb(sentCb, obj);
+    session->registerSessionDisconnectedCb(disconnectedCb, obj);
+  }
+
+  template <typename Predicate>
+  bool pollUntil(TcpServer &server, Predicate done)
+  {
+    for (int i = 0; (i < 200) && !done(); i++)
+    {
+      server.poll(10);
+    }
+    return done();
+  }
+
+  int connectTo(unsigned short port, int receiveBuffer = 0)
+  {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (receiveBuffer > 0)
+    {
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    }
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+    {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+}
+
+TEST_CASE("accept, receive and send")
+{
+  TcpServer server;
+  Observed observed;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+  REQUIRE_NE(server.getListenPort(), 0);
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE_GE(client, 0);
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  REQUIRE(observed.sessions[0]->isSessionValid());
+
+  REQUIRE_EQ(send(client, "\xC0\x00", 2, 0), 2);
+  REQUIRE(pollUntil(server, [&] { return observed.received.size() == 2; }));
+  REQUIRE_EQ(observed.received, std::string("\xC0\x00", 2));
+
+  unsigned char pingresp[] = {0xD0, 0x00};
+  REQUIRE_EQ(observed.sessions[0]->sendMessage(pingresp, sizeof(pingresp)), TcpSession::SEND_OK);
+  unsigned char reply[2] = {};
+  REQUIRE_EQ(recv(client, reply, sizeof(reply), MSG_WAITALL), 2);
+  REQUIRE_EQ(reply[0], 0xD0);
+
+  close(client);
+}
+
+TEST_CASE("peer close disconnects the session")
+{
+  TcpServer server;
+  Observed observed;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == 1; }));
+
+  close(client);
+  REQUIRE(pollUntil(server, [&] { return observed.disconnected == 1; }));
+  REQUIRE_EQ(server.getSessionCount(), 0);
+  REQUIRE_FALSE(observed.sessions[0]->isSessionValid());
+  REQUIRE_EQ(observed.sessions[0]->sendMessage(nullptr, 0), TcpSession::FAILED_ABORTED);
+}
+
+TEST_CASE("send returns RETRY until the backlog drains")
+{
+  TcpServer server;
+  Observed observed;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort(), 4096);
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  TcpSession::TcpSessionPtr session = observed.sessions[0];
+
+  std::vector<unsigned char> chunk(MQTT_BUF_SIZE, 0x5A);
+  std::size_t accepted = 0;
+  TcpSession::sendResult result = TcpSession::SEND_OK;
+  for (int i = 0; (i < 100000) && (result == TcpSession::SEND_OK); i++)
+  {
+    result = session->sendMessage(chunk.data(), chunk.size());
+    if (result == TcpSession::SEND_OK)
+    {
+      accepted += chunk.size();
+    }
+  }
+  REQUIRE_EQ(result, TcpSession::RETRY);
+  REQUIRE_EQ(observed.sent, 0);
+
+  // read everything the session accepted, polling so it can flush what it held back
+  std::vector<unsigned char> sink(65536);
+  std::size_t drained = 0;
+  while (drained < accepted)
+  {
+    server.poll(0);
+    ssize_t count = recv(client, sink.data(), sink.size(), MSG_DONTWAIT);
+    if (count > 0)
+    {
+      drained += count;
+    }
+  }
+  REQUIRE_EQ(drained, accepted);
+  REQUIRE(pollUntil(server, [&] { return observed.sent == 1; }));
+  REQUIRE_EQ(session->sendMessage(chunk.data(), 2), TcpSession::SEND_OK);
+
+  close(client);
+}
+
+TEST_CASE("vectored send writes the segments in order")
+{
+  TcpServer server;
+  Observed observed;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+
+  // more segments than one sendmsg takes, some of them empty
+  std::string expected;
+  std::vector<std::string> parts;
+  for (int i = 0; i < MQTT_SEND_MAX_SEGMENTS * 2 + 3; i++)
+  {
+    parts.push_back((i % 5 == 0) ? std::string() : std::to_string(i) + ",");
+    expected += parts.back();
+  }
+  std::vector<std::span<const unsigned char>> segments;
+  for (const std::string &part : parts)
+  {
+    segments.emplace_back(reinterpret_cast<const unsigned char *>(part.data()), part.size());
+  }
+
+  REQUIRE_EQ(observed.sessions[0]->sendMessageVector(segments), TcpSession::SEND_OK);
+  std::string received(expected.size(), '\0');
+  REQUIRE_EQ(recv(client, received.data(), received.size(), MSG_WAITALL), expected.size());
+  REQUIRE_EQ(received, expected);
+
+  close(client);
+}
+
+TEST_CASE("vectored send holds back what the socket won't take")
+{
+  TcpServer server;
+  Observed observed;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort(), 4096);
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  TcpSession::TcpSessionPtr session = observed.sessions[0];
+
+  std::vector<std::vector<unsigned char>> blocks;
+  std::vector<std::span<const unsigned char>> segments;
+  std::size_t total = 0;
+  for (int i = 0; i < 64; i++)
+  {
+    blocks.emplace_back(262144, static_cast<unsigned char>(i));
+    total += blocks.back().size();
+  }
+  for (const std::vector<unsigned char> &block : blocks)
+  {
+    segments.emplace_back(block);
+  }
+
+  REQUIRE_EQ(session->sendMessageVector(segments), TcpSession::SEND_OK);
+  blocks.clear(); // the session must have its own copy of what it held back
+  REQUIRE_EQ(session->sendMessageVector({}), TcpSession::RETRY);
+
+  std::vector<unsigned char> received;
+  std::vector<unsigned char> sink(65536);
+  while (received.size() < total)
+  {
+    server.poll(0);
+    ssize_t count = recv(client, sink.data(), sink.size(), MSG_DONTWAIT);
+    if (count > 0)
+    {
+      received.insert(received.end(), sink.begin(), sink.begin() + count);
+    }
+  }
+  REQUIRE_EQ(received.size(), total);
+  bool inOrder = true;
+  for (std::size_t i = 0; i < total; i++)
+  {
+    inOrder = inOrder && (received[i] == static_cast<unsigned char>(i / 262144));
+  }
+  REQUIRE(inOrder);
+  REQUIRE(pollUntil(server, [&] { return observed.sent == 1; }));
+
+  close(client);
+}
+
+TEST_CASE("PUBLISH frames queued while the socket is busy leave together")
+{
+  TcpServer server;
+  Observed observed;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort(), 4096);
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  TcpSession::TcpSessionPtr tcpSession = observed.sessions[0];
+  MqttSession session(tcpSession);
+
+  // fill the socket so the frames have to wait in the outbound queue
+  std::vector<unsigned char> chunk(MQTT_BUF_SIZE, 0x5A);
+  std::size_t filler = 0;
+  while (tcpSession->sendMessage(chunk.data(), chunk.size()) == TcpSession::SEND_OK)
+  {
+    filler += chunk.size();
+  }
+
+  const unsigned char payload[] = {'o', 'n'};
+  MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("a/b", payload);
+  for (int i = 0; i < 3; i++)
+  {
+    REQUIRE(session.deliverPublish(publish, 1, false));
+  }
+  REQUIRE_EQ(session.getOutboundCount(), 3);
+
+  const unsigned char expected[] = {0x32, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x01, 'o', 'n',
+                                    0x32, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x02, 'o', 'n',
+                                    0x32, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x03, 'o', 'n'};
+  std::vector<unsigned char> received;
+  std::vector<unsigned char> sink(65536);
+  while (received.size() < filler + sizeof(expected))
+  {
+    server.poll(0);
+    ssize_t count = recv(client, sink.data(), sink.size(), MSG_DONTWAIT);
+    if (count > 0)
+    {
+      received.insert(received.end(), sink.begin(), sink.begin() + count);
+    }
+  }
+
+  // the sent callback for the filler flushed all three at once
+  REQUIRE_EQ(session.getOutboundCount(), 0);
+  REQUIRE_EQ(session.getInflightCount(), 3);
+  REQUIRE_EQ(std::vector<unsigned char>(received.begin() + filler, received.end()),
+             std::vector<unsigned char>(expected, expected + sizeof(expected)));
+
+  close(client);
+}
+
+TEST_CASE("QoS 1 and 2 acknowledgements and retransmission")
+{
+  TcpServer server;
+  Observed observed;
+  static MqttTimerWheel wheel;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  MqttSession session(observed.sessions[0]);
+  session.setTimerWheel(&wheel);
+
+  auto receive = [&](std::size_t length) {
+    std::vector<unsigned char> frame(length);
+    REQUIRE_EQ(recv(client, frame.data(), frame.size(), MSG_WAITALL), length);
+    return frame;
+  };
+
+  // a v3.1.1 CONNECT with keep alive off
+  const unsigned char connect[] = {0x10, 0x0E, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x00, 0x00, 0x02, 'c', '1'};
+  REQUIRE_EQ(send(client, connect, sizeof(connect), 0), sizeof(connect));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+
+  const unsigned char payload[] = {'o', 'n'};
+  MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("a/b", payload);
+
+  REQUIRE(session.deliverPublish(publish, 1, false));
+  REQUIRE_EQ(receive(11)[8], 0x01);
+  REQUIRE_EQ(session.getInflightCount(), 1);
+  REQUIRE_EQ(send(client, "\x40\x02\x00\x01", 4, 0), 4);
+  REQUIRE(pollUntil(server, [&] { return session.getInflightCount() == 0; }));
+
+  REQUIRE(session.deliverPublish(publish, 2, false));
+  REQUIRE_EQ(receive(11)[0], 0x34);
+  REQUIRE_EQ(send(client, "\x50\x02\x00\x02", 4, 0), 4);
+  REQUIRE(pollUntil(server, [&] { return publish.use_count() == 1; }));
+  REQUIRE_EQ(receive(4), std::vector<unsigned char>({0x62, 0x02, 0x00, 0x02}));
+  REQUIRE_EQ(send(client, "\x70\x02\x00\x02", 4, 0), 4);
+  REQUIRE(pollUntil(server, [&] { return session.getInflightCount() == 0; }));
+
+  // nothing comes back, so the PUBLISH goes again with DUP set
+  REQUIRE(session.deliverPublish(publish, 1, false));
+  REQUIRE_EQ(receive(11)[0], 0x32);
+  wheel.advance(MQTT_RETRANSMIT_MS + MQTT_TIMER_TICK_MS);
+  std::vector<unsigned char> again = receive(11);
+  REQUIRE_EQ(again[0], 0x3A);
+  REQUIRE_EQ(again[8], 0x03);
+
+  session.retransmitInflight();
+  REQUIRE_EQ(receive(11)[0], 0x3A);
+
+  close(client);
+}
+
+TEST_CASE("a v5 connection gets no timer resend, only the one on reconnect")
+{
+  TcpServer server;
+  Observed observed;
+  static MqttTimerWheel wheel;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  MqttSession session(observed.sessions[0]);
+  session.setTimerWheel(&wheel);
+
+  // keep alive off, so only the retransmit timer could fire
+  const unsigned char connect[] = {0x10, 0x12, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x02, 0x00, 0x00,
+                                   0x03, 0x21, 0x00, 0x01, 0x00, 0x02, 'c', '1'};
+  REQUIRE_EQ(send(client, connect, sizeof(connect), 0), sizeof(connect));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+
+  const unsigned char payload[] = {'o', 'n'};
+  MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("a/b", payload);
+  REQUIRE(session.deliverPublish(publish, 1, false));
+  std::vector<unsigned char> frame(12);
+  REQUIRE_EQ(recv(client, frame.data(), frame.size(), MSG_WAITALL), 12);
+  REQUIRE_EQ(frame[0], 0x32);
+
+  wheel.advance(MQTT_RETRANSMIT_MS + MQTT_TIMER_TICK_MS);
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+  REQUIRE_EQ(recv(client, frame.data(), frame.size(), MSG_DONTWAIT), -1);
+
+  session.retransmitInflight();
+  REQUIRE_EQ(recv(client, frame.data(), frame.size(), MSG_WAITALL), 12);
+  REQUIRE_EQ(frame[0], 0x3A);
+
+  close(client);
+}
+
+TEST_CASE("the first packet must be CONNECT")
+{
+  TcpServer server;
+  Observed observed;
+  static MqttTimerWheel wheel;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  MqttSession session(observed.sessions[0]);
+  session.setTimerWheel(&wheel);
+
+  REQUIRE_EQ(send(client, "\xC0\x00", 2, 0), 2);
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == 0; }));
+  REQUIRE_FALSE(observed.sessions[0]->isSessionValid());
+
+  close(client);
+}
+
+TEST_CASE("a connection without CONNECT is dropped after the connect timeout")
+{
+  TcpServer server;
+  Observed observed;
+  static MqttTimerWheel wheel;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  MqttSession session(observed.sessions[0]);
+  session.setTimerWheel(&wheel);
+
+  // part of a CONNECT doesn't hold the timeout off
+  REQUIRE_EQ(send(client, "\x10\x0E\x00\x04", 4, 0), 4);
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+  REQUIRE_EQ(wheel.advance(MQTT_CONNECT_TIMEOUT_MS - MQTT_TIMER_TICK_MS), 0);
+  REQUIRE_EQ(server.getSessionCount(), 1);
+  REQUIRE_EQ(wheel.advance(MQTT_TIMER_TICK_MS), 1);
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == 0; }));
+
+  close(client);
+}
+
+TEST_CASE("a packet the decoder refuses closes the connection")
+{
+  TcpServer server;
+  Observed observed;
+  static MqttTimerWheel wheel;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  MqttSession session(observed.sessions[0]);
+  session.setTimerWheel(&wheel);
+
+  // a v5 CONNECT with Receive Maximum 1, then a PUBLISH with a wildcard in its topic
+  const unsigned char connect[] = {0x10, 0x12, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x02, 0x00, 0x0A,
+                                   0x03, 0x21, 0x00, 0x01, 0x00, 0x02, 'c', '1'};
+  REQUIRE_EQ(send(client, connect, sizeof(connect), 0), sizeof(connect));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+
+  const unsigned char payload[] = {'o', 'n'};
+  MqttSharedPublish::MqttSharedPublishPtr publish = MqttSharedPublish::create("a/b", payload);
+  REQUIRE(session.deliverPublish(publish, 1, false));
+  REQUIRE(session.deliverPublish(publish, 1, false));
+  REQUIRE_EQ(session.getInflightCount(), 1);
+  REQUIRE_EQ(session.getOutboundCount(), 1);
+
+  REQUIRE_EQ(send(client, "\x30\x05\x00\x03a/+", 7, 0), 7);
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == 0; }));
+  REQUIRE_FALSE(observed.sessions[0]->isSessionValid());
+
+  close(client);
+}
+
+TEST_CASE("a PUBLISH from the client with a Subscription Identifier closes the connection")
+{
+  TcpServer server;
+  Observed observed;
+  static MqttTimerWheel wheel;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  MqttSession session(observed.sessions[0]);
+  session.setTimerWheel(&wheel);
+
+  const unsigned char connect[] = {0x10, 0x12, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x02, 0x00, 0x0A,
+                                   0x03, 0x21, 0x00, 0x01, 0x00, 0x02, 'c', '1'};
+  REQUIRE_EQ(send(client, connect, sizeof(connect), 0), sizeof(connect));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+  REQUIRE_EQ(server.getSessionCount(), 1);
+
+  REQUIRE_EQ(send(client, "\x30\x09\x00\x03" "a/b" "\x02\x0B\x01" "x", 11, 0), 11);
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == 0; }));
+
+  close(client);
+}
+
+TEST_CASE("topic aliases in and out on a v5 connection")
+{
+  TcpServer server;
+  Observed observed;
+  static MqttTimerWheel wheel;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return observed.sessions.size() == 1; }));
+  MqttSession session(observed.sessions[0]);
+  session.setTimerWheel(&wheel);
+
+  auto receive = [&](std::size_t length) {
+    std::vector<unsigned char> frame(length);
+    REQUIRE_EQ(recv(client, frame.data(), frame.size(), MSG_WAITALL), length);
+    return frame;
+  };
+
+  // a v5 CONNECT taking two topic aliases from the broker
+  const unsigned char connect[] = {0x10, 0x12, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x02, 0x00, 0x0A,
+                                   0x03, 0x22, 0x00, 0x02, 0x00, 0x02, 'c', '1'};
+  REQUIRE_EQ(send(client, connect, sizeof(connect), 0), sizeof(connect));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+
+  const unsigned char payload[] = {'o', 'n'};
+  auto deliver = [&](const char *topic) {
+    REQUIRE(session.deliverPublish(MqttSharedPublish::create(topic, payload), 0, false));
+  };
+
+  // a topic goes out in full with its alias once, then as the alias alone
+  deliver("dev/1");
+  REQUIRE_EQ(receive(15), std::vector<unsigned char>({0x30, 0x0D, 0x00, 0x05, 'd', 'e', 'v', '/', '1', 0x03, 0x23, 0x00, 0x01, 'o', 'n'}));
+  deliver("dev/1");
+  REQUIRE_EQ(receive(10), std::vector<unsigned char>({0x30, 0x08, 0x00, 0x00, 0x03, 0x23, 0x00, 0x01, 'o', 'n'}));
+
+  // with both aliases taken the least recently used one moves to the new topic
+  deliver("dev/2");
+  REQUIRE_EQ(receive(15)[12], 0x02);
+  deliver("dev/3");
+  std::vector<unsigned char> moved = receive(15);
+  REQUIRE_EQ(moved[8], '3');
+  REQUIRE_EQ(moved[12], 0x01);
+  deliver("dev/2");
+  REQUIRE_EQ(receive(10)[7], 0x02);
+
+  // QoS 1 keeps its topic, so it can go again whatever the aliases do meanwhile
+  REQUIRE(session.deliverPublish(MqttSharedPublish::create("dev/3", payload), 1, false));
+  REQUIRE_EQ(receive(14), std::vector<unsigned char>({0x32, 0x0C, 0x00, 0x05, 'd', 'e', 'v', '/', '3', 0x00, 0x01, 0x00, 'o', 'n'}));
+
+  // inbound, no CONNACK has advertised a Topic Alias Maximum, so the client may use
+  // no alias and setting one ends the connection
+  REQUIRE_EQ(send(client, "\x30\x0A\x00\x03" "a/b" "\x03\x23\x00\x01" "x", 12, 0), 12);
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == 0; }));
+  REQUIRE_FALSE(observed.sessions[0]->isSessionValid());
+
+  close(client);
+}
+
+TEST_CASE("closed connections give their session slot back to the server")
+{
+  TcpServer server;
+  static MqttServer mqttServer;
+  REQUIRE(mqttServer.startMqttServer(server, 0));
+
+  // a v3.1.1 CONNECT with no session expiry, so nothing outlives the connection
+  const unsigned char connect[] = {0x10, 0x0E, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x00, 0x00, 0x02, 'c', '1'};
+  const unsigned char payload[] = {'x'};
+
+  for (int i = 0; i < MAX_MQTT_SESSIONS * 3; i++)
+  {
+    int client = connectTo(server.getListenPort());
+    REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == 1; }));
+    REQUIRE_EQ(send(client, connect, sizeof(connect), 0), sizeof(connect));
+
+    // the first session's subscription must not be inherited by the next one in its slot
+    if (i == 0)
+    {
+      REQUIRE(mqttServer.getSubscriptionIndex().subscribe("t/#", 0, 0));
+    }
+    else
+    {
+      REQUIRE_EQ(mqttServer.publish("t/x", payload, 0), 0);
+    }
+
+    close(client);
+    REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == 0; }));
+  }
+
+  REQUIRE_EQ(mqttServer.getSessionPoolStats().inUse, 0);
+  REQUIRE_EQ(mqttServer.getSessionPoolStats().failures, 0);
+}
+
+TEST_CASE("a PUBLISH from one client reaches another client's subscription")
+{
+  TcpServer server;
+  static MqttServer mqttServer;
+  REQUIRE(mqttServer.startMqttServer(server, 0));
+
+  const unsigned char connect[] = {0x10, 0x0E, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x00, 0x00, 0x02, 'c', '1'};
+  int subscriber = connectTo(server.getListenPort());
+  int publisher = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == 2; }));
+  REQUIRE_EQ(send(subscriber, connect, sizeof(connect), 0), sizeof(connect));
+  REQUIRE_EQ(send(publisher, connect, sizeof(connect), 0), sizeof(connect));
+
+  const unsigned char subscribe[] = {0x82, 0x08, 0x00, 0x01, 0x00, 0x03, 't', '/', '#', 0x00};
+  REQUIRE_EQ(send(subscriber, subscribe, sizeof(subscribe), 0), sizeof(subscribe));
+  REQUIRE(pollUntil(server, [&] { return mqttServer.getSubscriptionIndex().getSubscriptionCount() == 1; }));
+
+  const unsigned char publish[] = {0x30, 0x07, 0x00, 0x03, 't', '/', 'x', 'h', 'i'};
+  REQUIRE_EQ(send(publisher, publish, sizeof(publish), 0), sizeof(publish));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+  std::vector<unsigned char> frame(sizeof(publish));
+  REQUIRE_EQ(recv(subscriber, frame.data(), frame.size(), MSG_WAITALL), sizeof(publish));
+  REQUIRE_EQ(frame, std::vector<unsigned char>(publish, publish + sizeof(publish)));
+
+  const unsigned char unsubscribe[] = {0xA2, 0x07, 0x00, 0x02, 0x00, 0x03, 't', '/', '#'};
+  REQUIRE_EQ(send(subscriber, unsubscribe, sizeof(unsubscribe), 0), sizeof(unsubscribe));
+  REQUIRE(pollUntil(server, [&] { return mqttServer.getSubscriptionIndex().getSubscriptionCount() == 0; }));
+
+  close(subscriber);
+  close(publisher);
+  REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == 0; }));
+}
+
+TEST_CASE("a session ended by a failed resend is released once the timers have run")
+{
+  TcpServer server;
+  static MqttServer mqttServer;
+  REQUIRE(mqttServer.startMqttServer(server, 0));
+
+  const unsigned char connect[] = {0x10, 0x0E, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x00, 0x00, 0x02, 'c', '1'};
+  int client = connectTo(server.getListenPort());
+  REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == 1; }));
+  REQUIRE_EQ(send(client, connect, sizeof(connect), 0), sizeof(connect));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+
+  // one QoS 1 PUBLISH in flight
+  const unsigned char payload[] = {'x'};
+  REQUIRE(mqttServer.getSubscriptionIndex().subscribe("t/#", 0, 1));
+  REQUIRE_EQ(mqttServer.publish("t/x", payload, 1), 1);
+  std::vector<unsigned char> frame(10);
+  REQUIRE_EQ(recv(client, frame.data(), frame.size(), MSG_WAITALL), 10);
+
+  // the client resets the connection, and the resend is the first to hear of it
+  linger reset = {1, 0};
+  setsockopt(client, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+  close(client);
+  usleep(10000);
+
+  mqttServer.processTimers(MQTT_RETRANSMIT_MS + MQTT_TIMER_TICK_MS);
+  REQUIRE_EQ(mqttServer.getSessionCount(), 0);
+  REQUIRE_EQ(mqttServer.getSessionPoolStats().inUse, 0);
+  REQUIRE_EQ(mqttServer.getTimerWheel().getActiveCount(), 0);
+}
+
+TEST_CASE("an expired session gives its slot back to the server")
+{
+  TcpServer server;
+  static MqttServer mqttServer;
+  REQUIRE(mqttServer.startMqttServer(server, 0));
+
+  // a v5 CONNECT with a Session Expiry Interval of one second
+  const unsigned char connect[] = {0x10, 0x14, 0x00, 0x04, 'M', 'Q', 'T', 'T', 0x05, 0x02, 0x00, 0x00,
+                                   0x05, 0x11, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 'c', '1'};
+
+  // fill every slot, then close the connections while their sessions live on
+  std::vector<int> clients;
+  for (int i = 0; i < MAX_MQTT_SESSIONS; i++)
+  {
+    clients.push_back(connectTo(server.getListenPort()));
+    REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == clients.size(); }));
+    REQUIRE_EQ(send(clients.back(), connect, sizeof(connect), 0), sizeof(connect));
+  }
+  REQUIRE(mqttServer.getSubscriptionIndex().subscribe("t/#", 0, 0));
+  for (int i = 0; i < 5; i++)
+  {
+    server.poll(10);
+  }
+  for (int client : clients)
+  {
+    close(client);
+  }
+  for (int i = 0; i < 20; i++)
+  {
+    server.poll(10);
+  }
+  REQUIRE_EQ(mqttServer.getSessionCount(), MAX_MQTT_SESSIONS);
+
+  mqttServer.processTimers(1000 - MQTT_TIMER_TICK_MS);
+  REQUIRE_EQ(mqttServer.getSessionCount(), MAX_MQTT_SESSIONS);
+  REQUIRE_EQ(mqttServer.processTimers(MQTT_TIMER_TICK_MS), MAX_MQTT_SESSIONS);
+  REQUIRE_EQ(mqttServer.getSessionCount(), 0);
+  REQUIRE_EQ(mqttServer.getSessionPoolStats().inUse, 0);
+
+  const unsigned char payload[] = {'x'};
+  REQUIRE_EQ(mqttServer.publish("t/x", payload, 0), 0);
+
+  // and every slot can be had again
+  clients.clear();
+  for (int i = 0; i < MAX_MQTT_SESSIONS; i++)
+  {
+    clients.push_back(connectTo(server.getListenPort()));
+    REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == clients.size(); }));
+  }
+  for (int client : clients)
+  {
+    close(client);
+  }
+  REQUIRE(pollUntil(server, [&] { return mqttServer.getSessionCount() == 0; }));
+}
+
+TEST_CASE("outgoing connection to a local listener")
+{
+  TcpServer server;
+  Observed accepted;
+  Observed connected;
+  REQUIRE(server.startTcpServer(0, connectCb, &accepted));
+
+  ip_addr_t loopback;
+  IP4_ADDR(&loopback, 127, 0, 0, 1);
+  REQUIRE(server.startTcpClient(loopback, server.getListenPort(), connectCb, &connected));
+  REQUIRE(pollUntil(server, [&] { return (connected.sessions.size() == 1) && (accepted.sessions.size() == 1); }));
+
+  unsigned char connack[] = {0x20, 0x02, 0x00, 0x00};
+  REQUIRE_EQ(accepted.sessions[0]->sendMessage(connack, sizeof(connack)), TcpSession::SEND_OK);
+  REQUIRE(pollUntil(server, [&] { return connected.received.size() == 4; }));
+  REQUIRE_EQ(connected.received[0], '\x20');
+
+  REQUIRE(server.stopTcpClient(loopback));
+  REQUIRE_EQ(server.getSessionCount(), 0);
+}
+
+TEST_CASE("many concurrent connections on one thread")
+{
+  const int clients = 400;
+  TcpServer server;
+  Observed observed;
+  REQUIRE(server.startTcpServer(0, connectCb, &observed));
+
+  std::vector<int> fds;
+  for (int i = 0; i < clients; i++)
+  {
+    fds.push_back(connectTo(server.getListenPort()));
+  }
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == clients; }));
+
+  for (int fd : fds)
+  {
+    send(fd, "\xC0\x00", 2, 0);
+  }
+  REQUIRE(pollUntil(server, [&] { return observed.received.size() == 2 * clients; }));
+
+  for (int fd : fds)
+  {
+    close(fd);
+  }
+  REQUIRE(pollUntil(server, [&] { return server.getSessionCount() == 0; }));
+  REQUIRE_EQ(observed.disconnected, clients);
+}
+
+int main(int argc, char **argv)
+{
+  doctest::Context context;
+
+  // BEGIN:: PLATFORMIO REQUIRED OPTIONS
+  context.setOption("success", true);     // Report successful tests
+  context.setOption("no-exitcode", true); // Do not return non-zero code on failed test case
+  // END:: PLATFORMIO REQUIRED OPTIONS
+
+  // YOUR CUSTOM DOCTEST OPTIONS
+  context.applyCommandLine(argc, argv);
+  return context.run();
+}